@@ -0,0 +1,71 @@
+#pragma once
+#include <Arduino.h>
+
+// Per-slot counters every endpoint keeps for its clients
+struct ClientStats {
+  uint32_t connectedAt;  // millis() when the slot was acquired
+  uint64_t bytesSent;    // Bytes accepted by the socket
+  uint32_t lastSendUs;   // Duration of the last complete frame/block send
+};
+
+// Statically allocated table of N client slots. Slots are handed out and returned in
+// O(1) through a stack of free indices, so connects and disconnects never touch the
+// heap. Only the task that serves the clients releases slots; it walks the table with
+// at() and skips inactive entries.
+template <typename T, size_t N>
+class ClientTable {
+public:
+  ClientTable() : _top(N), _count(0) {
+    for (size_t i = 0; i < N; i++) {
+      _free[i] = N - 1 - i;
+      _active[i] = false;
+    }
+  }
+
+  // Returns a reset slot, or NULL when the table is full
+  T* acquire() {
+    taskENTER_CRITICAL(&_lock);
+    if (_top == 0) {
+      taskEXIT_CRITICAL(&_lock);
+      return NULL;
+    }
+    size_t i = _free[--_top];
+    taskEXIT_CRITICAL(&_lock);
+
+    _slots[i] = T();
+    _slots[i].stats.connectedAt = millis();
+    return &_slots[i];
+  }
+
+  // Makes an acquired slot visible to the serving task once it is fully set up
+  void activate(T* c) {
+    taskENTER_CRITICAL(&_lock);
+    _active[c - _slots] = true;
+    _count++;
+    taskEXIT_CRITICAL(&_lock);
+  }
+
+  // Returns a slot to the free stack; the caller must already have dropped its connection
+  void release(T* c) {
+    size_t i = c - _slots;
+    taskENTER_CRITICAL(&_lock);
+    if (_active[i]) {
+      _active[i] = false;
+      _count--;
+    }
+    _free[_top++] = i;
+    taskEXIT_CRITICAL(&_lock);
+  }
+
+  T* at(size_t i) { return _active[i] ? &_slots[i] : NULL; }
+  size_t count() const { return _count; }
+  static constexpr size_t capacity() { return N; }
+
+private:
+  T _slots[N];
+  size_t _free[N];
+  volatile bool _active[N];
+  size_t _top;
+  volatile size_t _count;
+  portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+};
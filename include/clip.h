@@ -0,0 +1,27 @@
+#pragma once
+#include <Arduino.h>
+
+#ifndef CLIP_ARENA_KB
+#define CLIP_ARENA_KB 0      // PSRAM kept for pre-event recording; 0 disables it and leaves capture idle without clients
+#endif
+#define CLIP_SLAB_BYTES  2048  // Allocation unit: one PCM block, or a run of slabs per JPEG
+// Every entry takes at least one slab, so one index entry per slab is never the limit
+#define CLIP_ENTRIES     (CLIP_ARENA_KB ? CLIP_ARENA_KB * 1024 / CLIP_SLAB_BYTES : 1)
+#define CLIP_CLIENTS     2
+
+// Arena occupancy, for monitoring
+struct ClipStats {
+  size_t footprint;     // Bytes of PSRAM and index held by the arena
+  size_t slabs;         // Slabs in the arena
+  size_t slabsUsed;     // Slabs holding buffered entries
+  uint32_t entries;     // Buffered frames and audio blocks
+  uint32_t windowMs;    // Capture time covered by the buffered entries
+  uint32_t evicted;     // Entries overwritten to make room
+  uint32_t dropped;     // Entries not buffered because a /clip download still needed the space
+};
+
+void clipSetup();
+void clipPush(uint8_t track, const uint8_t* data, size_t len, int64_t time);
+ClipStats clipStats();
+void clipCB(void* pvParameters);
+void ClipHandler(void);
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define WAV_FORMAT_PCM       0x0001
+#define WAV_FORMAT_MULAW     0x0007
+#define WAV_FORMAT_IMA_ADPCM 0x0011
+
+// Encoded size of one IMA-ADPCM mono block holding n samples (n must be odd)
+#define ADPCM_BLOCK_BYTES(n) (4 + ((n) - 1) / 2)
+
+// IMA-ADPCM predictor state carried from one block to the next
+struct AdpcmState {
+  int16_t predictor;
+  uint8_t index;
+};
+
+// Fixed-point polyphase FIR converting a sample stream by the rational factor up/down.
+// Output sample m is the input interpolated at m * down / up, filtered by a windowed-sinc
+// lowpass below the lower Nyquist frequency.
+struct Resampler {
+  uint16_t up;       // Interpolation factor (number of filter phases)
+  uint16_t down;     // Decimation factor
+  uint16_t taps;     // Taps per phase
+  int16_t* coefs;    // up x taps Q15 coefficients, phase-major; each phase sums to exactly 1.0
+  int16_t* history;  // Last taps - 1 input samples, followed by room for one block
+  uint16_t phase;    // Filter phase of the next output sample
+  uint32_t next;     // Input index of the next output sample, relative to the next block
+};
+
+// Most output samples resample() produces from n input samples
+#define RESAMPLE_MAX_OUT(r, n) (((n) * (r)->up + (r)->down - 1) / (r)->down + 1)
+
+void ulawEncode(const int16_t* in, uint8_t* out, size_t samples);
+size_t adpcmEncodeBlock(AdpcmState* state, const int16_t* in, uint8_t* out, size_t samples);
+void pcm8Encode(const int16_t* in, uint8_t* out, size_t samples);
+bool resamplerInit(Resampler* r, uint32_t inRate, uint32_t outRate, size_t blockSamples);
+size_t resample(Resampler* r, const int16_t* in, size_t samples, int16_t* out);
@@ -0,0 +1,24 @@
+#pragma once
+#include <Arduino.h>
+
+#define CONTROL_FPS_MAX    30    // Highest capture rate /control accepts
+#define CONTROL_XCLK_MIN   8000000
+#define CONTROL_XCLK_MAX   20000000
+#define CONTROL_DRAIN_MS   3000  // Longest wait for clients to release their frames before a sensor re-init
+#define CONTROL_MEASURE_MS 1000  // Capture window the frame rate reported after a change is measured over
+
+// Camera settings that can be changed at run time. They start from the build flags
+// and are kept in NVS once changed through /control.
+struct CameraSettings {
+  int frameSize;  // framesize_t
+  int quality;    // Best (lowest) JPEG quality the quality controller may use
+  int fps;        // Capture rate, also the ceiling of every client's frame rate
+  uint32_t xclk;  // Sensor clock, Hz
+};
+
+void settingsLoad();
+void settingsReset();
+const CameraSettings& cameraSettings();
+bool cameraBegin();
+void controlPoll();
+void ControlHandler(void);
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include "globals.h"
+#include "esp_camera.h"
+#include "scale.h"
+#include "mjpeg.h"
+
+#define FRAME_POOL_SLABS 3  // Copies that can stand in for driver buffers pinned by slow clients
+#define FRAME_HANDLES (FB_COUNT + FRAME_POOL_SLABS)
+
+// Reference-counted handle around a driver frame buffer, or around a pool slab the
+// frame was copied into. The buffer is handed back (esp_camera_fb_return() or to the
+// pool) when the last reference is released.
+struct Frame {
+  camera_fb_t* fb;
+  int8_t slab;      // Pool slab holding the frame, -1 for a driver buffer
+  uint32_t seq;
+  uint16_t motion;  // Changed MCUs per mille against the previously published frame
+  ScaledJpeg scaled[SCALE_COUNT];  // Downscaled copies for /mjpeg?scale= subscribers
+  std::atomic<uint8_t> scaledMask; // Substreams rendered into scaled[] so far, one bit per index
+  char head[MJPEG_HEAD_MAX];       // Multipart part header, built once and sent ahead of the frame to every client
+  uint8_t headLen;
+  std::atomic<uint32_t> refs;
+};
+
+// Frame pool occupancy and counters
+struct FramePoolStats {
+  size_t slabs;
+  size_t slabBytes;
+  size_t inUse;
+  size_t highWater;   // Most slabs ever in use at once
+  uint32_t copies;    // Frames copied into the pool to free a driver buffer
+  uint32_t oversize;  // Frames dropped because they did not fit a slab
+  uint32_t exhausted; // Frames dropped because every slab was taken
+};
+
+void framePoolSetup(size_t slabBytes);
+FramePoolStats framePoolStats();
+Frame* framePublish(camera_fb_t* fb, uint16_t motion);
+Frame* frameAcquire();
+Frame* frameAcquireScaled();
+void framePublishScaled(Frame* frame);
+void frameRetract();
+bool frameDrained();
+void frameRelease(Frame* frame);
+int64_t frameTime(const Frame* frame);
+void frameSubscribe();
+void frameUnsubscribe();
+bool frameSubscribed();
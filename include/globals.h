@@ -1,15 +1,30 @@
 #pragma once
-#include <WebServer.h>
-#include <ArduinoLog.h>
+#include "http.h"
+#include "logging.h"
 
 #define APP_CPU     1
 #define PRO_CPU     0
 #define KILOBYTE    1024
 #define SERIAL_RATE 115200
+#ifndef HTTP_PORT
+#define HTTP_PORT   80  // The native build serves on an unprivileged port instead
+#endif
+#define FB_COUNT    3   // Driver frame buffers: one filling, one published, one pinned by a slow send
 #define MJPEG_URL "/mjpeg"
+#define JPG_URL "/jpg"
 #define I2S_URL "/i2s"
+#define AV_URL "/av"
+#define CLIP_URL "/clip"
+#define METRICS_URL "/metrics"
+#define QUALITY_URL "/quality"
+#define WS_URL "/ws"
+#define TRACE_URL "/trace"
+#define CONTROL_URL "/control"
 
-extern SemaphoreHandle_t frameSync;
 extern TaskHandle_t tCam;
 extern TaskHandle_t tMic;
-extern WebServer server;
+extern TaskHandle_t tMux;
+extern TaskHandle_t tClip;
+extern TaskHandle_t tWs;
+extern TaskHandle_t tScale;
+extern HttpServer server;
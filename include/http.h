@@ -0,0 +1,77 @@
+#pragma once
+#include <WiFi.h>
+
+#define HTTP_PENDING     4     // Connections whose request is still being read
+#define HTTP_REQUEST_MAX 1024  // Request line plus headers
+#define HTTP_ROUTES      12
+#define HTTP_ARGS        8
+#define HTTP_HEADERS     20  // Browsers send a dozen or more with a WebSocket upgrade
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST };
+
+// Minimal HTTP/1.1 front end: blocks on socket readiness instead of polling, reads
+// request headers from several connections at once and dispatches each complete
+// request to its handler. Handlers use the same calls as the Arduino WebServer and
+// keep the connection by copying client().
+class HttpServer {
+public:
+  typedef void (*THandlerFunction)(void);
+
+  HttpServer(uint16_t port);
+  void on(const char* uri, HTTPMethod method, THandlerFunction handler);
+  void onNotFound(THandlerFunction handler);
+  void begin();
+  void handleClient();
+
+  WiFiClient& client() { return _client; }
+  String uri() { return String(_path); }
+  String hostHeader() { return header("Host"); }
+  String header(const char* name);
+  bool hasHeader(const char* name);
+  bool hasArg(const char* name);
+  String arg(const char* name);
+  void send(int code, const char* contentType, const String& content);
+  void send(int code, const char* contentType, const char* content, size_t len);
+
+private:
+  struct Pending {
+    int fd;
+    size_t len;
+    uint32_t since;
+#if defined(BENCHMARK)
+    uint32_t acceptedUs;
+#endif
+    char buf[HTTP_REQUEST_MAX];
+  };
+  struct Route {
+    const char* uri;
+    HTTPMethod method;
+    THandlerFunction handler;
+  };
+  struct Pair {
+    const char* name;
+    const char* value;
+  };
+
+  void accept();
+  void receive(Pending* p);
+  bool parse(Pending* p);
+  void dispatch(Pending* p);
+  void drop(Pending* p);
+
+  uint16_t _port;
+  int _listenFd;
+  Pending _pending[HTTP_PENDING];
+  Route _routes[HTTP_ROUTES];
+  size_t _routeCount;
+  THandlerFunction _notFound;
+
+  // Request being dispatched
+  WiFiClient _client;
+  HTTPMethod _method;
+  const char* _path;
+  Pair _args[HTTP_ARGS];
+  size_t _argCount;
+  Pair _headers[HTTP_HEADERS];
+  size_t _headerCount;
+};
@@ -1,4 +1,16 @@
 #pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define SAMPLE_RATE_HZ    44100
+#define BLOCK_SAMPLES     881  // ~20 ms; odd so one block maps onto one IMA-ADPCM block
+#define BLOCK_US          (BLOCK_SAMPLES * 1000000LL / SAMPLE_RATE_HZ)
+#define AUDIO_RING_BLOCKS 16   // Ring depth: how far a client may fall behind before losing audio
+
 void micCB(void* pvParameters);
 void I2SHandler(void);
-void I2SSetup();
\ No newline at end of file
+void I2SSetup();
+void audioSubscribe();
+void audioUnsubscribe();
+uint32_t audioHeadSeq();
+const uint8_t* audioBlock(uint32_t seq, size_t* len, int64_t* time);
@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+
+#define JPEG_HUFF_FAST_BITS 9
+
+// Canonical Huffman table from a DHT segment, with a lookup for short codes
+struct JpegHuffman {
+  int32_t maxcode[17];   // Largest code of each length, -1 if none
+  uint16_t mincode[17];  // Smallest code of each length
+  uint8_t valptr[17];    // Index into vals of the first code of each length
+  uint8_t vals[256];
+  uint16_t fast[1 << JPEG_HUFF_FAST_BITS];  // (length << 8) | value, 0 if the code is longer
+};
+
+struct JpegComponent {
+  uint8_t id;
+  uint8_t h, v;    // Sampling factors
+  uint8_t tq;      // Quantization table
+  uint8_t td, ta;  // DC and AC Huffman tables
+  int pred;        // DC predictor
+};
+
+// Baseline JPEG headers, parsed up to the start of the entropy-coded scan
+struct JpegInfo {
+  uint16_t width, height;
+  uint8_t ncomp;
+  JpegComponent comp[3];
+  uint8_t hmax, vmax;
+  uint16_t mcusX, mcusY;
+  uint16_t restart;       // MCUs per restart interval, 0 if none
+  uint16_t qt[4][64];     // Quantization tables, zigzag order
+  JpegHuffman dc[2], ac[2];
+  const uint8_t* scan;    // First byte of entropy-coded data
+  const uint8_t* end;
+};
+
+// Bit reader over entropy-coded data that removes byte stuffing and stops at markers
+struct JpegBits {
+  const uint8_t* p;
+  const uint8_t* end;
+  uint32_t acc;
+  int n;
+  bool marker;
+};
+
+bool jpegParse(const uint8_t* buf, size_t len, JpegInfo* info);
+void jpegBitsBegin(JpegBits* b, const JpegInfo* info);
+bool jpegRestart(JpegBits* b, JpegInfo* info);
+bool jpegDecodeBlock(JpegBits* b, JpegInfo* info, JpegComponent* c, int16_t* coef);
+bool jpegDcMap(JpegInfo* info, int16_t* dc);
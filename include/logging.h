@@ -1,2 +1,116 @@
 #pragma once
-void setupLogging();
\ No newline at end of file
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+
+// Levels and line ending of the Arduino-Log API this logger keeps
+#define LOG_LEVEL_SILENT  0
+#define LOG_LEVEL_FATAL   1
+#define LOG_LEVEL_ERROR   2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_NOTICE  4
+#define LOG_LEVEL_TRACE   5
+#define LOG_LEVEL_VERBOSE 6
+#ifndef CR
+#define CR "\n"
+#endif
+
+#define LOG_RING_BYTES  4096  // Per-core record ring
+#define LOG_RECORD_MAX  160   // Most argument bytes in a record; arguments that do not fit are dropped from it
+#define LOG_STRING_MAX  48    // %s arguments are copied up to this many bytes
+#define LOG_HEXDUMP_MAX 128   // printBuffer() records at most this many bytes
+
+// Argument tags in a record, each followed by its value. 0 is not a tag: the drain task
+// zeroes the ring, so bytes left unpacked end the argument list
+enum LogArg : uint8_t { LOG_ARG_INT = 1, LOG_ARG_UINT, LOG_ARG_INT64, LOG_ARG_UINT64, LOG_ARG_DOUBLE, LOG_ARG_STRING };
+
+// Builds a record's argument list: one tag byte per argument, then its raw value.
+// Strings are copied, since the caller's buffer may be gone by the time it is formatted.
+// With a NULL buffer it only measures the list, so the record can be sized to fit it.
+class LogPacker {
+public:
+  LogPacker(uint8_t* buf, size_t size) : _buf(buf), _size(size) {}
+
+  template <typename T>
+  void put(T v) {
+    if constexpr (std::is_same<T, const char*>::value || std::is_same<T, char*>::value) {
+      putString(v);
+    } else if constexpr (std::is_floating_point<T>::value) {
+      double d = v;
+      putRaw(LOG_ARG_DOUBLE, &d, sizeof(d));
+    } else if constexpr (std::is_pointer<T>::value) {
+      put((uintptr_t)v);
+    } else if constexpr (std::is_enum<T>::value) {
+      put((typename std::underlying_type<T>::type)v);
+    } else if constexpr (sizeof(T) > 4) {
+      uint64_t u = v;
+      putRaw(std::is_signed<T>::value ? LOG_ARG_INT64 : LOG_ARG_UINT64, &u, sizeof(u));
+    } else {
+      uint32_t u = std::is_signed<T>::value ? (uint32_t)(int32_t)v : (uint32_t)v;
+      putRaw(std::is_signed<T>::value ? LOG_ARG_INT : LOG_ARG_UINT, &u, sizeof(u));
+    }
+  }
+  void put(const String& s) { putString(s.c_str()); }
+
+  size_t size() const { return _len; }
+
+private:
+  void putRaw(uint8_t tag, const void* v, size_t len);
+  void putString(const char* s);
+
+  uint8_t* _buf;
+  size_t _size;
+  size_t _len = 0;
+  bool _full = false;  // An argument did not fit; the ones after it are dropped too
+};
+
+// Drop-in for the Arduino-Log calls used in this project. A call only copies the format
+// string pointer, a timestamp and its raw arguments into a lock-free ring of the calling
+// core; a low-priority task formats the records and writes them to the output.
+class DeferredLog {
+public:
+  void begin(int level, Print* output);
+  void setLevel(int level) { _level = level; }
+  int level() const { return _level; }
+  uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+  template <typename... Args> void fatal(const char* fmt, Args... args) { log(LOG_LEVEL_FATAL, fmt, args...); }
+  template <typename... Args> void error(const char* fmt, Args... args) { log(LOG_LEVEL_ERROR, fmt, args...); }
+  template <typename... Args> void warning(const char* fmt, Args... args) { log(LOG_LEVEL_WARNING, fmt, args...); }
+  template <typename... Args> void notice(const char* fmt, Args... args) { log(LOG_LEVEL_NOTICE, fmt, args...); }
+  template <typename... Args> void trace(const char* fmt, Args... args) { log(LOG_LEVEL_TRACE, fmt, args...); }
+  template <typename... Args> void verbose(const char* fmt, Args... args) { log(LOG_LEVEL_VERBOSE, fmt, args...); }
+
+  void hexDump(const void* buf, size_t len);
+  bool drain();
+
+private:
+  template <typename... Args>
+  void log(int level, const char* fmt, Args... args) {
+#ifndef DISABLE_LOGGING
+    if (level > _level)
+      return;
+    LogPacker measure(NULL, LOG_RECORD_MAX);
+    (measure.put(args), ...);
+    uint8_t* buf = reserve(measure.size());
+    if (buf == NULL)
+      return;
+    LogPacker packer(buf, measure.size());
+    (packer.put(args), ...);
+    publish(buf, level, fmt, measure.size(), false);
+#endif
+  }
+  uint8_t* reserve(size_t len);
+  void publish(uint8_t* args, int level, const char* fmt, size_t len, bool dump);
+  void format(const uint32_t* rec);
+
+  int _level = LOG_LEVEL_SILENT;
+  Print* _output = NULL;
+  std::atomic<uint32_t> _dropped{0};  // Records lost because the ring of their core was full
+  uint32_t _reported = 0;             // _dropped when the drain task last reported it
+};
+
+extern DeferredLog Log;
+
+void setupLogging();
+void printBuffer(const char* aBuf, size_t aSize);
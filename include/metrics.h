@@ -0,0 +1,72 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+#define HISTOGRAM_BUCKETS 12  // Upper bounds per histogram, +Inf not included
+
+// Monotonic counter. Relaxed atomics: updates never lock and never order other memory.
+class Counter {
+public:
+  void inc(uint32_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+  uint32_t value() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint32_t> _value{0};
+};
+
+// Histogram with fixed upper bounds. Buckets are stored per range and made cumulative
+// on export. The sum is 64-bit, since 32 bits of microseconds wrap after 71 minutes
+// and the sum would then disagree with the count.
+class Histogram {
+public:
+  Histogram(const uint32_t* bounds, size_t count) : _bounds(bounds), _count(count) {}
+
+  void observe(uint32_t v) {
+    size_t i = 0;
+    while (i < _count && v > _bounds[i])
+      i++;
+    _buckets[i].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(v, std::memory_order_relaxed);
+  }
+
+  size_t bounds() const { return _count; }
+  uint32_t bound(size_t i) const { return _bounds[i]; }
+  uint32_t bucket(size_t i) const { return _buckets[i].load(std::memory_order_relaxed); }
+  uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+
+private:
+  const uint32_t* _bounds;
+  size_t _count;
+  std::atomic<uint32_t> _buckets[HISTOGRAM_BUCKETS + 1] = {};
+  std::atomic<uint64_t> _sum{0};
+};
+
+// Streaming endpoints, as the `endpoint` label of per-endpoint metrics
+enum Endpoint { EP_MJPEG, EP_JPG, EP_I2S, EP_AV, EP_CLIP, EP_WS, EP_COUNT };
+
+extern Histogram captureUs;      // esp_camera_fb_get() duration
+extern Histogram publishUs;      // Time to hand a captured frame to the readers
+extern Histogram frameBytes;     // Published JPEG sizes
+extern Histogram sendUs;         // Per-client time to send one MJPEG frame, socket stalls included
+extern Histogram audioSendUs;    // Per-client time to send one audio block
+extern Histogram wsAckUs;        // Capture of a frame to its WebSocket acknowledgement
+extern Histogram scaleUs;        // Rendering one downscaled substream of a frame
+extern Counter framesCaptured;
+extern Counter framesPublished;
+extern Counter captureErrors;
+extern Counter framesStatic;     // Not published: below the motion threshold
+extern Counter framesDropped;    // Not published: no handle, or the frame pool was full or too small
+extern Counter framesSkipped;    // Published but never sent to a busy or paced client
+extern Counter framesSent;       // Sent completely to an MJPEG client, once per client
+extern Counter framesStalled;    // MJPEG sends that had to wait for the socket to drain
+extern Counter mjpegSendCalls;   // send calls made for MJPEG clients, each carrying up to a whole multipart part
+extern Counter scaleFailures;    // Substreams not rendered; their clients got the full frame
+extern Counter frameRetries;     // frameAcquire() reads retried because the frame was released meanwhile
+extern Counter audioBlocks;
+extern Counter audioOverruns;    // Blocks lost by clients lapped by the capture task
+extern Counter audioUnderruns;   // Blocks that could not be written in one go
+extern Counter connects[EP_COUNT];
+extern Counter disconnects[EP_COUNT];
+extern Counter bytesSent[EP_COUNT];
+
+void MetricsHandler(void);
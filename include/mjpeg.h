@@ -1,3 +1,23 @@
 #pragma once
+#include <Arduino.h>
+
+#ifndef STREAM_WORKERS
+#define STREAM_WORKERS 2  // MJPEG sender tasks, alternately pinned to APP_CPU and PRO_CPU
+#endif
+#define MJPEG_HEAD_MAX 96  // Multipart part header of one frame: Content-Type, Content-Length, X-Motion-Score
+
+// Load of one MJPEG sender task
+struct StreamWorkerStats {
+  uint8_t core;
+  uint8_t clients;      // MJPEG clients it owns
+  uint16_t busy;        // Per mille of its last measurement window spent servicing clients
+  uint32_t migrations;  // Clients it handed to a less busy sender
+};
+
 void camCB(void* pvParameters);
-void MJPEGHandler(void);
\ No newline at end of file
+size_t mjpegPartHeader(char* buf, size_t frameLen, uint16_t motion);
+void streamNotify();
+uint32_t mjpegDemand(uint32_t frameBytes, uint32_t publishedFps, uint32_t* wantFps);
+void MJPEGHandler(void);
+void SnapshotHandler(void);
+StreamWorkerStats streamWorkerStats(int worker);
@@ -0,0 +1,14 @@
+#pragma once
+#include <Arduino.h>
+
+#ifndef MOTION_THRESHOLD
+#define MOTION_THRESHOLD 2        // Score (per mille of MCUs changed) below which a frame counts as static
+#endif
+#ifndef MOTION_KEEPALIVE_MS
+#define MOTION_KEEPALIVE_MS 1000  // Static scenes are still published this often
+#endif
+#define MOTION_BLOCK_DELTA 32     // Change of an MCU's dequantized luma DC (8x its mean) that counts as motion
+#define MOTION_UNKNOWN 1000       // Score of frames that could not be parsed
+
+uint16_t motionScore(const uint8_t* buf, size_t len);
+void motionCommit();
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define VIDEO_TRACK 1
+#define AUDIO_TRACK 2
+
+void muxCB(void* pvParameters);
+void MuxHandler(void);
+void muxCloseAll();
+size_t buildContainerHeader(uint8_t* buf, uint16_t width, uint16_t height);
+size_t muxBlockHeader(uint8_t* hdr, int64_t* clusterMs, int64_t ms, uint8_t track, size_t len);
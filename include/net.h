@@ -0,0 +1,10 @@
+#pragma once
+#include <WiFi.h>
+#include <sys/uio.h>
+
+int netSend(WiFiClient& client, const void* buf, size_t len);
+int netSendv(WiFiClient& client, const struct iovec* parts, int count, size_t offset);
+int netRecv(WiFiClient& client, void* buf, size_t len);
+int netWakeOpen();
+void netWake(int fd);
+void netWakeClear(int fd);
@@ -0,0 +1,30 @@
+#pragma once
+#include <Arduino.h>
+
+#ifndef TARGET_KBPS
+#define TARGET_KBPS 8000        // Uplink budget for all MJPEG clients together, kbit/s
+#endif
+#define QUALITY_WORST   40      // Highest (coarsest) set_quality value the controller may pick
+#define QUALITY_WINDOW_MS 1000  // Controller decision interval
+
+// Controller state, readable for monitoring. Lower quality values mean better images.
+struct QualityState {
+  int quality;          // Value currently programmed with set_quality
+  uint32_t frameBytes;  // EWMA of captured JPEG sizes
+  uint32_t publishedFps; // Frames published per second over the last window; static ones are not
+  uint32_t wantFps;     // Sum of the frame rates clients can receive: their caps, limited by publishedFps
+  uint32_t demandBps;   // Each client's rate times the size of the stream it receives, bytes/s
+  uint32_t sentBps;     // Bytes/s actually written to MJPEG clients over the last window
+  int pressure;         // Consecutive windows over (>0) or comfortably under (<0) budget
+  uint32_t raised;      // Times quality was coarsened
+  uint32_t lowered;     // Times quality was refined
+};
+
+// Sums the clients' frame rates into *wantFps and returns the bytes/s they ask for
+typedef uint32_t (*QualityDemand)(uint32_t frameBytes, uint32_t publishedFps, uint32_t* wantFps);
+
+void qualityUpdate(size_t frameLen, bool published, uint32_t sentBytes, uint32_t now);
+void qualitySetDemand(QualityDemand demand);
+void qualityReset();
+const QualityState& qualityState();
+void QualityHandler(void);
@@ -0,0 +1,27 @@
+#pragma once
+#include <Arduino.h>
+#include "mjpeg.h"
+
+#define SCALE_COUNT 3  // Substreams at 1/2, 1/4 and 1/8 of the camera resolution
+
+struct Frame;
+
+// A downscaled copy of a published frame, owned by its frame handle. The buffer is
+// allocated with the frame pool and reused each time the handle carries a new frame.
+struct ScaledJpeg {
+  uint8_t* buf;
+  size_t len;  // 0 if this scale was not rendered for the frame
+  size_t cap;
+  char head[MJPEG_HEAD_MAX];  // Multipart part header of this copy
+  uint8_t headLen;
+};
+
+int scaleIndex(int factor);
+int scaleFactor(int index);
+void scaleSetup(Frame* handles, size_t count, size_t frameBytes);
+void scaleSubscribe(int index);
+void scaleUnsubscribe(int index);
+uint32_t scaleFrameBytes(int index, uint32_t frameBytes);
+void scaleNotify();
+void scaleCB(void* pvParameters);
+size_t jpegDownscale(const uint8_t* in, size_t len, int factor, uint8_t* out, size_t cap);
@@ -0,0 +1,43 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+#define TRACE_EVENTS 4096  // Ring capacity; the oldest spans are overwritten first
+#define TRACE_TRACK_CLIENT 16  // Client tracks are this plus the socket descriptor
+
+// Span names, exported as the Chrome trace event name
+enum TraceName : uint8_t {
+  TRACE_CAPTURE,     // esp_camera_fb_get()
+  TRACE_MOTION,      // Motion scoring of a captured frame
+  TRACE_PUBLISH,     // framePublish(), pool copy included
+  TRACE_SEND,        // One MJPEG frame to one client, first byte to last
+  TRACE_I2S_READ,    // One I2S block read
+  TRACE_AUDIO_SEND,  // One audio block to one /i2s client
+  TRACE_SCALE,       // Rendering one downscaled substream of a frame
+  TRACE_NAMES
+};
+
+// Fixed tracks (Chrome trace thread ids); clients get one each from TRACE_TRACK_CLIENT up
+enum TraceTrack : uint8_t { TRACK_CAMERA = 1, TRACK_MIC = 2, TRACK_SCALE = 3 };
+
+extern std::atomic<bool> traceOn;
+
+void traceRecord(TraceName name, uint8_t track, uint32_t id, uint32_t start, uint32_t end);
+void TraceHandler(void);
+
+/**
+ * @brief Records a completed span if tracing is switched on.
+ *
+ * Costs one atomic load while tracing is off, so it can stay in the hot paths.
+ *
+ * @param name What the span measured.
+ * @param track Task or client the span belongs to.
+ * @param id Frame or audio block sequence number the span worked on.
+ * @param start micros() at the start of the span.
+ * @param end micros() at its end.
+ * @return void
+ */
+inline void traceSpan(TraceName name, uint8_t track, uint32_t id, uint32_t start, uint32_t end) {
+  if (traceOn.load(std::memory_order_acquire))
+    traceRecord(name, track, id, start, end);
+}
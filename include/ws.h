@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define WS_WINDOW         2     // Default video messages a client may have unacknowledged
+#define WS_WINDOW_MAX     8     // Largest window a client may ask for with ?window=
+#define WS_ACK_TIMEOUT_MS 2000  // Unacknowledged frames older than this no longer hold the window
+#define WS_HEADER_BYTES   16    // Message header ahead of every payload, see wsMessageHeader()
+
+// Message types, first byte of the message header
+enum { WS_VIDEO = 1, WS_AUDIO = 2 };
+
+void wsCB(void* pvParameters);
+void WSHandler(void);
+void wsNotify();
+size_t wsMessageHeader(uint8_t* hdr, uint8_t type, uint32_t seq, int64_t time, size_t len);
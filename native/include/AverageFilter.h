@@ -0,0 +1,40 @@
+#pragma once
+// Host stand-in for the AverageFilter library: a moving average over the last samples.
+#include <stdint.h>
+#include <vector>
+
+template <typename T>
+class averageFilter {
+public:
+  explicit averageFilter(int samples) : _samples(samples) {}
+
+  int8_t initialize() {
+    _values.clear();
+    _next = 0;
+    _sum = 0;
+    _current = 0;
+    return 0;
+  }
+
+  T value(T sample) {
+    if ((int)_values.size() < _samples) {
+      _values.push_back(sample);
+    } else {
+      _sum -= _values[_next];
+      _values[_next] = sample;
+      _next = (_next + 1) % _samples;
+    }
+    _sum += sample;
+    _current = (T)(_sum / (int64_t)_values.size());
+    return _current;
+  }
+
+  T currentValue() { return _current; }
+
+private:
+  int _samples;
+  std::vector<T> _values;
+  int _next = 0;
+  int64_t _sum = 0;
+  T _current = 0;
+};
@@ -0,0 +1,30 @@
+#pragma once
+// Host stand-in for the ESP_I2S library: a microphone that replays the PCM fixture in
+// I2S_FIXTURE (16-bit little-endian mono) in a loop, in real time at the configured rate.
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+typedef enum { I2S_MODE_STD, I2S_MODE_TDM, I2S_MODE_PDM_TX, I2S_MODE_PDM_RX } i2s_mode_t;
+typedef enum {
+  I2S_DATA_BIT_WIDTH_8BIT = 8,
+  I2S_DATA_BIT_WIDTH_16BIT = 16,
+  I2S_DATA_BIT_WIDTH_24BIT = 24,
+  I2S_DATA_BIT_WIDTH_32BIT = 32,
+} i2s_data_bit_width_t;
+typedef enum { I2S_SLOT_MODE_MONO = 1, I2S_SLOT_MODE_STEREO = 2 } i2s_slot_mode_t;
+typedef enum { I2S_STD_SLOT_LEFT = 1, I2S_STD_SLOT_RIGHT = 2, I2S_STD_SLOT_BOTH = 3 } i2s_std_slot_mask_t;
+
+class I2SClass {
+public:
+  void setPins(int8_t bclk, int8_t ws, int8_t dout, int8_t din = -1, int8_t mclk = -1) {}
+  bool begin(i2s_mode_t mode, uint32_t rate, i2s_data_bit_width_t bits, i2s_slot_mode_t ch, int8_t slot_mask = -1);
+  size_t readBytes(char* buffer, size_t size);
+
+private:
+  std::vector<uint8_t> _pcm;
+  size_t _pos = 0;
+  uint32_t _byteRate = 0;
+  uint64_t _bytesRead = 0;
+  int64_t _start = 0;
+};
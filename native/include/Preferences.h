@@ -0,0 +1,19 @@
+#pragma once
+// Host stand-in for the NVS-backed Preferences library; values live until the program exits
+#include <stdint.h>
+#include <stddef.h>
+
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false);
+  void end();
+  bool clear();
+  int32_t getInt(const char* key, int32_t defaultValue = 0);
+  uint32_t getUInt(const char* key, uint32_t defaultValue = 0);
+  size_t putInt(const char* key, int32_t value);
+  size_t putUInt(const char* key, uint32_t value);
+
+private:
+  const char* _name = NULL;
+  bool _readOnly = true;
+};
@@ -0,0 +1,47 @@
+#pragma once
+// Host stand-in for the WiFi library: the station is always connected and clients are
+// plain host sockets. Copies of a client share its socket, which closes with the last one.
+#include <Arduino.h>
+#include <memory>
+
+typedef enum { WL_IDLE_STATUS = 0, WL_CONNECTED = 3, WL_DISCONNECTED = 6 } wl_status_t;
+
+class IPAddress {
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : _a{ a, b, c, d } {}
+  operator String() const;
+
+private:
+  uint8_t _a[4];
+};
+
+class WiFiClient : public Print {
+public:
+  WiFiClient() {}
+  explicit WiFiClient(int fd);
+
+  int fd() const;
+  uint8_t connected();
+  void stop();
+  int setTimeout(uint32_t seconds);
+  int setNoDelay(bool nodelay);
+  void clear();
+  using Print::write;
+  size_t write(const uint8_t* buf, size_t size) override;
+  explicit operator bool() { return connected(); }
+
+private:
+  struct Socket;
+  std::shared_ptr<Socket> _socket;
+  uint32_t _timeoutMs = 3000;
+};
+
+class WiFiClass {
+public:
+  wl_status_t begin(const char* ssid, const char* passphrase = NULL) { return WL_CONNECTED; }
+  bool setSleep(bool enabled) { return true; }
+  wl_status_t status() { return WL_CONNECTED; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,12 @@
+#pragma once
+// Host stand-in: Linux has eventfd natively, so registering the VFS driver does nothing
+#include <sys/eventfd.h>
+#include "esp_err.h"
+
+typedef struct {
+  size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() { 5 }
+
+inline esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t* config) { return ESP_OK; }
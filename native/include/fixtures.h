@@ -0,0 +1,14 @@
+#pragma once
+// Replayed inputs of the native build, read from FIXTURE_DIR (the FIXTURE_DIR environment
+// variable overrides the directory the build was configured with)
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifndef FIXTURE_DIR
+#define FIXTURE_DIR "test/fixtures"
+#endif
+
+std::string fixturePath(const char* name);
+bool fixtureLoad(const char* name, std::vector<uint8_t>* data);
+std::vector<std::string> fixtureList(const char* dir);
@@ -0,0 +1,33 @@
+#pragma once
+// Host stand-in for the FreeRTOS kernel of ESP-IDF: every task is a thread, ticks are
+// milliseconds of the monotonic clock and critical sections are recursive spinlocks.
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY      0xFFFFFFFFu
+#define portNUM_PROCESSORS 2
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+#define pdTRUE             1
+#define pdFALSE            0
+#define pdPASS             pdTRUE
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+// ESP-IDF spinlock; taken again by its owner without blocking
+struct portMUX_TYPE {
+  std::atomic<const void*> owner{nullptr};
+  uint32_t count = 0;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+void vPortEnterCritical(portMUX_TYPE* mux);
+void vPortExitCritical(portMUX_TYPE* mux);
+#define taskENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux)  vPortExitCritical(mux)
+
+BaseType_t xPortGetCoreID();
@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+
+typedef struct {
+  char chunk_id[4];      // "RIFF"
+  uint32_t chunk_size;
+  char chunk_format[4];  // "WAVE"
+} wav_descriptor_chunk_t;
+
+typedef struct {
+  char subchunk_id[4];   // "fmt "
+  uint32_t subchunk_size;
+  uint16_t audio_format;
+  uint16_t num_of_channels;
+  uint32_t sample_rate;
+  uint32_t byte_rate;
+  uint16_t block_align;
+  uint16_t bits_per_sample;
+} pcm_wav_fmt_chunk_t;
+
+typedef struct {
+  char subchunk_id[4];   // "data"
+  uint32_t subchunk_size;
+} wav_data_chunk_t;
+
+typedef struct {
+  wav_descriptor_chunk_t descriptor_chunk;
+  pcm_wav_fmt_chunk_t fmt_chunk;
+  wav_data_chunk_t data_chunk;
+} pcm_wav_header_t;
+
+#define PCM_WAV_HEADER_SIZE 44
+
+#define PCM_WAV_HEADER_DEFAULT(wav_sample_size, wav_sample_width, wav_sample_rate, wav_channel_num) \
+  { \
+    .descriptor_chunk = { .chunk_id = { 'R', 'I', 'F', 'F' }, \
+                          .chunk_size = (uint32_t)((wav_sample_size) + sizeof(pcm_wav_header_t) - 8), \
+                          .chunk_format = { 'W', 'A', 'V', 'E' } }, \
+    .fmt_chunk = { .subchunk_id = { 'f', 'm', 't', ' ' }, \
+                   .subchunk_size = 16, \
+                   .audio_format = 1, \
+                   .num_of_channels = (uint16_t)(wav_channel_num), \
+                   .sample_rate = (uint32_t)(wav_sample_rate), \
+                   .byte_rate = (uint32_t)((wav_sample_width) * (wav_sample_rate) * (wav_channel_num) / 8), \
+                   .block_align = (uint16_t)((wav_sample_width) * (wav_channel_num) / 8), \
+                   .bits_per_sample = (uint16_t)(wav_sample_width) }, \
+    .data_chunk = { .subchunk_id = { 'd', 'a', 't', 'a' }, .subchunk_size = (uint32_t)(wav_sample_size) } \
+  }
@@ -0,0 +1,66 @@
+//  === Arduino core on the host  =================================================================
+#include <Arduino.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+uint32_t millis() {
+  return esp_timer_get_time() / 1000;
+}
+
+uint32_t micros() {
+  return esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+size_t Print::printf(const char* fmt, ...) {
+  char small[128];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(small, sizeof(small), fmt, args);
+  va_end(args);
+  if (len < 0)
+    return 0;
+  if ((size_t)len < sizeof(small))
+    return write((const uint8_t*)small, len);
+
+  char* big = (char*)malloc(len + 1);
+  if (big == NULL)
+    return 0;
+  va_start(args, fmt);
+  vsnprintf(big, len + 1, fmt, args);
+  va_end(args);
+  size_t n = write((const uint8_t*)big, len);
+  free(big);
+  return n;
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t len) {
+  return fwrite(buf, 1, len, stdout);
+}
+
+// The host has nothing to reboot into; exit so a supervisor can start the program again
+void EspClass::restart() {
+  fflush(stdout);
+  _exit(1);
+}
+
+#ifndef PIO_UNIT_TESTING
+// Runs the sketch like the Arduino core's main task does
+int main() {
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  setup();
+  for (;;)
+    loop();
+}
+#endif
@@ -0,0 +1,172 @@
+//  === Replayed OV2640  ==========================================================================
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "fixtures.h"
+#include <condition_variable>
+#include <mutex>
+
+#define CAMERA_FRAMES_DIR  "frames"  // Fixture directory replayed in name order
+#define CAMERA_FB_WAIT_MS  4000      // The driver gives up waiting for a returned buffer after this
+
+const resolution_info_t resolution[] = {
+  { 96, 96, 0 },     { 160, 120, 0 },  { 128, 128, 0 },  { 176, 144, 0 },
+  { 240, 176, 0 },   { 240, 240, 0 },  { 320, 240, 0 },  { 320, 320, 0 },
+  { 400, 296, 0 },   { 480, 320, 0 },  { 640, 480, 0 },  { 800, 600, 0 },
+  { 1024, 768, 0 },  { 1280, 720, 0 }, { 1280, 1024, 0 }, { 1600, 1200, 0 },
+  { 0, 0, 0 },
+};
+
+// Driver state: the fixture frames and the buffers handed out to the application
+struct Camera {
+  std::mutex lock;
+  std::condition_variable returned;
+  std::vector<std::vector<uint8_t>> frames;
+  std::vector<camera_fb_t> fbs;
+  std::vector<bool> taken;
+  int64_t start;
+  int64_t periodUs;
+  int64_t lastIndex;
+  sensor_t sensor;
+  bool running;
+};
+
+static Camera camera;
+
+static int setFramesize(sensor_t* s, framesize_t size) { s->status.framesize = size; return 0; }
+static int setQuality(sensor_t* s, int quality) { s->status.quality = quality; return 0; }
+static int setVflip(sensor_t* s, int enable) { s->status.vflip = enable; return 0; }
+static int setWbMode(sensor_t* s, int mode) { s->status.wb_mode = mode; return 0; }
+
+// Reads the frame size from the SOF0 segment of a fixture
+static void frameSize(const std::vector<uint8_t>& jpeg, size_t* width, size_t* height) {
+  *width = *height = 0;
+  for (size_t i = 2; i + 9 < jpeg.size(); i += 2 + (jpeg[i + 2] << 8 | jpeg[i + 3])) {
+    if (jpeg[i] != 0xFF)
+      return;
+    if (jpeg[i + 1] == 0xC0) {
+      *height = jpeg[i + 5] << 8 | jpeg[i + 6];
+      *width = jpeg[i + 7] << 8 | jpeg[i + 8];
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Loads the fixture frames and allocates the frame buffers.
+ *
+ * The frame size, quality and clock of the configuration are recorded in the sensor
+ * status but change nothing: the fixtures are replayed as they are. The
+ * CAMERA_SENSOR_FPS environment variable overrides the rate the build set.
+ *
+ * @param config Driver configuration; only fb_count is used.
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if there are no fixture frames.
+ */
+esp_err_t esp_camera_init(const camera_config_t* config) {
+  std::lock_guard<std::mutex> lock(camera.lock);
+  camera.frames.clear();
+  size_t largest = 0;
+  for (const std::string& name : fixtureList(CAMERA_FRAMES_DIR)) {
+    std::vector<uint8_t> frame;
+    if (!fixtureLoad(name.c_str(), &frame))
+      continue;
+    largest = frame.size() > largest ? frame.size() : largest;
+    camera.frames.push_back(std::move(frame));
+  }
+  if (camera.frames.empty())
+    return ESP_ERR_NOT_FOUND;
+
+  camera.fbs.assign(config->fb_count, camera_fb_t());
+  camera.taken.assign(config->fb_count, false);
+  for (camera_fb_t& fb : camera.fbs) {
+    fb.buf = (uint8_t*)malloc(largest);
+    fb.format = PIXFORMAT_JPEG;
+  }
+
+  camera.sensor = sensor_t();
+  camera.sensor.status.framesize = config->frame_size;
+  camera.sensor.status.quality = config->jpeg_quality;
+  camera.sensor.set_framesize = setFramesize;
+  camera.sensor.set_quality = setQuality;
+  camera.sensor.set_vflip = setVflip;
+  camera.sensor.set_wb_mode = setWbMode;
+  const char* fps = getenv("CAMERA_SENSOR_FPS");
+  camera.periodUs = 1000000 / (fps != NULL && atoi(fps) > 0 ? atoi(fps) : CAMERA_SENSOR_FPS);
+  camera.start = esp_timer_get_time();
+  camera.lastIndex = -1;
+  camera.running = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit() {
+  std::lock_guard<std::mutex> lock(camera.lock);
+  if (!camera.running)
+    return ESP_ERR_INVALID_STATE;
+  for (camera_fb_t& fb : camera.fbs)
+    free(fb.buf);
+  camera.fbs.clear();
+  camera.taken.clear();
+  camera.running = false;
+  return ESP_OK;
+}
+
+/**
+ * @brief Returns the newest frame of the replayed sensor, like CAMERA_GRAB_LATEST.
+ *
+ * The sensor delivers fixture frames in a loop at CAMERA_SENSOR_FPS. A caller that
+ * falls behind gets the latest one and skips the rest; a caller that is ahead waits
+ * for the next one.
+ *
+ * @return A frame buffer to hand back with esp_camera_fb_return(), or NULL if every
+ *         buffer is still held after CAMERA_FB_WAIT_MS.
+ */
+camera_fb_t* esp_camera_fb_get() {
+  std::unique_lock<std::mutex> lock(camera.lock);
+  if (!camera.running)
+    return NULL;
+  size_t i = 0;
+  auto available = [&i] {
+    for (i = 0; i < camera.taken.size(); i++) {
+      if (!camera.taken[i])
+        return true;
+    }
+    return false;
+  };
+  if (!camera.returned.wait_for(lock, std::chrono::milliseconds(CAMERA_FB_WAIT_MS), available))
+    return NULL;
+  camera.taken[i] = true;
+
+  // Wait for the sensor to expose a frame the caller has not had yet
+  const int64_t periodUs = camera.periodUs;
+  int64_t index = (esp_timer_get_time() - camera.start) / periodUs;
+  if (index <= camera.lastIndex) {
+    index = camera.lastIndex + 1;
+    int64_t wait = camera.start + index * periodUs - esp_timer_get_time();
+    lock.unlock();
+    if (wait > 0)
+      delayMicroseconds(wait);
+    lock.lock();
+  }
+  camera.lastIndex = index;
+
+  const std::vector<uint8_t>& frame = camera.frames[index % camera.frames.size()];
+  camera_fb_t* fb = &camera.fbs[i];
+  memcpy(fb->buf, frame.data(), frame.size());
+  fb->len = frame.size();
+  frameSize(frame, &fb->width, &fb->height);
+  int64_t now = esp_timer_get_time();
+  fb->timestamp.tv_sec = now / 1000000;
+  fb->timestamp.tv_usec = now % 1000000;
+  return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t* fb) {
+  std::lock_guard<std::mutex> lock(camera.lock);
+  size_t i = fb - camera.fbs.data();
+  if (i < camera.taken.size())
+    camera.taken[i] = false;
+  camera.returned.notify_all();
+}
+
+sensor_t* esp_camera_sensor_get() {
+  return camera.running ? &camera.sensor : NULL;
+}
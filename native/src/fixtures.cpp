@@ -0,0 +1,56 @@
+#include "fixtures.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+/**
+ * @brief Returns the path of a fixture.
+ *
+ * @param name Path relative to the fixture directory.
+ * @return The full path.
+ */
+std::string fixturePath(const char* name) {
+  const char* dir = getenv("FIXTURE_DIR");
+  return std::string(dir != NULL ? dir : FIXTURE_DIR) + "/" + name;
+}
+
+/**
+ * @brief Reads a whole fixture file.
+ *
+ * @param name Path relative to the fixture directory.
+ * @param data Receives the contents.
+ * @return false if the file could not be read.
+ */
+bool fixtureLoad(const char* name, std::vector<uint8_t>* data) {
+  FILE* f = fopen(fixturePath(name).c_str(), "rb");
+  if (f == NULL)
+    return false;
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data->resize(len > 0 ? len : 0);
+  bool ok = len > 0 && fread(data->data(), 1, len, f) == (size_t)len;
+  fclose(f);
+  return ok;
+}
+
+/**
+ * @brief Lists the files of a fixture directory in name order.
+ *
+ * @param dir Directory relative to the fixture directory.
+ * @return Paths relative to the fixture directory; empty if the directory cannot be read.
+ */
+std::vector<std::string> fixtureList(const char* dir) {
+  std::vector<std::string> names;
+  DIR* d = opendir(fixturePath(dir).c_str());
+  if (d == NULL)
+    return names;
+  while (struct dirent* e = readdir(d)) {
+    if (e->d_name[0] != '.')
+      names.push_back(std::string(dir) + "/" + e->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return names;
+}
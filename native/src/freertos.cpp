@@ -0,0 +1,222 @@
+//  === FreeRTOS on host threads  ================================================================
+#include <Arduino.h>
+#include <pthread.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <thread>
+
+// One task: a detached thread plus the state the notification calls use
+struct NativeTask {
+  const char* name;
+  uint32_t stackDepth;
+  int core;
+  std::mutex lock;
+  std::condition_variable wake;
+  uint32_t notifications = 0;
+};
+
+struct NativeSemaphore {
+  std::mutex lock;
+  std::condition_variable wake;
+  bool given = false;
+};
+
+// Fixed-size items copied in and out, like the kernel's queues
+struct NativeQueue {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+};
+
+static thread_local NativeTask* currentTask = NULL;
+
+// Threads FreeRTOS did not start (main, the test runner) become tasks on first use
+static NativeTask* self() {
+  if (currentTask == NULL)
+    currentTask = new NativeTask{ "main", 8192, 1 };
+  return currentTask;
+}
+
+// Waits up to `ticks` (forever for portMAX_DELAY) for ready() to hold; returns whether it does
+template <typename Ready>
+static bool waitTicks(std::condition_variable& wake, std::unique_lock<std::mutex>& lock, TickType_t ticks, Ready ready) {
+  if (ticks != portMAX_DELAY)
+    return wake.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+  wake.wait(lock, ready);
+  return true;
+}
+
+// Static initialisers read the clock too, so the start time is set on first use
+int64_t esp_timer_get_time() {
+  static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void vPortEnterCritical(portMUX_TYPE* mux) {
+  const void* me = self();
+  if (mux->owner.load(std::memory_order_relaxed) == me) {
+    mux->count++;
+    return;
+  }
+  const void* expected = nullptr;
+  while (!mux->owner.compare_exchange_weak(expected, me, std::memory_order_acquire)) {
+    expected = nullptr;
+    std::this_thread::yield();
+  }
+  mux->count = 1;
+}
+
+void vPortExitCritical(portMUX_TYPE* mux) {
+  if (--mux->count == 0)
+    mux->owner.store(nullptr, std::memory_order_release);
+}
+
+BaseType_t xPortGetCoreID() {
+  return self()->core;
+}
+
+/**
+ * @brief Starts a task on a new thread.
+ *
+ * Priorities and core affinity are recorded but not enforced: the host scheduler runs
+ * every task whenever it is ready. The core only selects the per-core state the
+ * project keeps, such as the log rings.
+ *
+ * @return pdPASS, with the handle stored in *handle if handle is not NULL.
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char* name, uint32_t stackDepth, void* param,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  NativeTask* task = new NativeTask{ name, stackDepth, core == tskNO_AFFINITY ? 0 : core };
+  if (handle != NULL)
+    *handle = task;
+  std::thread([task, code, param]() {
+    currentTask = task;
+    pthread_setname_np(pthread_self(), task->name);
+    code(param);
+  }).detach();
+  return pdPASS;
+}
+
+// Only a task deleting itself is supported; its thread ends here
+void vTaskDelete(TaskHandle_t task) {
+  if (task == NULL || task == self())
+    pthread_exit(NULL);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return self();
+}
+
+// Stack use is not measured on the host; reports the whole stack as free
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  return (task != NULL ? task : self())->stackDepth;
+}
+
+TickType_t xTaskGetTickCount() {
+  return esp_timer_get_time() / 1000;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+BaseType_t xTaskDelayUntil(TickType_t* previousWake, TickType_t increment) {
+  TickType_t wake = *previousWake + increment;
+  *previousWake = wake;
+  TickType_t now = xTaskGetTickCount();
+  if ((int32_t)(wake - now) <= 0)
+    return pdFALSE;
+  vTaskDelay(wake - now);
+  return pdTRUE;
+}
+
+void taskYIELD() {
+  std::this_thread::yield();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  std::lock_guard<std::mutex> lock(task->lock);
+  task->notifications++;
+  task->wake.notify_all();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+  NativeTask* t = self();
+  std::unique_lock<std::mutex> lock(t->lock);
+  waitTicks(t->wake, lock, ticksToWait, [t] { return t->notifications > 0; });
+  uint32_t count = t->notifications;
+  if (count > 0)
+    t->notifications = clearOnExit ? 0 : count - 1;
+  return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new NativeSemaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticksToWait) {
+  std::unique_lock<std::mutex> lock(sem->lock);
+  if (!waitTicks(sem->wake, lock, ticksToWait, [sem] { return sem->given; }))
+    return pdFALSE;
+  sem->given = false;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  std::lock_guard<std::mutex> lock(sem->lock);
+  if (sem->given)
+    return pdFALSE;
+  sem->given = true;
+  sem->wake.notify_one();
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  delete sem;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  NativeQueue* queue = new NativeQueue;
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+  std::unique_lock<std::mutex> lock(queue->lock);
+  if (!waitTicks(queue->changed, lock, ticksToWait, [queue] { return queue->items.size() < queue->length; }))
+    return pdFALSE;
+  queue->items.emplace_back((const uint8_t*)item, (const uint8_t*)item + queue->itemSize);
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticksToWait) {
+  std::unique_lock<std::mutex> lock(queue->lock);
+  if (!waitTicks(queue->changed, lock, ticksToWait, [queue] { return !queue->items.empty(); }))
+    return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->lock);
+  return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->lock);
+  return queue->length - queue->items.size();
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
@@ -0,0 +1,55 @@
+//  === Replayed INMP441  =========================================================================
+#include <Arduino.h>
+#include <ESP_I2S.h>
+#include "fixtures.h"
+
+#define I2S_FIXTURE "audio.pcm"  // 16-bit little-endian mono, replayed in a loop
+#define I2S_DMA_BYTES (6 * 240 * 2) // The driver's default DMA ring: 6 descriptors of 240 frames
+
+/**
+ * @brief Loads the PCM fixture and starts the replay clock.
+ *
+ * The fixture is taken to be recorded at the requested rate.
+ *
+ * @return false for anything but 16-bit mono, or if the fixture cannot be read.
+ */
+bool I2SClass::begin(i2s_mode_t mode, uint32_t rate, i2s_data_bit_width_t bits, i2s_slot_mode_t ch, int8_t slot_mask) {
+  if (bits != I2S_DATA_BIT_WIDTH_16BIT || ch != I2S_SLOT_MODE_MONO || !fixtureLoad(I2S_FIXTURE, &_pcm) || _pcm.size() < 2)
+    return false;
+  _pcm.resize(_pcm.size() & ~(size_t)1);
+  _pos = 0;
+  _byteRate = rate * 2;
+  _bytesRead = 0;
+  _start = esp_timer_get_time();
+  return true;
+}
+
+/**
+ * @brief Reads the next samples, blocking until the microphone would have delivered them.
+ *
+ * Like the driver, only the last I2S_DMA_BYTES of samples wait for a reader that falls
+ * behind; older ones are lost.
+ *
+ * @return size, or 0 if begin() did not succeed.
+ */
+size_t I2SClass::readBytes(char* buffer, size_t size) {
+  if (_pcm.empty())
+    return 0;
+  uint64_t delivered = (esp_timer_get_time() - _start) * _byteRate / 1000000 & ~(uint64_t)1;
+  if (delivered > _bytesRead + I2S_DMA_BYTES) {
+    uint64_t lost = delivered - I2S_DMA_BYTES - _bytesRead;
+    _pos = (_pos + lost) % _pcm.size();
+    _bytesRead += lost;
+  }
+  for (size_t done = 0; done < size;) {
+    size_t n = _pcm.size() - _pos < size - done ? _pcm.size() - _pos : size - done;
+    memcpy(buffer + done, _pcm.data() + _pos, n);
+    _pos = (_pos + n) % _pcm.size();
+    done += n;
+  }
+  _bytesRead += size;
+  int64_t wait = _start + (int64_t)(_bytesRead * 1000000 / _byteRate) - esp_timer_get_time();
+  if (wait > 0)
+    delayMicroseconds(wait);
+  return size;
+}
@@ -0,0 +1,80 @@
+//  === SHA-1 and Base64 for the WebSocket handshake  =============================================
+#include <mbedtls/sha1.h>
+#include <mbedtls/base64.h>
+#include <string.h>
+
+static inline uint32_t rol(uint32_t v, int n) {
+  return v << n | v >> (32 - n);
+}
+
+int mbedtls_sha1(const unsigned char* input, size_t ilen, unsigned char output[20]) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  uint64_t bits = (uint64_t)ilen * 8;
+  size_t total = (ilen + 9 + 63) / 64 * 64;
+
+  for (size_t off = 0; off < total; off += 64) {
+    uint8_t block[64];
+    for (size_t i = 0; i < 64; i++) {
+      size_t k = off + i;
+      block[i] = k < ilen ? input[k] : k == ilen ? 0x80 : k >= total - 8 ? bits >> (8 * (total - 1 - k)) : 0;
+    }
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+      w[i] = block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    for (int i = 16; i < 80; i++)
+      w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rol(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  for (int i = 0; i < 20; i++)
+    output[i] = h[i / 4] >> (24 - 8 * (i % 4));
+  return 0;
+}
+
+int mbedtls_base64_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t need = (slen + 2) / 3 * 4 + 1;
+  if (dlen < need) {
+    *olen = need;
+    return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < slen; i += 3) {
+    uint32_t v = src[i] << 16 | (i + 1 < slen ? src[i + 1] << 8 : 0) | (i + 2 < slen ? src[i + 2] : 0);
+    dst[n++] = alphabet[v >> 18 & 63];
+    dst[n++] = alphabet[v >> 12 & 63];
+    dst[n++] = i + 1 < slen ? alphabet[v >> 6 & 63] : '=';
+    dst[n++] = i + 2 < slen ? alphabet[v & 63] : '=';
+  }
+  dst[n] = 0;
+  *olen = n;
+  return 0;
+}
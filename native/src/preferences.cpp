@@ -0,0 +1,53 @@
+//  === Preferences kept in memory  ===============================================================
+#include <Preferences.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+static std::mutex storeLock;
+static std::map<std::string, std::map<std::string, uint32_t>> store;  // Namespace -> key -> value
+
+bool Preferences::begin(const char* name, bool readOnly) {
+  _name = name;
+  _readOnly = readOnly;
+  return true;
+}
+
+void Preferences::end() {
+  _name = NULL;
+}
+
+bool Preferences::clear() {
+  if (_name == NULL || _readOnly)
+    return false;
+  std::lock_guard<std::mutex> lock(storeLock);
+  store.erase(_name);
+  return true;
+}
+
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue) {
+  if (_name == NULL)
+    return defaultValue;
+  std::lock_guard<std::mutex> lock(storeLock);
+  auto ns = store.find(_name);
+  if (ns == store.end())
+    return defaultValue;
+  auto v = ns->second.find(key);
+  return v == ns->second.end() ? defaultValue : v->second;
+}
+
+int32_t Preferences::getInt(const char* key, int32_t defaultValue) {
+  return getUInt(key, defaultValue);
+}
+
+size_t Preferences::putUInt(const char* key, uint32_t value) {
+  if (_name == NULL || _readOnly)
+    return 0;
+  std::lock_guard<std::mutex> lock(storeLock);
+  store[_name][key] = value;
+  return sizeof(value);
+}
+
+size_t Preferences::putInt(const char* key, int32_t value) {
+  return putUInt(key, value);
+}
@@ -0,0 +1,96 @@
+//  === WiFi over host sockets  ===================================================================
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <poll.h>
+#include <signal.h>
+
+WiFiClass WiFi;
+
+// lwIP reports a peer that went away as an error from send(), never as a signal
+static const bool ignoreSigpipe = signal(SIGPIPE, SIG_IGN) != SIG_ERR;
+
+// Socket shared by the copies of a client
+struct WiFiClient::Socket {
+  int fd;
+  explicit Socket(int fd) : fd(fd) {}
+  ~Socket() { close(fd); }
+};
+
+IPAddress::operator String() const {
+  char s[16];
+  snprintf(s, sizeof(s), "%u.%u.%u.%u", _a[0], _a[1], _a[2], _a[3]);
+  return String(s);
+}
+
+// lwIP's TCP_SND_BUF in the Arduino core. The host default of several megabytes would hide a
+// slow peer from the sender for seconds; Linux doubles what is set for its bookkeeping.
+#define LWIP_SND_BUF 5744
+
+WiFiClient::WiFiClient(int fd) : _socket(std::make_shared<Socket>(fd)) {
+  int size = LWIP_SND_BUF / 2;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+int WiFiClient::fd() const {
+  return _socket ? _socket->fd : -1;
+}
+
+/**
+ * @brief Reports whether the peer is still there, like the core's WiFiClient.
+ *
+ * @return 1 while the socket is open and the peer has not closed its side.
+ */
+uint8_t WiFiClient::connected() {
+  if (!_socket)
+    return 0;
+  uint8_t dummy;
+  int r = recv(_socket->fd, &dummy, 1, MSG_DONTWAIT | MSG_PEEK);
+  if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+void WiFiClient::stop() {
+  _socket.reset();
+}
+
+int WiFiClient::setTimeout(uint32_t seconds) {
+  _timeoutMs = seconds * 1000;
+  return 0;
+}
+
+int WiFiClient::setNoDelay(bool nodelay) {
+  int flag = nodelay;
+  return _socket ? setsockopt(_socket->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) : -1;
+}
+
+// Discards whatever the peer has sent and not been read
+void WiFiClient::clear() {
+  uint8_t buf[256];
+  while (_socket && recv(_socket->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+  }
+}
+
+/**
+ * @brief Writes the whole buffer, waiting for the socket to drain for up to the timeout.
+ *
+ * @return Bytes written; short if the timeout expired or the connection failed.
+ */
+size_t WiFiClient::write(const uint8_t* buf, size_t size) {
+  size_t done = 0;
+  while (_socket && done < size) {
+    int w = send(_socket->fd, buf + done, size - done, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (w > 0) {
+      done += w;
+      continue;
+    }
+    if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      break;
+    struct pollfd p = { _socket->fd, POLLOUT, 0 };
+    if (poll(&p, 1, _timeoutMs) <= 0)
+      break;
+  }
+  return done;
+}
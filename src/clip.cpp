@@ -0,0 +1,362 @@
+#include "globals.h"
+#include "clip.h"
+#include "mux.h"
+#include "frame.h"
+#include "i2s.h"
+#include "net.h"
+#include "clients.h"
+#include "metrics.h"
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include "esp_camera.h"
+
+#if defined(BENCHMARK)
+#define BENCHMARK_PRINT_INT 5000
+uint32_t lastPrintClip = millis();
+uint32_t lastEvicted = 0;
+#endif
+
+const char *CLIP_HEADER = "HTTP/1.1 200 OK\r\n"
+                          "Access-Control-Allow-Origin: *\r\n"
+                          "Content-Type: video/x-matroska\r\n"
+                          "Content-Disposition: attachment; filename=\"clip.mkv\"\r\n"
+                          "Connection: close\r\n"
+                          "\r\n";
+
+// One buffered frame or audio block: a run of contiguous slabs in the arena
+struct ClipEntry {
+  int64_t time;             // Capture time on the esp_timer clock (us)
+  uint32_t len;
+  uint16_t slab;            // First slab
+  uint16_t slabs;           // Slabs occupied
+  uint8_t track;            // VIDEO_TRACK or AUDIO_TRACK
+  std::atomic<bool> ready;  // Data fully copied in
+};
+
+// Per-download state: a cursor over the entries buffered when the request came in
+struct ClipClient {
+  WiFiClient client;
+  uint32_t cursor;     // Next entry to send; entries from here on are never evicted
+  uint32_t end;        // First entry past the requested window
+  int64_t t0;          // Capture time mapped to timestamp 0
+  int64_t clusterMs;   // Timestamp of the open cluster, -1 until the first packet
+  uint8_t hdr[40];     // Cluster and SimpleBlock headers of the packet in flight
+  size_t hdrLen;
+  const uint8_t *body; // Packet payload inside the arena
+  size_t bodyLen;
+  size_t offset;       // Bytes of hdr + body already written
+  bool busy;           // A packet is in flight
+  bool stalling;       // Socket filled up while sending the current packet
+  ClientStats stats;
+};
+
+TaskHandle_t tClip;  // Clip download task handle
+ClientTable<ClipClient, CLIP_CLIENTS> clipClients;
+
+uint8_t *arena;                  // CLIP_ARENA_KB of PSRAM, carved into CLIP_SLAB_BYTES slabs
+size_t slabCount;
+ClipEntry entries[CLIP_ENTRIES]; // Entry n lives at n % CLIP_ENTRIES
+uint32_t clipHead;               // Next entry to write
+uint32_t clipTail;               // Oldest entry still buffered
+size_t writeSlab;                // Slab following the newest entry
+size_t usedSlabs;
+uint32_t clipEvicted;
+uint32_t clipDropped;
+portMUX_TYPE clipLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Allocates the pre-event arena and keeps both capture tasks running to fill it.
+ *
+ * Does nothing unless the build sets CLIP_ARENA_KB, so by default capture still
+ * stops while no client is connected.
+ *
+ * @return void
+ * @note Call after the capture tasks have been created. With an arena, camera and
+ *       microphone are subscribed for good and never go idle.
+ */
+void clipSetup() {
+  if (CLIP_ARENA_KB == 0)
+    return;
+  slabCount = CLIP_ARENA_KB * KILOBYTE / CLIP_SLAB_BYTES;
+  arena = (uint8_t *)ps_malloc(slabCount * CLIP_SLAB_BYTES);
+  if (arena == NULL) {
+    Log.error("clipSetup: Arena allocation of %d KB failed\n", CLIP_ARENA_KB);
+    slabCount = 0;
+    return;
+  }
+  frameSubscribe();
+  audioSubscribe();
+  Log.trace("clipSetup: Buffering into %d slabs of %d bytes\n", slabCount, CLIP_SLAB_BYTES);
+}
+
+/**
+ * @brief Copies a published frame or captured audio block into the arena.
+ *
+ * The entry takes a run of contiguous slabs following the newest one, wrapping to the
+ * start of the arena when the run does not fit before its end. The oldest entries in
+ * the way are overwritten, unless a /clip download still has to send them, in which
+ * case the new entry is dropped instead.
+ *
+ * @param track VIDEO_TRACK or AUDIO_TRACK.
+ * @param data Payload to copy.
+ * @param len Payload size.
+ * @param time Capture time on the esp_timer clock (us).
+ * @return void
+ * @note Called from the camera and microphone tasks; the copy runs outside the lock.
+ */
+void clipPush(uint8_t track, const uint8_t *data, size_t len, int64_t time) {
+  if (arena == NULL)
+    return;
+  size_t k = (len + CLIP_SLAB_BYTES - 1) / CLIP_SLAB_BYTES;
+  if (k == 0 || k > slabCount) {
+    clipDropped++;
+    return;
+  }
+
+  taskENTER_CRITICAL(&clipLock);
+  // Entries at or after the slowest download's cursor must survive
+  uint32_t floor = clipHead;
+  for (size_t i = 0; i < clipClients.capacity(); i++) {
+    ClipClient *c = clipClients.at(i);
+    if (c != NULL && (int32_t)(c->cursor - floor) < 0)
+      floor = c->cursor;
+  }
+
+  // The run starts after the newest entry, or at slab 0 if it would cross the end;
+  // the slabs skipped at the end count as needed too, so the entries there go first
+  bool wrap = writeSlab + k > slabCount;
+  size_t start = wrap ? 0 : writeSlab;
+  while (clipTail != clipHead) {
+    ClipEntry *t = &entries[clipTail % CLIP_ENTRIES];
+    size_t s = t->slab, e = t->slab + t->slabs;
+    bool overlaps = wrap ? (e > writeSlab || s < k) : (s < writeSlab + k && e > writeSlab);
+    if (!overlaps && clipHead - clipTail < CLIP_ENTRIES)
+      break;
+    if (!t->ready.load() || (int32_t)(clipTail - floor) >= 0) {
+      clipDropped++;
+      taskEXIT_CRITICAL(&clipLock);
+      return;
+    }
+    usedSlabs -= t->slabs;
+    clipTail++;
+    clipEvicted++;
+  }
+
+  ClipEntry *entry = &entries[clipHead % CLIP_ENTRIES];
+  entry->ready.store(false);
+  entry->time = time;
+  entry->len = len;
+  entry->slab = start;
+  entry->slabs = k;
+  entry->track = track;
+  writeSlab = start + k == slabCount ? 0 : start + k;
+  usedSlabs += k;
+  clipHead++;
+  taskEXIT_CRITICAL(&clipLock);
+
+  memcpy(arena + start * CLIP_SLAB_BYTES, data, len);
+  entry->ready.store(true, std::memory_order_release);
+
+#if defined(BENCHMARK)
+  if (track == VIDEO_TRACK && millis() - lastPrintClip > BENCHMARK_PRINT_INT) {
+    ClipStats s = clipStats();
+    Log.verbose("clip: fill=%d/%d slabs, entries=%d, window=%d ms, evicted=%d (+%d), dropped=%d, footprint=%d bytes\n",
+                s.slabsUsed, s.slabs, s.entries, s.windowMs, s.evicted, s.evicted - lastEvicted, s.dropped, s.footprint);
+    lastPrintClip = millis();
+    lastEvicted = s.evicted;
+  }
+#endif
+}
+
+/**
+ * @brief Returns the arena's occupancy and counters.
+ *
+ * @return Snapshot of the arena statistics.
+ */
+ClipStats clipStats() {
+  ClipStats s;
+  taskENTER_CRITICAL(&clipLock);
+  s.footprint = slabCount * CLIP_SLAB_BYTES + sizeof(entries);
+  s.slabs = slabCount;
+  s.slabsUsed = usedSlabs;
+  s.entries = clipHead - clipTail;
+  s.windowMs = s.entries > 1 ? (entries[(clipHead - 1) % CLIP_ENTRIES].time - entries[clipTail % CLIP_ENTRIES].time) / 1000 : 0;
+  s.evicted = clipEvicted;
+  s.dropped = clipDropped;
+  taskEXIT_CRITICAL(&clipLock);
+  return s;
+}
+
+/**
+ * @brief Handles /clip requests: downloads the last `seconds` of buffered audio and video.
+ *
+ * The window is fixed when the request arrives and sent as one Matroska file by the
+ * clip task, straight from the arena. Capture and buffering carry on meanwhile. How
+ * much the arena holds depends on frame sizes, so `seconds` is capped to the capture
+ * time actually buffered, which is also what a request without it gets.
+ *
+ * @return void
+ * @note Answers 503 when pre-event recording is disabled or CLIP_CLIENTS downloads are running.
+ */
+void ClipHandler(void) {
+  if (arena == NULL) {
+    server.send(503, "text/plain", "Pre-event recording disabled");
+    return;
+  }
+
+  ClipClient *c = clipClients.acquire();
+  if (c == NULL) {
+    Log.error("ClipHandler: Max number of clip downloads reached\n");
+    server.send(503, "text/plain", "Too many clip downloads");
+    return;
+  }
+  c->client = server.client();
+  c->clusterMs = -1;
+
+  // Pin everything buffered so far, then move the cursor up to the start of the window
+  taskENTER_CRITICAL(&clipLock);
+  uint32_t tail = clipTail;
+  c->end = clipHead;
+  c->cursor = tail;
+  clipClients.activate(c);
+  taskEXIT_CRITICAL(&clipLock);
+  connects[EP_CLIP].inc();
+
+  int seconds = 0;
+  if (c->end != tail) {
+    // Whole seconds covering everything pinned above, rounded up
+    int held = (entries[(c->end - 1) % CLIP_ENTRIES].time - entries[tail % CLIP_ENTRIES].time + 999999) / 1000000;
+    seconds = server.hasArg("seconds") ? server.arg("seconds").toInt() : held;
+    seconds = seconds < 1 ? 1 : seconds > held ? held : seconds;
+    int64_t from = entries[(c->end - 1) % CLIP_ENTRIES].time - (int64_t)seconds * 1000000;
+    uint32_t cursor = tail;
+    while (cursor != c->end && entries[cursor % CLIP_ENTRIES].time < from)
+      cursor++;
+    c->cursor = cursor;
+    c->t0 = entries[cursor % CLIP_ENTRIES].time;
+  }
+
+  uint8_t hdr[256];
+  sensor_t *s = esp_camera_sensor_get();
+  size_t len = buildContainerHeader(hdr, resolution[s->status.framesize].width, resolution[s->status.framesize].height);
+
+  c->client.setTimeout(1);
+  c->client.write(CLIP_HEADER, strlen(CLIP_HEADER));
+  c->client.write(hdr, len);
+  c->client.clear();
+
+  xTaskNotifyGive(tClip);
+
+  Log.trace("ClipHandler: Sending %d entries (%d s)\n", c->end - c->cursor, seconds);
+}
+
+/**
+ * @brief Writes as much of a clip download as its socket accepts without blocking.
+ *
+ * @param c Download to service.
+ * @return 1 if any bytes were written, 0 if it is waiting on its socket, -1 once finished or disconnected.
+ */
+int serviceClipClient(ClipClient *c) {
+  int progress = 0;
+  for (;;) {
+    if (!c->busy) {
+      if (c->cursor == c->end)
+        return -1;
+      ClipEntry *e = &entries[c->cursor % CLIP_ENTRIES];
+      if (!e->ready.load(std::memory_order_acquire))
+        return progress;  // Still being copied in by a capture task
+
+      int64_t ms = (e->time - c->t0) / 1000;
+      c->hdrLen = muxBlockHeader(c->hdr, &c->clusterMs, ms < 0 ? 0 : ms, e->track, e->len);
+      c->body = arena + e->slab * CLIP_SLAB_BYTES;
+      c->bodyLen = e->len;
+      c->offset = 0;
+      c->busy = true;
+      c->stalling = false;
+    }
+
+    while (c->offset < c->hdrLen + c->bodyLen) {
+      const uint8_t *data;
+      size_t len;
+      if (c->offset < c->hdrLen) {
+        data = c->hdr + c->offset;
+        len = c->hdrLen - c->offset;
+      } else {
+        data = c->body + (c->offset - c->hdrLen);
+        len = c->bodyLen - (c->offset - c->hdrLen);
+      }
+
+      int w = netSend(c->client, data, len);
+      if (w < 0)
+        return -1;
+      if (w == 0) {
+        c->stalling = true;
+        return progress;
+      }
+      progress = 1;
+      c->offset += w;
+      c->stats.bytesSent += w;
+      bytesSent[EP_CLIP].inc(w);
+    }
+
+    // Moving the cursor releases the entry for eviction
+    c->busy = false;
+    c->cursor++;
+  }
+}
+
+/**
+ * @brief RTOS task: Streams /clip downloads out of the pre-event arena.
+ *
+ * @param pvParameters Unused (RTOS task parameter signature).
+ * @return Never returns; runs as a FreeRTOS task.
+ */
+void clipCB(void *pvParameters) {
+  for (;;) {
+    if (!clipClients.count()) {
+      // No downloads: sleep until the handler starts one
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+    bool progress = false;
+    fd_set writable;
+    int maxFd = -1;
+    FD_ZERO(&writable);
+
+    for (size_t i = 0; i < clipClients.capacity(); i++) {
+      ClipClient *c = clipClients.at(i);
+      if (c == NULL)
+        continue;
+
+      int r = c->client.connected() ? serviceClipClient(c) : -1;
+      if (r < 0) {
+        Log.trace("clipCB: Download %s after %d ms, %d bytes\n", c->cursor == c->end ? "finished" : "aborted",
+                  millis() - c->stats.connectedAt, (uint32_t)c->stats.bytesSent);
+        c->client.stop();
+        c->client = WiFiClient();
+        clipClients.release(c);
+        disconnects[EP_CLIP].inc();
+        continue;
+      }
+      progress |= r > 0;
+
+      if (c->stalling) {
+        int fd = c->client.fd();
+        FD_SET(fd, &writable);
+        if (fd > maxFd)
+          maxFd = fd;
+      }
+    }
+
+    if (!progress) {
+      if (maxFd >= 0) {
+        struct timeval tv = { 0, (long)BLOCK_US };
+        select(maxFd + 1, NULL, &writable, NULL, &tv);
+      } else {
+        // Waiting for a capture task to finish copying an entry in
+        vTaskDelay(1);
+      }
+    }
+  }
+}
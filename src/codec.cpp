@@ -0,0 +1,258 @@
+#include "codec.h"
+#include <Arduino.h>
+#include <math.h>
+
+#define RESAMPLE_STOPBAND_DB 60  // Attenuation of the resampling filter above the output Nyquist frequency
+#define RESAMPLE_PASSBAND    40  // Passband edge, percent of the output rate; the transition ends at 50
+
+static const int16_t adpcmSteps[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767
+};
+
+static const int8_t adpcmIndexShift[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/**
+ * @brief Encodes 16-bit PCM samples to 8-bit G.711 mu-law.
+ *
+ * @param in PCM samples.
+ * @param out Encoded bytes, one per sample.
+ * @param samples Number of samples.
+ * @return void
+ */
+void ulawEncode(const int16_t* in, uint8_t* out, size_t samples) {
+  const int BIAS = 0x84;
+  const int CLIP = 32635;
+  for (size_t i = 0; i < samples; i++) {
+    int pcm = in[i];
+    uint8_t sign = 0;
+    if (pcm < 0) {
+      pcm = -pcm;
+      sign = 0x80;
+    }
+    if (pcm > CLIP)
+      pcm = CLIP;
+    pcm += BIAS;
+
+    uint8_t exponent = 7;
+    for (int mask = 0x4000; (pcm & mask) == 0 && exponent > 0; mask >>= 1)
+      exponent--;
+    uint8_t mantissa = (pcm >> (exponent + 3)) & 0x0F;
+    out[i] = ~(sign | (exponent << 4) | mantissa);
+  }
+}
+
+/**
+ * @brief Encodes one mono IMA-ADPCM block as laid out in WAV files.
+ *
+ * The block starts with the first sample verbatim plus the step index, followed by
+ * the remaining samples as 4-bit codes, low nibble first. The step index carries
+ * over in state so consecutive blocks adapt smoothly.
+ *
+ * @param state Predictor state, updated for the next block.
+ * @param in PCM samples.
+ * @param out Encoded block of ADPCM_BLOCK_BYTES(samples) bytes.
+ * @param samples Number of samples in the block (odd).
+ * @return Number of bytes written.
+ */
+size_t adpcmEncodeBlock(AdpcmState* state, const int16_t* in, uint8_t* out, size_t samples) {
+  int predictor = in[0];
+  int index = state->index;
+
+  out[0] = predictor & 0xFF;
+  out[1] = (predictor >> 8) & 0xFF;
+  out[2] = index;
+  out[3] = 0;
+
+  uint8_t* p = out + 4;
+  for (size_t i = 1; i < samples; i++) {
+    int step = adpcmSteps[index];
+    int diff = in[i] - predictor;
+    uint8_t code = 0;
+    if (diff < 0) {
+      code = 8;
+      diff = -diff;
+    }
+
+    int delta = step >> 3;
+    if (diff >= step) {
+      code |= 4;
+      diff -= step;
+      delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+      code |= 2;
+      diff -= step;
+      delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+      code |= 1;
+      delta += step;
+    }
+
+    predictor += (code & 8) ? -delta : delta;
+    if (predictor > 32767)
+      predictor = 32767;
+    else if (predictor < -32768)
+      predictor = -32768;
+
+    index += adpcmIndexShift[code];
+    if (index < 0)
+      index = 0;
+    else if (index > 88)
+      index = 88;
+
+    if (i & 1)
+      *p = code;
+    else
+      *p++ |= code << 4;
+  }
+
+  state->predictor = predictor;
+  state->index = index;
+  return ADPCM_BLOCK_BYTES(samples);
+}
+
+/**
+ * @brief Converts 16-bit PCM samples to the unsigned 8-bit PCM of WAV files.
+ *
+ * @param in PCM samples.
+ * @param out Converted bytes, one per sample, 128 for silence.
+ * @param samples Number of samples.
+ * @return void
+ */
+void pcm8Encode(const int16_t* in, uint8_t* out, size_t samples) {
+  for (size_t i = 0; i < samples; i++) {
+    int v = (in[i] + 128) >> 8;
+    out[i] = (v > 127 ? 127 : v) + 128;
+  }
+}
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser window
+static float besselI0(float x) {
+  float sum = 1, term = 1;
+  for (int k = 1; k < 32 && term > 1e-8f * sum; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+/**
+ * @brief Designs the polyphase filter for one conversion and allocates its state in PSRAM.
+ *
+ * The prototype is a Kaiser-windowed sinc at up * inRate, with its transition band from
+ * RESAMPLE_PASSBAND percent of the output rate to the output Nyquist frequency and
+ * RESAMPLE_STOPBAND_DB of attenuation beyond. Each phase is normalized in Q15 to a DC
+ * gain of exactly one, which also keeps the 32-bit accumulator of resample() from
+ * overflowing: the absolute coefficients of a phase sum to well under 2.0.
+ *
+ * @param r Resampler to set up.
+ * @param inRate Input sample rate, Hz.
+ * @param outRate Output sample rate, Hz; must be below inRate.
+ * @param blockSamples Most input samples passed to one resample() call.
+ * @return true on success, false if the allocation failed.
+ */
+bool resamplerInit(Resampler* r, uint32_t inRate, uint32_t outRate, size_t blockSamples) {
+  uint32_t a = inRate, b = outRate;
+  while (b != 0) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  r->up = outRate / a;
+  r->down = inRate / a;
+
+  // Kaiser's estimate of the length needed for the transition band, at the input rate
+  float transition = (float)outRate * (50 - RESAMPLE_PASSBAND) / 100 / inRate;
+  r->taps = ceilf((RESAMPLE_STOPBAND_DB - 8) / (2.285f * 2 * M_PI * transition));
+  r->phase = 0;
+  r->next = 0;
+
+  size_t len = (size_t)r->up * r->taps;
+  r->coefs = (int16_t*)ps_malloc(len * sizeof(int16_t));
+  r->history = (int16_t*)ps_malloc((r->taps - 1 + blockSamples) * sizeof(int16_t));
+  float* proto = (float*)ps_malloc(len * sizeof(float));
+  if (r->coefs == NULL || r->history == NULL || proto == NULL) {
+    free(proto);
+    return false;
+  }
+  memset(r->history, 0, (r->taps - 1) * sizeof(int16_t));
+
+  // Cutoff in the middle of the transition band, relative to the prototype's rate
+  float cutoff = (float)outRate * (50 + RESAMPLE_PASSBAND) / 200 / ((float)inRate * r->up);
+  float beta = 0.1102f * (RESAMPLE_STOPBAND_DB - 8.7f);
+  float center = (len - 1) / 2.0f;
+  float norm = besselI0(beta);
+  for (size_t j = 0; j < len; j++) {
+    float t = j - center;
+    float x = 2 * M_PI * cutoff * t;
+    float sinc = t == 0 ? 1 : sinf(x) / x;
+    float w = 2 * t / (len - 1);
+    proto[j] = sinc * besselI0(beta * sqrtf(1 - w * w)) / norm;
+  }
+
+  // Phase p uses prototype taps p, p + up, p + 2 * up, ...
+  for (uint16_t p = 0; p < r->up; p++) {
+    float sum = 0;
+    for (uint16_t k = 0; k < r->taps; k++)
+      sum += proto[p + k * r->up];
+    int16_t* c = r->coefs + p * r->taps;
+    int32_t total = 0, largest = 0;
+    for (uint16_t k = 0; k < r->taps; k++) {
+      c[k] = lroundf(proto[p + k * r->up] / sum * 32768);
+      total += c[k];
+      if (c[k] > c[largest])
+        largest = k;
+    }
+    c[largest] += 32768 - total;
+  }
+  free(proto);
+  return true;
+}
+
+/**
+ * @brief Converts one block of samples, carrying the filter state over to the next block.
+ *
+ * @param r Resampler set up with resamplerInit().
+ * @param in Input samples; at most the blockSamples given to resamplerInit().
+ * @param samples Number of input samples.
+ * @param out Output samples; room for RESAMPLE_MAX_OUT(r, samples).
+ * @return Number of output samples written.
+ */
+size_t resample(Resampler* r, const int16_t* in, size_t samples, int16_t* out) {
+  // history[taps - 1 + i] is input sample i of this block, earlier indices the previous block's tail
+  int16_t* x = r->history + r->taps - 1;
+  memcpy(x, in, samples * sizeof(int16_t));
+
+  size_t n = 0;
+  uint32_t i = r->next;
+  uint16_t phase = r->phase;
+  while (i < samples) {
+    const int16_t* c = r->coefs + phase * r->taps;
+    const int16_t* s = x + i;
+    int32_t acc = 1 << 14;
+    for (uint16_t k = 0; k < r->taps; k++)
+      acc += c[k] * s[-k];
+    acc >>= 15;
+    out[n++] = acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
+
+    phase += r->down;
+    i += phase / r->up;
+    phase %= r->up;
+  }
+  r->next = i - samples;
+  r->phase = phase;
+
+  memmove(r->history, r->history + samples, (r->taps - 1) * sizeof(int16_t));
+  return n;
+}
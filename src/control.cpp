@@ -0,0 +1,353 @@
+#include "globals.h"
+#include "control.h"
+#include "camera_pins.h"
+#include "frame.h"
+#include "quality.h"
+#include "metrics.h"
+#include "mux.h"
+#include <Preferences.h>
+#include "esp_camera.h"
+
+#define SETTINGS_NAMESPACE "camera"
+
+// Frame sizes /control accepts, by the name of their framesize_t
+struct FrameSizeName {
+  const char* name;
+  framesize_t size;
+};
+
+const FrameSizeName FRAME_SIZE_NAMES[] = {
+  { "QQVGA", FRAMESIZE_QQVGA }, { "QVGA", FRAMESIZE_QVGA }, { "CIF", FRAMESIZE_CIF },
+  { "VGA", FRAMESIZE_VGA },     { "SVGA", FRAMESIZE_SVGA }, { "XGA", FRAMESIZE_XGA },
+  { "HD", FRAMESIZE_HD },       { "SXGA", FRAMESIZE_SXGA }, { "UXGA", FRAMESIZE_UXGA },
+};
+const size_t FRAME_SIZE_COUNT = sizeof(FRAME_SIZE_NAMES) / sizeof(FRAME_SIZE_NAMES[0]);
+
+CameraSettings settings = { FRAME_SIZE, JPEG_QUALITY, FPS, XCLK_FREQ };
+
+// A change handed from ControlHandler to the camera task, which owns the sensor
+CameraSettings pendingSettings;
+bool pendingReinit;
+bool pendingApplied;
+std::atomic<bool> controlRequested(false);
+SemaphoreHandle_t controlDone = NULL;
+
+/**
+ * @brief Looks a frame size up by name.
+ *
+ * @param name Frame size name, e.g. "VGA" or "HD" (case-insensitive).
+ * @return The framesize_t, or -1 if the name is not supported.
+ */
+static int frameSizeByName(const String& name) {
+  for (size_t i = 0; i < FRAME_SIZE_COUNT; i++) {
+    if (name.equalsIgnoreCase(FRAME_SIZE_NAMES[i].name))
+      return FRAME_SIZE_NAMES[i].size;
+  }
+  return -1;
+}
+
+/**
+ * @brief Returns the name of a frame size.
+ *
+ * @param size framesize_t value.
+ * @return Its name, or "?" if /control does not support it.
+ */
+static const char* frameSizeName(int size) {
+  for (size_t i = 0; i < FRAME_SIZE_COUNT; i++) {
+    if (FRAME_SIZE_NAMES[i].size == size)
+      return FRAME_SIZE_NAMES[i].name;
+  }
+  return "?";
+}
+
+/**
+ * @brief Checks that every field of a settings record is within the supported range.
+ *
+ * @param s Settings to check.
+ * @return true if the sensor can be configured with them.
+ */
+static bool settingsValid(const CameraSettings& s) {
+  return strcmp(frameSizeName(s.frameSize), "?") != 0 &&
+         s.quality >= 4 && s.quality <= QUALITY_WORST &&
+         s.fps >= 1 && s.fps <= CONTROL_FPS_MAX &&
+         s.xclk >= CONTROL_XCLK_MIN && s.xclk <= CONTROL_XCLK_MAX;
+}
+
+/**
+ * @brief Loads the settings saved by /control, falling back to the build flags.
+ *
+ * A saved record that is incomplete or out of range is ignored as a whole.
+ *
+ * @return void
+ * @note Call before cameraBegin().
+ */
+void settingsLoad() {
+  Preferences prefs;
+  if (!prefs.begin(SETTINGS_NAMESPACE, true))
+    return;
+  CameraSettings saved;
+  saved.frameSize = prefs.getInt("framesize", FRAME_SIZE);
+  saved.quality = prefs.getInt("quality", JPEG_QUALITY);
+  saved.fps = prefs.getInt("fps", FPS);
+  saved.xclk = prefs.getUInt("xclk", XCLK_FREQ);
+  prefs.end();
+
+  if (!settingsValid(saved)) {
+    Log.error("settingsLoad: Ignoring invalid saved settings\n");
+    return;
+  }
+  settings = saved;
+  Log.trace("settingsLoad: framesize=%s quality=%d fps=%d xclk=%u\n",
+            frameSizeName(settings.frameSize), settings.quality, settings.fps, settings.xclk);
+}
+
+/**
+ * @brief Stores the current settings in NVS.
+ *
+ * @return void
+ */
+static void settingsSave() {
+  Preferences prefs;
+  if (!prefs.begin(SETTINGS_NAMESPACE, false)) {
+    Log.error("settingsSave: NVS unavailable, settings not persisted\n");
+    return;
+  }
+  prefs.putInt("framesize", settings.frameSize);
+  prefs.putInt("quality", settings.quality);
+  prefs.putInt("fps", settings.fps);
+  prefs.putUInt("xclk", settings.xclk);
+  prefs.end();
+}
+
+/**
+ * @brief Forgets the saved settings and returns to the build flags.
+ *
+ * Used when the saved settings keep the camera from starting, so a bad /control
+ * request cannot leave the board in a restart loop.
+ *
+ * @return void
+ */
+void settingsReset() {
+  Preferences prefs;
+  if (prefs.begin(SETTINGS_NAMESPACE, false)) {
+    prefs.clear();
+    prefs.end();
+  }
+  settings = { FRAME_SIZE, JPEG_QUALITY, FPS, XCLK_FREQ };
+}
+
+/**
+ * @brief Returns the camera settings in effect.
+ *
+ * @return Current settings.
+ */
+const CameraSettings& cameraSettings() {
+  return settings;
+}
+
+/**
+ * @brief Initializes the camera driver, sensor and frame pool from the current settings.
+ *
+ * @return true on success; false if the driver could not be started.
+ * @note Called from setup(), and from the camera task after esp_camera_deinit().
+ */
+bool cameraBegin() {
+  camera_config_t config = {
+    .pin_pwdn       = PWDN_GPIO_NUM,
+    .pin_reset      = RESET_GPIO_NUM,
+    .pin_xclk       = XCLK_GPIO_NUM,
+    .pin_sscb_sda   = SIOD_GPIO_NUM,
+    .pin_sscb_scl   = SIOC_GPIO_NUM,
+    .pin_d7         = Y9_GPIO_NUM,
+    .pin_d6         = Y8_GPIO_NUM,
+    .pin_d5         = Y7_GPIO_NUM,
+    .pin_d4         = Y6_GPIO_NUM,
+    .pin_d3         = Y5_GPIO_NUM,
+    .pin_d2         = Y4_GPIO_NUM,
+    .pin_d1         = Y3_GPIO_NUM,
+    .pin_d0         = Y2_GPIO_NUM,
+    .pin_vsync      = VSYNC_GPIO_NUM,
+    .pin_href       = HREF_GPIO_NUM,
+    .pin_pclk       = PCLK_GPIO_NUM,
+    .xclk_freq_hz   = (int)settings.xclk,
+    .ledc_timer     = LEDC_TIMER_0,
+    .ledc_channel   = LEDC_CHANNEL_0,
+    .pixel_format   = PIXFORMAT_JPEG,
+    .frame_size     = (framesize_t)settings.frameSize,
+    .jpeg_quality   = settings.quality,
+    .fb_count       = FB_COUNT,
+    .fb_location    = CAMERA_FB_IN_PSRAM,
+    .grab_mode      = CAMERA_GRAB_LATEST,
+  };
+
+  if (esp_camera_init(&config) != ESP_OK)
+    return false;
+
+  // Size the frame pool like the driver sizes its JPEG buffers
+  framePoolSetup(resolution[settings.frameSize].width * resolution[settings.frameSize].height / 5);
+
+  sensor_t* s = esp_camera_sensor_get();
+#if defined (FLIP_VERTICALLY)
+  // Flip image vertically if requested by build flag
+  s->set_vflip(s, true);
+#endif
+
+#if defined (WHITEBALANCE)
+  // Enable auto white balance if requested by build flag
+  s->set_wb_mode(s, WHITEBALANCE);
+#endif
+  return true;
+}
+
+/**
+ * @brief Restarts the camera with new settings once every published frame is released.
+ *
+ * Publishing stops first, so clients finish the frame they are sending and then wait;
+ * their connections stay open and pick up the new resolution with the next frame.
+ * /av clients are closed on a resolution change, since their Matroska header fixes it.
+ * Driver buffers cannot be freed while a client still pins one, so a client that does
+ * not finish within CONTROL_DRAIN_MS fails the change instead.
+ *
+ * @param next Settings to start the camera with.
+ * @return true if the camera runs with the new settings.
+ */
+static bool reconfigure(const CameraSettings& next) {
+  uint32_t start = millis();
+  for (;;) {
+    // Retract every round: the scale task may still hand out the frame it was rendering
+    frameRetract();
+    if (frameDrained())
+      break;
+    if (millis() - start > CONTROL_DRAIN_MS) {
+      Log.error("reconfigure: Clients still hold frames after %d ms, not restarting the camera\n", CONTROL_DRAIN_MS);
+      return false;
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+
+  esp_camera_deinit();
+  CameraSettings old = settings;
+  settings = next;
+  if (cameraBegin()) {
+    if (next.frameSize != old.frameSize)
+      muxCloseAll();
+    return true;
+  }
+
+  Log.error("reconfigure: Camera init failed with framesize=%s xclk=%u, restoring previous settings\n",
+            frameSizeName(next.frameSize), next.xclk);
+  settings = old;
+  esp_camera_deinit();
+  if (!cameraBegin()) {
+    Log.fatal("reconfigure: Error re-initializing the camera\n");
+    delay(10000);
+    ESP.restart();
+  }
+  return false;
+}
+
+/**
+ * @brief Applies a change requested through /control.
+ *
+ * Frame rate and quality change in place. Resolution and XCLK changes restart the
+ * camera driver and the frame pool (see reconfigure()). The quality controller
+ * restarts from the new best quality either way.
+ *
+ * @return void
+ * @note Only called from the camera task, between captures, so the sensor has one owner.
+ */
+void controlPoll() {
+  if (!controlRequested.load(std::memory_order_acquire))
+    return;
+  controlRequested.store(false, std::memory_order_relaxed);
+
+  if (pendingReinit) {
+    pendingApplied = reconfigure(pendingSettings);
+  } else {
+    settings.fps = pendingSettings.fps;
+    settings.quality = pendingSettings.quality;
+    pendingApplied = true;
+  }
+  qualityReset();
+  xSemaphoreGive(controlDone);
+}
+
+/**
+ * @brief Reads or changes the camera settings at run time.
+ *
+ * Accepts `framesize=` (QQVGA, QVGA, CIF, VGA, SVGA, XGA, HD, SXGA or UXGA), `quality=`
+ * (4..QUALITY_WORST, the best quality the controller may use), `fps=`
+ * (1..CONTROL_FPS_MAX) and `xclk=` (Hz). Changes are applied by the camera task and saved
+ * in NVS once they took effect. The response reports whether the request changed
+ * anything, the settings in effect and the average frame size; after a change it also
+ * reports whether it was applied and the capture rate measured over the following
+ * CONTROL_MEASURE_MS. It is sent with 503 if a resolution or XCLK change could not be
+ * applied.
+ *
+ * @return void
+ * @note A change blocks the HTTP loop for the measurement window, and for a sensor restart;
+ *       a request that changes nothing returns at once.
+ */
+void ControlHandler(void) {
+  CameraSettings next = settings;
+  if (server.hasArg("framesize"))
+    next.frameSize = frameSizeByName(server.arg("framesize"));
+  if (server.hasArg("quality"))
+    next.quality = server.arg("quality").toInt();
+  if (server.hasArg("fps"))
+    next.fps = server.arg("fps").toInt();
+  if (server.hasArg("xclk"))
+    next.xclk = strtoul(server.arg("xclk").c_str(), NULL, 10);
+
+  if (!settingsValid(next)) {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "Invalid settings, use framesize=QQVGA..UXGA, quality=4..%d, fps=1..%d, xclk=%d..%d",
+             QUALITY_WORST, CONTROL_FPS_MAX, CONTROL_XCLK_MIN, CONTROL_XCLK_MAX);
+    server.send(400, "text/plain", buf);
+    return;
+  }
+
+  if (controlDone == NULL)
+    controlDone = xSemaphoreCreateBinary();
+
+  bool applied = true;
+  bool changed = memcmp(&next, &settings, sizeof(next)) != 0;
+  char outcome[48] = "";
+  if (changed) {
+    // Keep the camera running for the change and the measurement
+    frameSubscribe();
+    pendingSettings = next;
+    pendingReinit = next.frameSize != settings.frameSize || next.xclk != settings.xclk;
+    xSemaphoreTake(controlDone, 0);
+    controlRequested.store(true, std::memory_order_release);
+    bool done = xSemaphoreTake(controlDone, pdMS_TO_TICKS(CONTROL_DRAIN_MS + 5000)) == pdTRUE;
+    if (!done) {
+      // Withdraw the request unless the camera task already took it; then its outcome is what counts
+      bool requested = true;
+      if (!controlRequested.compare_exchange_strong(requested, false))
+        done = xSemaphoreTake(controlDone, portMAX_DELAY) == pdTRUE;
+    }
+    applied = done && pendingApplied;
+    if (applied)
+      settingsSave();
+    Log.notice("ControlHandler: framesize=%s quality=%d fps=%d xclk=%u %s\n", frameSizeName(next.frameSize),
+               next.quality, next.fps, next.xclk, applied ? "applied" : "failed");
+
+    uint32_t captured = framesCaptured.value();
+    uint32_t start = millis();
+    vTaskDelay(pdMS_TO_TICKS(CONTROL_MEASURE_MS));
+    uint32_t elapsed = millis() - start;
+    float fps = (framesCaptured.value() - captured) * 1000.0f / (elapsed ? elapsed : 1);
+    frameUnsubscribe();
+    snprintf(outcome, sizeof(outcome), "\"applied\":%s,\"measuredFps\":%.1f,", applied ? "true" : "false", fps);
+  }
+
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "{\"changed\":%s,%s\"framesize\":\"%s\",\"width\":%u,\"height\":%u,\"quality\":%d,\"fps\":%d,"
+           "\"xclk\":%u,\"frameBytes\":%u}",
+           changed ? "true" : "false", outcome, frameSizeName(settings.frameSize), resolution[settings.frameSize].width,
+           resolution[settings.frameSize].height, settings.quality, settings.fps, settings.xclk,
+           qualityState().frameBytes);
+  server.send(applied ? 200 : 503, "application/json", buf);
+}
@@ -0,0 +1,316 @@
+#include "globals.h"
+#include "frame.h"
+#include "metrics.h"
+
+// One handle per driver buffer and pool slab: a buffer can never be referenced twice
+Frame frames[FRAME_HANDLES];
+std::atomic<Frame*> camFrame(NULL);   // Latest published frame
+std::atomic<Frame*> scaledFrame(NULL); // Latest frame whose substreams the scale task rendered
+uint32_t frameSeq = 0;
+std::atomic<int> frameConsumers(0);   // Clients of any endpoint that need live frames
+std::atomic<int> driverHeld(0);       // Driver buffers currently wrapped in a handle
+
+// Fixed pool of frame-sized slabs in one PSRAM allocation, made once at startup
+uint8_t* poolMem = NULL;
+camera_fb_t poolFbs[FRAME_POOL_SLABS];  // Descriptor of the frame copied into each slab
+int8_t poolFree[FRAME_POOL_SLABS];      // Stack of free slab indices
+size_t poolTop = 0;
+FramePoolStats pool;
+portMUX_TYPE poolLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Allocates the frame pool once, so the capture path never allocates.
+ *
+ * Called again when the resolution changes, to replace the pool with one sized for
+ * the new frames; every slab must be free by then (see frameDrained()). The substream
+ * buffers of the frame handles are sized along with it (see scaleSetup()).
+ *
+ * @param slabBytes Size of each slab; frames larger than this are never copied.
+ * @return void
+ */
+void framePoolSetup(size_t slabBytes) {
+  free(poolMem);
+  poolTop = 0;
+  pool.slabs = 0;
+  pool.slabBytes = 0;
+  scaleSetup(frames, FRAME_HANDLES, slabBytes);
+  poolMem = (uint8_t*)ps_malloc(FRAME_POOL_SLABS * slabBytes);
+  if (poolMem == NULL) {
+    Log.error("framePoolSetup: Allocation of %d x %d bytes failed\n", FRAME_POOL_SLABS, slabBytes);
+    return;
+  }
+  for (int i = 0; i < FRAME_POOL_SLABS; i++)
+    poolFree[i] = FRAME_POOL_SLABS - 1 - i;
+  poolTop = FRAME_POOL_SLABS;
+  pool.slabs = FRAME_POOL_SLABS;
+  pool.slabBytes = slabBytes;
+}
+
+// Pops a free slab index in O(1), or returns -1 when all are in use; counts either outcome
+static int poolAcquire() {
+  int slab = -1;
+  taskENTER_CRITICAL(&poolLock);
+  if (poolTop > 0) {
+    slab = poolFree[--poolTop];
+    pool.inUse++;
+    pool.copies++;
+    if (pool.inUse > pool.highWater)
+      pool.highWater = pool.inUse;
+  } else {
+    pool.exhausted++;
+  }
+  taskEXIT_CRITICAL(&poolLock);
+  return slab;
+}
+
+// Pushes a slab back onto the free stack in O(1)
+static void poolRelease(int slab) {
+  taskENTER_CRITICAL(&poolLock);
+  poolFree[poolTop++] = slab;
+  pool.inUse--;
+  taskEXIT_CRITICAL(&poolLock);
+}
+
+/**
+ * @brief Returns the frame pool's occupancy and counters.
+ *
+ * @return Snapshot of the pool statistics.
+ */
+FramePoolStats framePoolStats() {
+  taskENTER_CRITICAL(&poolLock);
+  FramePoolStats s = pool;
+  taskEXIT_CRITICAL(&poolLock);
+  return s;
+}
+
+/**
+ * @brief Wraps a driver frame buffer in a handle and publishes it as the latest frame.
+ *
+ * The publisher keeps one reference on the latest frame; it is dropped when the
+ * next frame replaces it, so the driver buffer is only returned once every client
+ * sending it has released it as well.
+ *
+ * When slow clients pin so many driver buffers that publishing this one would leave
+ * the driver none to capture into, the frame is copied into a pool slab and its driver
+ * buffer returned at once. A frame too large for a slab is dropped in that case; it is
+ * never reallocated. So is a frame arriving while every slab is taken: the previous one
+ * stays published and capture keeps its last buffer.
+ *
+ * The multipart part header every MJPEG client sends ahead of the frame is built here,
+ * once. Downscaled substreams are rendered later, off the capture path, by the scale
+ * task (see scaleCB()).
+ *
+ * @param fb Frame buffer obtained from esp_camera_fb_get(); owned by this call afterwards.
+ * @param motion Motion score of the frame (see motionScore()).
+ * @return The published handle, or NULL if the frame was dropped (fb is returned to the driver).
+ * @note Only called from the camera task.
+ */
+Frame* framePublish(camera_fb_t* fb, uint16_t motion) {
+  Frame* frame = NULL;
+  for (int i = 0; i < FRAME_HANDLES; i++) {
+    if (frames[i].refs.load() == 0) {
+      frame = &frames[i];
+      break;
+    }
+  }
+  if (frame == NULL) {
+    Log.error("framePublish: No free frame handle\n");
+    esp_camera_fb_return(fb);
+    return NULL;
+  }
+
+  frame->slab = -1;
+  if (driverHeld.load() >= FB_COUNT - 1 && poolMem != NULL) {
+    if (fb->len > pool.slabBytes) {
+      taskENTER_CRITICAL(&poolLock);
+      pool.oversize++;
+      taskEXIT_CRITICAL(&poolLock);
+      Log.error("framePublish: Dropping %d byte frame, larger than a pool slab\n", fb->len);
+      esp_camera_fb_return(fb);
+      return NULL;
+    }
+    int slab = poolAcquire();
+    if (slab >= 0) {
+      camera_fb_t* copy = &poolFbs[slab];
+      *copy = *fb;
+      copy->buf = poolMem + slab * pool.slabBytes;
+      memcpy(copy->buf, fb->buf, fb->len);
+      esp_camera_fb_return(fb);
+      fb = copy;
+      frame->slab = slab;
+    } else {
+      // Keeping it would pin the driver's last buffer and stall capture until a client lets go
+      esp_camera_fb_return(fb);
+      return NULL;
+    }
+  }
+  if (frame->slab < 0)
+    driverHeld++;
+
+  // The handle is unreferenced, so no reader can see these writes until refs is set
+  frame->fb = fb;
+  frame->seq = ++frameSeq;
+  frame->motion = motion;
+  frame->headLen = mjpegPartHeader(frame->head, fb->len, motion);
+  frame->scaledMask.store(0, std::memory_order_relaxed);
+  frame->refs.store(1, std::memory_order_release);
+
+  Frame* old = camFrame.exchange(frame, std::memory_order_acq_rel);
+  if (old != NULL) {
+    frameRelease(old);
+  }
+  return frame;
+}
+
+/**
+ * @brief Hands a frame whose substreams were rendered to the ?scale= clients.
+ *
+ * Like the latest published frame, the latest rendered one is held by a reference of
+ * its own until the next one replaces it.
+ *
+ * @param frame Pinned frame with its subscribed scales rendered, or NULL to release the held one.
+ * @return void
+ * @note Only called from the scale task.
+ */
+void framePublishScaled(Frame* frame) {
+  if (frame != NULL)
+    frame->refs.fetch_add(1, std::memory_order_relaxed);
+  Frame* old = scaledFrame.exchange(frame, std::memory_order_acq_rel);
+  if (old != NULL)
+    frameRelease(old);
+}
+
+/**
+ * @brief Withdraws the latest published and rendered frames, so no client can pick them up any more.
+ *
+ * @return void
+ * @note Only called from the camera task, which publishes the next frame as usual.
+ */
+void frameRetract() {
+  Frame* old = camFrame.exchange(NULL, std::memory_order_acq_rel);
+  if (old != NULL)
+    frameRelease(old);
+  old = scaledFrame.exchange(NULL, std::memory_order_acq_rel);
+  if (old != NULL)
+    frameRelease(old);
+}
+
+/**
+ * @brief Reports whether every driver buffer and pool slab has been handed back.
+ *
+ * @return true once no frame is referenced anywhere.
+ */
+bool frameDrained() {
+  return driverHeld.load() == 0 && framePoolStats().inUse == 0;
+}
+
+/**
+ * @brief Takes a reference on the frame held by a publishing slot without locking.
+ *
+ * The reference count is only incremented while it is non-zero, so a handle that was
+ * released in the meantime is never revived; the read is retried on the new latest
+ * frame instead. A handle recycled for a newer frame between the two steps is fine to
+ * return: the producer fills a handle completely before its count becomes non-zero.
+ *
+ * @param slot camFrame or scaledFrame.
+ * @return The frame in the slot, or NULL if it is empty.
+ */
+static Frame* acquireFrom(std::atomic<Frame*>& slot) {
+  for (;;) {
+    Frame* frame = slot.load(std::memory_order_acquire);
+    if (frame == NULL)
+      return NULL;
+    uint32_t refs = frame->refs.load(std::memory_order_relaxed);
+    while (refs != 0 && !frame->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+    }
+    if (refs != 0)
+      return frame;
+    frameRetries.inc();
+  }
+}
+
+/**
+ * @brief Takes a reference on the latest published frame without locking (see acquireFrom()).
+ *
+ * @return The latest frame, or NULL if nothing has been published yet.
+ * @note Every non-NULL result must be handed back with frameRelease().
+ */
+Frame* frameAcquire() {
+  return acquireFrom(camFrame);
+}
+
+/**
+ * @brief Takes a reference on the latest frame the scale task rendered substreams for.
+ *
+ * The handle may have been recycled for a newer frame that is not rendered yet, so
+ * check scaledMask before using one of its scaled[] copies.
+ *
+ * @return The latest rendered frame, or NULL if there is none.
+ * @note Every non-NULL result must be handed back with frameRelease().
+ */
+Frame* frameAcquireScaled() {
+  return acquireFrom(scaledFrame);
+}
+
+/**
+ * @brief Drops a reference on a frame, returning its buffer on the last one.
+ *
+ * @param frame Handle obtained from frameAcquire() or framePublish().
+ * @return void
+ */
+void frameRelease(Frame* frame) {
+  camera_fb_t* fb = frame->fb;
+  int slab = frame->slab;
+  if (frame->refs.fetch_sub(1) == 1) {
+    if (slab >= 0) {
+      poolRelease(slab);
+    } else {
+      esp_camera_fb_return(fb);
+      driverHeld--;
+    }
+  }
+}
+
+/**
+ * @brief Returns the capture time of a frame on the esp_timer clock.
+ *
+ * @param frame Pinned frame.
+ * @return Capture time in microseconds since boot, comparable with esp_timer_get_time().
+ */
+int64_t frameTime(const Frame* frame) {
+  return (int64_t)frame->fb->timestamp.tv_sec * 1000000LL + frame->fb->timestamp.tv_usec;
+}
+
+/**
+ * @brief Registers a consumer of live frames and wakes capture if it was idle.
+ *
+ * The count is raised before the notification, so the camera task cannot miss it
+ * between checking for consumers and going to sleep.
+ *
+ * @return void
+ */
+void frameSubscribe() {
+  frameConsumers++;
+  xTaskNotifyGive(tCam);
+}
+
+/**
+ * @brief Drops a consumer of live frames.
+ *
+ * The camera task waits for a notification once none are left. With CLIP_ARENA_KB set, the
+ * clip arena is a consumer for good, so capture never stops (see clipSetup()).
+ *
+ * @return void
+ */
+void frameUnsubscribe() {
+  frameConsumers--;
+}
+
+/**
+ * @brief Reports whether any endpoint currently needs live frames.
+ *
+ * @return true while at least one consumer is registered.
+ */
+bool frameSubscribed() {
+  return frameConsumers.load() > 0;
+}
@@ -0,0 +1,400 @@
+#include "globals.h"
+#include "http.h"
+#include <lwip/sockets.h>
+
+#define HTTP_TIMEOUT_MS 5000  // Drop connections that have not sent a complete request by then
+#define HTTP_BACKLOG    8
+
+/**
+ * @brief Returns the reason phrase for the status codes this server emits.
+ *
+ * @param code HTTP status code.
+ * @return Reason phrase.
+ */
+static const char* reasonPhrase(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default:  return "";
+  }
+}
+
+/**
+ * @brief Answers a connection with a bodyless status response and closes it.
+ *
+ * Used before a request has been dispatched, when there is no WiFiClient yet.
+ *
+ * @param fd Socket to answer.
+ * @param code HTTP status code.
+ * @return void
+ */
+static void reject(int fd, int code) {
+  char buf[96];
+  int len = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", code, reasonPhrase(code));
+  send(fd, buf, len, MSG_DONTWAIT);
+  close(fd);
+}
+
+/**
+ * @brief Decodes a URL-encoded query component in place.
+ *
+ * @param s NUL-terminated string to decode.
+ * @return void
+ */
+static void urlDecode(char* s) {
+  char* out = s;
+  for (; *s; s++) {
+    if (*s == '+') {
+      *out++ = ' ';
+    } else if (*s == '%' && isxdigit((unsigned char)s[1]) && isxdigit((unsigned char)s[2])) {
+      char hex[3] = { s[1], s[2], 0 };
+      *out++ = (char)strtol(hex, NULL, 16);
+      s += 2;
+    } else {
+      *out++ = *s;
+    }
+  }
+  *out = 0;
+}
+
+HttpServer::HttpServer(uint16_t port)
+  : _port(port), _listenFd(-1), _routeCount(0), _notFound(NULL),
+    _method(HTTP_ANY), _path(""), _argCount(0), _headerCount(0) {
+  for (int i = 0; i < HTTP_PENDING; i++)
+    _pending[i].fd = -1;
+}
+
+/**
+ * @brief Registers a handler for an exact path.
+ *
+ * @param uri Path to match, without query string.
+ * @param method Method to match, or HTTP_ANY.
+ * @param handler Function called with the request available through this server.
+ * @return void
+ */
+void HttpServer::on(const char* uri, HTTPMethod method, THandlerFunction handler) {
+  if (_routeCount == HTTP_ROUTES) {
+    Log.error("HttpServer: Route table full, %s not registered\n", uri);
+    return;
+  }
+  _routes[_routeCount++] = { uri, method, handler };
+}
+
+/**
+ * @brief Registers the handler for requests no route matches.
+ *
+ * @param handler Function called for unmatched requests.
+ * @return void
+ */
+void HttpServer::onNotFound(THandlerFunction handler) {
+  _notFound = handler;
+}
+
+/**
+ * @brief Opens the non-blocking listening socket.
+ *
+ * @return void
+ */
+void HttpServer::begin() {
+  _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_listenFd < 0) {
+    Log.fatal("HttpServer: socket failed\n");
+    return;
+  }
+
+  int yes = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(_port);
+  if (bind(_listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listenFd, HTTP_BACKLOG) < 0) {
+    Log.fatal("HttpServer: bind/listen on port %d failed\n", _port);
+    close(_listenFd);
+    _listenFd = -1;
+    return;
+  }
+  fcntl(_listenFd, F_SETFL, fcntl(_listenFd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/**
+ * @brief Waits for network activity and serves whatever became ready.
+ *
+ * Blocks in select() on the listening socket and every connection whose request is
+ * still arriving, so a request is dispatched as soon as its headers are complete and
+ * an idle server does not wake up at all. Stale connections are dropped after
+ * HTTP_TIMEOUT_MS.
+ *
+ * @return void
+ */
+void HttpServer::handleClient() {
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(_listenFd, &readable);
+  int maxFd = _listenFd;
+  bool pending = false;
+
+  for (int i = 0; i < HTTP_PENDING; i++) {
+    if (_pending[i].fd >= 0) {
+      FD_SET(_pending[i].fd, &readable);
+      if (_pending[i].fd > maxFd)
+        maxFd = _pending[i].fd;
+      pending = true;
+    }
+  }
+
+  // Only wake up on a timer while there are connections to expire
+  struct timeval tv = { HTTP_TIMEOUT_MS / 1000, 0 };
+  if (select(maxFd + 1, &readable, NULL, NULL, pending ? &tv : NULL) < 0) {
+    Log.error("HttpServer: select failed: %d\n", errno);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    return;
+  }
+
+  for (int i = 0; i < HTTP_PENDING; i++) {
+    Pending* p = &_pending[i];
+    if (p->fd < 0)
+      continue;
+    if (FD_ISSET(p->fd, &readable))
+      receive(p);
+    else if (millis() - p->since > HTTP_TIMEOUT_MS)
+      drop(p);
+  }
+
+  if (FD_ISSET(_listenFd, &readable))
+    accept();
+}
+
+/**
+ * @brief Accepts every queued connection into a free pending slot.
+ *
+ * @return void
+ * @note Connections beyond HTTP_PENDING get a 503 straight away.
+ */
+void HttpServer::accept() {
+  for (;;) {
+    int fd = ::accept(_listenFd, NULL, NULL);
+    if (fd < 0)
+      return;
+
+    Pending* p = NULL;
+    for (int i = 0; i < HTTP_PENDING && p == NULL; i++) {
+      if (_pending[i].fd < 0)
+        p = &_pending[i];
+    }
+    if (p == NULL) {
+      Log.error("HttpServer: Too many pending requests\n");
+      reject(fd, 503);
+      continue;
+    }
+
+    p->fd = fd;
+    p->len = 0;
+    p->since = millis();
+#if defined(BENCHMARK)
+    p->acceptedUs = micros();
+#endif
+  }
+}
+
+/**
+ * @brief Reads available request bytes and dispatches once the headers are complete.
+ *
+ * @param p Pending connection that select() reported readable.
+ * @return void
+ */
+void HttpServer::receive(Pending* p) {
+  int r = recv(p->fd, p->buf + p->len, HTTP_REQUEST_MAX - 1 - p->len, MSG_DONTWAIT);
+  if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
+  if (r <= 0) {
+    drop(p);
+    return;
+  }
+
+  p->len += r;
+  p->buf[p->len] = 0;
+  if (strstr(p->buf, "\r\n\r\n") != NULL) {
+    dispatch(p);
+  } else if (p->len == HTTP_REQUEST_MAX - 1) {
+    reject(p->fd, 431);
+    p->fd = -1;
+  }
+}
+
+/**
+ * @brief Splits the request line, query string and headers in place.
+ *
+ * @param p Pending connection holding a complete request head.
+ * @return true if the request line is well formed.
+ */
+bool HttpServer::parse(Pending* p) {
+  _argCount = 0;
+  _headerCount = 0;
+
+  char* line = p->buf;
+  char* end = strstr(line, "\r\n");
+  *end = 0;
+
+  char* uri = strchr(line, ' ');
+  if (uri == NULL)
+    return false;
+  *uri++ = 0;
+  char* version = strchr(uri, ' ');
+  if (version == NULL)
+    return false;
+  *version = 0;
+
+  _method = strcmp(line, "GET") == 0 ? HTTP_GET : strcmp(line, "POST") == 0 ? HTTP_POST : HTTP_ANY;
+
+  char* query = strchr(uri, '?');
+  if (query != NULL) {
+    *query++ = 0;
+    char* save;
+    for (char* pair = strtok_r(query, "&", &save); pair != NULL && _argCount < HTTP_ARGS; pair = strtok_r(NULL, "&", &save)) {
+      char* value = strchr(pair, '=');
+      if (value != NULL)
+        *value++ = 0;
+      else
+        value = pair + strlen(pair);
+      urlDecode(pair);
+      urlDecode(value);
+      _args[_argCount++] = { pair, value };
+    }
+  }
+  urlDecode(uri);
+  _path = uri;
+
+  for (char* h = end + 2; *h && strncmp(h, "\r\n", 2) != 0; h = end + 2) {
+    end = strstr(h, "\r\n");
+    *end = 0;
+    char* value = strchr(h, ':');
+    if (value == NULL || _headerCount == HTTP_HEADERS)
+      continue;
+    *value++ = 0;
+    while (*value == ' ')
+      value++;
+    _headers[_headerCount++] = { h, value };
+  }
+  return true;
+}
+
+/**
+ * @brief Hands a complete request to its route handler.
+ *
+ * The socket is wrapped in client() for the handler. Handlers that stream keep a
+ * copy of it; otherwise the connection closes when the last reference is dropped.
+ *
+ * @param p Pending connection holding a complete request head.
+ * @return void
+ */
+void HttpServer::dispatch(Pending* p) {
+  int fd = p->fd;
+  p->fd = -1;
+
+  if (!parse(p)) {
+    reject(fd, 400);
+    return;
+  }
+
+  _client = WiFiClient(fd);
+
+  THandlerFunction handler = _notFound;
+  for (size_t i = 0; i < _routeCount; i++) {
+    if (strcmp(_routes[i].uri, _path) == 0 && (_routes[i].method == HTTP_ANY || _routes[i].method == _method)) {
+      handler = _routes[i].handler;
+      break;
+    }
+  }
+  if (handler != NULL)
+    handler();
+  else
+    send(404, "text/plain", "Not found");
+
+#if defined(BENCHMARK)
+  Log.verbose("HttpServer: %s served %d us after accept\n", _path, micros() - p->acceptedUs);
+#endif
+
+  _client = WiFiClient();
+  _path = "";
+}
+
+/**
+ * @brief Closes a pending connection that never completed its request.
+ *
+ * @param p Pending connection.
+ * @return void
+ */
+void HttpServer::drop(Pending* p) {
+  close(p->fd);
+  p->fd = -1;
+}
+
+String HttpServer::header(const char* name) {
+  for (size_t i = 0; i < _headerCount; i++) {
+    if (strcasecmp(_headers[i].name, name) == 0)
+      return String(_headers[i].value);
+  }
+  return String();
+}
+
+bool HttpServer::hasHeader(const char* name) {
+  for (size_t i = 0; i < _headerCount; i++) {
+    if (strcasecmp(_headers[i].name, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool HttpServer::hasArg(const char* name) {
+  for (size_t i = 0; i < _argCount; i++) {
+    if (strcmp(_args[i].name, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+String HttpServer::arg(const char* name) {
+  for (size_t i = 0; i < _argCount; i++) {
+    if (strcmp(_args[i].name, name) == 0)
+      return String(_args[i].value);
+  }
+  return String();
+}
+
+/**
+ * @brief Sends a complete response with a body to the current client.
+ *
+ * @param code HTTP status code.
+ * @param contentType Value of the Content-Type header.
+ * @param content Response body.
+ * @return void
+ */
+void HttpServer::send(int code, const char* contentType, const String& content) {
+  send(code, contentType, content.c_str(), content.length());
+}
+
+/**
+ * @brief Sends a complete response from a caller-owned buffer to the current client.
+ *
+ * @param code HTTP status code.
+ * @param contentType Value of the Content-Type header.
+ * @param content Response body.
+ * @param len Size of the body.
+ * @return void
+ */
+void HttpServer::send(int code, const char* contentType, const char* content, size_t len) {
+  _client.printf("HTTP/1.1 %d %s\r\n"
+                 "Content-Type: %s\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Connection: close\r\n"
+                 "\r\n",
+                 code, reasonPhrase(code), contentType, len);
+  _client.write(content, len);
+}
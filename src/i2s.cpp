@@ -1,12 +1,24 @@
 #include "globals.h"
 #include "stream.h"
+#include "i2s.h"
+#include "net.h"
+#include "codec.h"
+#include "clients.h"
+#include "clip.h"
+#include "metrics.h"
+#include "mux.h"
+#include "trace.h"
+#include "ws.h"
 #include <WiFi.h>
+#include <lwip/sockets.h>
 #include <ESP_I2S.h>
 #include <wav_header.h>
 
 #if defined(BENCHMARK)
 #include <AverageFilter.h>
 #define BENCHMARK_PRINT_INT 1000
+averageFilter<int32_t> readAvg(10);
+averageFilter<int32_t> encodeAvg(10);
 averageFilter<int32_t> streamAvg(10);
 uint32_t lastPrint = millis();
 #endif
@@ -15,36 +27,99 @@ uint32_t lastPrint = millis();
 #define PIN_I2S_WS       15   // I2S Word Select (LRCLK)
 #define PIN_I2S_SD       12   // I2S Serial Data (mic data out)
 
-#define SAMPLE_RATE_HZ 44100
 #define I2S_BIT_WIDTH I2S_DATA_BIT_WIDTH_16BIT
 #define I2S_SLOT I2S_STD_SLOT_LEFT
 
+#define BLOCK_MS          20   // Audio captured and sent per chunk (nominal)
+
 const uint16_t num_channels = 1; // mono
 const uint32_t sample_size = 0xFFFFFFFF; // live stream, so set max size since unknown
-const pcm_wav_header_t wav_header = PCM_WAV_HEADER_DEFAULT(sample_size, I2S_BIT_WIDTH, SAMPLE_RATE_HZ, num_channels); 
+const size_t BYTES_BUFFER = BLOCK_SAMPLES * (I2S_BIT_WIDTH / 8);
+
+// Codecs and output formats; resampled 16-bit rings precede the 8-bit rings derived from them
+enum AudioCodec { CODEC_PCM, CODEC_ULAW, CODEC_ADPCM, CODEC_PCM8, CODEC_PCM_16K, CODEC_PCM8_16K, CODEC_PCM_8K, CODEC_PCM8_8K, CODEC_COUNT };
+
+// Resampled output rates, one shared filter each
+enum { RESAMPLE_16K, RESAMPLE_8K, RESAMPLE_COUNT };
 
-TaskHandle_t tMic;
-QueueHandle_t i2sClients = xQueueCreate(5, sizeof(WiFiClient*));
+// One ring per codec and format. Each slot holds one block already framed as an HTTP
+// chunk: "<size>\r\n<data>\r\n". All rings share the capture counter audioHead, so
+// block n lives in slot n % AUDIO_RING_BLOCKS of every ring.
+struct AudioRing {
+  const char* name;
+  uint32_t rate;                  // Sample rate, Hz
+  uint16_t bits;                  // Bits per sample as announced in the WAV header
+  uint8_t* slots;
+  size_t stride;                  // Bytes per slot including chunk framing
+  size_t dataOffset;              // Offset of the encoded data inside a slot
+  size_t dataLen;                 // Encoded bytes per block; the most a block can take when resampled
+  size_t blockLen[AUDIO_RING_BLOCKS]; // Encoded bytes of the block in each slot
+  Resampler* resampler;           // Converts capture PCM to this ring's rate, or NULL
+  AudioRing* source;              // Ring whose samples are narrowed to 8 bits, or NULL for capture PCM
+  uint8_t wav[64];                // WAV header announcing this codec
+  size_t wavLen;
+  std::atomic<uint32_t> clients;  // Listeners on this ring or a ring derived from it; blocks are only encoded while non-zero
+};
+
+// Per-client read cursor into its codec's ring
+struct AudioClient {
+  WiFiClient client;
+  AudioRing* ring;
+  uint32_t cursor;    // Next block to send
+  size_t offset;      // Bytes of that block's slot already written
+  size_t slotLen;     // Bytes of that block's slot, fixed when its first byte is sent
+  bool stalling;      // Socket filled up at least once while sending the current block
+  uint32_t sent;      // Blocks sent completely
+  uint32_t overruns;  // Blocks lost because the client fell more than the ring depth behind
+  uint32_t underruns; // Blocks that could not be written in one go, starving the listener
+  uint32_t sendStart; // micros() when the current block's first byte was sent
+  ClientStats stats;
+};
+
+TaskHandle_t tMic;     // Capture task handle
+TaskHandle_t tAudio;   // Sender task handle
+ClientTable<AudioClient, MAX_CLIENTS> i2sClients;
 I2SClass i2s;
+AudioRing rings[CODEC_COUNT];
+Resampler resamplers[RESAMPLE_COUNT];
+std::atomic<uint32_t> audioHead;      // Number of blocks captured so far
+std::atomic<int> audioConsumers;      // /i2s clients plus other readers of the PCM ring; capture runs while non-zero
+int64_t blockTimes[AUDIO_RING_BLOCKS]; // Capture time (esp_timer, us) of the first sample of each block
+int64_t blockClock = -1;              // Capture time the sample clock gives the next block, -1 until the first
+
+void audioCB(void *pv);
 
+// Picks the ring for ?codec=, ?rate= and ?bits= (default 16-bit PCM at the capture rate)
 void I2SHandler() {
-  if ( !uxQueueSpacesAvailable(i2sClients) ) {
-    Serial.println("Max number of WiFi clients reached");
+  String codec = server.hasArg("codec") ? server.arg("codec") : String("pcm");
+  uint32_t rate = server.hasArg("rate") ? server.arg("rate").toInt() : SAMPLE_RATE_HZ;
+  AudioRing* ring = NULL;
+  for (int i = 0; i < CODEC_COUNT; i++) {
+    if ( codec == rings[i].name && rings[i].rate == rate &&
+         (!server.hasArg("bits") || server.arg("bits").toInt() == rings[i].bits) ) {
+      ring = &rings[i];
+      break;
+    }
+  }
+  if ( ring == NULL || ring->slots == NULL ) {
+    server.send(400, "text/plain", "Unsupported format, use codec=ulaw, codec=adpcm, or pcm with rate=44100, 16000 or 8000 and bits=16 or 8");
     return;
   }
 
-  // Create a new WiFi Client object for this connection
-  WiFiClient* client = new WiFiClient();
-  if ( client == NULL ) {
-    Serial.println("Can not create new WiFi client - OOM");
+  // Take a free slot for this connection
+  AudioClient* c = i2sClients.acquire();
+  if ( c == NULL ) {
+    Log.error("I2SHandler: Max number of WiFi clients reached\n");
+    server.send(503, "text/plain", "Too many audio clients");
     return;
   }
-  *client = server.client();
+  c->client = server.client();
+  c->ring = ring;
 
   // Send audio/wav chunked header to client
-  client->setTimeout(1);
-  client->setNoDelay(true);
-  client->print(
+  c->client.setTimeout(1);
+  c->client.setNoDelay(true);
+  c->client.print(
     "HTTP/1.1 200 OK\r\n"
     "Content-Type: audio/wav\r\n"
     "Accept-Ranges: none\r\n"
@@ -52,58 +127,373 @@ void I2SHandler() {
     "Connection: close\r\n"
     "\r\n"
   );
-  client->printf("%X\r\n", (unsigned)sizeof(wav_header));
-  client->write((const char*)&wav_header, sizeof(wav_header));
-  client->print("\r\n");
-  client->clear(); 
-  
-  // Add the client to the streaming queue
-  xQueueSend(i2sClients, (void *) &client, 0);
-
-  if (eTaskGetState(tMic) == eSuspended) {
-    vTaskResume(tMic);
+  c->client.printf("%X\r\n", (unsigned)ring->wavLen);
+  c->client.write(ring->wav, ring->wavLen);
+  c->client.print("\r\n");
+  c->client.clear(); 
+
+  // Start one block ahead: the block in flight may have been captured before this codec was enabled
+  ring->clients++;
+  if ( ring->source != NULL ) {
+    ring->source->clients++;
   }
-  Serial.println("Client connected");
+  c->cursor = audioHead.load() + 1;
+
+  // Hand the client to the sender task
+  i2sClients.activate(c);
+  connects[EP_I2S].inc();
+
+  audioSubscribe();
+  xTaskNotifyGive(tAudio);
+  Log.trace("I2SHandler: Client connected, codec=%s, rate=%d, bits=%d\n", ring->name, ring->rate, ring->bits);
 }
 
+// Stores the framing of a block whose encoded length varies, after its data was written
+void ringCommit(AudioRing* ring, size_t slot, size_t len) {
+  uint8_t* p = ring->slots + slot * ring->stride;
+  char chunkHdr[8];
+  snprintf(chunkHdr, sizeof(chunkHdr), "%03X\r\n", (unsigned)len);
+  memcpy(p, chunkHdr, ring->dataOffset);
+  memcpy(p + ring->dataOffset + len, "\r\n", 2);
+  ring->blockLen[slot] = len;
+}
+
+// Capture task: fills the rings one block at a time, independent of how fast clients drain them.
+// Each codec and format with listeners is encoded here, once per block, and shared by all of them.
 void micCB(void *pv) {
-  const size_t BYTES_PER_MS = (SAMPLE_RATE_HZ * (I2S_BIT_WIDTH / 8)) / 1000;
-  const size_t BYTES_BUFFER = BYTES_PER_MS * 20; // ~20ms of audio
-  std::vector<uint8_t> localBuf(BYTES_BUFFER);
-  uint32_t streamStart = 0;
+  AdpcmState adpcm = { 0, 0 };
+
+  xTaskCreatePinnedToCore(
+      audioCB,
+      "audio",
+      4 * KILOBYTE,
+      NULL,
+      tskIDLE_PRIORITY + 1,
+      &tAudio,
+      APP_CPU);
+
+#if defined(BENCHMARK)
+  readAvg.initialize();
+  encodeAvg.initialize();
+#endif
   for (;;) {
+    // No consumers: sleep until audioSubscribe() wakes this task
+    if ( audioConsumers.load() == 0 ) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      // The DMA buffers filled up while nobody read them, so the first read returns at once
+      // with samples of unknown age: drop them and restart the sample clock
+      i2s.readBytes((char*)rings[CODEC_PCM].slots + rings[CODEC_PCM].dataOffset, BYTES_BUFFER);
+      blockClock = -1;
+      continue;
+    }
+    uint32_t readStart = micros();
+    uint32_t head = audioHead.load();
+    size_t slot = (head % AUDIO_RING_BLOCKS);
+    uint8_t* pcm = rings[CODEC_PCM].slots + slot * rings[CODEC_PCM].stride + rings[CODEC_PCM].dataOffset;
+    size_t recievedBytes = i2s.readBytes((char*)pcm, BYTES_BUFFER);
+    if (recievedBytes < BYTES_BUFFER) {
+      memset(pcm + recievedBytes, 0, BYTES_BUFFER - recievedBytes);
+    }
+    uint32_t readEnd = micros();
+    // The read returns once the last sample is in, so a block started at the latest one
+    // block before that; scheduling delays only ever make it look later
+    int64_t latest = esp_timer_get_time() - BLOCK_US;
+    traceSpan(TRACE_I2S_READ, TRACK_MIC, head, readStart, readEnd);
 #if defined(BENCHMARK)
-    streamStart = micros();
+    readAvg.value(readEnd - readStart);
+    uint32_t encodeStart = micros();
 #endif
-    UBaseType_t activeClients = uxQueueMessagesWaiting(i2sClients);
-    // No clients, suspend this task
+
+    AudioRing* ulaw = &rings[CODEC_ULAW];
+    if ( ulaw->clients.load() ) {
+      ulawEncode((const int16_t*)pcm, ulaw->slots + slot * ulaw->stride + ulaw->dataOffset, BLOCK_SAMPLES);
+    }
+    AudioRing* ima = &rings[CODEC_ADPCM];
+    if ( ima->clients.load() ) {
+      adpcmEncodeBlock(&adpcm, (const int16_t*)pcm, ima->slots + slot * ima->stride + ima->dataOffset, BLOCK_SAMPLES);
+    }
+    for (int i = CODEC_PCM8; i < CODEC_COUNT; i++) {
+      AudioRing* ring = &rings[i];
+      if ( ring->slots == NULL || !ring->clients.load() ) {
+        continue;
+      }
+      const int16_t* in = (const int16_t*)pcm;
+      size_t samples = BLOCK_SAMPLES;
+      if ( ring->source != NULL ) {
+        in = (const int16_t*)(ring->source->slots + slot * ring->source->stride + ring->source->dataOffset);
+        samples = ring->source->blockLen[slot] / 2;
+      }
+      uint8_t* out = ring->slots + slot * ring->stride + ring->dataOffset;
+      if ( ring->resampler != NULL ) {
+        ringCommit(ring, slot, resample(ring->resampler, in, samples, (int16_t*)out) * 2);
+      } else {
+        pcm8Encode(in, out, samples);
+        ringCommit(ring, slot, samples);
+      }
+    }
+#if defined(BENCHMARK)
+    encodeAvg.value(micros() - encodeStart);
+#endif
+
+    // Stamp blocks from a sample clock that snaps down to that bound, creeps up towards it
+    // to follow a slow I2S clock, and restarts from it when samples were lost
+    if ( blockClock < 0 || latest < blockClock || latest - blockClock > BLOCK_US ) {
+      blockClock = latest;
+    } else {
+      blockClock += (latest - blockClock) / 64;
+    }
+    blockTimes[slot] = blockClock;
+    blockClock += BLOCK_US;
+    clipPush(AUDIO_TRACK, pcm, BYTES_BUFFER, blockTimes[slot]);
+    audioBlocks.inc();
+    audioHead.store(head + 1);
+    if ( i2sClients.count() ) {
+      xTaskNotifyGive(tAudio);
+    }
+    xTaskNotifyGive(tMux);
+    wsNotify();
+  }
+}
+
+// Registers a reader of the PCM ring and makes sure capture is running
+void audioSubscribe() {
+  audioConsumers++;
+  xTaskNotifyGive(tMic);
+}
+
+// Drops a reader of the PCM ring; micCB idles once none are left, which never happens with a clip arena
+void audioUnsubscribe() {
+  audioConsumers--;
+}
+
+// Number of blocks captured so far
+uint32_t audioHeadSeq() {
+  return audioHead.load();
+}
+
+// Returns the PCM samples of captured block seq and its capture time, or NULL if it is
+// not captured yet or has already been overwritten
+const uint8_t* audioBlock(uint32_t seq, size_t* len, int64_t* time) {
+  uint32_t head = audioHead.load();
+  if (seq >= head || head - seq > AUDIO_RING_BLOCKS - 1) {
+    return NULL;
+  }
+  AudioRing* ring = &rings[CODEC_PCM];
+  size_t slot = seq % AUDIO_RING_BLOCKS;
+  *len = ring->dataLen;
+  *time = blockTimes[slot];
+  return ring->slots + slot * ring->stride + ring->dataOffset;
+}
+
+// Writes as much of the client's pending blocks as its socket accepts.
+// Returns 1 on progress, 0 if waiting on capture or the socket, -1 on disconnect.
+int serviceAudioClient(AudioClient* c) {
+  AudioRing* ring = c->ring;
+  uint32_t head = audioHead.load();
+  int progress = 0;
+  // A new client's cursor starts one block past the head, so compare as a signed distance
+  while ((int32_t)(head - c->cursor) > 0) {
+    if (head - c->cursor > AUDIO_RING_BLOCKS - 1) {
+      if (c->offset != 0) {
+        // Lapped mid-block: the rest of the chunk is being overwritten and its size line is
+        // already out, so the stream cannot be resumed without corrupting it
+        c->overruns++;
+        audioOverruns.inc();
+        return -1;
+      }
+      // Lapped by the capture task: jump to the oldest block still intact, at a block boundary
+      c->overruns += head - c->cursor - (AUDIO_RING_BLOCKS - 1);
+      audioOverruns.inc(head - c->cursor - (AUDIO_RING_BLOCKS - 1));
+      c->cursor = head - (AUDIO_RING_BLOCKS - 1);
+    }
+    const uint8_t* slot = ring->slots + (c->cursor % AUDIO_RING_BLOCKS) * ring->stride;
+    if (c->offset == 0) {
+      // A resampled block's length varies, and must not change under a chunk already begun
+      c->slotLen = ring->dataOffset + ring->blockLen[c->cursor % AUDIO_RING_BLOCKS] + 2;
+      c->sendStart = micros();
+    }
+    int w = netSend(c->client, slot + c->offset, c->slotLen - c->offset);
+    if (w < 0) {
+      return -1;
+    }
+    if (w == 0) {
+      if (!c->stalling) {
+        c->stalling = true;
+        c->underruns++;
+        audioUnderruns.inc();
+      }
+      return progress;
+    }
+    progress = 1;
+    c->offset += w;
+    c->stats.bytesSent += w;
+    bytesSent[EP_I2S].inc(w);
+    if (c->offset == c->slotLen) {
+      c->offset = 0;
+      c->stalling = false;
+      uint32_t sendEnd = micros();
+      traceSpan(TRACE_AUDIO_SEND, TRACE_TRACK_CLIENT + c->client.fd(), c->cursor, c->sendStart, sendEnd);
+      c->cursor++;
+      c->sent++;
+      c->stats.lastSendUs = sendEnd - c->sendStart;
+      audioSendUs.observe(c->stats.lastSendUs);
+    }
+  }
+  return progress;
+}
+
+// Sender task: serves every client from its own cursor so one stalled socket only affects itself
+void audioCB(void *pv) {
+  const TickType_t xFrequency = pdMS_TO_TICKS(BLOCK_MS);
+#if defined(BENCHMARK)
+  streamAvg.initialize();
+#endif
+  for (;;) {
+    size_t activeClients = i2sClients.count();
+    // No clients: sleep until the handler hands this task one
     if ( !activeClients ) {
-      vTaskSuspend(NULL);
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
       continue;
     }
-    size_t recievedBytes = i2s.readBytes((char*)localBuf.data(), localBuf.size());
+#if defined(BENCHMARK)
+    uint32_t streamStart = micros();
+    bool report = millis() - lastPrint > BENCHMARK_PRINT_INT;
+    if (report) {
+      lastPrint = millis();
+    }
+#endif
 
-    WiFiClient *client;
-    for (int i=0; i < activeClients; i++) {
-      xQueueReceive(i2sClients, (void*)&client, 0);
+    bool progress = false;
+    fd_set writable;
+    int maxFd = -1;
+    FD_ZERO(&writable);
 
-      if (!client->connected()) {
-        Serial.println("Client disconnected");
-        client->stop();
-        delete client;
+    AudioClient *c;
+    for (size_t i=0; i < i2sClients.capacity(); i++) {
+      c = i2sClients.at(i);
+      if ( c == NULL ) {
         continue;
       }
-   
-      client->printf("%X\r\n", localBuf.size());
-      client->write(localBuf.data(), localBuf.size());
-      client->print("\r\n");
 
-      xQueueSend(i2sClients, (void *) &client, 0);
+      int r = c->client.connected() ? serviceAudioClient(c) : -1;
+      if (r < 0) {
+        Log.notice("audioCB: Client disconnected after %d ms: sent=%d overruns=%d underruns=%d bytes=%d\n",
+                   millis() - c->stats.connectedAt, c->sent, c->overruns, c->underruns, (uint32_t)c->stats.bytesSent);
+        c->ring->clients--;
+        if (c->ring->source != NULL) {
+          c->ring->source->clients--;
+        }
+        audioUnsubscribe();
+        c->client.stop();
+        c->client = WiFiClient();
+        i2sClients.release(c);
+        disconnects[EP_I2S].inc();
+        continue;
+      }
+      progress |= r > 0;
+#if defined(BENCHMARK)
+      if (report) {
+        Log.verbose("audioCB: client %d sent=%d overruns=%d underruns=%d\n", c->client.fd(), c->sent, c->overruns, c->underruns);
+      }
+#endif
+
+      if (c->stalling) {
+        int fd = c->client.fd();
+        FD_SET(fd, &writable);
+        if (fd > maxFd) {
+          maxFd = fd;
+        }
+      }
     }
 #if defined(BENCHMARK)
-    streamAvg.value(micros() - streamStart);
+    if (progress) {
+      streamAvg.value(micros() - streamStart);
+    }
+    if (report) {
+      Log.verbose("micCB: clients=%d, read avg=%d us, encode avg=%d us, stream avg=%d us\n", activeClients, readAvg.currentValue(), encodeAvg.currentValue(), streamAvg.currentValue());
+    }
 #endif
+
+    if (!progress) {
+      if (maxFd >= 0) {
+        // Wait for a stalled socket to drain, or for the next block
+        struct timeval tv = { 0, BLOCK_MS * 1000 };
+        select(maxFd + 1, NULL, &writable, NULL, &tv);
+        ulTaskNotifyTake(pdTRUE, 0);
+      } else {
+        ulTaskNotifyTake(pdTRUE, xFrequency);
+      }
+    }
+  }
+}
+
+// Writes a streaming WAV header (unknown length) for the ring's codec and format into ring->wav
+void buildWavHeader(AudioRing* ring, uint16_t format, uint16_t bits) {
+  pcm_wav_header_t hdr = PCM_WAV_HEADER_DEFAULT(sample_size, I2S_BIT_WIDTH, ring->rate, num_channels);
+  hdr.descriptor_chunk.chunk_size = sample_size;
+  hdr.fmt_chunk.audio_format = format;
+  hdr.fmt_chunk.bits_per_sample = bits;
+  hdr.fmt_chunk.block_align = num_channels * bits / 8;
+  hdr.fmt_chunk.byte_rate = ring->rate * hdr.fmt_chunk.block_align;
+
+  // Non-PCM formats carry a cbSize extension; IMA-ADPCM adds samples per block
+  uint16_t ext[2] = { 0, 0 };
+  size_t extLen = 0;
+  if (format == WAV_FORMAT_MULAW) {
+    extLen = 2;
+  } else if (format == WAV_FORMAT_IMA_ADPCM) {
+    ext[0] = 2;
+    ext[1] = BLOCK_SAMPLES;
+    extLen = 4;
+    hdr.fmt_chunk.block_align = ring->dataLen;
+    hdr.fmt_chunk.byte_rate = SAMPLE_RATE_HZ * ring->dataLen / BLOCK_SAMPLES;
+  }
+  hdr.fmt_chunk.subchunk_size = 16 + extLen;
+
+  size_t off = sizeof(hdr.descriptor_chunk) + sizeof(hdr.fmt_chunk);
+  memcpy(ring->wav, &hdr, off);
+  memcpy(ring->wav + off, ext, extLen);
+  off += extLen;
+  memcpy(ring->wav + off, &hdr.data_chunk, sizeof(hdr.data_chunk));
+  ring->wavLen = off + sizeof(hdr.data_chunk);
+}
+
+// Allocates a ring. Blocks of a constant length get their chunk framing written once
+// here; rings fed through ringCommit() reserve a fixed-width size field instead.
+void setupRing(AudioRing* ring, const char* name, uint32_t rate, uint16_t format, uint16_t bits, size_t dataLen, bool variable) {
+  char chunkHdr[12];
+  ring->name = name;
+  ring->rate = rate;
+  ring->bits = bits;
+  ring->dataLen = dataLen;
+  ring->dataOffset = sprintf(chunkHdr, variable ? "%03X\r\n" : "%X\r\n", (unsigned)dataLen);
+  ring->stride = ring->dataOffset + dataLen + 2;
+  ring->slots = (uint8_t*)ps_malloc(ring->stride * AUDIO_RING_BLOCKS);
+  ring->clients.store(0);
+  if (ring->slots == NULL) {
+    Log.fatal("I2S %s ring allocation failed", name);
+    return;
+  }
+  for (int i = 0; i < AUDIO_RING_BLOCKS; i++) {
+    uint8_t* slot = ring->slots + i * ring->stride;
+    memcpy(slot, chunkHdr, ring->dataOffset);
+    memcpy(slot + ring->stride - 2, "\r\n", 2);
+    ring->blockLen[i] = dataLen;
   }
+  buildWavHeader(ring, format, bits);
+}
+
+// Sets up a 16-bit ring at a lower rate and the 8-bit ring narrowed from it
+void setupResampledRings(AudioRing* wide, AudioRing* narrow, Resampler* resampler, uint32_t rate) {
+  if (!resamplerInit(resampler, SAMPLE_RATE_HZ, rate, BLOCK_SAMPLES)) {
+    Log.fatal("I2S %d Hz resampler allocation failed", rate);
+    return;
+  }
+  size_t samples = RESAMPLE_MAX_OUT(resampler, BLOCK_SAMPLES);
+  setupRing(wide, "pcm", rate, WAV_FORMAT_PCM, 16, samples * 2, true);
+  wide->resampler = resampler;
+  setupRing(narrow, "pcm", rate, WAV_FORMAT_PCM, 8, samples, true);
+  narrow->source = wide;
 }
 
 void I2SSetup() {
@@ -113,5 +503,14 @@ void I2SSetup() {
     Log.fatal("I2S begin failed");
     return;
   }
-}
 
+  // Build one ring per codec in PSRAM, with the chunk framing written once per slot
+  setupRing(&rings[CODEC_PCM], "pcm", SAMPLE_RATE_HZ, WAV_FORMAT_PCM, 16, BYTES_BUFFER, false);
+  setupRing(&rings[CODEC_ULAW], "ulaw", SAMPLE_RATE_HZ, WAV_FORMAT_MULAW, 8, BLOCK_SAMPLES, false);
+  setupRing(&rings[CODEC_ADPCM], "adpcm", SAMPLE_RATE_HZ, WAV_FORMAT_IMA_ADPCM, 4, ADPCM_BLOCK_BYTES(BLOCK_SAMPLES), false);
+  setupRing(&rings[CODEC_PCM8], "pcm", SAMPLE_RATE_HZ, WAV_FORMAT_PCM, 8, BLOCK_SAMPLES, false);
+  setupResampledRings(&rings[CODEC_PCM_16K], &rings[CODEC_PCM8_16K], &resamplers[RESAMPLE_16K], 16000);
+  setupResampledRings(&rings[CODEC_PCM_8K], &rings[CODEC_PCM8_8K], &resamplers[RESAMPLE_8K], 8000);
+  audioHead.store(0);
+  audioConsumers.store(0);
+}
@@ -0,0 +1,350 @@
+#include "jpeg.h"
+
+// Marker codes used by the parser
+#define M_SOF0 0xC0
+#define M_SOF1 0xC1
+#define M_DHT  0xC4
+#define M_RST0 0xD0
+#define M_SOI  0xD8
+#define M_EOI  0xD9
+#define M_SOS  0xDA
+#define M_DQT  0xDB
+#define M_DRI  0xDD
+
+/**
+ * @brief Builds decoding tables from the counts and symbols of a DHT table.
+ *
+ * @param t Table to fill.
+ * @param counts Number of codes of each length 1..16.
+ * @param symbols Symbols in code order.
+ * @return false if the table holds more than 256 symbols.
+ */
+static bool buildHuffman(JpegHuffman* t, const uint8_t* counts, const uint8_t* symbols) {
+  int code = 0, k = 0;
+  memset(t->fast, 0, sizeof(t->fast));
+  for (int l = 1; l <= 16; l++) {
+    t->valptr[l] = k;
+    t->mincode[l] = code;
+    for (int i = 0; i < counts[l - 1]; i++, k++, code++) {
+      if (k == 256)
+        return false;
+      t->vals[k] = symbols[k];
+      if (l <= JPEG_HUFF_FAST_BITS) {
+        int shift = JPEG_HUFF_FAST_BITS - l;
+        for (int j = 0; j < (1 << shift); j++)
+          t->fast[(code << shift) | j] = (l << 8) | symbols[k];
+      }
+    }
+    t->maxcode[l] = counts[l - 1] ? code - 1 : -1;
+    code <<= 1;
+  }
+  return true;
+}
+
+/**
+ * @brief Parses the headers of a baseline JPEG up to its entropy-coded scan.
+ *
+ * Reads the frame size and sampling factors, quantization and Huffman tables and
+ * the restart interval. Progressive and multi-scan images are rejected.
+ *
+ * @param buf JPEG data.
+ * @param len Size of buf.
+ * @param info Parsed headers.
+ * @return true if the image is a supported baseline JPEG.
+ */
+bool jpegParse(const uint8_t* buf, size_t len, JpegInfo* info) {
+  const uint8_t* p = buf;
+  const uint8_t* end = buf + len;
+  bool sof = false;
+
+  if (len < 4 || p[0] != 0xFF || p[1] != M_SOI)
+    return false;
+  p += 2;
+  info->restart = 0;
+
+  while (p + 4 <= end) {
+    if (p[0] != 0xFF)
+      return false;
+    uint8_t marker = p[1];
+    if (marker == 0xFF) {
+      p++;
+      continue;
+    }
+    size_t seg = (p[2] << 8) | p[3];
+    const uint8_t* s = p + 4;
+    const uint8_t* next = p + 2 + seg;
+    if (seg < 2 || next > end)
+      return false;
+
+    switch (marker) {
+      case M_SOF0:
+      case M_SOF1:
+        info->height = (s[1] << 8) | s[2];
+        info->width = (s[3] << 8) | s[4];
+        info->ncomp = s[5];
+        if (info->ncomp != 1 && info->ncomp != 3)
+          return false;
+        info->hmax = info->vmax = 1;
+        for (int i = 0; i < info->ncomp; i++) {
+          JpegComponent* c = &info->comp[i];
+          c->id = s[6 + i * 3];
+          c->h = s[7 + i * 3] >> 4;
+          c->v = s[7 + i * 3] & 15;
+          c->tq = s[8 + i * 3] & 3;
+          if (c->h == 0 || c->v == 0 || c->h > 2 || c->v > 2)
+            return false;
+          if (c->h > info->hmax)
+            info->hmax = c->h;
+          if (c->v > info->vmax)
+            info->vmax = c->v;
+        }
+        if (info->ncomp == 1)
+          info->comp[0].h = info->comp[0].v = info->hmax = info->vmax = 1;
+        info->mcusX = (info->width + 8 * info->hmax - 1) / (8 * info->hmax);
+        info->mcusY = (info->height + 8 * info->vmax - 1) / (8 * info->vmax);
+        sof = true;
+        break;
+
+      case M_DQT:
+        while (s < next) {
+          uint8_t pq = s[0] >> 4, tq = s[0] & 3;
+          s++;
+          for (int i = 0; i < 64; i++) {
+            info->qt[tq][i] = pq ? (s[0] << 8) | s[1] : s[0];
+            s += pq ? 2 : 1;
+          }
+        }
+        break;
+
+      case M_DHT:
+        while (s + 17 <= next) {
+          uint8_t tc = s[0] >> 4, th = s[0] & 1;
+          const uint8_t* counts = s + 1;
+          int total = 0;
+          for (int i = 0; i < 16; i++)
+            total += counts[i];
+          if (s + 17 + total > next || !buildHuffman(tc ? &info->ac[th] : &info->dc[th], counts, s + 17))
+            return false;
+          s += 17 + total;
+        }
+        break;
+
+      case M_DRI:
+        info->restart = (s[0] << 8) | s[1];
+        break;
+
+      case M_SOS: {
+        if (!sof || s[0] != info->ncomp)
+          return false;
+        for (int i = 0; i < s[0]; i++) {
+          JpegComponent* c = &info->comp[i];
+          if (s[1 + i * 2] != c->id)
+            return false;
+          c->td = s[2 + i * 2] >> 4 & 1;
+          c->ta = s[2 + i * 2] & 1;
+          c->pred = 0;
+        }
+        info->scan = next;
+        info->end = end;
+        return true;
+      }
+
+      case M_EOI:
+        return false;
+
+      default:
+        if ((marker & 0xF0) == 0xC0 && marker != 0xC8 && marker != 0xCC)
+          return false;  // Progressive, lossless or arithmetic-coded frame
+        break;
+    }
+    p = next;
+  }
+  return false;
+}
+
+/**
+ * @brief Positions a bit reader at the start of the scan.
+ *
+ * @param b Bit reader.
+ * @param info Parsed headers.
+ * @return void
+ */
+void jpegBitsBegin(JpegBits* b, const JpegInfo* info) {
+  b->p = info->scan;
+  b->end = info->end;
+  b->acc = 0;
+  b->n = 0;
+  b->marker = false;
+}
+
+/**
+ * @brief Tops the bit accumulator up to at least 25 bits.
+ *
+ * Stuffed 0xFF00 pairs yield 0xFF; once a marker is reached zeros are fed instead.
+ *
+ * @param b Bit reader.
+ * @return void
+ */
+static inline void fill(JpegBits* b) {
+  while (b->n <= 24) {
+    uint32_t byte = 0;
+    if (!b->marker && b->p < b->end) {
+      byte = *b->p;
+      if (byte == 0xFF) {
+        if (b->p + 1 < b->end && b->p[1] == 0x00) {
+          b->p += 2;
+        } else {
+          b->marker = true;
+          byte = 0;
+        }
+      } else {
+        b->p++;
+      }
+    }
+    b->acc |= byte << (24 - b->n);
+    b->n += 8;
+  }
+}
+
+static inline uint32_t getBits(JpegBits* b, int n) {
+  fill(b);
+  uint32_t v = b->acc >> (32 - n);
+  b->acc <<= n;
+  b->n -= n;
+  return v;
+}
+
+/**
+ * @brief Decodes one Huffman symbol.
+ *
+ * @param b Bit reader.
+ * @param t Huffman table.
+ * @return The symbol, or -1 for an invalid code.
+ */
+static inline int decodeSymbol(JpegBits* b, const JpegHuffman* t) {
+  fill(b);
+  uint16_t e = t->fast[b->acc >> (32 - JPEG_HUFF_FAST_BITS)];
+  if (e != 0) {
+    int l = e >> 8;
+    b->acc <<= l;
+    b->n -= l;
+    return e & 0xFF;
+  }
+  for (int l = JPEG_HUFF_FAST_BITS + 1; l <= 16; l++) {
+    int32_t code = b->acc >> (32 - l);
+    if (code <= t->maxcode[l]) {
+      b->acc <<= l;
+      b->n -= l;
+      return t->vals[t->valptr[l] + code - t->mincode[l]];
+    }
+  }
+  return -1;
+}
+
+// Reads s magnitude bits and sign-extends them (JPEG EXTEND procedure)
+static inline int receiveExtend(JpegBits* b, int s) {
+  if (s == 0)
+    return 0;
+  int v = getBits(b, s);
+  return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+}
+
+/**
+ * @brief Consumes a restart marker and resets the DC predictors.
+ *
+ * @param b Bit reader, positioned at the end of a restart interval.
+ * @param info Parsed headers.
+ * @return false if the expected RSTn marker is missing.
+ */
+bool jpegRestart(JpegBits* b, JpegInfo* info) {
+  fill(b);  // Reads up to the marker past the padding bits
+  b->acc = 0;
+  b->n = 0;
+  if (!b->marker || b->p + 1 >= b->end || (b->p[1] & 0xF8) != M_RST0)
+    return false;
+  b->p += 2;
+  b->marker = false;
+  for (int i = 0; i < info->ncomp; i++)
+    info->comp[i].pred = 0;
+  return true;
+}
+
+/**
+ * @brief Entropy-decodes one 8x8 block.
+ *
+ * @param b Bit reader.
+ * @param info Parsed headers.
+ * @param c Component the block belongs to; its DC predictor is updated.
+ * @param coef 64 quantized coefficients in zigzag order, or NULL to skip the AC terms.
+ * @return false on a corrupt code.
+ */
+bool jpegDecodeBlock(JpegBits* b, JpegInfo* info, JpegComponent* c, int16_t* coef) {
+  int s = decodeSymbol(b, &info->dc[c->td]);
+  if (s < 0 || s > 11)
+    return false;
+  c->pred += receiveExtend(b, s);
+  if (coef != NULL) {
+    memset(coef, 0, 64 * sizeof(int16_t));
+    coef[0] = c->pred;
+  }
+
+  const JpegHuffman* ac = &info->ac[c->ta];
+  for (int k = 1; k < 64; k++) {
+    int rs = decodeSymbol(b, ac);
+    if (rs < 0)
+      return false;
+    int r = rs >> 4;
+    s = rs & 15;
+    if (s == 0) {
+      if (r != 15)
+        break;  // End of block
+      k += 15;
+      continue;
+    }
+    k += r;
+    if (k > 63)
+      return false;
+    if (coef != NULL)
+      coef[k] = receiveExtend(b, s);
+    else
+      getBits(b, s);
+  }
+  return true;
+}
+
+/**
+ * @brief Extracts the luma DC term of every MCU without decoding the image.
+ *
+ * Walks the entropy-coded data, skipping AC terms, and records the dequantized
+ * DC coefficient of each MCU (averaged over its luma blocks), which is eight
+ * times the block's mean brightness offset.
+ *
+ * @param info Headers from jpegParse().
+ * @param dc Output, one value per MCU in raster order (mcusX * mcusY entries).
+ * @return false if the entropy-coded data is corrupt.
+ */
+bool jpegDcMap(JpegInfo* info, int16_t* dc) {
+  size_t mcus = (size_t)info->mcusX * info->mcusY;
+  JpegBits b;
+  jpegBitsBegin(&b, info);
+  JpegComponent* luma = &info->comp[0];
+  int lumaBlocks = luma->h * luma->v;
+  int q = info->qt[luma->tq][0];
+
+  for (size_t m = 0; m < mcus; m++) {
+    if (info->restart && m && m % info->restart == 0 && !jpegRestart(&b, info))
+      return false;
+    int sum = 0;
+    for (int i = 0; i < info->ncomp; i++) {
+      JpegComponent* c = &info->comp[i];
+      for (int k = 0; k < c->h * c->v; k++) {
+        if (!jpegDecodeBlock(&b, info, c, NULL))
+          return false;
+        if (i == 0)
+          sum += c->pred;
+      }
+    }
+    dc[m] = sum * q / lumaBlocks;
+  }
+  return true;
+}
@@ -1,115 +1,408 @@
-//  === Arduino-Log implementation  =================================================================
+//  === Deferred logging implementation  =========================================================
 #include "globals.h"
 #include "logging.h"
 
 #define MILLIS_FUNCTION xTaskGetTickCount()
 // #define MILLIS_FUNCTION millis()
 
-#ifndef DISABLE_LOGGING
+#define LOG_DRAIN_MS 20       // Drain task sleep while both rings are empty
+#define LOG_LINE_MAX 256      // Formatted line, truncated beyond this
+#define LOG_HEADER_BYTES (8 + sizeof(const char*))  // Header word, timestamp and format pointer
+
+// Record kinds, in the top byte of the header word
+enum { LOG_KIND_TEXT = 1, LOG_KIND_DUMP = 2, LOG_KIND_PAD = 3 };
+
+// Per-core ring of variable-size records, written by any task and read by the drain task.
+// Writers reserve space by advancing head with a compare-and-swap and publish a record
+// by storing its header word (size | level << 16 | kind << 24) last. The drain task
+// consumes from tail and zeroes what it consumed, so an unpublished header reads as 0.
+// A record never wraps: the space left at the end of the ring is filled with padding.
+// Records take whole words; size is the exact length, so the rounding is never read as an argument.
+struct LogRing {
+  uint32_t buf[LOG_RING_BYTES / 4];
+  std::atomic<uint32_t> head{0};  // Bytes reserved so far
+  std::atomic<uint32_t> tail{0};  // Bytes consumed so far
+};
+
+DeferredLog Log;
+LogRing logRings[portNUM_PROCESSORS];
+TaskHandle_t tLog;
+
+void LogPacker::putRaw(uint8_t tag, const void* v, size_t len) {
+  if (_full || _len + 1 + len > _size) {
+    _full = true;
+    return;
+  }
+  if (_buf != NULL) {
+    _buf[_len] = tag;
+    memcpy(_buf + _len + 1, v, len);
+  }
+  _len += 1 + len;
+}
+
+void LogPacker::putString(const char* s) {
+  if (s == NULL)
+    s = "(null)";
+  size_t len = strnlen(s, LOG_STRING_MAX);
+  if (_full || _len + 2 + len > _size) {
+    _full = true;
+    return;
+  }
+  if (_buf != NULL) {
+    _buf[_len] = LOG_ARG_STRING;
+    _buf[_len + 1] = len;
+    memcpy(_buf + _len + 2, s, len);
+  }
+  _len += 2 + len;
+}
+
 /**
- * @brief Prints a timestamp in [days:hours:minutes:seconds.milliseconds] format to the log output.
- *
- * Used as a prefix for log messages to aid in debugging and event tracing.
+ * @brief Sets the level and the output the drain task writes to.
  *
- * @param logOutput Pointer to the Print object for log output.
+ * @param level Most verbose level recorded (LOG_LEVEL_*).
+ * @param output Where formatted lines go, normally Serial.
  * @return void
  */
-void printTimestampMillis(Print* logOutput);
+void DeferredLog::begin(int level, Print* output) {
+  _level = level;
+  _output = output;
+}
 
 /**
- * @brief Prints a buffer in hex and ASCII for debugging.
+ * @brief Reserves a record in the ring of the calling core without locking.
  *
- * Useful for inspecting raw data or binary buffers during development.
+ * The caller packs the arguments straight into the record and then publishes it, so
+ * nothing is staged on its stack. Another task on the same core may reserve and publish
+ * in between; the drain task stops at this record until it is published.
  *
- * @param aBuf Pointer to the buffer.
- * @param aSize Size of the buffer in bytes.
- * @return void
+ * @param len Bytes of packed arguments the record holds.
+ * @return Where the arguments go, or NULL if the ring is full.
+ * @note Counts the record as dropped instead of waiting when the ring is full.
  */
-void printBuffer(const char* aBuf, size_t aSize);
-#endif  //   #ifndef DISABLE_LOGGING
+uint8_t* DeferredLog::reserve(size_t len) {
+  LogRing* ring = &logRings[xPortGetCoreID()];
+  uint32_t span = (LOG_HEADER_BYTES + len + 3) & ~3;
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  uint32_t off, pad;
+  do {
+    off = head % LOG_RING_BYTES;
+    pad = off + span > LOG_RING_BYTES ? LOG_RING_BYTES - off : 0;
+    if (head + pad + span - ring->tail.load(std::memory_order_acquire) > LOG_RING_BYTES) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    }
+  } while (!ring->head.compare_exchange_weak(head, head + pad + span, std::memory_order_relaxed));
+
+  if (pad) {
+    __atomic_store_n(&ring->buf[off / 4], pad | LOG_KIND_PAD << 24, __ATOMIC_RELEASE);
+    off = 0;
+  }
+  return (uint8_t*)(ring->buf + off / 4) + LOG_HEADER_BYTES;
+}
 
 /**
- * @brief Initializes the logging system.
- *
- * Sets up the log level, output stream, and timestamp prefix.
- * Should be called early in setup().
+ * @brief Publishes a record reserved with reserve() to the drain task.
  *
+ * @param args Arguments of the record, as returned by reserve().
+ * @param level Level of the record.
+ * @param fmt Format string; only the pointer is stored, so it must be a literal.
+ * @param len Bytes of packed arguments, as reserved.
+ * @param dump true for a hex-dump record, whose arguments are the raw bytes.
  * @return void
  */
-void setupLogging() {
-#ifndef DISABLE_LOGGING
-  Log.begin(LOG_LEVEL, &Serial);
-  Log.setPrefix(printTimestampMillis);
-  Log.trace("setupLogging()" CR);
-#endif  //  #ifndef DISABLE_LOGGING
+void DeferredLog::publish(uint8_t* args, int level, const char* fmt, size_t len, bool dump) {
+  uint32_t* rec = (uint32_t*)(args - LOG_HEADER_BYTES);
+  rec[1] = MILLIS_FUNCTION;
+  memcpy(rec + 2, &fmt, sizeof(fmt));
+  __atomic_store_n(&rec[0], (LOG_HEADER_BYTES + len) | level << 16 | (dump ? LOG_KIND_DUMP : LOG_KIND_TEXT) << 24, __ATOMIC_RELEASE);
 }
 
 /**
- * @brief Prints a simple millisecond-based timestamp to the log output.
+ * @brief Records the first LOG_HEXDUMP_MAX bytes of a buffer for a deferred hex dump.
  *
- * @param logOutput Pointer to the Print object for log output.
+ * @param buf Buffer to dump.
+ * @param len Size of the buffer in bytes.
  * @return void
  */
-void printTimestamp(Print* logOutput) {
-  char c[24];
-  sprintf(c, "%10lu ", (long unsigned int) MILLIS_FUNCTION);
-  logOutput->print(c);
+void DeferredLog::hexDump(const void* buf, size_t len) {
+#ifndef DISABLE_LOGGING
+  if (_level == LOG_LEVEL_SILENT)
+    return;
+  uint32_t total = len;
+  size_t n = len < LOG_HEXDUMP_MAX ? len : LOG_HEXDUMP_MAX;
+  uint8_t* args = reserve(4 + n);
+  if (args == NULL)
+    return;
+  memcpy(args, &total, 4);
+  memcpy(args + 4, buf, n);
+  publish(args, LOG_LEVEL_FATAL, NULL, 4 + n, true);
+#endif
+}
+
+// Appends to a line buffer, silently truncating at LOG_LINE_MAX
+static void append(char* line, size_t* len, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(line + *len, LOG_LINE_MAX - *len, fmt, args);
+  va_end(args);
+  if (n > 0)
+    *len = *len + n < LOG_LINE_MAX ? *len + n : LOG_LINE_MAX - 1;
 }
 
 /**
- * @brief Prints a formatted timestamp (days:hours:minutes:seconds.milliseconds) to the log output.
+ * @brief Formats a timestamp as [days:hours:minutes:seconds.milliseconds].
  *
- * @param logOutput Pointer to the Print object for log output.
+ * @param line Line buffer.
+ * @param len Bytes already in the line; updated.
+ * @param mm Timestamp in milliseconds.
  * @return void
  */
-void printTimestampMillis(Print* logOutput) {
-  char c[64];
-  unsigned long mm = MILLIS_FUNCTION;
+static void printTimestampMillis(char* line, size_t* len, uint32_t mm) {
   int ms = mm % 1000;
   int s = mm / 1000;
   int m = s / 60;
   int h = m / 60;
   int d = h / 24;
-  sprintf(c, "%02d:%02d:%02d:%02d.%03d ", d, h % 24, m % 60, s % 60, ms);
-  logOutput->print(c);
+  append(line, len, "%02d:%02d:%02d:%02d.%03d ", d, h % 24, m % 60, s % 60, ms);
+}
+
+/**
+ * @brief Formats one record and writes it to the output.
+ *
+ * Supports the Arduino-Log conversions: %d %i %l %u %x %X %b %c %s %t %T %D %F and %%.
+ * printf flags, width and length modifiers are skipped, since every integer argument
+ * carries its own size.
+ *
+ * @param rec Published record.
+ * @return void
+ */
+void DeferredLog::format(const uint32_t* rec) {
+  uint32_t hdr = rec[0];
+  size_t size = hdr & 0xFFFF;
+  const uint8_t* arg = (const uint8_t*)rec + LOG_HEADER_BYTES;
+  const uint8_t* end = (const uint8_t*)rec + size;
+  char line[LOG_LINE_MAX];
+  size_t len = 0;
+
+  printTimestampMillis(line, &len, rec[1]);
+
+  if ((hdr >> 24) == LOG_KIND_DUMP) {
+    uint32_t total;
+    memcpy(&total, arg, 4);
+    arg += 4;
+    size_t n = total < LOG_HEXDUMP_MAX ? total : LOG_HEXDUMP_MAX;
+    append(line, &len, "Buffer contents (%u bytes):\n", total);
+    _output->write((const uint8_t*)line, len);
+    for (size_t j = 0; j < n; j += 16) {
+      len = 0;
+      append(line, &len, "%04x : ", j);
+      for (size_t i = j; i < j + 16 && i < n; i++)
+        append(line, &len, "%02x ", arg[i]);
+      append(line, &len, " : ");
+      for (size_t i = j; i < j + 16 && i < n; i++)
+        append(line, &len, "%c", arg[i] < 32 ? '.' : arg[i]);
+      append(line, &len, "\n");
+      _output->write((const uint8_t*)line, len);
+    }
+    return;
+  }
+
+  const char* fmt;
+  memcpy(&fmt, rec + 2, sizeof(fmt));
+  append(line, &len, "%c: ", "?FEWNTV"[(hdr >> 16) & 7]);
+  for (const char* f = fmt; *f; f++) {
+    if (*f != '%') {
+      if (len < LOG_LINE_MAX - 1)
+        line[len++] = *f;
+      continue;
+    }
+    f++;
+    if (*f == '%') {
+      append(line, &len, "%%");
+      continue;
+    }
+    while (*f && strchr("-+ #0123456789.", *f))
+      f++;
+    while (*f && strchr("hlzj", *f) && f[1] && strchr("diuxX", f[1]))
+      f++;
+    if (*f == 0)
+      break;
+    if (arg >= end) {
+      append(line, &len, "%%%c", *f);
+      continue;
+    }
+
+    // Fetch the next argument, whatever its type
+    uint8_t tag = *arg++;
+    int64_t i = 0;
+    uint64_t u = 0;
+    double d = 0;
+    const char* str = NULL;
+    uint8_t strLen = 0;
+    switch (tag) {
+      case LOG_ARG_INT: { int32_t v; memcpy(&v, arg, 4); arg += 4; i = v; u = (uint32_t)v; d = v; break; }
+      case LOG_ARG_UINT: { uint32_t v; memcpy(&v, arg, 4); arg += 4; i = v; u = v; d = v; break; }
+      case LOG_ARG_INT64: memcpy(&i, arg, 8); arg += 8; u = i; d = i; break;
+      case LOG_ARG_UINT64: memcpy(&u, arg, 8); arg += 8; i = u; d = u; break;
+      case LOG_ARG_DOUBLE: memcpy(&d, arg, 8); arg += 8; i = d; u = d; break;
+      case LOG_ARG_STRING: strLen = *arg++; str = (const char*)arg; arg += strLen; break;
+      default: arg = end; append(line, &len, "%%%c", *f); continue;
+    }
+
+    switch (*f) {
+      case 'd':
+      case 'i':
+      case 'l':
+        append(line, &len, "%lld", (long long)i);
+        break;
+      case 'u':
+        append(line, &len, "%llu", (unsigned long long)u);
+        break;
+      case 'x':
+        append(line, &len, "%llx", (unsigned long long)u);
+        break;
+      case 'X':
+        append(line, &len, "0x%llX", (unsigned long long)u);
+        break;
+      case 'b':
+      case 'B':
+        append(line, &len, "0b");
+        for (int bit = 63 - __builtin_clzll(u | 1); bit >= 0; bit--)
+          append(line, &len, "%c", (u >> bit) & 1 ? '1' : '0');
+        break;
+      case 'c':
+        append(line, &len, "%c", (char)i);
+        break;
+      case 's':
+      case 'S':
+        if (str != NULL)
+          append(line, &len, "%.*s", strLen, str);
+        break;
+      case 't':
+        append(line, &len, "%c", i ? 'T' : 'F');
+        break;
+      case 'T':
+        append(line, &len, "%s", i ? "true" : "false");
+        break;
+      case 'D':
+      case 'F':
+        append(line, &len, "%.2f", d);
+        break;
+      default:
+        append(line, &len, "%%%c", *f);
+        break;
+    }
+  }
+  _output->write((const uint8_t*)line, len);
+}
+
+/**
+ * @brief Returns the next published record of a ring, skipping padding.
+ *
+ * @param ring Ring to read.
+ * @return The record, or NULL if the ring is empty or its next record is still being written.
+ */
+static const uint32_t* nextRecord(LogRing* ring) {
+  for (;;) {
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail == ring->head.load(std::memory_order_acquire))
+      return NULL;
+    uint32_t* rec = ring->buf + (tail % LOG_RING_BYTES) / 4;
+    uint32_t hdr = __atomic_load_n(rec, __ATOMIC_ACQUIRE);
+    if (hdr == 0)
+      return NULL;
+    if ((hdr >> 24) != LOG_KIND_PAD)
+      return rec;
+    memset(rec, 0, hdr & 0xFFFF);
+    ring->tail.store(tail + (hdr & 0xFFFF), std::memory_order_release);
+  }
+}
+
+/**
+ * @brief Formats and writes every published record, oldest first across the cores.
+ *
+ * @return true if anything was written.
+ */
+bool DeferredLog::drain() {
+  bool any = false;
+  for (;;) {
+    LogRing* ring = NULL;
+    const uint32_t* rec = NULL;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+      const uint32_t* r = nextRecord(&logRings[i]);
+      if (r != NULL && (rec == NULL || (int32_t)(r[1] - rec[1]) < 0)) {
+        rec = r;
+        ring = &logRings[i];
+      }
+    }
+    if (rec == NULL)
+      break;
+
+    format(rec);
+    size_t span = ((rec[0] & 0xFFFF) + 3) & ~3;
+    memset((void*)rec, 0, span);
+    ring->tail.fetch_add(span, std::memory_order_release);
+    any = true;
+  }
+
+  uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+  if (dropped != _reported) {
+    char line[64];
+    int n = snprintf(line, sizeof(line), "log: %u records dropped, ring full\n", dropped - _reported);
+    _output->write((const uint8_t*)line, n);
+    _reported = dropped;
+    any = true;
+  }
+  return any;
 }
 
+/**
+ * @brief RTOS task: Writes the logged records to the output in the background.
+ *
+ * @param pvParameters Unused (RTOS task parameter signature).
+ * @return Never returns; runs as a FreeRTOS task.
+ */
+void logCB(void* pvParameters) {
+  for (;;) {
+    if (!Log.drain())
+      vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_MS));
+  }
+}
+
+/**
+ * @brief Initializes the logging system.
+ *
+ * Sets up the log level and output stream and starts the drain task on the protocol
+ * core at the lowest priority, so formatting and the 115200 baud Serial writes
+ * never hold up the streaming tasks. Should be called early in setup().
+ *
+ * @return void
+ */
+void setupLogging() {
 #ifndef DISABLE_LOGGING
+  Log.begin(LOG_LEVEL, &Serial);
+  xTaskCreatePinnedToCore(
+      logCB,
+      "log",
+      3 * KILOBYTE,
+      NULL,
+      tskIDLE_PRIORITY + 1,
+      &tLog,
+      PRO_CPU);
+  Log.trace("setupLogging()" CR);
+#endif  //  #ifndef DISABLE_LOGGING
+}
+
 /**
- * @brief Prints the contents of a buffer in both hexadecimal and ASCII.
+ * @brief Records a buffer for a deferred dump in hex and ASCII.
  *
- * Each line shows 16 bytes in hex and their ASCII representation.
- * Non-printable characters are shown as '.'.
+ * Useful for inspecting raw data or binary buffers during development. Only the first
+ * LOG_HEXDUMP_MAX bytes are kept; the dump is written by the drain task.
  *
  * @param aBuf Pointer to the buffer.
  * @param aSize Size of the buffer in bytes.
  * @return void
  */
 void printBuffer(const char* aBuf, size_t aSize) {
-    Serial.println("Buffer contents:");
-
-    char c;
-    String s;
-    size_t cnt = 0;
-
-    for (int j = 0; j < aSize / 16 + 1; j++) {
-      Serial.printf("%04x : ", j * 16);
-      for (int i = 0; i < 16 && cnt < aSize; i++) {
-        c = aBuf[cnt++];
-        Serial.printf("%02x ", c);
-        if (c < 32) {
-          s += '.';
-        }
-        else {
-          s += c;
-        }
-      }
-      Serial.print(" : ");
-      Serial.println(s);
-      s = "";
-    }
-    Serial.println();
+  Log.hexDump(aBuf, aSize);
 }
-#else
-void printBuffer(const char* aBuf, size_t aSize) {}
-#endif
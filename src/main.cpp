@@ -1,15 +1,14 @@
-#include <WebServer.h>
 #include <WiFi.h>
 #include "esp_camera.h"
 
 #include "globals.h"
 #include "stream.h"
-#include "camera_pins.h"
 #include "logging.h"
 #include "i2s.h"
+#include "control.h"
 
-// Global web server instance on port 80
-WebServer server(80);
+// Global web server instance on HTTP_PORT
+HttpServer server(HTTP_PORT);
 
 // RTOS handle for setup task
 TaskHandle_t tSetup;
@@ -36,40 +35,17 @@ void setup() {
   Log.trace("setup: total psram : %d\n", ESP.getPsramSize());
   Log.trace("setup: free psram  : %d\n", ESP.getFreePsram());
 
-  // Camera configuration struct (static to ensure it persists)
-  static camera_config_t camera_config = {
-    .pin_pwdn       = PWDN_GPIO_NUM,
-    .pin_reset      = RESET_GPIO_NUM,
-    .pin_xclk       = XCLK_GPIO_NUM,
-    .pin_sscb_sda   = SIOD_GPIO_NUM,
-    .pin_sscb_scl   = SIOC_GPIO_NUM,
-    .pin_d7         = Y9_GPIO_NUM,
-    .pin_d6         = Y8_GPIO_NUM,
-    .pin_d5         = Y7_GPIO_NUM,
-    .pin_d4         = Y6_GPIO_NUM,
-    .pin_d3         = Y5_GPIO_NUM,
-    .pin_d2         = Y4_GPIO_NUM,
-    .pin_d1         = Y3_GPIO_NUM,
-    .pin_d0         = Y2_GPIO_NUM,
-    .pin_vsync      = VSYNC_GPIO_NUM,
-    .pin_href       = HREF_GPIO_NUM,
-    .pin_pclk       = PCLK_GPIO_NUM,
-    .xclk_freq_hz   = XCLK_FREQ,
-    .ledc_timer     = LEDC_TIMER_0,
-    .ledc_channel   = LEDC_CHANNEL_0,
-    .pixel_format   = PIXFORMAT_JPEG,
-    .frame_size     = FRAME_SIZE,
-    .jpeg_quality   = JPEG_QUALITY,
-    .fb_count       = 2,
-    .fb_location    = CAMERA_FB_IN_PSRAM,
-    .grab_mode      = CAMERA_GRAB_LATEST,
-  };
-
-  // Initialize the camera hardware; restart if initialization fails
-  if (esp_camera_init(&camera_config) != ESP_OK) {
-    Log.fatal("setup: Error initializing the camera\n");
-    delay(10000);
-    ESP.restart();
+  // Initialize the camera hardware with the saved settings; fall back to the build flags, then restart
+  settingsLoad();
+  if (!cameraBegin()) {
+    Log.error("setup: Camera init failed with the saved settings, using the defaults\n");
+    settingsReset();
+    esp_camera_deinit();
+    if (!cameraBegin()) {
+      Log.fatal("setup: Error initializing the camera\n");
+      delay(10000);
+      ESP.restart();
+    }
   }
 
 #if defined(CAMERA_MODEL_ESP_EYE)
@@ -78,17 +54,6 @@ void setup() {
   pinMode(14, INPUT_PULLUP);
 #endif
 
-  sensor_t* s = esp_camera_sensor_get();
-#if defined (FLIP_VERTICALLY)
-  // Flip image vertically if requested by build flag
-  s->set_vflip(s, true);
-#endif
-
-#if defined (WHITEBALANCE)
-  // Enable auto white balance if requested by build flag
-  s->set_wb_mode(s, WHITEBALANCE);
-#endif
-
   I2SSetup();
 
   // Connect to WiFi using credentials from build flags
@@ -109,11 +74,12 @@ void setup() {
   Serial.print(MJPEG_URL);
   Serial.println("' to connect");
 
-  // Start the main streaming RTOS task on the PRO_CPU core
+  // Start the main streaming RTOS task on the PRO_CPU core. Every HTTP handler runs on
+  // its stack (WebSocket SHA-1, NVS writes, String-built pages); see http_stack_free_bytes
   xTaskCreatePinnedToCore(
     setupCB,                 // Task function
     "setup",                 // Task name
-    3 * KILOBYTE,            // Stack size
+    8 * KILOBYTE,            // Stack size
     NULL,                    // Parameters
     tskIDLE_PRIORITY + 2,    // Priority
     &tSetup,                 // Task handle
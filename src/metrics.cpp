@@ -0,0 +1,182 @@
+#include "globals.h"
+#include "metrics.h"
+#include "frame.h"
+#include "quality.h"
+#include "clip.h"
+#include "mjpeg.h"
+#include <stdarg.h>
+
+#define METRICS_BUFFER (12 * KILOBYTE)
+
+const uint32_t LATENCY_BOUNDS[] = { 250, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000 };
+const uint32_t BYTES_BOUNDS[] = { 8192, 16384, 24576, 32768, 49152, 65536, 98304, 131072, 196608, 262144 };
+#define BOUNDS(b) b, sizeof(b) / sizeof(b[0])
+
+Histogram captureUs(BOUNDS(LATENCY_BOUNDS));
+Histogram publishUs(BOUNDS(LATENCY_BOUNDS));
+Histogram frameBytes(BOUNDS(BYTES_BOUNDS));
+Histogram sendUs(BOUNDS(LATENCY_BOUNDS));
+Histogram audioSendUs(BOUNDS(LATENCY_BOUNDS));
+Histogram wsAckUs(BOUNDS(LATENCY_BOUNDS));
+Histogram scaleUs(BOUNDS(LATENCY_BOUNDS));
+Counter framesCaptured;
+Counter framesPublished;
+Counter captureErrors;
+Counter framesStatic;
+Counter framesDropped;
+Counter framesSkipped;
+Counter framesSent;
+Counter framesStalled;
+Counter mjpegSendCalls;
+Counter scaleFailures;
+Counter frameRetries;
+Counter audioBlocks;
+Counter audioOverruns;
+Counter audioUnderruns;
+Counter connects[EP_COUNT];
+Counter disconnects[EP_COUNT];
+Counter bytesSent[EP_COUNT];
+
+const char* ENDPOINT_NAMES[EP_COUNT] = { "mjpeg", "jpg", "i2s", "av", "clip", "ws" };
+
+char* metricsBuf = NULL;  // Export buffer, allocated in PSRAM on first scrape
+size_t metricsLen;
+
+// Appends formatted text to the export buffer, silently truncating when it is full
+static void append(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(metricsBuf + metricsLen, METRICS_BUFFER - metricsLen, fmt, args);
+  va_end(args);
+  if (n > 0)
+    metricsLen = metricsLen + n < METRICS_BUFFER ? metricsLen + n : METRICS_BUFFER - 1;
+}
+
+static void writeHeader(const char* name, const char* type, const char* help) {
+  append("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void writeCounter(const char* name, const char* help, const Counter& c) {
+  writeHeader(name, "counter", help);
+  append("%s %u\n", name, c.value());
+}
+
+static void writeGauge(const char* name, const char* help, uint32_t value) {
+  writeHeader(name, "gauge", help);
+  append("%s %u\n", name, value);
+}
+
+static void writeEndpointCounter(const char* name, const char* help, const Counter* c) {
+  writeHeader(name, "counter", help);
+  for (int i = 0; i < EP_COUNT; i++)
+    append("%s{endpoint=\"%s\"} %u\n", name, ENDPOINT_NAMES[i], c[i].value());
+}
+
+// Writes the per-sender MJPEG metrics, labelled with the sender index and its core
+static void writeWorkers() {
+  StreamWorkerStats w[STREAM_WORKERS];
+  for (int i = 0; i < STREAM_WORKERS; i++)
+    w[i] = streamWorkerStats(i);
+
+  writeHeader("mjpeg_worker_clients", "gauge", "MJPEG clients owned by each sender task.");
+  for (int i = 0; i < STREAM_WORKERS; i++)
+    append("mjpeg_worker_clients{worker=\"%d\",core=\"%u\"} %u\n", i, w[i].core, w[i].clients);
+  writeHeader("mjpeg_worker_busy_ratio", "gauge", "Share of the last second each sender task spent servicing clients.");
+  for (int i = 0; i < STREAM_WORKERS; i++)
+    append("mjpeg_worker_busy_ratio{worker=\"%d\",core=\"%u\"} %u.%03u\n", i, w[i].core, w[i].busy / 1000, w[i].busy % 1000);
+  writeHeader("mjpeg_worker_migrations_total", "counter", "Clients each sender task handed to a less busy one.");
+  for (int i = 0; i < STREAM_WORKERS; i++)
+    append("mjpeg_worker_migrations_total{worker=\"%d\",core=\"%u\"} %u\n", i, w[i].core, w[i].migrations);
+}
+
+/**
+ * @brief Writes one histogram with cumulative buckets.
+ *
+ * @param name Metric name.
+ * @param help Description.
+ * @param h Histogram to export.
+ * @param micros true if the observations are microseconds, exported as seconds.
+ * @return void
+ */
+static void writeHistogram(const char* name, const char* help, const Histogram& h, bool micros) {
+  writeHeader(name, "histogram", help);
+  uint32_t total = 0;
+  for (size_t i = 0; i < h.bounds(); i++) {
+    total += h.bucket(i);
+    if (micros)
+      append("%s_bucket{le=\"%u.%06u\"} %u\n", name, h.bound(i) / 1000000, h.bound(i) % 1000000, total);
+    else
+      append("%s_bucket{le=\"%u\"} %u\n", name, h.bound(i), total);
+  }
+  total += h.bucket(h.bounds());
+  append("%s_bucket{le=\"+Inf\"} %u\n", name, total);
+  unsigned long long sum = h.sum();
+  if (micros)
+    append("%s_sum %llu.%06llu\n", name, sum / 1000000, sum % 1000000);
+  else
+    append("%s_sum %llu\n", name, sum);
+  append("%s_count %u\n", name, total);
+}
+
+/**
+ * @brief Serves all metrics in the Prometheus text exposition format.
+ *
+ * Counters and histograms are read with relaxed loads while the tasks keep updating
+ * them, so a scrape never blocks capture or streaming. Gauges come from the modules'
+ * own snapshots.
+ *
+ * @return void
+ */
+void MetricsHandler(void) {
+  if (metricsBuf == NULL) {
+    metricsBuf = (char*)ps_malloc(METRICS_BUFFER);
+    if (metricsBuf == NULL) {
+      server.send(503, "text/plain", "Out of memory");
+      return;
+    }
+  }
+  metricsLen = 0;
+
+  writeHistogram("camera_capture_seconds", "Time spent in esp_camera_fb_get().", captureUs, true);
+  writeHistogram("camera_publish_seconds", "Time to hand a captured frame to the readers.", publishUs, true);
+  writeHistogram("camera_scale_seconds", "Time to render one downscaled substream of a frame.", scaleUs, true);
+  writeHistogram("camera_frame_bytes", "Size of published JPEG frames.", frameBytes, false);
+  writeHistogram("mjpeg_send_seconds", "Per-client time to send one MJPEG frame.", sendUs, true);
+  writeHistogram("audio_send_seconds", "Per-client time to send one audio block.", audioSendUs, true);
+  writeHistogram("ws_ack_latency_seconds", "Capture of a frame to its acknowledgement by a WebSocket client.", wsAckUs, true);
+
+  writeCounter("camera_frames_captured_total", "Frames read from the camera.", framesCaptured);
+  writeCounter("camera_frames_published_total", "Frames published to clients.", framesPublished);
+  writeCounter("camera_capture_errors_total", "Failed frame captures.", captureErrors);
+  writeCounter("camera_frames_static_total", "Frames not published because nothing moved.", framesStatic);
+  writeCounter("camera_frames_dropped_total", "Frames dropped for lack of a handle or pool slab.", framesDropped);
+  writeCounter("mjpeg_frames_sent_total", "Frames sent completely, counted once per client.", framesSent);
+  writeCounter("mjpeg_frames_skipped_total", "Published frames a client never received.", framesSkipped);
+  writeCounter("mjpeg_frames_stalled_total", "Frames whose send had to wait for the client's socket to drain.", framesStalled);
+  writeCounter("mjpeg_send_calls_total", "Socket send calls made for MJPEG clients.", mjpegSendCalls);
+  writeCounter("mjpeg_scale_failures_total", "Downscaled substreams not rendered; their clients got the full frame.", scaleFailures);
+  writeCounter("frame_acquire_retries_total", "Frame reads retried because the frame was released meanwhile.", frameRetries);
+  writeCounter("audio_blocks_captured_total", "Audio blocks read from I2S.", audioBlocks);
+  writeCounter("audio_overruns_total", "Audio blocks lost by lagging clients.", audioOverruns);
+  writeCounter("audio_underruns_total", "Audio blocks that could not be written in one go.", audioUnderruns);
+
+  writeEndpointCounter("http_connects_total", "Streaming clients accepted.", connects);
+  writeEndpointCounter("http_disconnects_total", "Streaming clients dropped.", disconnects);
+  writeEndpointCounter("http_bytes_sent_total", "Bytes written to streaming clients.", bytesSent);
+
+  writeWorkers();
+
+  const QualityState& q = qualityState();
+  writeGauge("camera_jpeg_quality", "JPEG quality chosen by the controller (lower is better).", q.quality);
+  FramePoolStats pool = framePoolStats();
+  writeGauge("frame_pool_slabs_in_use", "Frame pool slabs holding frames.", pool.inUse);
+  writeGauge("frame_pool_high_water", "Most frame pool slabs ever in use.", pool.highWater);
+  ClipStats clip = clipStats();
+  writeGauge("clip_slabs_used", "Pre-event arena slabs holding entries.", clip.slabsUsed);
+  writeGauge("clip_window_ms", "Capture time covered by the pre-event arena.", clip.windowMs);
+  writeGauge("heap_free_bytes", "Free internal heap.", ESP.getFreeHeap());
+  // Handlers run on the HTTP task, so this is its own stack
+  writeGauge("http_stack_free_bytes", "Least stack the HTTP task has had free since boot.", uxTaskGetStackHighWaterMark(NULL));
+
+  server.send(200, "text/plain; version=0.0.4", metricsBuf, metricsLen);
+}
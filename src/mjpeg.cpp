@@ -1,6 +1,20 @@
 #include "globals.h"
 #include "stream.h"
+#include "mjpeg.h"
+#include "frame.h"
+#include "net.h"
+#include "clients.h"
+#include "quality.h"
+#include "motion.h"
+#include "clip.h"
+#include "metrics.h"
+#include "mux.h"
+#include "trace.h"
+#include "control.h"
+#include "scale.h"
+#include "ws.h"
 #include <WiFi.h>
+#include <lwip/sockets.h>
 #include "esp_camera.h"
 
 #if defined(CAMERA_MULTICLIENT_QUEUE)
@@ -9,9 +23,18 @@
 #include <AverageFilter.h>
 #define BENCHMARK_PRINT_INT 5000
 averageFilter<uint32_t> captureAvg(10);
+averageFilter<uint32_t> publishAvg(10);
+averageFilter<uint32_t> motionAvg(10);
 uint32_t lastPrintCam = millis();
 #endif
 
+#define RATE_HEADROOM 80   // Percent of a client's measured throughput its frame rate may use
+#define RATE_EWMA_SHIFT 2  // EWMA weight of a new sample: 1/4
+#define LONGPOLL_MS 10000  // /jpg?after= answers 304 if no newer frame is published by then
+#define WORKER_WINDOW_MS 1000  // Interval over which each sender measures how busy it is
+#define WORKER_BUSY_HIGH 800   // Per mille of a window spent sending above which a sender sheds a client
+#define WORKER_BUSY_MARGIN 250 // A client only moves to a sender at least this much less busy
+
 const char *HEADER = "HTTP/1.1 200 OK\r\n"
                      "Access-Control-Allow-Origin: *\r\n"
                      "Content-Type: multipart/x-mixed-replace; boundary=+++===123454321===+++\r\n";
@@ -21,234 +44,850 @@ const int hdrLen = strlen(HEADER);
 const int bdrLen = strlen(BOUNDARY);
 const int cntLen = strlen(CTNTTYPE);
 
-SemaphoreHandle_t frameSync;
 TaskHandle_t tCam;    // Camera frame capture task handle
-TaskHandle_t tStream; // Streaming task handle
-QueueHandle_t mjpegClients = xQueueCreate(5, sizeof(WiFiClient*));
 
-std::vector<uint8_t>* camBuf;   // Points to the latest captured frame for streaming
+// A sender task. MJPEG clients are sharded across the senders and only ever serviced
+// by the one that owns them; /jpg snapshots are always served by sender 0.
+struct StreamWorker {
+  TaskHandle_t task;
+  uint8_t core;
+  uint8_t clients;       // MJPEG clients owned, guarded by workerLock
+  // Clients owned by stream (full resolution, then each substream) and ?fps= cap, changed
+  // under workerLock; the camera task reads them without it for mjpegDemand()
+  std::atomic<uint8_t> demand[SCALE_COUNT + 1][CONTROL_FPS_MAX + 1];
+  uint32_t migrations;   // Clients handed to a less busy sender
+  uint32_t windowStart;  // millis() at the start of the current measurement window
+  uint32_t busyUs;       // Time spent servicing clients in the current window
+  volatile uint16_t busy; // Per mille of the last window spent servicing clients
+};
+
+StreamWorker workers[STREAM_WORKERS];
+portMUX_TYPE workerLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Per-client streaming state: a pinned frame and a write cursor into its multipart part
+struct MJPEGClient {
+  WiFiClient client;
+  Frame *frame;      // Frame being sent, pinned until its last byte is written
+  uint32_t lastSeq;  // Sequence number of the last frame sent completely
+  size_t offset;     // Bytes of the current multipart part (header, JPEG, boundary) already written
+  bool stalling;     // Socket filled up at least once while sending the current frame
+  struct iovec part[3]; // Prebuilt header, JPEG data and boundary of the current frame, shared with the other clients
+  size_t partLen;
+  size_t frameLen;   // JPEG size of the current (or last sent) frame
+  int8_t scale;      // Substream requested with ?scale=, -1 for full resolution
+  uint32_t sent;     // Frames sent completely
+  uint32_t skipped;  // Frames never sent because the client was busy or paced below the capture rate
+  uint32_t stalled;  // Frames whose send had to wait for the socket to drain
+  uint32_t sendStart; // micros() when the current frame was picked up
+  uint32_t stallStart; // micros() when the socket first filled up during the current frame
+  uint64_t stallBytes; // bytesSent at that point
+  uint32_t bps;      // EWMA of the throughput achieved while sending a frame, bytes/s
+  uint8_t fpsCap;    // Frame rate requested with ?fps=, CONTROL_FPS_MAX if none; the capture rate still caps it
+  uint8_t fps;       // Frame rate currently chosen for this client
+  uint32_t nextDue;  // micros() from which the client may pick up its next frame
+  volatile uint8_t worker; // Sender that owns the client; changed only by the owner, between frames
+  ClientStats stats;
+};
+
+// Per-request state of a /jpg snapshot: waits for a frame newer than `after`, then sends it once
+struct SnapshotClient {
+  WiFiClient client;
+  Frame *frame;      // Frame being sent, pinned until its last byte is written
+  uint32_t after;    // Only a frame with a later sequence number answers the request
+  bool subscribed;   // Holds a frameSubscribe() while waiting for a new frame
+  uint32_t deadline; // millis() at which a long-poll gives up with 304
+  uint8_t part;      // Part of the response being written (PART_HEADER or PART_BODY)
+  size_t offset;     // Bytes of the current part already written
+  char hdr[224];     // Response head for the current frame
+  size_t hdrLen;
+  ClientStats stats;
+};
+
+enum { PART_HEADER, PART_BODY, PART_DONE };
+
+ClientTable<MJPEGClient, MAX_CLIENTS> mjpegClients;
+ClientTable<SnapshotClient, MAX_CLIENTS> snapshotClients;
+std::atomic<uint32_t> mjpegBytes;  // Bytes written to all MJPEG clients, for the quality controller
 
 void streamCB(void *pvParameters);
 
 /**
- * @brief RTOS task: Continuously captures frames from the camera and updates the shared buffer.
+ * @brief Formats the multipart part header that precedes a frame in every MJPEG stream.
+ *
+ * @param buf Output, MJPEG_HEAD_MAX bytes.
+ * @param frameLen Size of the JPEG that follows.
+ * @param motion Motion score of the frame.
+ * @return Length of the header.
+ * @note Called once per frame when it is published, never per client.
+ */
+size_t mjpegPartHeader(char *buf, size_t frameLen, uint16_t motion) {
+  return snprintf(buf, MJPEG_HEAD_MAX, "%s%zu\r\nX-Motion-Score: %u\r\n\r\n", CTNTTYPE, frameLen, motion);
+}
+
+// Frame rate a client may receive at most: its ?fps= cap, limited by the capture rate
+static uint8_t clientFpsCap(const MJPEGClient *c) {
+  return c->fpsCap < cameraSettings().fps ? c->fpsCap : cameraSettings().fps;
+}
+
+/**
+ * @brief Wakes every sender, after a frame or its substreams became available.
+ *
+ * @return void
+ */
+void streamNotify() {
+  for (int i = 0; i < STREAM_WORKERS; i++)
+    xTaskNotifyGive(workers[i].task);
+}
+
+/**
+ * @brief Sums the bitrate the MJPEG clients ask for, for the quality controller.
+ *
+ * A client can only receive frames that were published, so its rate is its frame rate
+ * cap limited by the publish rate; frames dropped because nothing moved add no demand.
+ * Each client is weighted by the size of the stream it receives, so a ?scale= viewer
+ * counts with its downscaled frames. Reads the senders' demand counts rather than the
+ * client table, whose slots only their owners may look at.
+ *
+ * @param frameBytes Average size of a captured frame.
+ * @param publishedFps Frames published per second over the controller window.
+ * @param wantFps Set to the sum of the clients' frame rates.
+ * @return Demanded bytes/s.
+ * @note Only called from the camera task, through qualityUpdate().
+ */
+uint32_t mjpegDemand(uint32_t frameBytes, uint32_t publishedFps, uint32_t *wantFps) {
+  uint32_t maxFps = cameraSettings().fps < publishedFps ? cameraSettings().fps : publishedFps;
+  *wantFps = 0;
+  uint32_t demand = 0;
+  for (int s = 0; s <= SCALE_COUNT; s++) {
+    uint32_t bytes = s > 0 ? scaleFrameBytes(s - 1, frameBytes) : frameBytes;
+    for (int cap = 1; cap <= CONTROL_FPS_MAX; cap++) {
+      uint32_t clients = 0;
+      for (int i = 0; i < STREAM_WORKERS; i++)
+        clients += workers[i].demand[s][cap].load(std::memory_order_relaxed);
+      uint32_t fps = clients * (cap < maxFps ? cap : maxFps);
+      *wantFps += fps;
+      demand += bytes * fps;
+    }
+  }
+  return demand;
+}
+
+/**
+ * @brief RTOS task: Continuously captures frames from the camera and publishes them for streaming.
  *
- * Uses double buffering to avoid race conditions between capture and streaming.
- * Synchronization is handled via a semaphore to ensure the streaming task never reads a partially written frame.
+ * Frames are not copied: each driver buffer is wrapped in a reference-counted handle and
+ * returned to the driver once the streaming task has finished sending it to every client.
  *
  * @param pvParameters Unused (RTOS task parameter signature).
  * @return Never returns; runs as a FreeRTOS task.
- * @note Updates global camBuf pointer to point to the latest frame.
- * @note Blocks on frameSync semaphore to synchronize with the streaming task.
+ * @note Replaces the latest published frame; the previous one is released. Feeds every
+ *       frame to the JPEG quality controller. Frames scoring below MOTION_THRESHOLD
+ *       against the last published one are dropped, down to one per MOTION_KEEPALIVE_MS.
+ *       Applies /control changes between captures.
  */
 void camCB(void *pvParameters) {
   TickType_t xLastWakeTime;
-  const TickType_t xFrequency = pdMS_TO_TICKS(1000 / FPS);
-
-  xTaskCreatePinnedToCore(
-      streamCB,
-      "streamCB",
-      4 * KILOBYTE,
-      NULL,
-      tskIDLE_PRIORITY + 2,
-      &tStream,
-      APP_CPU);
 
-  std::vector<uint8_t> fbs[2]; // Double buffer for frames
-  int ifb = 0;                 // Index for double buffering
+  // Start the senders, alternating between the cores so viewers are not all served by one
+  for (int i = 0; i < STREAM_WORKERS; i++) {
+    char name[12];
+    snprintf(name, sizeof(name), "stream%d", i);
+    workers[i].core = i % 2 == 0 ? APP_CPU : PRO_CPU;
+    xTaskCreatePinnedToCore(
+        streamCB,
+        name,
+        4 * KILOBYTE,
+        (void *)(intptr_t)i,
+        tskIDLE_PRIORITY + 2,
+        &workers[i].task,
+        workers[i].core);
+  }
 
   xLastWakeTime = xTaskGetTickCount();
 
 #if defined(BENCHMARK)
   captureAvg.initialize();
+  publishAvg.initialize();
+  motionAvg.initialize();
 #endif
 
   camera_fb_t *fb = NULL;
+  uint32_t lastPublish = 0;
+  uint32_t staticFrames = 0;  // Captured frames not published because nothing moved
 
   for (;;) {
-#if defined(BENCHMARK)
-    uint32_t captureStart = micros();
-#endif
+    controlPoll();
+    const TickType_t xFrequency = pdMS_TO_TICKS(1000 / cameraSettings().fps);
 
+    uint32_t captureStart = micros();
     fb = esp_camera_fb_get();
-    size_t s = fb->len;
-
-    // Ensure buffer is large enough for the new frame (with some headroom to reduce reallocations)
-    if (s > fbs[ifb].capacity()) {
-      fbs[ifb].reserve(s * 4 / 3);
+    if (fb == NULL) {
+      captureErrors.inc();
+      Log.error("camCB: Frame capture failed\n");
+      vTaskDelay(xFrequency);
+      continue;
     }
-    fbs[ifb].resize(s);
 
-    memcpy(fbs[ifb].data(), fb->buf, s);
-    esp_camera_fb_return(fb);
+    uint32_t captureTime = micros() - captureStart;
+    captureUs.observe(captureTime);
+    framesCaptured.inc();
+
+#if defined(BENCHMARK)
+    captureAvg.value(captureTime);
+#endif
+
+    uint32_t motionStart = micros();
+    uint16_t motion = motionScore(fb->buf, fb->len);
+    uint32_t motionEnd = micros();
 
 #if defined(BENCHMARK)
-    captureAvg.value(micros() - captureStart);
+    motionAvg.value(motionEnd - motionStart);
+    uint32_t publishStart = micros();
 #endif
 
-    // Block until the streaming task has finished with the previous frame
-    xSemaphoreTake(frameSync, portMAX_DELAY);
+    size_t frameLen = fb->len;  // fb is released or handed over below
+    bool published = false;
+    if (motion < MOTION_THRESHOLD && millis() - lastPublish < MOTION_KEEPALIVE_MS) {
+      // Static scene: keep the last published frame and only refresh it every MOTION_KEEPALIVE_MS
+      esp_camera_fb_return(fb);
+      framesStatic.inc();
+      staticFrames++;
+      traceSpan(TRACE_CAPTURE, TRACK_CAMERA, 0, captureStart, captureStart + captureTime);
+      traceSpan(TRACE_MOTION, TRACK_CAMERA, 0, motionStart, motionEnd);
+    } else {
+      // Publish the new frame for streaming; the previous one returns to the driver once sent
+      motionCommit();
+      uint32_t handoffStart = micros();
+      Frame *frame = framePublish(fb, motion);
+      uint32_t handoffEnd = micros();
+      publishUs.observe(handoffEnd - handoffStart);
+      lastPublish = millis();
+      uint32_t seq = frame != NULL ? frame->seq : 0;
+      traceSpan(TRACE_CAPTURE, TRACK_CAMERA, seq, captureStart, captureStart + captureTime);
+      traceSpan(TRACE_MOTION, TRACK_CAMERA, seq, motionStart, motionEnd);
+      traceSpan(TRACE_PUBLISH, TRACK_CAMERA, seq, handoffStart, handoffEnd);
+      if (frame != NULL) {
+        published = true;
+        framesPublished.inc();
+        frameBytes.observe(frame->fb->len);
+        clipPush(VIDEO_TRACK, frame->fb->buf, frame->fb->len, frameTime(frame));
+      } else {
+        framesDropped.inc();
+      }
 
-    // Publish the new frame for streaming
-    camBuf = &fbs[ifb];
-    ifb = (ifb + 1) & 1; // Toggle between two buffers
+#if defined(BENCHMARK)
+      publishAvg.value(micros() - publishStart);
+#endif
 
-    // Allow the streaming task to access the new frame
-    xSemaphoreGive(frameSync);
+      // Notify the streaming tasks that a new frame is available; substreams follow once rendered
+      streamNotify();
+      xTaskNotifyGive(tMux);
+      wsNotify();
+      scaleNotify();
+    }
 
-    // Notify the streaming task that a new frame is available (only required for the first frame)
-    xTaskNotifyGive(tStream);
+    // Steer JPEG quality towards the uplink budget
+    qualityUpdate(frameLen, published, mjpegBytes.load(std::memory_order_relaxed), millis());
 
     // Maintain target frame rate
-    if (xTaskDelayUntil(&xLastWakeTime, xFrequency) != pdTRUE)
+    // Running late (slow capture or an idle wait): restart the schedule rather than catch up
+    // with a burst of frames above the target rate
+    if (xTaskDelayUntil(&xLastWakeTime, xFrequency) != pdTRUE) {
+      xLastWakeTime = xTaskGetTickCount();
       taskYIELD();
+    }
 
-    // Suspend capture if there are no active clients (saves power)
-    if (eTaskGetState(tStream) == eSuspended) {
-      vTaskSuspend(NULL);
+    // Stop capturing once no consumer is left (saves power) until frameSubscribe() notifies
+    // this task; a clip arena stays subscribed. A notification given while capturing is
+    // consumed here and only costs one more check
+    while (!frameSubscribed()) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
 
 #if defined(BENCHMARK)
     if (millis() - lastPrintCam > BENCHMARK_PRINT_INT) {
       lastPrintCam = millis();
-      Log.verbose("setupCB: average frame capture time: %d microseconds\n", captureAvg.currentValue());
+      Log.verbose("camCB: capture avg=%d us, motion avg=%d us, publish avg=%d us, static frames=%d\n", captureAvg.currentValue(), motionAvg.currentValue(), publishAvg.currentValue(), staticFrames);
+      FramePoolStats pool = framePoolStats();
+      Log.verbose("camCB: pool in use=%d/%d, high water=%d, copies=%d, oversize=%d, exhausted=%d\n", pool.inUse, pool.slabs, pool.highWater, pool.copies, pool.oversize, pool.exhausted);
     }
 #endif
   }
 }
 
+
+// Slot of a client in its sender's demand counts
+static std::atomic<uint8_t> *demandSlot(const MJPEGClient *c, int worker) {
+  return &workers[worker].demand[c->scale + 1][c->fpsCap];
+}
+
+/**
+ * @brief Assigns a new MJPEG client to the sender with the fewest clients.
+ *
+ * Ties go to the sender that was least busy over its last window.
+ *
+ * @param c Client, with its stream and frame rate cap already set.
+ * @return Index of the chosen sender; its client and demand counts already include the new client.
+ */
+static uint8_t assignWorker(const MJPEGClient *c) {
+  taskENTER_CRITICAL(&workerLock);
+  uint8_t best = 0;
+  for (int i = 1; i < STREAM_WORKERS; i++) {
+    if (workers[i].clients < workers[best].clients ||
+        (workers[i].clients == workers[best].clients && workers[i].busy < workers[best].busy))
+      best = i;
+  }
+  workers[best].clients++;
+  demandSlot(c, best)->fetch_add(1, std::memory_order_relaxed);
+  taskEXIT_CRITICAL(&workerLock);
+  return best;
+}
+
 /**
  * @brief Handles new client connections for MJPEG streaming.
  *
- * Enforces a maximum client limit and immediately sends HTTP headers to the client.
- * Adds the client to the streaming queue and resumes streaming/capture tasks if needed.
+ * Takes a free slot in the client table (answering 503 when all MAX_CLIENTS are in use)
+ * and immediately sends HTTP headers to the client. The client is handed to the least
+ * loaded sender, which is woken up along with capture if needed.
+ * An optional `?fps=` argument caps the client's frame rate below the capture rate, and
+ * `?scale=2|4|8` subscribes it to a substream downscaled in the compressed domain.
  *
  * @return void
- * @note May allocate a new WiFiClient and modify the streamingClients queue.
+ * @note Activates a slot in the mjpegClients table.
  */
 void MJPEGHandler(void) {
-  if (!uxQueueSpacesAvailable(mjpegClients)) {
+  int factor = server.hasArg("scale") ? server.arg("scale").toInt() : 1;
+  if (factor != 1 && scaleIndex(factor) < 0) {
+    server.send(400, "text/plain", "Unsupported scale, use scale=2, 4 or 8");
+    return;
+  }
+
+  MJPEGClient *c = mjpegClients.acquire();
+  if (c == NULL) {
     Log.error("handleJPGSstream: Max number of WiFi clients reached\n");
+    server.send(503, "text/plain", "Too many MJPEG clients");
     return;
   }
+  c->client = server.client();
+
+  int fps = server.hasArg("fps") ? server.arg("fps").toInt() : CONTROL_FPS_MAX;
+  c->fpsCap = fps < 1 ? 1 : fps > CONTROL_FPS_MAX ? CONTROL_FPS_MAX : fps;
+  c->fps = clientFpsCap(c);
+  c->scale = factor == 1 ? -1 : scaleIndex(factor);
+  if (c->scale >= 0)
+    scaleSubscribe(c->scale);
+
+  c->client.setTimeout(1);
+  c->client.write(HEADER, hdrLen);
+  c->client.write(BOUNDARY, bdrLen);
+  c->client.clear();
+  c->worker = assignWorker(c);
+
+  mjpegClients.activate(c);
+  connects[EP_MJPEG].inc();
 
-  WiFiClient *client = new WiFiClient();
-  if (client == NULL) {
-    Log.error("handleJPGSstream: Can not create new WiFi client - OOM\n");
+  // Resume capture if it was suspended and wake the sender up if it was idle
+  frameSubscribe();
+  xTaskNotifyGive(workers[c->worker].task);
+
+  Log.trace("handleJPGSstream: Client connected to sender %d, fps cap=%d, scale=1/%d\n", c->worker, clientFpsCap(c), factor);
+}
+
+/**
+ * @brief Handles /jpg snapshot requests from the latest published frame.
+ *
+ * Plain requests are answered with the frame already in memory, or with 304 when
+ * its ETag (the frame sequence number) matches If-None-Match. With `?after=<seq>`
+ * the request is parked until a later frame is published, for up to LONGPOLL_MS.
+ * Responses are written by the streaming task without blocking, from their own
+ * table, so snapshots never take an MJPEG slot.
+ *
+ * @return void
+ * @note Only waiting requests keep the camera running, and only until answered.
+ */
+void SnapshotHandler(void) {
+  uint32_t after = 0;
+  bool wait = server.hasArg("after");
+  if (wait) {
+    after = strtoul(server.arg("after").c_str(), NULL, 10);
+  } else {
+    Frame *frame = frameAcquire();
+    if (frame == NULL) {
+      // Nothing captured yet: wait for the first frame
+      wait = true;
+    } else {
+      char etag[16];
+      snprintf(etag, sizeof(etag), "\"%u\"", frame->seq);
+      after = frame->seq - 1;
+      frameRelease(frame);
+      if (server.header("If-None-Match") == etag) {
+        server.client().printf("HTTP/1.1 304 Not Modified\r\nETag: %s\r\nConnection: close\r\n\r\n", etag);
+        return;
+      }
+    }
+  }
+
+  SnapshotClient *c = snapshotClients.acquire();
+  if (c == NULL) {
+    Log.error("SnapshotHandler: Max number of snapshot clients reached\n");
+    server.send(503, "text/plain", "Too many snapshot clients");
     return;
   }
-  *client = server.client();
+  c->client = server.client();
+  c->after = after;
+  c->deadline = millis() + LONGPOLL_MS;
+  c->subscribed = wait;
+  snapshotClients.activate(c);
+  connects[EP_JPG].inc();
+
+  if (wait)
+    frameSubscribe();
+  xTaskNotifyGive(workers[0].task);
+}
 
-  client->setTimeout(1);
-  client->write(HEADER, hdrLen);
-  client->write(BOUNDARY, bdrLen);
-  client->clear(); 
+/**
+ * @brief Advances a snapshot response as far as its socket allows.
+ *
+ * @param c Snapshot request to service.
+ * @return 1 if any bytes were written, 0 if it is waiting (on a frame or its socket), -1 once it is finished or failed.
+ */
+int serviceSnapshot(SnapshotClient *c) {
+  if (c->frame == NULL) {
+    Frame *frame = frameAcquire();
+    if (frame == NULL || (int32_t)(frame->seq - c->after) <= 0) {
+      if ((int32_t)(millis() - c->deadline) >= 0) {
+        char buf[96];
+        int len = snprintf(buf, sizeof(buf), "HTTP/1.1 304 Not Modified\r\nETag: \"%u\"\r\nConnection: close\r\n\r\n",
+                           frame != NULL ? frame->seq : c->after);
+        netSend(c->client, buf, len);
+        if (frame != NULL)
+          frameRelease(frame);
+        return -1;
+      }
+      if (frame != NULL)
+        frameRelease(frame);
+      return 0;
+    }
 
-  xQueueSend(mjpegClients, (void *)&client, 0);
+    c->frame = frame;
+    c->part = PART_HEADER;
+    c->offset = 0;
+    c->hdrLen = snprintf(c->hdr, sizeof(c->hdr),
+                         "HTTP/1.1 200 OK\r\n"
+                         "Access-Control-Allow-Origin: *\r\n"
+                         "Content-Type: image/jpeg\r\n"
+                         "Content-Length: %zu\r\n"
+                         "ETag: \"%u\"\r\n"
+                         "X-Motion-Score: %u\r\n"
+                         "Cache-Control: no-cache\r\n"
+                         "Connection: close\r\n"
+                         "\r\n",
+                         frame->fb->len, frame->seq, frame->motion);
+  }
 
-  // Resume tasks if they were suspended due to no clients
-  if (eTaskGetState(tCam) == eSuspended)
-    vTaskResume(tCam);
-  if (eTaskGetState(tStream) == eSuspended)
-    vTaskResume(tStream);
+  int progress = 0;
+  while (c->part != PART_DONE) {
+    const uint8_t *data = c->part == PART_HEADER ? (const uint8_t *)c->hdr : c->frame->fb->buf;
+    size_t len = c->part == PART_HEADER ? c->hdrLen : c->frame->fb->len;
+
+    int w = netSend(c->client, data + c->offset, len - c->offset);
+    if (w < 0)
+      return -1;
+    if (w == 0)
+      return progress;
+
+    progress = 1;
+    c->offset += w;
+    c->stats.bytesSent += w;
+    bytesSent[EP_JPG].inc(w);
+    if (c->offset == len) {
+      c->part++;
+      c->offset = 0;
+    }
+  }
+  return -1;
+}
 
-  Log.trace("handleJPGSstream: Client connected\n");
+/**
+ * @brief Closes a snapshot request and returns its slot to the table.
+ *
+ * @param c Snapshot request to drop.
+ * @return void
+ */
+void dropSnapshot(SnapshotClient *c) {
+  Log.trace("streamCB: Snapshot %s after %d ms, %d bytes\n", c->frame != NULL ? "sent" : "expired",
+            millis() - c->stats.connectedAt, (uint32_t)c->stats.bytesSent);
+  if (c->frame != NULL)
+    frameRelease(c->frame);
+  if (c->subscribed)
+    frameUnsubscribe();
+  disconnects[EP_JPG].inc();
+  c->client.stop();
+  c->client = WiFiClient();
+  snapshotClients.release(c);
 }
 
 /**
- * @brief RTOS task: Streams the latest camera frame to all connected clients.
+ * @brief Chooses a client's frame rate from its measured throughput.
  *
- * Waits for new frames, then sends them to each client in the queue.
- * Uses a semaphore to ensure it never reads a frame while it is being updated.
- * Handles client disconnects and manages the client queue.
+ * Only a frame that filled the socket says how fast the link is: from the first stall
+ * on, bytes leave at the rate the link drains them. That drain rate is folded into the
+ * client's EWMA and the rate is set to the frames of the current average size that fit
+ * into RATE_HEADROOM percent of it. A frame the socket took without pushing back went
+ * into buffers the link had already emptied, so the rate steps up by one frame instead.
+ * A viewer on a poor link thus receives fewer whole frames instead of falling behind
+ * mid-frame and pinning old buffers.
  *
- * @param pvParameters Unused (RTOS task parameter signature).
+ * @param c Client that just finished a frame.
+ * @param now micros() when its last byte was written.
+ * @return void
+ */
+void adaptRate(MJPEGClient *c, uint32_t now) {
+  uint32_t fps = c->fps + 1;
+  if (c->stalling) {
+    uint32_t us = now - c->stallStart;
+    uint32_t bps = (c->stats.bytesSent - c->stallBytes) * 1000000 / (us ? us : 1);
+    if (c->bps == 0)
+      c->bps = bps;
+    else
+      c->bps = (int64_t)c->bps + (((int64_t)bps - c->bps) >> RATE_EWMA_SHIFT);
+    // A substream client is paced by the size of its scaled copies
+    uint32_t frameBytes = c->scale >= 0 ? c->frameLen : qualityState().frameBytes;
+    fps = (uint64_t)c->bps * RATE_HEADROOM / 100 / (frameBytes ? frameBytes : 1);
+  }
+
+  uint32_t cap = clientFpsCap(c);
+  fps = fps < 1 ? 1 : fps > cap ? cap : fps;
+  if (fps != c->fps)
+    Log.trace("streamCB: client %d rate %d -> %d fps (%d bytes/s)\n", c->client.fd(), c->fps, fps, c->bps);
+  c->fps = fps;
+}
+
+/**
+ * @brief Advances one client's send state machine as far as its socket allows.
+ *
+ * Between frames the client picks up the newest published frame once its chosen
+ * frame rate allows, skipping any it fell behind on or was paced past. The multipart part
+ * (the header prebuilt with the frame, the JPEG body and the boundary) goes out as one
+ * message with a single non-blocking send per call, resuming from the saved cursor on
+ * the next one. A substream client picks up the latest frame the scale task rendered
+ * its scale for, and is sent the shared downscaled copy, or the full frame if it did
+ * not fit.
+ *
+ * @param c Client to service.
+ * @return 1 if any bytes were written, 0 if the client is waiting (on a frame or its socket), -1 if it disconnected.
+ */
+int serviceClient(MJPEGClient *c) {
+  if (c->frame == NULL) {
+    uint32_t now = micros();
+    if (c->sent != 0 && (int32_t)(now - c->nextDue) < 0)
+      return 0;
+
+    Frame *frame = c->scale >= 0 ? frameAcquireScaled() : frameAcquire();
+    if (frame != NULL && c->scale >= 0 && !(frame->scaledMask.load(std::memory_order_acquire) & (1 << c->scale))) {
+      // Recycled for a newer frame, or rendered before this client subscribed
+      frameRelease(frame);
+      frame = NULL;
+    }
+    if (frame == NULL || frame->seq == c->lastSeq) {
+      if (frame != NULL)
+        frameRelease(frame);
+      return 0;
+    }
+    if (c->lastSeq != 0 && frame->seq > c->lastSeq + 1) {
+      c->skipped += frame->seq - c->lastSeq - 1;
+      framesSkipped.inc(frame->seq - c->lastSeq - 1);
+    }
+
+    c->frame = frame;
+    c->offset = 0;
+    c->stalling = false;
+    const ScaledJpeg *scaled = c->scale >= 0 ? &frame->scaled[c->scale] : NULL;
+    if (scaled != NULL && scaled->len) {
+      c->part[0] = { (void *)scaled->head, scaled->headLen };
+      c->part[1] = { scaled->buf, scaled->len };
+    } else {
+      c->part[0] = { frame->head, frame->headLen };
+      c->part[1] = { frame->fb->buf, frame->fb->len };
+    }
+    c->part[2] = { (void *)BOUNDARY, (size_t)bdrLen };
+    c->frameLen = c->part[1].iov_len;
+    c->partLen = c->part[0].iov_len + c->frameLen + bdrLen;
+    c->sendStart = now;
+    // Half a capture interval of slack so pacing does not alias with the camera's own rate
+    c->nextDue = now + 1000000 / c->fps - 500000 / cameraSettings().fps;
+  }
+
+  int progress = 0;
+  while (c->offset < c->partLen) {
+    int w = netSendv(c->client, c->part, 3, c->offset);
+    mjpegSendCalls.inc();
+    if (w < 0)
+      return -1;
+    if (w == 0) {
+      // Socket is full: remember the cursor and come back once it drains
+      if (!c->stalling) {
+        c->stalling = true;
+        c->stalled++;
+        framesStalled.inc();
+        c->stallStart = micros();
+        c->stallBytes = c->stats.bytesSent;
+      }
+      return progress;
+    }
+
+    progress = 1;
+    c->offset += w;
+    c->stats.bytesSent += w;
+    bytesSent[EP_MJPEG].inc(w);
+    mjpegBytes.fetch_add(w, std::memory_order_relaxed);
+  }
+
+  c->lastSeq = c->frame->seq;
+  c->sent++;
+  framesSent.inc();
+  uint32_t now = micros();
+  c->stats.lastSendUs = now - c->sendStart;
+  traceSpan(TRACE_SEND, TRACE_TRACK_CLIENT + c->client.fd(), c->lastSeq, c->sendStart, now);
+  sendUs.observe(c->stats.lastSendUs);
+  adaptRate(c, now);
+  frameRelease(c->frame);
+  c->frame = NULL;
+  return 1;
+}
+
+/**
+ * @brief Releases a client's pinned frame and returns its slot to the table.
+ *
+ * @param c Client to drop.
+ * @return void
+ */
+void dropClient(MJPEGClient *c) {
+  Log.trace("streamCB: Client disconnected after %d ms: sent=%d skipped=%d stalled=%d bytes=%d fps=%d\n",
+            millis() - c->stats.connectedAt, c->sent, c->skipped, c->stalled, (uint32_t)c->stats.bytesSent, c->fps);
+  if (c->frame != NULL)
+    frameRelease(c->frame);
+  taskENTER_CRITICAL(&workerLock);
+  workers[c->worker].clients--;
+  demandSlot(c, c->worker)->fetch_sub(1, std::memory_order_relaxed);
+  taskEXIT_CRITICAL(&workerLock);
+  if (c->scale >= 0)
+    scaleUnsubscribe(c->scale);
+  c->client.stop();
+  c->client = WiFiClient();
+  mjpegClients.release(c);
+  frameUnsubscribe();
+  disconnects[EP_MJPEG].inc();
+}
+
+/**
+ * @brief Closes a sender's measurement window and sheds a client if it fell behind.
+ *
+ * A sender that spent more than WORKER_BUSY_HIGH per mille of the window servicing
+ * its clients hands one of them, between frames, to the least busy sender, provided
+ * that one is at least WORKER_BUSY_MARGIN per mille less busy. At most one client
+ * moves per window, so the measurements can settle before the next decision.
+ *
+ * @param self Index of the calling sender.
+ * @return void
+ * @note Only called by the sender itself; a client changes owner only through its current owner.
+ */
+void rebalance(int self) {
+  StreamWorker *w = &workers[self];
+  uint32_t elapsed = millis() - w->windowStart;
+  if (elapsed < WORKER_WINDOW_MS)
+    return;
+  w->busy = (uint64_t)w->busyUs / elapsed > 1000 ? 1000 : (uint64_t)w->busyUs / elapsed;
+  w->busyUs = 0;
+  w->windowStart = millis();
+
+  if (STREAM_WORKERS < 2 || w->busy < WORKER_BUSY_HIGH || w->clients < 2)
+    return;
+  int target = self == 0 ? 1 : 0;
+  for (int i = 0; i < STREAM_WORKERS; i++) {
+    if (i != self && workers[i].busy < workers[target].busy)
+      target = i;
+  }
+  if (workers[target].busy + WORKER_BUSY_MARGIN > w->busy)
+    return;
+
+  for (size_t i = 0; i < mjpegClients.capacity(); i++) {
+    MJPEGClient *c = mjpegClients.at(i);
+    if (c == NULL || c->worker != self || c->frame != NULL)
+      continue;
+    taskENTER_CRITICAL(&workerLock);
+    demandSlot(c, self)->fetch_sub(1, std::memory_order_relaxed);
+    demandSlot(c, target)->fetch_add(1, std::memory_order_relaxed);
+    c->worker = target;
+    w->clients--;
+    workers[target].clients++;
+    w->migrations++;
+    taskEXIT_CRITICAL(&workerLock);
+    xTaskNotifyGive(workers[target].task);
+    Log.trace("streamCB: sender %d busy %d/1000, moved client %d to sender %d (busy %d/1000)\n",
+              self, w->busy, c->client.fd(), target, workers[target].busy);
+    return;
+  }
+}
+
+/**
+ * @brief Returns a sender's core, client count and load.
+ *
+ * @param worker Sender index, below STREAM_WORKERS.
+ * @return Snapshot of the sender's statistics.
+ */
+StreamWorkerStats streamWorkerStats(int worker) {
+  StreamWorkerStats s;
+  taskENTER_CRITICAL(&workerLock);
+  s.core = workers[worker].core;
+  s.clients = workers[worker].clients;
+  s.busy = workers[worker].busy;
+  s.migrations = workers[worker].migrations;
+  taskEXIT_CRITICAL(&workerLock);
+  return s;
+}
+
+/**
+ * @brief RTOS task: Streams the latest camera frame to the clients of one sender.
+ *
+ * Each client has its own cursor into a pinned frame and is written to without
+ * blocking, so a viewer on a slow link only falls behind (and skips frames)
+ * instead of holding up capture and the other clients. Sender 0 also answers
+ * pending /jpg snapshot requests the same way once their frame is available. When no client can make
+ * progress the task sleeps until a stalled socket becomes writable or the camera
+ * task signals a new frame.
+ *
+ * @param pvParameters Index of the sender in workers[].
  * @return Never returns; runs as a FreeRTOS task.
- * @note Reads from global camBuf, modifies streamingClients queue, and interacts with WiFi clients.
- * @note Blocks on frameSync semaphore to synchronize with the camera task.
+ * @note Releases slots of the mjpegClients table it owns and interacts with WiFi clients.
  */
 void streamCB(void *pvParameters) {
-  char buf[16];
-  TickType_t xLastWakeTime;
-  TickType_t xFrequency = pdMS_TO_TICKS(1000 / FPS);
+  const int self = (intptr_t)pvParameters;
 
   // Wait until the first frame is available
   ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  workers[self].windowStart = millis();
 
 #if defined(BENCHMARK)
   averageFilter<int32_t> streamAvg(10);
-  averageFilter<int32_t> waitAvg(10);
+  averageFilter<int32_t> passAvg(10);
   averageFilter<uint32_t> frameAvg(10);
-  averageFilter<float> fpsAvg(10);
-  uint32_t streamStart = 0;
   streamAvg.initialize();
-  waitAvg.initialize();
+  passAvg.initialize();
   frameAvg.initialize();
   uint32_t lastPrint = millis();
-  uint32_t lastFrame = millis();
 #endif
 
-  xLastWakeTime = xTaskGetTickCount();
   for (;;) {
-    UBaseType_t activeClients = uxQueueMessagesWaiting(mjpegClients);
-    if (activeClients) {
-      WiFiClient *client;
-
-      for (int i = 0; i < activeClients; i++) {
-        xQueueReceive(mjpegClients, (void *)&client, 0);
-
-        if (!client->connected()) {
-          // Remove disconnected clients from the queue
-          Log.trace("streamCB: Client disconnected\n");
-          delete client;
-        } else {
+    size_t activeClients = workers[self].clients + (self == 0 ? snapshotClients.count() : 0);
+    if (!activeClients) {
+      // No clients: sleep until a handler or another sender hands this one a client
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      workers[self].busyUs = 0;
+      workers[self].windowStart = millis();
+      continue;
+    }
+
 #if defined(BENCHMARK)
-          streamStart = micros();
+    bool report = millis() - lastPrint > BENCHMARK_PRINT_INT;
+    if (report)
+      lastPrint = millis();
 #endif
-          // Prevent reading a frame while it is being updated
-          xSemaphoreTake(frameSync, portMAX_DELAY);
+    uint32_t passStart = micros();
+
+    MJPEGClient *c;
+    bool progress = false;
+    bool waitingForFrame = false;
+    fd_set writable;
+    int maxFd = -1;
+    FD_ZERO(&writable);
+
+    for (size_t i = 0; i < mjpegClients.capacity(); i++) {
+      c = mjpegClients.at(i);
+      if (c == NULL || c->worker != self)
+        continue;
+
+      if (!c->client.connected()) {
+        // Free the slots of disconnected clients
+        dropClient(c);
+        continue;
+      }
 
 #if defined(BENCHMARK)
-          waitAvg.value(micros() - streamStart);
-          frameAvg.value(camBuf->size());
-          streamStart = micros();
+      uint32_t sent = c->sent;
 #endif
-
-          // Send the current frame to the client
-          sprintf(buf, "%zu\r\n\r\n", camBuf->size());
-          client->write(CTNTTYPE, cntLen);
-          client->write(buf, strlen(buf));
-          client->write((char *)camBuf->data(), camBuf->size());
-          client->write(BOUNDARY, bdrLen);
+      int r = serviceClient(c);
+      if (r < 0) {
+        dropClient(c);
+        continue;
+      }
+      progress |= r > 0;
 
 #if defined(BENCHMARK)
-          streamAvg.value(micros() - streamStart);
+      if (c->sent != sent) {
+        streamAvg.value(c->stats.lastSendUs);
+        frameAvg.value(c->frameLen);
+      }
+      if (report)
+        Log.verbose("streamCB: client %d sent=%d skipped=%d stalled=%d fps=%d/%d rate=%d bytes/s\n", c->client.fd(), c->sent, c->skipped, c->stalled, c->fps, clientFpsCap(c), c->bps);
 #endif
 
-          xSemaphoreGive(frameSync);
+      if (c->frame != NULL) {
+        // Mid-frame: wake up when this socket can take more data
+        int fd = c->client.fd();
+        FD_SET(fd, &writable);
+        if (fd > maxFd)
+          maxFd = fd;
+      } else {
+        waitingForFrame = true;
+      }
+    }
 
-          // Keep the client in the queue for the next frame
-          xQueueSend(mjpegClients, (void *)&client, 0);
-        }
+    for (size_t i = 0; self == 0 && i < snapshotClients.capacity(); i++) {
+      SnapshotClient *s = snapshotClients.at(i);
+      if (s == NULL)
+        continue;
+
+      int r = s->client.connected() ? serviceSnapshot(s) : -1;
+      if (r < 0) {
+        dropSnapshot(s);
+        continue;
+      }
+      progress |= r > 0;
+
+      if (s->frame != NULL) {
+        int fd = s->client.fd();
+        FD_SET(fd, &writable);
+        if (fd > maxFd)
+          maxFd = fd;
+      } else {
+        waitingForFrame = true;
       }
-    } else {
-      // No clients: suspend to save power
-      vTaskSuspend(NULL);
     }
 
-    if (xTaskDelayUntil(&xLastWakeTime, xFrequency) != pdTRUE)
-      taskYIELD();
+    uint32_t passTime = micros() - passStart;
+    workers[self].busyUs += passTime;
+    rebalance(self);
 
 #if defined(BENCHMARK)
-    fpsAvg.value(1000.0 / (float)(millis() - lastFrame));
-    lastFrame = millis();
+    if (progress)
+      passAvg.value(passTime);
 #endif
 
-#if defined(BENCHMARK)
-    if (millis() - lastPrint > BENCHMARK_PRINT_INT) {
-      lastPrint = millis();
-      Log.verbose("streamCB: wait avg=%d, stream avg=%d us, frame avg size=%d bytes, fps=%S\n", waitAvg.currentValue(), streamAvg.currentValue(), frameAvg.currentValue(), String(fpsAvg.currentValue()));
+    if (!progress) {
+      if (maxFd >= 0) {
+        // Poll stalled sockets, but not for so long that idle clients miss the next frame
+        struct timeval tv = { 0, (waitingForFrame ? 10 : 1000 / cameraSettings().fps) * 1000 };
+        select(maxFd + 1, NULL, &writable, NULL, &tv);
+      } else {
+        // Every client is up to date: sleep until the camera task publishes a new frame
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000 / cameraSettings().fps));
+      }
     }
+
+#if defined(BENCHMARK)
+    if (report)
+      Log.verbose("streamCB: sender %d on core %d: clients=%d, busy=%d/1000, pass avg=%d us, send avg=%d us, frame avg size=%d bytes\n", self, workers[self].core, activeClients, workers[self].busy, passAvg.currentValue(), streamAvg.currentValue(), frameAvg.currentValue());
 #endif
   }
 }
@@ -0,0 +1,71 @@
+#include "globals.h"
+#include "motion.h"
+#include "jpeg.h"
+
+int16_t* dcMaps[2];   // Luma DC per MCU: [0] frame being scored, [1] last published frame
+size_t dcCapacity;    // MCUs each map can hold
+int dcMcus[2];        // MCUs in each map, -1 if invalid
+
+/**
+ * @brief Scores how much a captured frame differs from the last published one.
+ *
+ * Extracts the luma DC term of every MCU straight from the entropy-coded data
+ * (no IDCT) and counts the MCUs whose average brightness moved by more than
+ * MOTION_BLOCK_DELTA, after taking out the shift of the whole frame's brightness. Comparing against the last published frame rather than the
+ * previous capture lets slow changes accumulate until they are published.
+ *
+ * @param buf JPEG data.
+ * @param len Size of buf.
+ * @return Changed MCUs per mille, or MOTION_UNKNOWN if either frame could not be parsed.
+ * @note Only called from the camera task.
+ */
+uint16_t motionScore(const uint8_t* buf, size_t len) {
+  static JpegInfo info;  // Too large for the camera task stack
+  if (!jpegParse(buf, len, &info))
+    return MOTION_UNKNOWN;
+
+  // Grow the maps for the largest frame seen; the resolution can change at run time
+  size_t need = (size_t)info.mcusX * info.mcusY;
+  if (need > dcCapacity) {
+    for (int i = 0; i < 2; i++) {
+      int16_t* map = (int16_t*)ps_realloc(dcMaps[i], need * sizeof(int16_t));
+      if (map == NULL) {
+        Log.error("motionScore: Out of memory for %d MCUs\n", need);
+        return MOTION_UNKNOWN;
+      }
+      dcMaps[i] = map;
+    }
+    dcCapacity = need;
+    dcMcus[1] = -1;
+  }
+
+  dcMcus[0] = jpegDcMap(&info, dcMaps[0]) ? need : -1;
+  if (dcMcus[0] < 0 || dcMcus[0] != dcMcus[1])
+    return MOTION_UNKNOWN;
+
+  // Exposure changes shift every MCU alike: take the mean shift out before comparing
+  int32_t shift = 0;
+  for (int i = 0; i < dcMcus[0]; i++)
+    shift += dcMaps[0][i] - dcMaps[1][i];
+  shift /= dcMcus[0];
+
+  int changed = 0;
+  for (int i = 0; i < dcMcus[0]; i++) {
+    if (abs(dcMaps[0][i] - dcMaps[1][i] - shift) > MOTION_BLOCK_DELTA)
+      changed++;
+  }
+  return changed * 1000 / dcMcus[0];
+}
+
+/**
+ * @brief Makes the frame last passed to motionScore() the reference for the next ones.
+ *
+ * @return void
+ * @note Call when that frame is published.
+ */
+void motionCommit() {
+  int16_t* map = dcMaps[0];
+  dcMaps[0] = dcMaps[1];
+  dcMaps[1] = map;
+  dcMcus[1] = dcMcus[0];
+}
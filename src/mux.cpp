@@ -0,0 +1,509 @@
+#include "globals.h"
+#include "mux.h"
+#include "frame.h"
+#include "i2s.h"
+#include "net.h"
+#include "clients.h"
+#include "metrics.h"
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include "esp_camera.h"
+
+#if defined(BENCHMARK)
+#define BENCHMARK_PRINT_INT 5000
+#endif
+
+#define CLUSTER_MS  5000   // Start a new cluster at least this often
+
+const char *MUX_HEADER = "HTTP/1.1 200 OK\r\n"
+                         "Access-Control-Allow-Origin: *\r\n"
+                         "Content-Type: video/x-matroska\r\n"
+                         "Connection: close\r\n"
+                         "\r\n";
+
+// Per-client muxer state: the packet in flight and the read position in both streams
+struct MuxClient {
+  WiFiClient client;
+  Frame *frame;           // Video frame being sent, pinned until its last byte is written
+  uint32_t lastSeq;       // Sequence number of the last video frame sent
+  uint32_t audioCursor;   // Next audio block to send
+  int64_t connected;      // When the client connected (us); frames captured earlier are not sent
+  int64_t t0;             // Capture time (us) mapped to timestamp 0, -1 until the first packet
+  int64_t clusterMs;      // Timestamp of the open cluster, -1 until the first packet
+  int64_t lastAudioTime;  // Capture time of the last audio block sent
+  uint8_t hdr[40];        // Cluster and SimpleBlock headers of the packet in flight
+  size_t hdrLen;
+  const uint8_t *body;    // Packet payload: JPEG in the pinned frame or PCM in the audio ring
+  size_t bodyLen;
+  size_t offset;          // Bytes of hdr + body already written
+  bool busy;              // A packet is in flight
+  bool stalling;          // Socket filled up at least once while sending the current packet
+  uint32_t videoSent;     // Video frames sent completely
+  uint32_t audioSent;     // Audio blocks sent completely
+  uint32_t skipped;       // Video frames skipped because the client was still busy
+  uint32_t overruns;      // Audio blocks lost because the client fell more than the ring depth behind
+  uint32_t stalled;       // Packets whose send had to wait for the socket to drain
+  int64_t maxSkew;        // Largest gap between a video frame and the audio sent just before it (us)
+  uint32_t sendStart;     // micros() when the current packet was picked
+  uint32_t epoch;         // muxEpoch when the container header was sent
+  ClientStats stats;
+};
+
+TaskHandle_t tMux;  // Muxing task handle
+ClientTable<MuxClient, MAX_CLIENTS> muxClients;
+std::atomic<uint32_t> muxEpoch(0);  // Bumped when the video format the headers describe changes
+
+// EBML IDs already carry their length marker, so they are written as plain big-endian bytes
+size_t ebmlId(uint8_t *p, uint32_t id) {
+  size_t n = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+  for (size_t i = 0; i < n; i++)
+    p[i] = id >> (8 * (n - 1 - i));
+  return n;
+}
+
+// The reserved all-ones 8-byte size: element extends until the parent (or stream) ends
+size_t ebmlUnknownSize(uint8_t *p) {
+  p[0] = 0x01;
+  memset(p + 1, 0xFF, 7);
+  return 8;
+}
+
+size_t ebmlUint(uint8_t *p, uint32_t id, uint64_t value) {
+  size_t n = ebmlId(p, id);
+  size_t len = 1;
+  while (len < 8 && (value >> (8 * len)))
+    len++;
+  p[n++] = 0x80 | len;
+  for (size_t i = 0; i < len; i++)
+    p[n++] = value >> (8 * (len - 1 - i));
+  return n;
+}
+
+size_t ebmlFloat(uint8_t *p, uint32_t id, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  size_t n = ebmlId(p, id);
+  p[n++] = 0x88;
+  for (int i = 7; i >= 0; i--)
+    p[n++] = bits >> (8 * i);
+  return n;
+}
+
+size_t ebmlString(uint8_t *p, uint32_t id, const char *s) {
+  size_t len = strlen(s);
+  size_t n = ebmlId(p, id);
+  p[n++] = 0x80 | len;
+  memcpy(p + n, s, len);
+  return n + len;
+}
+
+// Opens a master element with a 2-byte size placeholder; returns where to patch it
+size_t ebmlOpen(uint8_t *buf, size_t *pos, uint32_t id) {
+  *pos += ebmlId(buf + *pos, id);
+  size_t sizeAt = *pos;
+  *pos += 2;
+  return sizeAt;
+}
+
+void ebmlClose(uint8_t *buf, size_t pos, size_t sizeAt) {
+  size_t len = pos - sizeAt - 2;
+  buf[sizeAt] = 0x40 | (len >> 8);
+  buf[sizeAt + 1] = len & 0xFF;
+}
+
+/**
+ * @brief Builds the Matroska stream header: EBML header, an unknown-size Segment, Info and Tracks.
+ *
+ * Track 1 is MJPEG video, track 2 is 16-bit little-endian mono PCM. Timestamps are in milliseconds.
+ *
+ * @param buf Output buffer (256 bytes is enough).
+ * @param width Video width in pixels.
+ * @param height Video height in pixels.
+ * @return Number of bytes written.
+ */
+size_t buildContainerHeader(uint8_t *buf, uint16_t width, uint16_t height) {
+  size_t pos = 0;
+  size_t master, track, sub;
+
+  master = ebmlOpen(buf, &pos, 0x1A45DFA3);  // EBML
+  pos += ebmlUint(buf + pos, 0x4286, 1);      // EBMLVersion
+  pos += ebmlUint(buf + pos, 0x42F7, 1);      // EBMLReadVersion
+  pos += ebmlUint(buf + pos, 0x42F2, 4);      // EBMLMaxIDLength
+  pos += ebmlUint(buf + pos, 0x42F3, 8);      // EBMLMaxSizeLength
+  pos += ebmlString(buf + pos, 0x4282, "matroska");
+  pos += ebmlUint(buf + pos, 0x4287, 4);      // DocTypeVersion
+  pos += ebmlUint(buf + pos, 0x4285, 2);      // DocTypeReadVersion (SimpleBlock)
+  ebmlClose(buf, pos, master);
+
+  // Live stream: the Segment never ends
+  pos += ebmlId(buf + pos, 0x18538067);
+  pos += ebmlUnknownSize(buf + pos);
+
+  master = ebmlOpen(buf, &pos, 0x1549A966);   // Info
+  pos += ebmlUint(buf + pos, 0x2AD7B1, 1000000);  // TimestampScale: 1 ms
+  pos += ebmlString(buf + pos, 0x4D80, "esp32-cam-i2s-rtos");  // MuxingApp
+  pos += ebmlString(buf + pos, 0x5741, "esp32-cam-i2s-rtos");  // WritingApp
+  ebmlClose(buf, pos, master);
+
+  master = ebmlOpen(buf, &pos, 0x1654AE6B);   // Tracks
+
+  track = ebmlOpen(buf, &pos, 0xAE);          // TrackEntry
+  pos += ebmlUint(buf + pos, 0xD7, VIDEO_TRACK);    // TrackNumber
+  pos += ebmlUint(buf + pos, 0x73C5, VIDEO_TRACK);  // TrackUID
+  pos += ebmlUint(buf + pos, 0x83, 1);        // TrackType: video
+  pos += ebmlUint(buf + pos, 0x9C, 0);        // FlagLacing
+  pos += ebmlString(buf + pos, 0x86, "V_MJPEG");
+  sub = ebmlOpen(buf, &pos, 0xE0);            // Video
+  pos += ebmlUint(buf + pos, 0xB0, width);
+  pos += ebmlUint(buf + pos, 0xBA, height);
+  ebmlClose(buf, pos, sub);
+  ebmlClose(buf, pos, track);
+
+  track = ebmlOpen(buf, &pos, 0xAE);          // TrackEntry
+  pos += ebmlUint(buf + pos, 0xD7, AUDIO_TRACK);
+  pos += ebmlUint(buf + pos, 0x73C5, AUDIO_TRACK);
+  pos += ebmlUint(buf + pos, 0x83, 2);        // TrackType: audio
+  pos += ebmlUint(buf + pos, 0x9C, 0);
+  pos += ebmlString(buf + pos, 0x86, "A_PCM/INT/LIT");
+  sub = ebmlOpen(buf, &pos, 0xE1);            // Audio
+  pos += ebmlFloat(buf + pos, 0xB5, SAMPLE_RATE_HZ);  // SamplingFrequency
+  pos += ebmlUint(buf + pos, 0x9F, 1);        // Channels
+  pos += ebmlUint(buf + pos, 0x6264, 16);     // BitDepth
+  ebmlClose(buf, pos, sub);
+  ebmlClose(buf, pos, track);
+
+  ebmlClose(buf, pos, master);
+  return pos;
+}
+
+/**
+ * @brief Writes the headers of a SimpleBlock, preceded by a new cluster when needed.
+ *
+ * Clusters are written with unknown size, so nothing has to be buffered to learn their length.
+ *
+ * @param hdr Output buffer (40 bytes is enough).
+ * @param clusterMs Timestamp of the open cluster, -1 before the first block; updated.
+ * @param ms Timestamp of the block in milliseconds.
+ * @param track Track number of the payload.
+ * @param len Payload size in bytes.
+ * @return Number of bytes written.
+ */
+size_t muxBlockHeader(uint8_t *hdr, int64_t *clusterMs, int64_t ms, uint8_t track, size_t len) {
+  size_t pos = 0;
+  if (*clusterMs < 0 || ms - *clusterMs >= CLUSTER_MS) {
+    pos += ebmlId(hdr, 0x1F43B675);       // Cluster
+    pos += ebmlUnknownSize(hdr + pos);
+    pos += ebmlUint(hdr + pos, 0xE7, ms);  // Timestamp
+    *clusterMs = ms;
+  }
+
+  // SimpleBlock with a 4-byte size: track, relative timestamp, keyframe flag
+  int16_t rel = ms - *clusterMs;
+  size_t blockLen = 4 + len;
+  hdr[pos++] = 0xA3;
+  hdr[pos++] = 0x10 | (blockLen >> 24);
+  hdr[pos++] = blockLen >> 16;
+  hdr[pos++] = blockLen >> 8;
+  hdr[pos++] = blockLen;
+  hdr[pos++] = 0x80 | track;
+  hdr[pos++] = rel >> 8;
+  hdr[pos++] = rel;
+  hdr[pos++] = 0x80;
+  return pos;
+}
+
+/**
+ * @brief Prepares a SimpleBlock for the given payload, opening a new cluster when needed.
+ *
+ * @param c Client to prepare the packet for.
+ * @param track Track number of the payload.
+ * @param time Capture time of the payload on the esp_timer clock (us).
+ * @param body Payload, referenced (not copied) until the packet is sent.
+ * @param len Payload size in bytes.
+ * @return void
+ */
+void startPacket(MuxClient *c, uint8_t track, int64_t time, const uint8_t *body, size_t len) {
+  if (c->t0 < 0)
+    c->t0 = time;
+  int64_t ms = (time - c->t0) / 1000;
+  if (ms < 0)
+    ms = 0;
+
+  c->hdrLen = muxBlockHeader(c->hdr, &c->clusterMs, ms, track, len);
+  c->body = body;
+  c->bodyLen = len;
+  c->offset = 0;
+  c->busy = true;
+  c->stalling = false;
+  c->sendStart = micros();
+}
+
+/**
+ * @brief Picks the next packet for a client in capture-time order.
+ *
+ * The earliest of the next audio block and the newest unsent video frame goes first.
+ * Video is held back while the audio covering its capture time is still being recorded,
+ * unless audio capture has stalled, so the two tracks stay interleaved. Frames captured
+ * before the client connected are not sent at all.
+ *
+ * @param c Client to pick a packet for.
+ * @return true if a packet was prepared, false if nothing is ready yet.
+ */
+bool nextPacket(MuxClient *c) {
+  uint32_t head = audioHeadSeq();
+  if (head > c->audioCursor && head - c->audioCursor > AUDIO_RING_BLOCKS - 1) {
+    c->overruns += head - c->audioCursor - (AUDIO_RING_BLOCKS - 1);
+    audioOverruns.inc(head - c->audioCursor - (AUDIO_RING_BLOCKS - 1));
+    c->audioCursor = head - (AUDIO_RING_BLOCKS - 1);
+  }
+
+  size_t audioLen = 0;
+  int64_t audioTime = 0;
+  const uint8_t *audio = audioBlock(c->audioCursor, &audioLen, &audioTime);
+
+  Frame *frame = frameAcquire();
+  if (frame != NULL && (frame->seq == c->lastSeq || frameTime(frame) < c->connected)) {
+    frameRelease(frame);
+    frame = NULL;
+  }
+
+  if (audio != NULL && (frame == NULL || audioTime <= frameTime(frame))) {
+    if (frame != NULL)
+      frameRelease(frame);
+    startPacket(c, AUDIO_TRACK, audioTime, audio, audioLen);
+    c->lastAudioTime = audioTime;
+    c->audioCursor++;
+    return true;
+  }
+
+  if (frame == NULL)
+    return false;
+
+  int64_t videoTime = frameTime(frame);
+  size_t lastLen;
+  int64_t lastTime;
+  bool covered = head > 0 && audioBlock(head - 1, &lastLen, &lastTime) != NULL &&
+                 lastTime + BLOCK_US >= videoTime;
+  if (!covered && esp_timer_get_time() - videoTime < 4 * BLOCK_US) {
+    frameRelease(frame);
+    return false;
+  }
+
+  if (c->lastSeq != 0 && frame->seq > c->lastSeq + 1) {
+    c->skipped += frame->seq - c->lastSeq - 1;
+    framesSkipped.inc(frame->seq - c->lastSeq - 1);
+  }
+  if (c->audioSent != 0 && videoTime - c->lastAudioTime > c->maxSkew)
+    c->maxSkew = videoTime - c->lastAudioTime;
+
+  c->frame = frame;
+  startPacket(c, VIDEO_TRACK, videoTime, frame->fb->buf, frame->fb->len);
+  return true;
+}
+
+/**
+ * @brief Writes as many packets to a client as its socket accepts without blocking.
+ *
+ * @param c Client to service.
+ * @return 1 if any bytes were written, 0 if the client is waiting (on data or its socket), -1 if it disconnected.
+ */
+int serviceMuxClient(MuxClient *c) {
+  int progress = 0;
+  for (;;) {
+    if (!c->busy && !nextPacket(c))
+      return progress;
+
+    while (c->offset < c->hdrLen + c->bodyLen) {
+      const uint8_t *data;
+      size_t len;
+      if (c->offset < c->hdrLen) {
+        data = c->hdr + c->offset;
+        len = c->hdrLen - c->offset;
+      } else {
+        data = c->body + (c->offset - c->hdrLen);
+        len = c->bodyLen - (c->offset - c->hdrLen);
+      }
+
+      int w = netSend(c->client, data, len);
+      if (w < 0)
+        return -1;
+      if (w == 0) {
+        if (!c->stalling) {
+          c->stalling = true;
+          c->stalled++;
+        }
+        return progress;
+      }
+      progress = 1;
+      c->offset += w;
+      c->stats.bytesSent += w;
+      bytesSent[EP_AV].inc(w);
+    }
+    c->stats.lastSendUs = micros() - c->sendStart;
+
+    if (c->frame != NULL) {
+      c->lastSeq = c->frame->seq;
+      frameRelease(c->frame);
+      c->frame = NULL;
+      c->videoSent++;
+    } else {
+      c->audioSent++;
+    }
+    c->busy = false;
+  }
+}
+
+/**
+ * @brief Releases a client's pinned frame and stream subscriptions and frees its slot.
+ *
+ * @param c Client to drop.
+ * @return void
+ */
+void dropMuxClient(MuxClient *c) {
+  Log.trace("muxCB: Client disconnected after %d ms: video=%d audio=%d skipped=%d overruns=%d stalled=%d bytes=%d\n",
+            millis() - c->stats.connectedAt, c->videoSent, c->audioSent, c->skipped, c->overruns, c->stalled, (uint32_t)c->stats.bytesSent);
+  if (c->frame != NULL)
+    frameRelease(c->frame);
+  c->client.stop();
+  c->client = WiFiClient();
+  muxClients.release(c);
+  frameUnsubscribe();
+  disconnects[EP_AV].inc();
+  audioUnsubscribe();
+}
+
+/**
+ * @brief Makes the muxing task close every open client.
+ *
+ * Their Tracks header carries the old frame size, so a client cannot follow a
+ * resolution change and has to reconnect for a new header.
+ *
+ * @return void
+ * @note Call before the first frame in the new format is published.
+ */
+void muxCloseAll() {
+  muxEpoch.fetch_add(1, std::memory_order_release);
+  xTaskNotifyGive(tMux);
+}
+
+/**
+ * @brief Handles new client connections for the combined audio/video stream.
+ *
+ * Sends the HTTP and Matroska headers, then hands the client to the muxing task.
+ * Answers 503 when all MAX_CLIENTS slots are in use.
+ *
+ * @return void
+ * @note Activates a slot in the muxClients table.
+ */
+void MuxHandler(void) {
+  MuxClient *c = muxClients.acquire();
+  if (c == NULL) {
+    Log.error("MuxHandler: Max number of WiFi clients reached\n");
+    server.send(503, "text/plain", "Too many audio/video clients");
+    return;
+  }
+  c->client = server.client();
+  c->connected = esp_timer_get_time();
+  c->t0 = -1;
+  c->clusterMs = -1;
+  c->audioCursor = audioHeadSeq();
+  c->epoch = muxEpoch.load(std::memory_order_acquire);
+
+  uint8_t hdr[256];
+  sensor_t *s = esp_camera_sensor_get();
+  size_t len = buildContainerHeader(hdr, resolution[s->status.framesize].width, resolution[s->status.framesize].height);
+
+  c->client.setTimeout(1);
+  c->client.write(MUX_HEADER, strlen(MUX_HEADER));
+  c->client.write(hdr, len);
+  c->client.clear();
+
+  muxClients.activate(c);
+  connects[EP_AV].inc();
+
+  // Both capture tasks must run for this client
+  frameSubscribe();
+  audioSubscribe();
+  xTaskNotifyGive(tMux);
+
+  Log.trace("MuxHandler: Client connected\n");
+}
+
+/**
+ * @brief RTOS task: Muxes JPEG frames and PCM blocks into one Matroska stream per client.
+ *
+ * Both tracks are stamped from the esp_timer clock (frame timestamp and I2S block
+ * capture time) and written as interleaved SimpleBlocks straight from the frame and
+ * audio buffers, so memory use does not grow with the stream. Woken by the capture
+ * tasks whenever a frame or block is published.
+ *
+ * @param pvParameters Unused (RTOS task parameter signature).
+ * @return Never returns; runs as a FreeRTOS task.
+ */
+void muxCB(void *pvParameters) {
+  const TickType_t xFrequency = pdMS_TO_TICKS(BLOCK_US / 1000);
+
+#if defined(BENCHMARK)
+  uint32_t lastPrint = millis();
+#endif
+
+  for (;;) {
+    size_t activeClients = muxClients.count();
+    if (!activeClients) {
+      // No clients: sleep until the handler hands this task one
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+#if defined(BENCHMARK)
+    bool report = millis() - lastPrint > BENCHMARK_PRINT_INT;
+    if (report)
+      lastPrint = millis();
+#endif
+
+    MuxClient *c;
+    bool progress = false;
+    fd_set writable;
+    int maxFd = -1;
+    FD_ZERO(&writable);
+
+    for (size_t i = 0; i < muxClients.capacity(); i++) {
+      c = muxClients.at(i);
+      if (c == NULL)
+        continue;
+
+      bool current = c->epoch == muxEpoch.load(std::memory_order_acquire);
+      int r = c->client.connected() && current ? serviceMuxClient(c) : -1;
+      if (r < 0) {
+        dropMuxClient(c);
+        continue;
+      }
+      progress |= r > 0;
+
+#if defined(BENCHMARK)
+      if (report) {
+        Log.verbose("muxCB: client %d video=%d audio=%d skipped=%d overruns=%d stalled=%d max skew=%d us\n",
+                    c->client.fd(), c->videoSent, c->audioSent, c->skipped, c->overruns, c->stalled, (int32_t)c->maxSkew);
+        c->maxSkew = 0;
+      }
+#endif
+
+      if (c->stalling) {
+        int fd = c->client.fd();
+        FD_SET(fd, &writable);
+        if (fd > maxFd)
+          maxFd = fd;
+      }
+    }
+
+    if (!progress) {
+      if (maxFd >= 0) {
+        struct timeval tv = { 0, (long)BLOCK_US };
+        select(maxFd + 1, NULL, &writable, NULL, &tv);
+      } else {
+        // Sleep until either capture task publishes something
+        ulTaskNotifyTake(pdTRUE, xFrequency);
+      }
+    }
+  }
+}
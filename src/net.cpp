@@ -0,0 +1,117 @@
+#include "globals.h"
+#include "net.h"
+#include <lwip/sockets.h>
+#include <esp_vfs_eventfd.h>
+
+/**
+ * @brief Writes as much of a buffer as the socket accepts without blocking.
+ *
+ * Unlike WiFiClient::write(), which retries until the whole buffer is sent or the
+ * timeout expires, this returns as soon as the socket send buffer is full so one
+ * slow peer cannot hold up the task serving it.
+ *
+ * @param client Connected client to write to.
+ * @param buf Data to send.
+ * @param len Number of bytes to send.
+ * @return Bytes accepted by the socket (0 if it is currently full), or -1 if the connection failed.
+ */
+int netSend(WiFiClient& client, const void* buf, size_t len) {
+  int w = send(client.fd(), buf, len, MSG_DONTWAIT);
+  if (w < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  return w;
+}
+
+/**
+ * @brief Writes a message made of several buffers with one non-blocking send.
+ *
+ * The buffers go to lwIP in a single sendmsg() call, which copies them into the
+ * same segments, so a small header ahead of a large body does not leave a short
+ * segment of its own.
+ *
+ * @param client Connected client to write to.
+ * @param parts Buffers making up the message, in order.
+ * @param count Number of buffers, at most 4.
+ * @param offset Bytes of the message already written; skipped.
+ * @return Bytes accepted by the socket (0 if it is currently full), or -1 if the connection failed.
+ */
+int netSendv(WiFiClient& client, const struct iovec* parts, int count, size_t offset) {
+  struct iovec iov[4];
+  int n = 0;
+  for (int i = 0; i < count && n < 4; i++) {
+    if (offset >= parts[i].iov_len) {
+      offset -= parts[i].iov_len;
+      continue;
+    }
+    iov[n].iov_base = (uint8_t*)parts[i].iov_base + offset;
+    iov[n].iov_len = parts[i].iov_len - offset;
+    offset = 0;
+    n++;
+  }
+  if (n == 0)
+    return 0;
+
+  struct msghdr msg = {};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+  int w = sendmsg(client.fd(), &msg, MSG_DONTWAIT);
+  if (w < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  return w;
+}
+
+/**
+ * @brief Reads whatever the socket has buffered without blocking.
+ *
+ * @param client Connected client to read from.
+ * @param buf Destination buffer.
+ * @param len Size of the buffer; must not be 0.
+ * @return Bytes read (0 if nothing is buffered), or -1 if the peer closed the connection or it failed.
+ */
+int netRecv(WiFiClient& client, void* buf, size_t len) {
+  int r = recv(client.fd(), buf, len, MSG_DONTWAIT);
+  if (r < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  return r == 0 ? -1 : r;
+}
+
+/**
+ * @brief Opens a descriptor other tasks can signal to end a select() in progress.
+ *
+ * A task notification cannot interrupt select(), so a task that waits on its sockets
+ * and on the capture tasks at once adds this eventfd to its readable set instead.
+ *
+ * @return Descriptor for netWake() and select(), or -1 if none could be created.
+ */
+int netWakeOpen() {
+  esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+  esp_err_t err = esp_vfs_eventfd_register(&config);
+  if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+    return -1;
+  return eventfd(0, 0);
+}
+
+/**
+ * @brief Makes a wake descriptor readable, ending the select() waiting on it.
+ *
+ * @param fd Descriptor from netWakeOpen().
+ * @return void
+ */
+void netWake(int fd) {
+  uint64_t one = 1;
+  write(fd, &one, sizeof(one));
+}
+
+/**
+ * @brief Consumes the signals of a wake descriptor that select() reported readable.
+ *
+ * @param fd Descriptor from netWakeOpen().
+ * @return void
+ */
+void netWakeClear(int fd) {
+  uint64_t count;
+  read(fd, &count, sizeof(count));
+}
@@ -0,0 +1,152 @@
+#include "globals.h"
+#include "quality.h"
+#include "control.h"
+#include "mjpeg.h"
+#include "esp_camera.h"
+
+#define BUDGET_BPS    (TARGET_KBPS * 1000 / 8)
+#define OVER_PCT      110  // Demand above this share of the budget counts as over
+#define UNDER_PCT     75   // Demand below this share of the budget counts as under
+#define DELIVERED_PCT 90   // Sends falling below this share of the demand mean the links are congested
+#define HOLD_OVER     2    // Windows over budget before coarsening
+#define HOLD_UNDER    4    // Windows under budget before refining
+#define STEP_OVER     2    // Quality steps per coarsening
+#define STEP_UNDER    1    // Quality steps per refinement
+
+QualityState quality = { JPEG_QUALITY };
+uint32_t windowStart;
+uint32_t windowBytes;  // sentBytes at windowStart
+uint32_t windowPublished;  // Frames published since windowStart
+QualityDemand demandOf = mjpegDemand;
+
+/**
+ * @brief Programs a new JPEG quality into the sensor.
+ *
+ * @param q set_quality value.
+ * @return void
+ */
+static void applyQuality(int q) {
+  sensor_t* s = esp_camera_sensor_get();
+  if (s == NULL || s->set_quality(s, q) != 0) {
+    Log.error("quality: set_quality(%d) failed\n", q);
+    return;
+  }
+  quality.quality = q;
+}
+
+/**
+ * @brief Closed-loop JPEG quality controller, called by the camera task once per frame.
+ *
+ * Tracks the captured frame size and, once per QUALITY_WINDOW_MS, compares the bitrate
+ * the clients ask for against TARGET_KBPS and against what the sends actually delivered.
+ * Clients only ask for frames that were published, up to their requested frame rates,
+ * so frames the camera task dropped as static add no demand (see mjpegDemand()).
+ * Quality is coarsened after HOLD_OVER windows over budget or congested, and refined
+ * only after HOLD_UNDER windows comfortably under it; the dead band between UNDER_PCT and OVER_PCT and the unequal
+ * hold times keep it from oscillating. It never refines past the configured quality.
+ *
+ * @param frameLen Size of the frame just captured.
+ * @param published Whether the frame was published to the clients.
+ * @param sentBytes Running count of bytes written to MJPEG clients.
+ * @param now millis() when the frame was captured.
+ * @return void
+ */
+void qualityUpdate(size_t frameLen, bool published, uint32_t sentBytes, uint32_t now) {
+  quality.frameBytes = quality.frameBytes ? quality.frameBytes + (((int32_t)frameLen - (int32_t)quality.frameBytes) >> 2) : frameLen;
+  if (published)
+    windowPublished++;
+
+  uint32_t elapsed = now - windowStart;
+  if (elapsed < QUALITY_WINDOW_MS)
+    return;
+  quality.sentBps = (uint64_t)(sentBytes - windowBytes) * 1000 / elapsed;
+  quality.publishedFps = (windowPublished * 1000 + elapsed / 2) / elapsed;
+  windowStart += elapsed;
+  windowBytes = sentBytes;
+  windowPublished = 0;
+
+  quality.demandBps = demandOf(quality.frameBytes, quality.publishedFps, &quality.wantFps);
+  if (quality.wantFps == 0) {
+    quality.pressure = 0;
+    return;
+  }
+
+  bool congested = (uint64_t)quality.sentBps * 100 < (uint64_t)quality.demandBps * DELIVERED_PCT;
+  bool over = (uint64_t)quality.demandBps * 100 > (uint64_t)BUDGET_BPS * OVER_PCT || congested;
+  bool under = (uint64_t)quality.demandBps * 100 < (uint64_t)BUDGET_BPS * UNDER_PCT && !congested;
+
+  if (over)
+    quality.pressure = quality.pressure > 0 ? quality.pressure + 1 : 1;
+  else if (under)
+    quality.pressure = quality.pressure < 0 ? quality.pressure - 1 : -1;
+  else
+    quality.pressure = 0;
+
+  int q = quality.quality;
+  int best = cameraSettings().quality;
+  if (quality.pressure >= HOLD_OVER && q < QUALITY_WORST) {
+    q = q + STEP_OVER > QUALITY_WORST ? QUALITY_WORST : q + STEP_OVER;
+    quality.raised++;
+  } else if (quality.pressure <= -HOLD_UNDER && q > best) {
+    q = q - STEP_UNDER < best ? best : q - STEP_UNDER;
+    quality.lowered++;
+  } else {
+    return;
+  }
+
+  Log.notice("quality: %d -> %d (frame=%d bytes, demand=%d B/s, sent=%d B/s, budget=%d B/s)\n",
+             quality.quality, q, quality.frameBytes, quality.demandBps, quality.sentBps, BUDGET_BPS);
+  quality.pressure = 0;
+  applyQuality(q);
+}
+
+/**
+ * @brief Restarts the controller from the configured quality.
+ *
+ * Forgets the average frame size and the pressure built up so far, since both
+ * describe frames taken with the previous settings.
+ *
+ * @return void
+ * @note Only called from the camera task.
+ */
+void qualityReset() {
+  quality.frameBytes = 0;
+  quality.pressure = 0;
+  applyQuality(cameraSettings().quality);
+}
+
+/**
+ * @brief Replaces the source of the clients' demand, mjpegDemand() by default.
+ *
+ * @param demand Function returning the bytes/s the clients ask for.
+ * @return void
+ * @note For the unit tests, which drive the controller without MJPEG clients.
+ */
+void qualitySetDemand(QualityDemand demand) {
+  demandOf = demand;
+}
+
+/**
+ * @brief Returns the controller state for monitoring.
+ *
+ * @return Current controller state.
+ */
+const QualityState& qualityState() {
+  return quality;
+}
+
+/**
+ * @brief Reports the quality controller state as JSON.
+ *
+ * @return void
+ */
+void QualityHandler(void) {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "{\"quality\":%d,\"best\":%d,\"worst\":%d,\"frameBytes\":%u,\"publishedFps\":%u,\"wantFps\":%u,"
+           "\"demandBps\":%u,\"sentBps\":%u,\"budgetBps\":%u,\"pressure\":%d,\"raised\":%u,\"lowered\":%u}",
+           quality.quality, cameraSettings().quality, QUALITY_WORST, quality.frameBytes, quality.publishedFps,
+           quality.wantFps, quality.demandBps,
+           quality.sentBps, BUDGET_BPS, quality.pressure, quality.raised, quality.lowered);
+  server.send(200, "application/json", buf);
+}
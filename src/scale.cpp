@@ -0,0 +1,652 @@
+#include "globals.h"
+#include "scale.h"
+#include "frame.h"
+#include "jpeg.h"
+#include "metrics.h"
+#include "trace.h"
+#include "mjpeg.h"
+#include <math.h>
+
+#define SCALE_HEADROOM 2048  // Output bytes reserved for headers beyond the scaled entropy-coded data
+
+// Zigzag index of each coefficient, in row-major (vertical, horizontal frequency) order
+const uint8_t ZIGZAG[64] = {
+   0,  1,  5,  6, 14, 15, 27, 28,
+   2,  4,  7, 13, 16, 26, 29, 42,
+   3,  8, 12, 17, 25, 30, 41, 43,
+   9, 11, 18, 24, 31, 40, 44, 53,
+  10, 19, 23, 32, 39, 45, 52, 54,
+  20, 22, 33, 38, 46, 51, 55, 60,
+  21, 34, 37, 47, 50, 56, 59, 61,
+  35, 36, 48, 49, 57, 58, 62, 63,
+};
+
+// Huffman tables of JPEG Annex K.3, written into every downscaled frame
+const uint8_t DC_LUMA_BITS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const uint8_t DC_CHROMA_BITS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+const uint8_t DC_VALS[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+const uint8_t AC_LUMA_BITS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const uint8_t AC_LUMA_VALS[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+const uint8_t AC_CHROMA_BITS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+const uint8_t AC_CHROMA_VALS[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+  0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+  0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+  0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+  0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+  0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa,
+};
+
+// Code and length of every symbol of an encoding table
+struct HuffCodes {
+  uint16_t code[256];
+  uint8_t size[256];
+};
+
+// Entropy-coded output with byte stuffing; full is set once it runs out of space
+struct BitWriter {
+  uint8_t* p;
+  uint8_t* end;
+  uint32_t acc;
+  int n;
+  bool full;
+};
+
+HuffCodes dcCodes[2], acCodes[2];  // [0] luma, [1] chroma
+float cosTables[4][64];            // Basis of the 1, 2, 4 and 8 point DCT, [x * m + u]
+bool scaleTablesReady = false;
+int16_t* band = NULL;              // Scaled pixels of one output MCU row, every component
+size_t bandCapacity = 0;           // int16_t values band can hold
+std::atomic<int> scaleSubscribers[SCALE_COUNT];
+std::atomic<uint32_t> scaleBytes[SCALE_COUNT];  // EWMA of the rendered sizes, 0 until a frame was rendered
+uint8_t* scaleMem = NULL;  // Substream buffers of every frame handle, in one PSRAM allocation
+TaskHandle_t tScale;       // Substream rendering task handle
+
+/**
+ * @brief Assigns the canonical code of every symbol of a DHT table.
+ *
+ * @param t Codes to fill.
+ * @param bits Number of codes of each length 1..16.
+ * @param vals Symbols in code order.
+ * @return void
+ */
+static void buildCodes(HuffCodes* t, const uint8_t* bits, const uint8_t* vals) {
+  int code = 0, k = 0;
+  for (int l = 1; l <= 16; l++) {
+    for (int i = 0; i < bits[l - 1]; i++, k++, code++) {
+      t->code[vals[k]] = code;
+      t->size[vals[k]] = l;
+    }
+    code <<= 1;
+  }
+}
+
+/**
+ * @brief Builds the Huffman codes and DCT bases on first use.
+ *
+ * Row x of the m point table holds c(u)/2 * cos((2x + 1)u pi / 2m), so the 8 point one
+ * is the orthonormal 8x8 DCT and the smaller ones keep its scaling: applied to the
+ * m x m lowest coefficients of a block they reconstruct the block shrunk m/8 times.
+ *
+ * @return void
+ */
+static void tablesInit() {
+  if (scaleTablesReady)
+    return;
+  buildCodes(&dcCodes[0], DC_LUMA_BITS, DC_VALS);
+  buildCodes(&dcCodes[1], DC_CHROMA_BITS, DC_VALS);
+  buildCodes(&acCodes[0], AC_LUMA_BITS, AC_LUMA_VALS);
+  buildCodes(&acCodes[1], AC_CHROMA_BITS, AC_CHROMA_VALS);
+  for (int t = 0; t < 4; t++) {
+    int m = 1 << t;
+    for (int x = 0; x < m; x++) {
+      for (int u = 0; u < m; u++)
+        cosTables[t][x * m + u] = (u == 0 ? M_SQRT1_2 : 1.0f) / 2 * cosf((2 * x + 1) * u * (float)M_PI / (2 * m));
+    }
+  }
+  scaleTablesReady = true;
+}
+
+static inline const float* cosTable(int m) {
+  return cosTables[m == 1 ? 0 : m == 2 ? 1 : m == 4 ? 2 : 3];
+}
+
+static inline void putByte(BitWriter* w, uint8_t byte) {
+  if (w->p < w->end)
+    *w->p++ = byte;
+  else
+    w->full = true;
+}
+
+static inline void put16(BitWriter* w, uint16_t v) {
+  putByte(w, v >> 8);
+  putByte(w, v & 0xFF);
+}
+
+// Appends the low `size` bits of `bits`, stuffing a zero after every 0xFF byte
+static inline void putBits(BitWriter* w, uint32_t bits, int size) {
+  w->acc = (w->acc << size) | (bits & ((1u << size) - 1));
+  w->n += size;
+  while (w->n >= 8) {
+    uint8_t byte = w->acc >> (w->n - 8);
+    w->n -= 8;
+    putByte(w, byte);
+    if (byte == 0xFF)
+      putByte(w, 0);
+  }
+}
+
+/**
+ * @brief Entropy-codes one block of quantized coefficients.
+ *
+ * @param w Output.
+ * @param q 64 coefficients in zigzag order.
+ * @param pred DC predictor of the block's component; updated.
+ * @param table 0 for the luma tables, 1 for the chroma tables.
+ * @return void
+ */
+static void encodeBlock(BitWriter* w, const int16_t* q, int* pred, int table) {
+  const HuffCodes* dc = &dcCodes[table];
+  const HuffCodes* ac = &acCodes[table];
+  int diff = q[0] - *pred;
+  *pred = q[0];
+  int a = diff < 0 ? -diff : diff;
+  int nb = a ? 32 - __builtin_clz(a) : 0;
+  putBits(w, dc->code[nb], dc->size[nb]);
+  if (nb)
+    putBits(w, diff < 0 ? diff - 1 : diff, nb);
+
+  int run = 0;
+  for (int k = 1; k < 64; k++) {
+    int v = q[k];
+    if (v == 0) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      putBits(w, ac->code[0xF0], ac->size[0xF0]);
+      run -= 16;
+    }
+    a = v < 0 ? -v : v;
+    nb = 32 - __builtin_clz(a);
+    putBits(w, ac->code[run << 4 | nb], ac->size[run << 4 | nb]);
+    putBits(w, v < 0 ? v - 1 : v, nb);
+    run = 0;
+  }
+  if (run)
+    putBits(w, ac->code[0x00], ac->size[0x00]);
+}
+
+/**
+ * @brief Reconstructs a block shrunk `factor` times from its low-frequency coefficients.
+ *
+ * Only the m x m lowest coefficients are dequantized and inverse transformed; the
+ * rest of the block is never touched. For 1/8 that is the DC term alone.
+ *
+ * @param coef 64 quantized coefficients in zigzag order.
+ * @param qt Quantization table of the block, zigzag order.
+ * @param m Side of the reduced block (8 / factor).
+ * @param dst First pixel of the reduced block (level shifted, -128..127).
+ * @param stride Pixels per row of dst.
+ * @return void
+ */
+static void reduceBlock(const int16_t* coef, const uint16_t* qt, int m, int16_t* dst, size_t stride) {
+  const float* t = cosTable(m);
+  float f[4][4], tmp[4][4];
+  for (int v = 0; v < m; v++) {
+    for (int u = 0; u < m; u++) {
+      int k = ZIGZAG[v * 8 + u];
+      f[v][u] = coef[k] * qt[k];
+    }
+  }
+  for (int v = 0; v < m; v++) {
+    for (int x = 0; x < m; x++) {
+      float s = 0;
+      for (int u = 0; u < m; u++)
+        s += t[x * m + u] * f[v][u];
+      tmp[v][x] = s;
+    }
+  }
+  for (int y = 0; y < m; y++) {
+    for (int x = 0; x < m; x++) {
+      float s = 0;
+      for (int v = 0; v < m; v++)
+        s += t[y * m + v] * tmp[v][x];
+      int p = lrintf(s);
+      dst[y * stride + x] = p < -128 ? -128 : p > 127 ? 127 : p;
+    }
+  }
+}
+
+/**
+ * @brief Transforms, quantizes and entropy-codes one 8x8 output block of the band.
+ *
+ * @param w Output.
+ * @param plane Band of the block's component.
+ * @param stride Pixels per band row; columns past it repeat the last one.
+ * @param x0 Left column of the block in the band.
+ * @param y0 Top row of the block in the band.
+ * @param qt Quantization table, zigzag order.
+ * @param pred DC predictor of the component; updated.
+ * @param table 0 for the luma tables, 1 for the chroma tables.
+ * @return void
+ */
+static void encodeScaled(BitWriter* w, const int16_t* plane, size_t stride, size_t x0, size_t y0,
+                         const uint16_t* qt, int* pred, int table) {
+  const float* t = cosTable(8);
+  float tmp[8][8];
+  for (int y = 0; y < 8; y++) {
+    const int16_t* row = plane + (y0 + y) * stride;
+    float p[8];
+    for (int x = 0; x < 8; x++)
+      p[x] = row[x0 + x < stride ? x0 + x : stride - 1];
+    for (int u = 0; u < 8; u++) {
+      float s = 0;
+      for (int x = 0; x < 8; x++)
+        s += t[x * 8 + u] * p[x];
+      tmp[y][u] = s;
+    }
+  }
+
+  int16_t q[64];
+  for (int v = 0; v < 8; v++) {
+    for (int u = 0; u < 8; u++) {
+      float s = 0;
+      for (int y = 0; y < 8; y++)
+        s += t[y * 8 + v] * tmp[y][u];
+      int k = ZIGZAG[v * 8 + u];
+      int c = lrintf(s / qt[k]);
+      q[k] = c < -1023 ? -1023 : c > 1023 ? 1023 : c;
+    }
+  }
+  encodeBlock(w, q, pred, table);
+}
+
+/**
+ * @brief Writes SOI and the table, frame and scan headers of the downscaled image.
+ *
+ * The quantization tables of the source are kept, so quality stays comparable; the
+ * Huffman tables are the Annex K ones, which cover every symbol the encoder can emit.
+ *
+ * @param w Output.
+ * @param info Source headers.
+ * @param width Width of the downscaled image.
+ * @param height Height of the downscaled image.
+ * @return void
+ */
+static void writeHeaders(BitWriter* w, const JpegInfo* info, uint16_t width, uint16_t height) {
+  put16(w, 0xFFD8);
+
+  uint8_t written = 0;
+  for (int i = 0; i < info->ncomp; i++) {
+    uint8_t tq = info->comp[i].tq;
+    if (written & (1 << tq))
+      continue;
+    written |= 1 << tq;
+    bool wide = false;
+    for (int k = 0; k < 64; k++)
+      wide |= info->qt[tq][k] > 255;
+    put16(w, 0xFFDB);
+    put16(w, 3 + 64 * (wide ? 2 : 1));
+    putByte(w, (wide ? 0x10 : 0) | tq);
+    for (int k = 0; k < 64; k++) {
+      if (wide)
+        put16(w, info->qt[tq][k]);
+      else
+        putByte(w, info->qt[tq][k]);
+    }
+  }
+
+  put16(w, 0xFFC0);
+  put16(w, 8 + 3 * info->ncomp);
+  putByte(w, 8);
+  put16(w, height);
+  put16(w, width);
+  putByte(w, info->ncomp);
+  for (int i = 0; i < info->ncomp; i++) {
+    putByte(w, info->comp[i].id);
+    putByte(w, info->comp[i].h << 4 | info->comp[i].v);
+    putByte(w, info->comp[i].tq);
+  }
+
+  const uint8_t* bits[4] = { DC_LUMA_BITS, AC_LUMA_BITS, DC_CHROMA_BITS, AC_CHROMA_BITS };
+  const uint8_t* vals[4] = { DC_VALS, AC_LUMA_VALS, DC_VALS, AC_CHROMA_VALS };
+  const uint8_t classes[4] = { 0x00, 0x10, 0x01, 0x11 };
+  put16(w, 0xFFC4);
+  put16(w, 2 + 2 * (17 + sizeof(DC_VALS)) + 2 * (17 + sizeof(AC_LUMA_VALS)));
+  for (int t = 0; t < 4; t++) {
+    putByte(w, classes[t]);
+    int total = 0;
+    for (int l = 0; l < 16; l++) {
+      putByte(w, bits[t][l]);
+      total += bits[t][l];
+    }
+    for (int k = 0; k < total; k++)
+      putByte(w, vals[t][k]);
+  }
+
+  put16(w, 0xFFDA);
+  put16(w, 6 + 2 * info->ncomp);
+  putByte(w, info->ncomp);
+  for (int i = 0; i < info->ncomp; i++) {
+    putByte(w, info->comp[i].id);
+    putByte(w, i == 0 ? 0x00 : 0x11);
+  }
+  putByte(w, 0);
+  putByte(w, 63);
+  putByte(w, 0);
+}
+
+/**
+ * @brief Downscales a baseline JPEG by 2, 4 or 8 without decoding it to full size.
+ *
+ * The source is entropy-decoded one MCU row at a time. Of every block only the
+ * (8 / factor)^2 lowest coefficients are used, inverse transformed straight to the
+ * reduced size; `factor` input MCU rows then make up one output MCU row, which is
+ * transformed, quantized with the source's tables and Huffman-coded again. No
+ * full-resolution pixel is ever produced, and memory use is one MCU row of the output.
+ *
+ * @param in Source JPEG.
+ * @param len Size of the source.
+ * @param factor 2, 4 or 8.
+ * @param out Output buffer.
+ * @param cap Size of the output buffer.
+ * @return Size of the downscaled JPEG, or 0 if the source is not a supported baseline
+ *         JPEG, is corrupt, or the result does not fit in cap.
+ * @note Uses static state; only called from the scale task.
+ */
+size_t jpegDownscale(const uint8_t* in, size_t len, int factor, uint8_t* out, size_t cap) {
+  static JpegInfo info;  // Too large for the scale task stack
+  if ((factor != 2 && factor != 4 && factor != 8) || !jpegParse(in, len, &info))
+    return 0;
+  tablesInit();
+
+  const int m = 8 / factor;
+  uint16_t width = (info.width + factor - 1) / factor;
+  uint16_t height = (info.height + factor - 1) / factor;
+  int outMcusX = (width + 8 * info.hmax - 1) / (8 * info.hmax);
+  int outMcusY = (height + 8 * info.vmax - 1) / (8 * info.vmax);
+
+  // The band holds `factor` input MCU rows of every component at the reduced size
+  size_t offset[3], stride[3], total = 0;
+  for (int i = 0; i < info.ncomp; i++) {
+    stride[i] = (size_t)info.mcusX * info.comp[i].h * m;
+    offset[i] = total;
+    total += stride[i] * 8 * info.comp[i].v;
+  }
+  if (total > bandCapacity) {
+    int16_t* grown = (int16_t*)ps_realloc(band, total * sizeof(int16_t));
+    if (grown == NULL) {
+      Log.error("jpegDownscale: Out of memory for a %d pixel band\n", total);
+      return 0;
+    }
+    band = grown;
+    bandCapacity = total;
+  }
+
+  BitWriter w = { out, out + cap, 0, 0, false };
+  writeHeaders(&w, &info, width, height);
+
+  JpegBits b;
+  jpegBitsBegin(&b, &info);
+  int16_t coef[64];
+  int pred[3] = { 0, 0, 0 };
+  size_t mcu = 0;  // Source MCUs decoded, for restart intervals
+  int inRow = 0;
+
+  for (int oy = 0; oy < outMcusY; oy++) {
+    for (int r = 0; r < factor; r++) {
+      if (inRow == info.mcusY) {
+        // Past the bottom of the source: repeat its last pixel row
+        for (int i = 0; i < info.ncomp; i++) {
+          int rows = info.comp[i].v * m;
+          int16_t* last = band + offset[i] + (r * rows - 1) * stride[i];
+          for (int y = 0; y < rows; y++)
+            memcpy(last + (y + 1) * stride[i], last, stride[i] * sizeof(int16_t));
+        }
+        continue;
+      }
+
+      for (int mx = 0; mx < info.mcusX; mx++, mcu++) {
+        if (info.restart && mcu && mcu % info.restart == 0 && !jpegRestart(&b, &info))
+          return 0;
+        for (int i = 0; i < info.ncomp; i++) {
+          JpegComponent* c = &info.comp[i];
+          for (int by = 0; by < c->v; by++) {
+            for (int bx = 0; bx < c->h; bx++) {
+              if (!jpegDecodeBlock(&b, &info, c, coef))
+                return 0;
+              size_t x = (mx * c->h + bx) * m;
+              size_t y = (r * c->v + by) * m;
+              reduceBlock(coef, info.qt[c->tq], m, band + offset[i] + y * stride[i] + x, stride[i]);
+            }
+          }
+        }
+      }
+      inRow++;
+    }
+
+    for (int ox = 0; ox < outMcusX; ox++) {
+      for (int i = 0; i < info.ncomp; i++) {
+        const JpegComponent* c = &info.comp[i];
+        for (int by = 0; by < c->v; by++) {
+          for (int bx = 0; bx < c->h; bx++)
+            encodeScaled(&w, band + offset[i], stride[i], (ox * c->h + bx) * 8, by * 8, info.qt[c->tq], &pred[i], i == 0 ? 0 : 1);
+        }
+      }
+      if (w.full)
+        return 0;
+    }
+  }
+
+  // Pad the last byte with ones and close the image
+  if (w.n > 0)
+    putBits(&w, 0x7F, 7);
+  put16(&w, 0xFFD9);
+  return w.full ? 0 : w.p - out;
+}
+
+/**
+ * @brief Maps a downscaling factor to its substream.
+ *
+ * @param factor 2, 4 or 8.
+ * @return Substream index, or -1 for any other factor.
+ */
+int scaleIndex(int factor) {
+  return factor == 2 ? 0 : factor == 4 ? 1 : factor == 8 ? 2 : -1;
+}
+
+/**
+ * @brief Returns the downscaling factor of a substream.
+ *
+ * @param index Substream index, below SCALE_COUNT.
+ * @return 2, 4 or 8.
+ */
+int scaleFactor(int index) {
+  return 2 << index;
+}
+
+/**
+ * @brief Allocates the substream buffers of every frame handle, once per frame size.
+ *
+ * Each scale gets twice its share of the frame's pixels plus SCALE_HEADROOM; a frame
+ * whose copy does not fit is not rendered at that scale, and its clients get the full
+ * frame instead. Nothing is allocated while rendering.
+ *
+ * @param handles Frame handles to equip.
+ * @param count Number of handles.
+ * @param frameBytes Largest frame size expected at the current resolution.
+ * @return void
+ * @note Called from framePoolSetup(), while no handle is in use.
+ */
+void scaleSetup(Frame* handles, size_t count, size_t frameBytes) {
+  size_t cap[SCALE_COUNT], total = 0;
+  for (int i = 0; i < SCALE_COUNT; i++) {
+    int factor = scaleFactor(i);
+    cap[i] = frameBytes / (factor * factor) * 2 + SCALE_HEADROOM;
+    total += cap[i];
+    scaleBytes[i].store(0, std::memory_order_relaxed);
+  }
+
+  free(scaleMem);
+  scaleMem = (uint8_t*)ps_malloc(count * total);
+  if (scaleMem == NULL)
+    Log.error("scaleSetup: Allocation of %d x %d bytes failed, substreams get full frames\n", count, total);
+
+  uint8_t* p = scaleMem;
+  for (size_t h = 0; h < count; h++) {
+    for (int i = 0; i < SCALE_COUNT; i++) {
+      ScaledJpeg* s = &handles[h].scaled[i];
+      s->buf = p;
+      s->cap = p != NULL ? cap[i] : 0;
+      s->len = 0;
+      if (p != NULL)
+        p += cap[i];
+    }
+  }
+}
+
+/**
+ * @brief Registers a client of a substream, so published frames are rendered at its scale.
+ *
+ * @param index Substream index.
+ * @return void
+ */
+void scaleSubscribe(int index) {
+  scaleSubscribers[index]++;
+  xTaskNotifyGive(tScale);
+}
+
+/**
+ * @brief Drops a client of a substream; the scale stops being rendered once none are left.
+ *
+ * @param index Substream index.
+ * @return void
+ */
+void scaleUnsubscribe(int index) {
+  scaleSubscribers[index]--;
+  xTaskNotifyGive(tScale);
+}
+
+// Substreams with at least one client, one bit per index
+static uint8_t scaleWanted() {
+  uint8_t wanted = 0;
+  for (int i = 0; i < SCALE_COUNT; i++) {
+    if (scaleSubscribers[i].load(std::memory_order_relaxed) > 0)
+      wanted |= 1 << i;
+  }
+  return wanted;
+}
+
+/**
+ * @brief Wakes the scale task after a frame was published, if any substream has clients.
+ *
+ * @return void
+ * @note Called from the camera task; costs nothing while no ?scale= client is connected.
+ */
+void scaleNotify() {
+  if (scaleWanted())
+    xTaskNotifyGive(tScale);
+}
+
+/**
+ * @brief Returns the average size of a substream's frames.
+ *
+ * @param index Substream index.
+ * @param frameBytes Average size of a full-resolution frame, used until the scale was rendered.
+ * @return Average rendered size, or an estimate from the pixel count.
+ */
+uint32_t scaleFrameBytes(int index, uint32_t frameBytes) {
+  uint32_t bytes = scaleBytes[index].load(std::memory_order_relaxed);
+  int factor = scaleFactor(index);
+  return bytes ? bytes : frameBytes / (factor * factor);
+}
+
+/**
+ * @brief Renders the requested scales of a published frame.
+ *
+ * Each scale is produced once per frame into the handle's own buffer and shared
+ * by every client of that scale, then marked in scaledMask so its clients can pick
+ * it up. A scale that does not fit its buffer is marked but left empty, and its
+ * clients get the full frame instead.
+ *
+ * @param frame Pinned published frame.
+ * @param wanted Scales to render, one bit per index; those already rendered are skipped.
+ * @return void
+ * @note Only called from the scale task.
+ */
+static void scaleFrame(Frame* frame, uint8_t wanted) {
+  const camera_fb_t* fb = frame->fb;
+  for (int i = 0; i < SCALE_COUNT; i++) {
+    if (!(wanted & (1 << i)) || (frame->scaledMask.load(std::memory_order_relaxed) & (1 << i)))
+      continue;
+
+    ScaledJpeg* s = &frame->scaled[i];
+    uint32_t start = micros();
+    s->len = s->cap ? jpegDownscale(fb->buf, fb->len, scaleFactor(i), s->buf, s->cap) : 0;
+    uint32_t end = micros();
+
+    if (s->len == 0) {
+      scaleFailures.inc();
+    } else {
+      s->headLen = mjpegPartHeader(s->head, s->len, frame->motion);
+      uint32_t avg = scaleBytes[i].load(std::memory_order_relaxed);
+      scaleBytes[i].store(avg ? avg + (((int32_t)s->len - (int32_t)avg) >> 2) : s->len, std::memory_order_relaxed);
+      scaleUs.observe(end - start);
+      traceSpan(TRACE_SCALE, TRACK_SCALE, frame->seq, start, end);
+    }
+    frame->scaledMask.fetch_or(1 << i, std::memory_order_release);
+  }
+}
+
+/**
+ * @brief RTOS task: Renders the downscaled substreams of the latest published frame.
+ *
+ * Runs beside capture rather than on it, so rendering a large frame delays only the
+ * ?scale= clients. Frames published while a render is in progress are skipped, and
+ * the substreams then run at a lower rate than the camera. Each rendered frame is
+ * handed to the senders with framePublishScaled().
+ *
+ * @param pvParameters Unused (RTOS task parameter signature).
+ * @return Never returns; runs as a FreeRTOS task.
+ * @note Woken by scaleNotify() on every publish and by every (un)subscription.
+ */
+void scaleCB(void* pvParameters) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    uint8_t wanted = scaleWanted();
+    if (!wanted) {
+      // No substream clients: stop pinning the last rendered frame
+      framePublishScaled(NULL);
+      continue;
+    }
+
+    Frame* frame = frameAcquire();
+    if (frame == NULL)
+      continue;
+    if ((frame->scaledMask.load(std::memory_order_acquire) & wanted) != wanted) {
+      scaleFrame(frame, wanted);
+      framePublishScaled(frame);
+      streamNotify();
+    }
+    frameRelease(frame);
+  }
+}
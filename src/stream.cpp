@@ -1,6 +1,14 @@
 #include "globals.h"
 #include "mjpeg.h"
 #include "i2s.h"
+#include "mux.h"
+#include "quality.h"
+#include "clip.h"
+#include "metrics.h"
+#include "ws.h"
+#include "trace.h"
+#include "control.h"
+#include "scale.h"
 #include <WiFi.h>
 
 
@@ -16,7 +24,16 @@
 void handleNotFound() {
   String message;
   message += "INMP441 Wav stream available at: <a href='http://"  + server.hostHeader() + String(I2S_URL)   + "'>http://" + server.hostHeader() + String(I2S_URL)   + "</a><br>";
-  message += "OV2640 MJPEG stream available at: <a href='http://" + server.hostHeader() + String(MJPEG_URL) + "'>http://" + server.hostHeader() + String(MJPEG_URL) + "</a>";
+  message += "OV2640 MJPEG stream available at: <a href='http://" + server.hostHeader() + String(MJPEG_URL) + "'>http://" + server.hostHeader() + String(MJPEG_URL) + "</a><br>";
+  message += "Downscaled MJPEG substreams at: <a href='http://" + server.hostHeader() + String(MJPEG_URL) + "?scale=4'>http://" + server.hostHeader() + String(MJPEG_URL) + "?scale=2|4|8</a><br>";
+  message += "OV2640 JPEG snapshot available at: <a href='http://" + server.hostHeader() + String(JPG_URL) + "'>http://" + server.hostHeader() + String(JPG_URL) + "</a><br>";
+  message += "Matroska audio/video stream available at: <a href='http://" + server.hostHeader() + String(AV_URL) + "'>http://" + server.hostHeader() + String(AV_URL) + "</a><br>";
+  message += "Buffered audio/video (Matroska, builds with CLIP_ARENA_KB) available at: <a href='http://" + server.hostHeader() + String(CLIP_URL) + "'>http://" + server.hostHeader() + String(CLIP_URL) + "?seconds=N</a><br>";
+  message += "WebSocket frame stream (acknowledged, ?audio=1 adds audio) at: ws://" + server.hostHeader() + String(WS_URL) + "<br>";
+  message += "JPEG quality controller state at: <a href='http://" + server.hostHeader() + String(QUALITY_URL) + "'>http://" + server.hostHeader() + String(QUALITY_URL) + "</a><br>";
+  message += "Latency trace (Chrome trace JSON, ?enable=1 to start) at: <a href='http://" + server.hostHeader() + String(TRACE_URL) + "'>http://" + server.hostHeader() + String(TRACE_URL) + "</a><br>";
+  message += "Camera settings (?framesize=, quality=, fps=, xclk= to change) at: <a href='http://" + server.hostHeader() + String(CONTROL_URL) + "'>http://" + server.hostHeader() + String(CONTROL_URL) + "</a><br>";
+  message += "Prometheus metrics at: <a href='http://" + server.hostHeader() + String(METRICS_URL) + "'>http://" + server.hostHeader() + String(METRICS_URL) + "</a>";
   server.send(200, "text/html", message);
 } 
 
@@ -24,20 +41,32 @@ void handleNotFound() {
  * @brief RTOS task: Initializes streaming infrastructure and runs the main web server loop.
  *
  * Sets up synchronization primitives, launches the camera capture task, and registers HTTP handlers.
- * The main loop services HTTP clients and yields to other RTOS tasks at a fixed interval.
+ * The main loop blocks until a connection or request arrives and dispatches it immediately.
  *
  * @param pvParameters Unused (RTOS task parameter signature).
  * @return Never returns; runs as a FreeRTOS task.
- * @note Initializes global frameSync semaphore, starts camera and web server tasks, and handles HTTP requests.
+ * @note Starts the capture, streaming and web server tasks, and handles HTTP requests.
  */
 void setupCB(void* pvParameters) {
-  TickType_t xLastWakeTime;
-  const TickType_t xFrequency = pdMS_TO_TICKS(WSINTERVAL);
-
+  // Launch the audio/video muxing task first: both capture tasks notify it
+  xTaskCreatePinnedToCore(
+      muxCB,
+      "mux",
+      4 * KILOBYTE,
+      NULL,
+      tskIDLE_PRIORITY + 2,
+      &tMux,
+      APP_CPU);
 
-  // Create frame synchronization semaphore (binary) and set it to available
-  frameSync = xSemaphoreCreateBinary();
-  xSemaphoreGive(frameSync);
+  // Launch substream rendering on the protocol core, below the senders so it only takes spare time
+  xTaskCreatePinnedToCore(
+      scaleCB,
+      "scale",
+      4 * KILOBYTE,
+      NULL,
+      tskIDLE_PRIORITY + 1,
+      &tScale,
+      PRO_CPU);
 
   // Launch camera capture RTOS task on the application core
   xTaskCreatePinnedToCore(
@@ -49,18 +78,48 @@ void setupCB(void* pvParameters) {
       &tCam,        // Task handle
       APP_CPU);     // Core
 
+  // Launch audio capture above the streaming tasks so a slow send never overflows the I2S DMA
   xTaskCreatePinnedToCore(
       micCB, 
       "microphone", 
       4 * KILOBYTE, 
       NULL, 
-      tskIDLE_PRIORITY + 1, 
+      tskIDLE_PRIORITY + 3, 
       &tMic, 
       APP_CPU);
 
-  // Register HTTP handlers for MJPEG stream and 404s
+  // Launch the clip download task, then start filling the pre-event arena
+  xTaskCreatePinnedToCore(
+      clipCB,
+      "clip",
+      4 * KILOBYTE,
+      NULL,
+      tskIDLE_PRIORITY + 1,
+      &tClip,
+      APP_CPU);
+  clipSetup();
+
+  // Launch the WebSocket streaming task
+  xTaskCreatePinnedToCore(
+      wsCB,
+      "ws",
+      4 * KILOBYTE,
+      NULL,
+      tskIDLE_PRIORITY + 2,
+      &tWs,
+      APP_CPU);
+
+  // Register HTTP handlers for the MJPEG, audio, muxed and WebSocket streams, monitoring, control and 404s
   server.on(MJPEG_URL, HTTP_GET, MJPEGHandler);
+  server.on(JPG_URL, HTTP_GET, SnapshotHandler);
   server.on(I2S_URL, HTTP_GET, I2SHandler);
+  server.on(AV_URL, HTTP_GET, MuxHandler);
+  server.on(CLIP_URL, HTTP_GET, ClipHandler);
+  server.on(METRICS_URL, HTTP_GET, MetricsHandler);
+  server.on(QUALITY_URL, HTTP_GET, QualityHandler);
+  server.on(WS_URL, HTTP_GET, WSHandler);
+  server.on(TRACE_URL, HTTP_GET, TraceHandler);
+  server.on(CONTROL_URL, HTTP_GET, ControlHandler);
   server.onNotFound(handleNotFound);
 
   // Start the web server
@@ -69,13 +128,9 @@ void setupCB(void* pvParameters) {
   Log.trace("setupCB: Starting streaming service\n");
   Log.verbose("setupCB: free heap (start)  : %d\n", ESP.getFreeHeap());
 
-  // Main server loop: handle HTTP clients and yield to other tasks
-  xLastWakeTime = xTaskGetTickCount();
+  // Main server loop: sleeps in select() until there is network activity to serve
   for (;;) {
     server.handleClient();
-
-    // Yield to other tasks and maintain a fixed interval between iterations
-    if (xTaskDelayUntil(&xLastWakeTime, xFrequency) != pdTRUE ) taskYIELD();
   }
 }
 
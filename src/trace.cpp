@@ -0,0 +1,125 @@
+#include "globals.h"
+#include "trace.h"
+
+#define TRACE_FLUSH_BYTES 2048  // Output buffered before each write to the client
+
+// One completed span. stamp is written last and holds the ring position it was
+// recorded at, so a reader can tell a complete event from one being overwritten.
+struct TraceEvent {
+  uint32_t start;
+  uint32_t dur;
+  uint32_t id;
+  uint8_t name;
+  uint8_t track;
+  std::atomic<uint32_t> stamp;
+};
+
+const char* TRACE_NAME_STRINGS[TRACE_NAMES] = { "capture", "motion", "publish", "send", "i2s_read", "audio_send", "scale" };
+
+std::atomic<bool> traceOn(false);
+TraceEvent* traceRing = NULL;        // Allocated in PSRAM the first time tracing is switched on
+std::atomic<uint32_t> traceHead(0);  // Events recorded so far
+
+/**
+ * @brief Appends a completed span to the ring without locking.
+ *
+ * Any task on either core may record; each claims its own slot with one atomic add.
+ *
+ * @param name What the span measured.
+ * @param track Task or client the span belongs to.
+ * @param id Frame or audio block sequence number.
+ * @param start micros() at the start of the span.
+ * @param end micros() at its end.
+ * @return void
+ */
+void traceRecord(TraceName name, uint8_t track, uint32_t id, uint32_t start, uint32_t end) {
+  uint32_t pos = traceHead.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent* e = &traceRing[pos % TRACE_EVENTS];
+  e->stamp.store(0, std::memory_order_relaxed);
+  e->start = start;
+  e->dur = end - start;
+  e->id = id;
+  e->name = name;
+  e->track = track;
+  e->stamp.store(pos + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Switches tracing on or off, or dumps the ring as Chrome Trace Event JSON.
+ *
+ * `/trace?enable=1` starts recording (allocating the ring on first use) and
+ * `/trace?enable=0` stops it. A plain `/trace` writes every complete event in the ring,
+ * oldest first, as "X" (complete) events with their sequence number in args; load the
+ * file in chrome://tracing or Perfetto. Recording carries on during a dump, so events
+ * overwritten while it is written are left out.
+ *
+ * @return void
+ */
+void TraceHandler(void) {
+  if (server.hasArg("enable")) {
+    bool on = server.arg("enable").toInt() != 0;
+    if (on && traceRing == NULL) {
+      traceRing = (TraceEvent*)ps_calloc(TRACE_EVENTS, sizeof(TraceEvent));
+      if (traceRing == NULL) {
+        server.send(503, "text/plain", "Out of memory");
+        return;
+      }
+    }
+    traceOn.store(on);
+    Log.trace("TraceHandler: tracing %s\n", on ? "on" : "off");
+    server.send(200, "application/json", on ? "{\"tracing\":true}" : "{\"tracing\":false}");
+    return;
+  }
+  if (traceRing == NULL) {
+    server.send(404, "text/plain", "Tracing was never enabled, use ?enable=1");
+    return;
+  }
+
+  char* buf = (char*)ps_malloc(TRACE_FLUSH_BYTES + 256);
+  if (buf == NULL) {
+    server.send(503, "text/plain", "Out of memory");
+    return;
+  }
+  WiFiClient client = server.client();
+  client.setTimeout(1);
+  client.print("HTTP/1.1 200 OK\r\n"
+               "Access-Control-Allow-Origin: *\r\n"
+               "Content-Type: application/json\r\n"
+               "Connection: close\r\n"
+               "\r\n");
+
+  size_t len = sprintf(buf,
+                       "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+                       "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"camera\"}},"
+                       "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"microphone\"}},"
+                       "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"scale\"}}",
+                       TRACK_CAMERA, TRACK_MIC, TRACK_SCALE);
+  uint32_t head = traceHead.load(std::memory_order_acquire);
+  uint32_t first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+  uint32_t written = 0;
+  for (uint32_t pos = first; pos != head; pos++) {
+    TraceEvent* e = &traceRing[pos % TRACE_EVENTS];
+    if (e->stamp.load(std::memory_order_acquire) != pos + 1)
+      continue;
+    TraceEvent copy;
+    copy.start = e->start;
+    copy.dur = e->dur;
+    copy.id = e->id;
+    copy.name = e->name;
+    copy.track = e->track;
+    if (e->stamp.load(std::memory_order_acquire) != pos + 1 || copy.name >= TRACE_NAMES)
+      continue;
+
+    len += sprintf(buf + len, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%u,\"dur\":%u,\"args\":{\"seq\":%u}}",
+                   TRACE_NAME_STRINGS[copy.name], copy.track, copy.start, copy.dur, copy.id);
+    written++;
+    if (len >= TRACE_FLUSH_BYTES) {
+      client.write((const uint8_t*)buf, len);
+      len = 0;
+    }
+  }
+  len += sprintf(buf + len, "]}\n");
+  client.write((const uint8_t*)buf, len);
+  free(buf);
+  Log.trace("TraceHandler: dumped %d events\n", written);
+}
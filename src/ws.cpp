@@ -0,0 +1,480 @@
+#include "globals.h"
+#include "ws.h"
+#include "frame.h"
+#include "i2s.h"
+#include "net.h"
+#include "clients.h"
+#include "metrics.h"
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <mbedtls/sha1.h>
+#include <mbedtls/base64.h>
+#include "esp_camera.h"
+
+#if defined(BENCHMARK)
+#define BENCHMARK_PRINT_INT 5000
+#endif
+
+#define WS_RX_MAX 64  // Client messages are acks; anything longer than this is refused
+#define WS_POLL_MS 5  // select() timeout while a client is ready, only used if the wake descriptor could not be opened
+
+const char *WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// A video message that was sent but not acknowledged yet
+struct WSInflight {
+  uint32_t seq;
+  int64_t time;     // Capture time of the frame (esp_timer, us)
+  uint32_t sentAt;  // millis() when its last byte was written
+};
+
+// Per-client state: the message in flight, the ack window and the partial client message
+struct WSClient {
+  WiFiClient client;
+  bool audio;             // Audio blocks are sent as well (?audio=1)
+  uint8_t window;         // Video messages allowed in flight before an ack
+  Frame *frame;           // Video frame being sent, pinned until its last byte is written
+  uint32_t lastSeq;       // Sequence number of the last video frame sent
+  WSInflight inflight[WS_WINDOW_MAX];  // Unacknowledged video messages, oldest first
+  uint8_t unacked;
+  uint32_t audioCursor;   // Next audio block to send
+  uint8_t hdr[10 + WS_HEADER_BYTES];   // Frame header and message header in flight
+  size_t hdrLen;
+  const uint8_t *body;    // Payload: JPEG in the pinned frame or PCM in the audio ring
+  size_t bodyLen;
+  size_t offset;          // Bytes of hdr + body already written
+  bool busy;              // A message is in flight
+  bool stalling;          // Socket filled up at least once while sending the current message
+  uint8_t rx[WS_RX_MAX];  // Client bytes not parsed yet
+  size_t rxLen;
+  uint32_t videoSent;     // Video messages sent completely
+  uint32_t audioSent;     // Audio messages sent completely
+  uint32_t skipped;       // Frames never sent because the window was full or the socket busy
+  uint32_t expired;       // Frames that left the window by timeout instead of an ack
+  uint32_t overruns;      // Audio blocks lost because the client fell more than the ring depth behind
+  uint32_t sendStart;     // micros() when the current message was picked
+  ClientStats stats;
+};
+
+TaskHandle_t tWs;  // WebSocket streaming task handle
+ClientTable<WSClient, MAX_CLIENTS> wsClients;
+int wsWake = -1;   // Signalled on every publish, so the task's select() also wakes for new frames and blocks
+
+/**
+ * @brief Writes the WebSocket frame header and message header of an unmasked binary message.
+ *
+ * The message header is WS_HEADER_BYTES long, little-endian: type (WS_VIDEO or WS_AUDIO),
+ * three reserved bytes, the frame or audio block sequence number, and the capture
+ * time in microseconds on the esp_timer clock.
+ *
+ * @param hdr Output buffer (10 + WS_HEADER_BYTES bytes is enough).
+ * @param type Message type.
+ * @param seq Sequence number of the payload.
+ * @param time Capture time of the payload (us).
+ * @param len Payload size in bytes, message header not included.
+ * @return Number of bytes written.
+ */
+size_t wsMessageHeader(uint8_t *hdr, uint8_t type, uint32_t seq, int64_t time, size_t len) {
+  size_t pos = 0;
+  uint64_t total = len + WS_HEADER_BYTES;
+  hdr[pos++] = 0x82;  // FIN, binary
+  if (total < 126) {
+    hdr[pos++] = total;
+  } else if (total < 65536) {
+    hdr[pos++] = 126;
+    hdr[pos++] = total >> 8;
+    hdr[pos++] = total;
+  } else {
+    hdr[pos++] = 127;
+    for (int i = 7; i >= 0; i--)
+      hdr[pos++] = total >> (8 * i);
+  }
+
+  hdr[pos++] = type;
+  hdr[pos++] = 0;
+  hdr[pos++] = 0;
+  hdr[pos++] = 0;
+  for (int i = 0; i < 4; i++)
+    hdr[pos++] = seq >> (8 * i);
+  for (int i = 0; i < 8; i++)
+    hdr[pos++] = (uint64_t)time >> (8 * i);
+  return pos;
+}
+
+/**
+ * @brief Prepares a message for the given payload.
+ *
+ * @param c Client to prepare the message for.
+ * @param type Message type.
+ * @param seq Sequence number of the payload.
+ * @param time Capture time of the payload (us).
+ * @param body Payload, referenced (not copied) until the message is sent.
+ * @param len Payload size in bytes.
+ * @return void
+ */
+void startMessage(WSClient *c, uint8_t type, uint32_t seq, int64_t time, const uint8_t *body, size_t len) {
+  c->hdrLen = wsMessageHeader(c->hdr, type, seq, time, len);
+  c->body = body;
+  c->bodyLen = len;
+  c->offset = 0;
+  c->busy = true;
+  c->stalling = false;
+  c->sendStart = micros();
+}
+
+/**
+ * @brief Removes acknowledged frames from the window.
+ *
+ * An ack covers its frame and every earlier one, so a lost ack is made up for by the next.
+ *
+ * @param c Client that sent the ack.
+ * @param seq Sequence number of the newest frame the client has received.
+ * @return void
+ */
+void wsAck(WSClient *c, uint32_t seq) {
+  int64_t now = esp_timer_get_time();
+  uint8_t n = 0;
+  while (n < c->unacked && (int32_t)(c->inflight[n].seq - seq) <= 0) {
+    wsAckUs.observe(now - c->inflight[n].time);
+    n++;
+  }
+  if (n == 0)
+    return;
+  memmove(c->inflight, c->inflight + n, (c->unacked - n) * sizeof(WSInflight));
+  c->unacked -= n;
+}
+
+/**
+ * @brief Reads and parses whatever the client has sent, without blocking.
+ *
+ * Clients acknowledge video messages with the sequence number of the newest frame they
+ * have received, either as a 4-byte little-endian binary message or as decimal text.
+ * Pings and pongs are ignored; a close message or anything too long to be an ack ends
+ * the connection.
+ *
+ * @param c Client to read from.
+ * @return 0 on success, -1 if the client closed the connection or broke the protocol.
+ */
+int wsReceive(WSClient *c) {
+  int r = netRecv(c->client, c->rx + c->rxLen, WS_RX_MAX - c->rxLen);
+  if (r < 0)
+    return -1;
+  c->rxLen += r;
+
+  while (c->rxLen >= 2) {
+    uint8_t opcode = c->rx[0] & 0x0F;
+    size_t len = c->rx[1] & 0x7F;
+    // Client frames must be masked; the short length form is all an ack needs
+    if (!(c->rx[1] & 0x80) || len >= 126)
+      return -1;
+    size_t need = 2 + 4 + len;
+    if (need > WS_RX_MAX)
+      return -1;
+    if (c->rxLen < need)
+      return 0;
+
+    uint8_t *mask = c->rx + 2;
+    uint8_t *payload = c->rx + 6;
+    for (size_t i = 0; i < len; i++)
+      payload[i] ^= mask[i & 3];
+
+    if (opcode == 0x8)
+      return -1;
+    if (opcode == 0x2 && len >= 4) {
+      wsAck(c, payload[0] | payload[1] << 8 | payload[2] << 16 | (uint32_t)payload[3] << 24);
+    } else if (opcode == 0x1) {
+      char text[16];
+      size_t n = len < sizeof(text) - 1 ? len : sizeof(text) - 1;
+      memcpy(text, payload, n);
+      text[n] = 0;
+      wsAck(c, strtoul(text, NULL, 10));
+    }
+
+    c->rxLen -= need;
+    memmove(c->rx, c->rx + need, c->rxLen);
+  }
+  return 0;
+}
+
+/**
+ * @brief Picks the next message for a client.
+ *
+ * Audio goes first, in order, so it is never held up behind a frame. The newest frame
+ * is sent only while fewer than `window` frames are unacknowledged; frames published
+ * while the window is full are skipped, so a viewer always receives the freshest frame
+ * and the latency it sees is bounded by the window instead of by TCP buffering.
+ *
+ * @param c Client to pick a message for.
+ * @return true if a message was prepared, false if nothing may be sent yet.
+ */
+bool nextMessage(WSClient *c) {
+  if (c->audio) {
+    uint32_t head = audioHeadSeq();
+    if (head > c->audioCursor && head - c->audioCursor > AUDIO_RING_BLOCKS - 1) {
+      c->overruns += head - c->audioCursor - (AUDIO_RING_BLOCKS - 1);
+      audioOverruns.inc(head - c->audioCursor - (AUDIO_RING_BLOCKS - 1));
+      c->audioCursor = head - (AUDIO_RING_BLOCKS - 1);
+    }
+    size_t len;
+    int64_t time;
+    const uint8_t *audio = audioBlock(c->audioCursor, &len, &time);
+    if (audio != NULL) {
+      startMessage(c, WS_AUDIO, c->audioCursor, time, audio, len);
+      c->audioCursor++;
+      return true;
+    }
+  }
+
+  // A client that stopped acknowledging must not stall forever
+  while (c->unacked > 0 && millis() - c->inflight[0].sentAt > WS_ACK_TIMEOUT_MS) {
+    memmove(c->inflight, c->inflight + 1, (c->unacked - 1) * sizeof(WSInflight));
+    c->unacked--;
+    c->expired++;
+  }
+  if (c->unacked >= c->window)
+    return false;
+
+  Frame *frame = frameAcquire();
+  if (frame == NULL || frame->seq == c->lastSeq) {
+    if (frame != NULL)
+      frameRelease(frame);
+    return false;
+  }
+  if (c->lastSeq != 0 && frame->seq > c->lastSeq + 1) {
+    c->skipped += frame->seq - c->lastSeq - 1;
+    framesSkipped.inc(frame->seq - c->lastSeq - 1);
+  }
+
+  c->frame = frame;
+  startMessage(c, WS_VIDEO, frame->seq, frameTime(frame), frame->fb->buf, frame->fb->len);
+  return true;
+}
+
+/**
+ * @brief Writes as many messages to a client as its socket and ack window allow.
+ *
+ * @param c Client to service.
+ * @return 1 if any bytes were written, 0 if the client is waiting (on data, an ack or its socket), -1 if it disconnected.
+ */
+int serviceWSClient(WSClient *c) {
+  if (wsReceive(c) < 0)
+    return -1;
+
+  int progress = 0;
+  for (;;) {
+    if (!c->busy && !nextMessage(c))
+      return progress;
+
+    while (c->offset < c->hdrLen + c->bodyLen) {
+      const uint8_t *data;
+      size_t len;
+      if (c->offset < c->hdrLen) {
+        data = c->hdr + c->offset;
+        len = c->hdrLen - c->offset;
+      } else {
+        data = c->body + (c->offset - c->hdrLen);
+        len = c->bodyLen - (c->offset - c->hdrLen);
+      }
+
+      int w = netSend(c->client, data, len);
+      if (w < 0)
+        return -1;
+      if (w == 0) {
+        c->stalling = true;
+        return progress;
+      }
+      progress = 1;
+      c->offset += w;
+      c->stats.bytesSent += w;
+      bytesSent[EP_WS].inc(w);
+    }
+    c->stats.lastSendUs = micros() - c->sendStart;
+
+    if (c->frame != NULL) {
+      c->lastSeq = c->frame->seq;
+      c->inflight[c->unacked++] = { c->frame->seq, frameTime(c->frame), millis() };
+      frameRelease(c->frame);
+      c->frame = NULL;
+      c->videoSent++;
+    } else {
+      c->audioSent++;
+    }
+    c->busy = false;
+    c->stalling = false;
+  }
+}
+
+/**
+ * @brief Releases a client's pinned frame and stream subscriptions and frees its slot.
+ *
+ * @param c Client to drop.
+ * @return void
+ */
+void dropWSClient(WSClient *c) {
+  Log.trace("wsCB: Client disconnected after %d ms: video=%d audio=%d skipped=%d expired=%d overruns=%d bytes=%d\n",
+            millis() - c->stats.connectedAt, c->videoSent, c->audioSent, c->skipped, c->expired, c->overruns, (uint32_t)c->stats.bytesSent);
+  if (c->frame != NULL)
+    frameRelease(c->frame);
+  c->client.stop();
+  c->client = WiFiClient();
+  frameUnsubscribe();
+  if (c->audio)
+    audioUnsubscribe();
+  wsClients.release(c);
+  disconnects[EP_WS].inc();
+}
+
+/**
+ * @brief Handles WebSocket upgrade requests for the frame stream.
+ *
+ * Completes the RFC 6455 handshake and hands the client to the WebSocket task.
+ * `?audio=1` adds the PCM blocks to the stream and `?window=<n>` sets how many frames
+ * may be unacknowledged (WS_WINDOW by default, at most WS_WINDOW_MAX). Answers 400 to
+ * plain HTTP requests and 503 when all MAX_CLIENTS slots are in use.
+ *
+ * @return void
+ * @note Activates a slot in the wsClients table.
+ */
+void WSHandler(void) {
+  String key = server.header("Sec-WebSocket-Key");
+  if (!server.header("Upgrade").equalsIgnoreCase("websocket") || key.length() == 0) {
+    server.send(400, "text/plain", "WebSocket upgrade required");
+    return;
+  }
+
+  WSClient *c = wsClients.acquire();
+  if (c == NULL) {
+    Log.error("WSHandler: Max number of WiFi clients reached\n");
+    server.send(503, "text/plain", "Too many WebSocket clients");
+    return;
+  }
+  c->client = server.client();
+  c->audio = server.hasArg("audio") && server.arg("audio").toInt() != 0;
+  int window = server.hasArg("window") ? server.arg("window").toInt() : WS_WINDOW;
+  c->window = window < 1 ? 1 : window > WS_WINDOW_MAX ? WS_WINDOW_MAX : window;
+  c->audioCursor = audioHeadSeq();
+
+  // Sec-WebSocket-Accept: base64(SHA-1(key + GUID))
+  key += WS_GUID;
+  uint8_t digest[20];
+  mbedtls_sha1((const uint8_t *)key.c_str(), key.length(), digest);
+  uint8_t accept[32];
+  size_t acceptLen;
+  mbedtls_base64_encode(accept, sizeof(accept), &acceptLen, digest, sizeof(digest));
+  accept[acceptLen] = 0;
+
+  c->client.setTimeout(1);
+  c->client.setNoDelay(true);
+  c->client.printf("HTTP/1.1 101 Switching Protocols\r\n"
+                   "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: %s\r\n"
+                   "\r\n",
+                   accept);
+
+  wsClients.activate(c);
+  connects[EP_WS].inc();
+
+  frameSubscribe();
+  if (c->audio)
+    audioSubscribe();
+  xTaskNotifyGive(tWs);
+  wsNotify();
+
+  Log.trace("WSHandler: Client connected, audio=%d, window=%d\n", c->audio, c->window);
+}
+
+/**
+ * @brief Wakes the WebSocket task out of select() after a frame or audio block was published.
+ *
+ * @return void
+ * @note Called by the capture tasks and by WSHandler; does nothing while there are no clients.
+ */
+void wsNotify() {
+  if (wsWake >= 0 && wsClients.count())
+    netWake(wsWake);
+}
+
+/**
+ * @brief RTOS task: Streams frames, and optionally audio, to WebSocket clients.
+ *
+ * Each message carries its sequence number and capture time; frames are gated by
+ * the client's acknowledgements. Sleeps in select() until a client sends an ack, a
+ * stalled socket drains or a capture task signals a new frame or block through
+ * wsNotify(). Without clients it sleeps until WSHandler notifies it.
+ *
+ * @param pvParameters Unused (RTOS task parameter signature).
+ * @return Never returns; runs as a FreeRTOS task.
+ */
+void wsCB(void *pvParameters) {
+  wsWake = netWakeOpen();
+  if (wsWake < 0)
+    Log.error("wsCB: No wake descriptor, polling every %d ms instead\n", WS_POLL_MS);
+
+#if defined(BENCHMARK)
+  uint32_t lastPrint = millis();
+#endif
+
+  for (;;) {
+    if (!wsClients.count()) {
+      // No clients: sleep until the handler hands this task one
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+#if defined(BENCHMARK)
+    bool report = millis() - lastPrint > BENCHMARK_PRINT_INT;
+    if (report)
+      lastPrint = millis();
+#endif
+
+    bool progress = false;
+    bool ready = false;
+    fd_set readable, writable;
+    int maxFd = -1;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+
+    for (size_t i = 0; i < wsClients.capacity(); i++) {
+      WSClient *c = wsClients.at(i);
+      if (c == NULL)
+        continue;
+
+      int r = c->client.connected() ? serviceWSClient(c) : -1;
+      if (r < 0) {
+        dropWSClient(c);
+        continue;
+      }
+      progress |= r > 0;
+
+#if defined(BENCHMARK)
+      if (report)
+        Log.verbose("wsCB: client %d video=%d audio=%d skipped=%d expired=%d unacked=%d/%d\n",
+                    c->client.fd(), c->videoSent, c->audioSent, c->skipped, c->expired, c->unacked, c->window);
+#endif
+
+      // Acks may arrive at any time; a full socket also wants to know when it drains
+      int fd = c->client.fd();
+      FD_SET(fd, &readable);
+      if (c->stalling)
+        FD_SET(fd, &writable);
+      else if (c->audio || c->unacked < c->window)
+        ready = true;
+      if (fd > maxFd)
+        maxFd = fd;
+    }
+
+    if (!progress && maxFd >= 0) {
+      // Wake up for acks, drained sockets and publishes; the timeout only lets unacked frames expire
+      if (wsWake >= 0) {
+        FD_SET(wsWake, &readable);
+        if (wsWake > maxFd)
+          maxFd = wsWake;
+      }
+      struct timeval tv = { WS_ACK_TIMEOUT_MS / 1000, (WS_ACK_TIMEOUT_MS % 1000) * 1000 };
+      if (ready && wsWake < 0)
+        tv = { 0, WS_POLL_MS * 1000 };
+      if (select(maxFd + 1, &readable, &writable, NULL, &tv) > 0 && wsWake >= 0 && FD_ISSET(wsWake, &readable))
+        netWakeClear(wsWake);
+    }
+  }
+}
@@ -0,0 +1,78 @@
+#pragma once
+// Runs the whole firmware in the test process and talks to it over loopback, for the
+// integration tests. Header-only: include it as "../loopback.h".
+#include <unity.h>
+#include <lwip/sockets.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "globals.h"
+
+#define LOOPBACK_STARTUP_MS 10000  // How long the firmware gets to start serving
+
+void setup();
+
+// Opens a connection to the server and sends a GET for path; returns the socket or -1
+static int loopbackGet(const char* path) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(HTTP_PORT);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  send(fd, request.data(), request.size(), 0);
+  return fd;
+}
+
+// Reads from fd for up to ms milliseconds, appending to out; stops early once the server
+// closes the connection. Returns false if it did.
+static bool loopbackRead(int fd, std::string* out, int ms) {
+  int64_t deadline = esp_timer_get_time() + ms * 1000LL;
+  for (int64_t now = esp_timer_get_time(); now < deadline; now = esp_timer_get_time()) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, (deadline - now) / 1000 + 1) <= 0)
+      continue;
+    char buf[16384];
+    int r = recv(fd, buf, sizeof(buf), 0);
+    if (r <= 0)
+      return false;
+    out->append(buf, r);
+  }
+  return true;
+}
+
+// Fetches path and returns the whole response, head included, once the server closes it
+static std::string loopbackFetch(const char* path) {
+  std::string response;
+  int fd = loopbackGet(path);
+  if (fd >= 0) {
+    loopbackRead(fd, &response, LOOPBACK_STARTUP_MS);
+    close(fd);
+  }
+  return response;
+}
+
+// Starts the firmware as the Arduino core would and waits until it answers requests
+static void loopbackStart() {
+  setup();
+  int64_t deadline = esp_timer_get_time() + LOOPBACK_STARTUP_MS * 1000LL;
+  while (esp_timer_get_time() < deadline) {
+    if (!loopbackFetch("/").empty())
+      return;
+    delay(100);
+  }
+  fprintf(stderr, "the firmware is not serving on port %d\n", HTTP_PORT);
+  _exit(1);
+}
+
+// Ends the test program without running static destructors under the firmware's tasks
+static int loopbackExit(int failures) {
+  fflush(stdout);
+  _exit(failures);
+}
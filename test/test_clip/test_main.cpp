@@ -0,0 +1,132 @@
+#include <unity.h>
+#include <vector>
+#include "globals.h"
+#include "clip.h"
+#include "i2s.h"
+#include "mux.h"
+#include "fixtures.h"
+
+#define PCM_BYTES (BLOCK_SAMPLES * 2)
+#define FILL_SECONDS 10  // Longest stretch of replayed capture the fill test pushes
+
+// Every entry pushed, in order, with the slabs it takes
+struct Pushed {
+  int64_t time;
+  size_t slabs;
+};
+
+static std::vector<Pushed> pushed;
+static std::vector<uint8_t> payload(128 * KILOBYTE, 0xA5);
+static int64_t clock_us;
+
+static void push(uint8_t track, size_t len, int64_t step) {
+  clock_us += step;
+  clipPush(track, payload.data(), len, clock_us);
+  pushed.push_back({ clock_us, (len + CLIP_SLAB_BYTES - 1) / CLIP_SLAB_BYTES });
+}
+
+// The buffered entries must be the newest ones pushed, in one unbroken run: the window
+// ends at the last push and starts at an entry whose slabs add up to the fill level
+static void assertNewestSurvive() {
+  ClipStats s = clipStats();
+  TEST_ASSERT_EQUAL(0, s.dropped);
+  TEST_ASSERT_TRUE(s.entries <= pushed.size());
+  size_t first = pushed.size() - s.entries;
+  TEST_ASSERT_EQUAL((uint32_t)((pushed.back().time - pushed[first].time) / 1000), s.windowMs);
+  size_t slabs = 0;
+  for (size_t i = first; i < pushed.size(); i++)
+    slabs += pushed[i].slabs;
+  TEST_ASSERT_EQUAL(slabs, s.slabsUsed);
+  TEST_ASSERT_LESS_OR_EQUAL(s.slabs, s.slabsUsed);
+  TEST_ASSERT_EQUAL(first, s.evicted);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_arena_fills_before_evicting() {
+  ClipStats s = clipStats();
+  TEST_ASSERT_EQUAL(CLIP_ARENA_KB * KILOBYTE / CLIP_SLAB_BYTES, s.slabs);
+  TEST_ASSERT_EQUAL(0, s.slabsUsed);
+  while (clipStats().slabsUsed < s.slabs)
+    push(AUDIO_TRACK, PCM_BYTES, BLOCK_US);
+  s = clipStats();
+  TEST_ASSERT_EQUAL(0, s.evicted);
+  TEST_ASSERT_EQUAL(s.slabs, s.entries);
+  assertNewestSurvive();
+}
+
+// A full arena makes room by overwriting exactly the oldest entries in its way
+void test_full_arena_evicts_the_oldest() {
+  push(AUDIO_TRACK, PCM_BYTES, BLOCK_US);
+  TEST_ASSERT_EQUAL(1, clipStats().evicted);
+  assertNewestSurvive();
+
+  // A frame takes a run of slabs, so as many single-slab entries go
+  push(VIDEO_TRACK, 10 * CLIP_SLAB_BYTES, BLOCK_US);
+  TEST_ASSERT_EQUAL(11, clipStats().evicted);
+  assertNewestSurvive();
+}
+
+// A run that does not fit before the end of the arena starts over at slab 0; the
+// entries at the end it skipped go too, still oldest first
+void test_wrapping_run_keeps_the_newest() {
+  for (int i = 0; i < 2000; i++) {
+    size_t len = i % 3 == 0 ? (7 + i % 29) * CLIP_SLAB_BYTES - 100 : PCM_BYTES;
+    push(i % 3 == 0 ? VIDEO_TRACK : AUDIO_TRACK, len, BLOCK_US / 2);
+    assertNewestSurvive();
+  }
+}
+
+// An entry larger than the whole arena is dropped, leaving the buffered ones alone
+void test_oversized_entry_is_dropped() {
+  ClipStats before = clipStats();
+  clipPush(VIDEO_TRACK, payload.data(), before.slabs * CLIP_SLAB_BYTES + 1, clock_us + 1);
+  ClipStats after = clipStats();
+  TEST_ASSERT_EQUAL(before.dropped + 1, after.dropped);
+  TEST_ASSERT_EQUAL(before.entries, after.entries);
+  TEST_ASSERT_EQUAL(before.evicted, after.evicted);
+}
+
+// How much capture the arena holds: the replayed VGA frames at FPS with audio alongside
+void test_window_of_replayed_capture() {
+  std::vector<std::vector<uint8_t>> frames;
+  for (const std::string& name : fixtureList("frames")) {
+    frames.emplace_back();
+    TEST_ASSERT_TRUE(fixtureLoad(name.c_str(), &frames.back()));
+  }
+  TEST_ASSERT_FALSE_MESSAGE(frames.empty(), "tools/fixtures.py writes the fixtures");
+
+  uint32_t evicted = clipStats().evicted;
+  int64_t audioDue = clock_us;
+  for (int i = 0; i < FPS * FILL_SECONDS; i++) {
+    int64_t frameTime = clock_us + 1000000 / FPS;
+    for (; audioDue < frameTime; audioDue += BLOCK_US)
+      clipPush(AUDIO_TRACK, payload.data(), PCM_BYTES, audioDue);
+    clock_us = frameTime;
+    const std::vector<uint8_t>& f = frames[i % frames.size()];
+    clipPush(VIDEO_TRACK, f.data(), f.size(), clock_us);
+  }
+  ClipStats s = clipStats();
+  TEST_ASSERT_GREATER_THAN(evicted, s.evicted);
+  TEST_ASSERT_EQUAL(1, s.dropped);
+  char message[128];
+  snprintf(message, sizeof(message), "%d KB arena: %d ms of VGA at %d fps with audio, %d entries, %d/%d slabs, %d bytes",
+           CLIP_ARENA_KB, (int)s.windowMs, FPS, (int)s.entries, (int)s.slabsUsed, (int)s.slabs, (int)s.footprint);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(1000, s.windowMs);
+}
+
+int main() {
+  // No firmware here: the arena's capture subscriptions land on the test itself
+  tCam = tMic = xTaskGetCurrentTaskHandle();
+  clipSetup();
+  UNITY_BEGIN();
+  RUN_TEST(test_arena_fills_before_evicting);
+  RUN_TEST(test_full_arena_evicts_the_oldest);
+  RUN_TEST(test_wrapping_run_keeps_the_newest);
+  RUN_TEST(test_oversized_entry_is_dropped);
+  RUN_TEST(test_window_of_replayed_capture);
+  return UNITY_END();
+}
@@ -0,0 +1,212 @@
+#include <unity.h>
+#include <math.h>
+#include "codec.h"
+#include "esp_timer.h"
+#include "fixtures.h"
+
+// One block of the /i2s stream: ~20 ms at 44.1 kHz, as in i2s.cpp
+#define BLOCK_SAMPLES 881
+#define BLOCK_BUDGET_US 20000
+
+static std::vector<int16_t> tones;
+
+static const int16_t adpcmSteps[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767
+};
+
+static const int8_t adpcmIndexShift[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// G.711 decoder, as a player would run it
+static int ulawDecode(uint8_t code) {
+  code = ~code;
+  int magnitude = ((((code & 0x0F) << 3) + 0x84) << ((code >> 4) & 7)) - 0x84;
+  return code & 0x80 ? -magnitude : magnitude;
+}
+
+// IMA-ADPCM decoder for one WAV block, as a player would run it
+static void adpcmDecodeBlock(const uint8_t* in, int16_t* out, size_t samples) {
+  int predictor = (int16_t)(in[0] | in[1] << 8);
+  int index = in[2];
+  out[0] = predictor;
+  for (size_t i = 1; i < samples; i++) {
+    uint8_t code = (i & 1) ? in[4 + (i - 1) / 2] & 0x0F : in[4 + (i - 1) / 2] >> 4;
+    int step = adpcmSteps[index];
+    int delta = step >> 3;
+    if (code & 4)
+      delta += step;
+    if (code & 2)
+      delta += step >> 1;
+    if (code & 1)
+      delta += step >> 2;
+    predictor += (code & 8) ? -delta : delta;
+    predictor = predictor > 32767 ? 32767 : predictor < -32768 ? -32768 : predictor;
+    index += adpcmIndexShift[code];
+    index = index < 0 ? 0 : index > 88 ? 88 : index;
+    out[i] = predictor;
+  }
+}
+
+// Signal to noise ratio of decoded against the original, dB
+static double snr(const int16_t* original, const int16_t* decoded, size_t samples) {
+  double signal = 0, noise = 0;
+  for (size_t i = 0; i < samples; i++) {
+    signal += (double)original[i] * original[i];
+    noise += (double)(original[i] - decoded[i]) * (original[i] - decoded[i]);
+  }
+  return 10 * log10(signal / (noise > 0 ? noise : 1));
+}
+
+void setUp() {
+  if (tones.empty()) {
+    std::vector<uint8_t> pcm;
+    TEST_ASSERT_TRUE_MESSAGE(fixtureLoad("audio.pcm", &pcm), "tools/fixtures.py writes the fixtures");
+    tones.resize(pcm.size() / 2);
+    memcpy(tones.data(), pcm.data(), tones.size() * 2);
+  }
+}
+
+void tearDown() {}
+
+void test_ulaw_known_codes() {
+  const int16_t in[] = { 0, -1, 32767, -32768, 1000, -1000 };
+  uint8_t out[6];
+  ulawEncode(in, out, 6);
+  TEST_ASSERT_EQUAL_HEX8(0xFF, out[0]);
+  TEST_ASSERT_EQUAL_HEX8(0x7F, out[1]);
+  TEST_ASSERT_EQUAL_HEX8(0x80, out[2]);
+  TEST_ASSERT_EQUAL_HEX8(0x00, out[3]);
+  TEST_ASSERT_EQUAL_HEX8(0xCE, out[4]);
+  TEST_ASSERT_EQUAL_HEX8(0x4E, out[5]);
+}
+
+void test_ulaw_round_trip_stays_within_the_segment_step() {
+  for (int v = -32768; v <= 32767; v += 7) {
+    int16_t in = v;
+    uint8_t code;
+    ulawEncode(&in, &code, 1);
+    int decoded = ulawDecode(code);
+    int magnitude = abs(v) > 32635 ? 32635 : abs(v);
+    // Each segment doubles the step: 8 at the bottom, 1024 at the top; decoding truncates
+    int step = 8 << ((~code >> 4) & 7);
+    TEST_ASSERT_INT_WITHIN(step, v < 0 ? -magnitude : magnitude, decoded);
+  }
+}
+
+void test_ulaw_keeps_the_tones() {
+  std::vector<uint8_t> codes(tones.size());
+  std::vector<int16_t> decoded(tones.size());
+  ulawEncode(tones.data(), codes.data(), tones.size());
+  for (size_t i = 0; i < tones.size(); i++)
+    decoded[i] = ulawDecode(codes[i]);
+  TEST_ASSERT_GREATER_THAN(30, snr(tones.data(), decoded.data(), tones.size()));
+}
+
+void test_adpcm_block_layout() {
+  int16_t in[BLOCK_SAMPLES];
+  for (int i = 0; i < BLOCK_SAMPLES; i++)
+    in[i] = -1234 + i;
+  uint8_t out[ADPCM_BLOCK_BYTES(BLOCK_SAMPLES)];
+  AdpcmState state = { 0, 17 };
+  TEST_ASSERT_EQUAL(ADPCM_BLOCK_BYTES(BLOCK_SAMPLES), adpcmEncodeBlock(&state, in, out, BLOCK_SAMPLES));
+  TEST_ASSERT_EQUAL(444, ADPCM_BLOCK_BYTES(BLOCK_SAMPLES));
+  // First sample verbatim, little-endian, then the step index the block starts from
+  TEST_ASSERT_EQUAL_INT16(-1234, (int16_t)(out[0] | out[1] << 8));
+  TEST_ASSERT_EQUAL(17, out[2]);
+  TEST_ASSERT_EQUAL(0, out[3]);
+  TEST_ASSERT_INT_WITHIN(64, in[BLOCK_SAMPLES - 1], state.predictor);
+}
+
+void test_adpcm_round_trip_across_blocks() {
+  size_t blocks = tones.size() / BLOCK_SAMPLES;
+  std::vector<int16_t> decoded(blocks * BLOCK_SAMPLES);
+  uint8_t block[ADPCM_BLOCK_BYTES(BLOCK_SAMPLES)];
+  AdpcmState state = { 0, 0 };
+  for (size_t b = 0; b < blocks; b++) {
+    uint8_t index = state.index;
+    adpcmEncodeBlock(&state, tones.data() + b * BLOCK_SAMPLES, block, BLOCK_SAMPLES);
+    // Each block resumes from the step size the previous one ended with
+    TEST_ASSERT_EQUAL(index, block[2]);
+    adpcmDecodeBlock(block, decoded.data() + b * BLOCK_SAMPLES, BLOCK_SAMPLES);
+  }
+  TEST_ASSERT_GREATER_THAN(20, snr(tones.data(), decoded.data(), decoded.size()));
+}
+
+void test_pcm8_centres_on_128() {
+  const int16_t in[] = { 0, 32767, -32768, 127, 128, -129, 256 };
+  uint8_t out[7];
+  pcm8Encode(in, out, 7);
+  TEST_ASSERT_EQUAL(128, out[0]);
+  TEST_ASSERT_EQUAL(255, out[1]);
+  TEST_ASSERT_EQUAL(0, out[2]);
+  TEST_ASSERT_EQUAL(128, out[3]);
+  TEST_ASSERT_EQUAL(129, out[4]);
+  TEST_ASSERT_EQUAL(127, out[5]);
+  TEST_ASSERT_EQUAL(129, out[6]);
+}
+
+// Mean encode time of one block over the whole fixture, microseconds
+template <typename Encode>
+static double blockCost(Encode encode) {
+  size_t blocks = tones.size() / BLOCK_SAMPLES;
+  int64_t start = esp_timer_get_time();
+  for (int pass = 0; pass < 20; pass++)
+    for (size_t b = 0; b < blocks; b++)
+      encode(tones.data() + b * BLOCK_SAMPLES);
+  return (double)(esp_timer_get_time() - start) / (20 * blocks);
+}
+
+// The encoders run on the capture task once per block; report what one block costs and
+// check it leaves the task nearly all of its 20 ms
+void test_encode_cost_per_block() {
+  uint8_t out[BLOCK_SAMPLES];
+  AdpcmState state = { 0, 0 };
+  double ulaw = blockCost([&](const int16_t* in) { ulawEncode(in, out, BLOCK_SAMPLES); });
+  double adpcm = blockCost([&](const int16_t* in) { adpcmEncodeBlock(&state, in, out, BLOCK_SAMPLES); });
+  double pcm8 = blockCost([&](const int16_t* in) { pcm8Encode(in, out, BLOCK_SAMPLES); });
+  char message[128];
+  snprintf(message, sizeof(message), "per %d-sample block: mu-law %.1f us, IMA-ADPCM %.1f us, 8-bit PCM %.1f us",
+           BLOCK_SAMPLES, ulaw, adpcm, pcm8);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(BLOCK_BUDGET_US / 10, (int)ulaw);
+  TEST_ASSERT_LESS_THAN(BLOCK_BUDGET_US / 10, (int)adpcm);
+  TEST_ASSERT_LESS_THAN(BLOCK_BUDGET_US / 10, (int)pcm8);
+}
+
+// Each resampled ring runs one resampler per block on the capture task as well
+void test_resample_cost_per_block() {
+  const uint32_t rates[] = { 16000, 8000 };
+  for (uint32_t rate : rates) {
+    Resampler r;
+    TEST_ASSERT_TRUE(resamplerInit(&r, 44100, rate, BLOCK_SAMPLES));
+    std::vector<int16_t> out(RESAMPLE_MAX_OUT(&r, BLOCK_SAMPLES));
+    double cost = blockCost([&](const int16_t* in) { resample(&r, in, BLOCK_SAMPLES, out.data()); });
+    char message[96];
+    snprintf(message, sizeof(message), "per %d-sample block: resample to %u Hz (%d taps/phase) %.1f us", BLOCK_SAMPLES,
+             (unsigned)rate, r.taps, cost);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_THAN(BLOCK_BUDGET_US / 10, (int)cost);
+    free(r.coefs);
+    free(r.history);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_ulaw_known_codes);
+  RUN_TEST(test_ulaw_round_trip_stays_within_the_segment_step);
+  RUN_TEST(test_ulaw_keeps_the_tones);
+  RUN_TEST(test_adpcm_block_layout);
+  RUN_TEST(test_adpcm_round_trip_across_blocks);
+  RUN_TEST(test_pcm8_centres_on_128);
+  RUN_TEST(test_encode_cost_per_block);
+  RUN_TEST(test_resample_cost_per_block);
+  return UNITY_END();
+}
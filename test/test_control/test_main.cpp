@@ -0,0 +1,170 @@
+#include <unity.h>
+#include <Preferences.h>
+#include "control.h"
+#include "esp_camera.h"
+#include "../loopback.h"
+
+#define VIEW_MS    3000  // How long the viewer watches each setting
+#define SETTLE_MS  3000  // The viewer's pacing settles before the first count
+#define BACKLOG_MS 1000  // Frames queued while the viewer waited for /control are read off first
+
+// Counts the whole frames /mjpeg delivers in a window, and whether the server closed it
+struct Viewer {
+  int fd = -1;
+  std::string buf;
+
+  void open() {
+    fd = loopbackGet("/mjpeg");
+    TEST_ASSERT_TRUE(fd >= 0);
+  }
+
+  // Frames received in the next ms milliseconds; -1 if the connection was closed
+  int frames(int ms) {
+    bool open = loopbackRead(fd, &buf, ms);
+    int n = 0;
+    for (;;) {
+      size_t at = buf.find("Content-Length: ");
+      size_t body = at == std::string::npos ? at : buf.find("\r\n\r\n", at);
+      if (body == std::string::npos)
+        break;
+      size_t len = strtoul(buf.c_str() + at + 16, NULL, 10);
+      if (buf.size() < body + 4 + len)
+        break;
+      buf.erase(0, body + 4 + len);
+      n++;
+    }
+    return open ? n : -1;
+  }
+};
+
+static Viewer viewer;
+
+static std::string body(const std::string& response) {
+  size_t head = response.find("\r\n\r\n");
+  return head == std::string::npos ? "" : response.substr(head + 4);
+}
+
+// Integer field of a flat JSON object, or -1
+static int field(const std::string& json, const char* name) {
+  std::string key = std::string("\"") + name + "\":";
+  size_t at = json.find(key);
+  return at == std::string::npos ? -1 : atoi(json.c_str() + at + key.size());
+}
+
+static double measuredFps(const std::string& json) {
+  size_t at = json.find("\"measuredFps\":");
+  return at == std::string::npos ? -1 : atof(json.c_str() + at + 14);
+}
+
+static void report(const char* what, const std::string& json, int frames) {
+  char message[128];
+  snprintf(message, sizeof(message), "%s: measured %.1f fps, viewer got %d frames in %d ms", what, measuredFps(json),
+           frames, VIEW_MS);
+  TEST_MESSAGE(message);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// A request that changes nothing answers at once, says so, and has no outcome to report
+void test_reports_the_build_settings() {
+  int64_t start = esp_timer_get_time();
+  std::string response = loopbackFetch("/control");
+  TEST_ASSERT_LESS_THAN(CONTROL_MEASURE_MS, (esp_timer_get_time() - start) / 1000);
+  TEST_ASSERT_TRUE(response.compare(0, 12, "HTTP/1.1 200") == 0);
+  std::string json = body(response);
+  TEST_ASSERT_TRUE(json.find("\"framesize\":\"VGA\"") != std::string::npos);
+  TEST_ASSERT_EQUAL(640, field(json, "width"));
+  TEST_ASSERT_EQUAL(FPS, field(json, "fps"));
+  TEST_ASSERT_EQUAL(JPEG_QUALITY, field(json, "quality"));
+  TEST_ASSERT_TRUE(json.find("\"changed\":false") != std::string::npos);
+  TEST_ASSERT_TRUE(json.find("applied") == std::string::npos);
+  TEST_ASSERT_TRUE(json.find("measuredFps") == std::string::npos);
+
+  // Naming the settings already in effect changes nothing either
+  json = body(loopbackFetch(("/control?fps=" + std::to_string(FPS)).c_str()));
+  TEST_ASSERT_TRUE(json.find("\"changed\":false") != std::string::npos);
+}
+
+// The capture rate changes in place, and the connected viewer follows it
+void test_fps_changes_in_place() {
+  viewer.open();
+  viewer.frames(SETTLE_MS);
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS * VIEW_MS / 1000 * 8 / 10, viewer.frames(VIEW_MS));
+
+  std::string json = body(loopbackFetch("/control?fps=5&quality=14"));
+  viewer.frames(BACKLOG_MS);
+  int frames = viewer.frames(VIEW_MS);
+  report("fps=5", json, frames);
+  TEST_ASSERT_TRUE(json.find("\"changed\":true,\"applied\":true") != std::string::npos);
+  TEST_ASSERT_EQUAL(5, field(json, "fps"));
+  TEST_ASSERT_EQUAL(14, field(json, "quality"));
+  TEST_ASSERT_FLOAT_WITHIN(1, 5, measuredFps(json));
+  TEST_ASSERT_INT_WITHIN(3, 5 * VIEW_MS / 1000, frames);
+  // The controller restarted from the new best quality and never refines past it
+  TEST_ASSERT_GREATER_OR_EQUAL(14, esp_camera_sensor_get()->status.quality);
+}
+
+// A resolution change restarts the camera under the viewer, which stays connected; an /av
+// client, whose Matroska header gave the old size, is closed
+void test_framesize_restarts_the_camera_without_dropping_clients() {
+  int av = loopbackGet("/av");
+  std::string avStream;
+  TEST_ASSERT_TRUE(loopbackRead(av, &avStream, 500));
+  int64_t start = esp_timer_get_time();
+  std::string response = loopbackFetch("/control?framesize=qvga&fps=10");
+  int restartMs = (esp_timer_get_time() - start) / 1000 - CONTROL_MEASURE_MS;
+  std::string json = body(response);
+  viewer.frames(BACKLOG_MS);
+  int frames = viewer.frames(VIEW_MS);
+  report("framesize=QVGA fps=10", json, frames);
+  char message[64];
+  snprintf(message, sizeof(message), "camera restart with one viewer connected: %d ms", restartMs);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(response.compare(0, 12, "HTTP/1.1 200") == 0);
+  TEST_ASSERT_TRUE(json.find("\"framesize\":\"QVGA\"") != std::string::npos);
+  TEST_ASSERT_EQUAL(320, field(json, "width"));
+  TEST_ASSERT_EQUAL(FRAMESIZE_QVGA, esp_camera_sensor_get()->status.framesize);
+  TEST_ASSERT_GREATER_OR_EQUAL(10 * VIEW_MS / 1000 * 8 / 10, frames);
+  TEST_ASSERT_FALSE(loopbackRead(av, &avStream, 1000));
+  close(av);
+}
+
+void test_invalid_settings_are_refused() {
+  const char* requests[] = { "/control?fps=0", "/control?fps=31", "/control?quality=3", "/control?framesize=8K",
+                             "/control?xclk=1000" };
+  for (const char* r : requests)
+    TEST_ASSERT_TRUE_MESSAGE(loopbackFetch(r).compare(0, 12, "HTTP/1.1 400") == 0, r);
+  TEST_ASSERT_EQUAL(10, cameraSettings().fps);
+  TEST_ASSERT_EQUAL(FRAMESIZE_QVGA, cameraSettings().frameSize);
+}
+
+// Applied settings are saved and loaded at the next boot; a saved record out of range is
+// ignored as a whole
+void test_settings_are_saved() {
+  Preferences prefs;
+  prefs.begin("camera", true);
+  TEST_ASSERT_EQUAL(FRAMESIZE_QVGA, prefs.getInt("framesize", -1));
+  TEST_ASSERT_EQUAL(14, prefs.getInt("quality", -1));
+  TEST_ASSERT_EQUAL(10, prefs.getInt("fps", -1));
+  prefs.end();
+
+  prefs.begin("camera", false);
+  prefs.putInt("fps", 99);
+  prefs.end();
+  settingsLoad();
+  TEST_ASSERT_EQUAL(10, cameraSettings().fps);
+  TEST_ASSERT_EQUAL(14, cameraSettings().quality);
+}
+
+int main() {
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_reports_the_build_settings);
+  RUN_TEST(test_fps_changes_in_place);
+  RUN_TEST(test_framesize_restarts_the_camera_without_dropping_clients);
+  RUN_TEST(test_invalid_settings_are_refused);
+  RUN_TEST(test_settings_are_saved);
+  return loopbackExit(UNITY_END());
+}
@@ -0,0 +1,182 @@
+#include <unity.h>
+#include <thread>
+#include <vector>
+#include "globals.h"
+#include "frame.h"
+
+// A snapshot of what a driver buffer held when it was published. The replayed camera
+// refills a buffer as soon as it is handed back, so a buffer returned while a reference
+// is still held no longer matches its snapshot.
+struct Snapshot {
+  struct timeval timestamp;
+  size_t len;
+  uint32_t sum;
+};
+
+static Snapshot snapshot(const camera_fb_t* fb) {
+  Snapshot s = { fb->timestamp, fb->len, 0 };
+  for (size_t i = 0; i < fb->len; i++)
+    s.sum = s.sum * 31 + fb->buf[i];
+  return s;
+}
+
+static bool unchanged(const Snapshot& s, const camera_fb_t* fb) {
+  Snapshot now = snapshot(fb);
+  return now.timestamp.tv_sec == s.timestamp.tv_sec && now.timestamp.tv_usec == s.timestamp.tv_usec &&
+         now.len == s.len && now.sum == s.sum;
+}
+
+// Captures one frame and publishes it, as the camera task does
+static Frame* capture() {
+  camera_fb_t* fb = esp_camera_fb_get();
+  TEST_ASSERT_NOT_NULL_MESSAGE(fb, "the camera ran out of buffers: one was never returned");
+  return framePublish(fb, 0);
+}
+
+void setUp() {
+  if (esp_camera_sensor_get() == NULL) {
+    camera_config_t config = {};
+    config.frame_size = FRAME_SIZE;
+    config.jpeg_quality = JPEG_QUALITY;
+    config.fb_count = FB_COUNT;
+    config.grab_mode = CAMERA_GRAB_LATEST;
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, esp_camera_init(&config), "tools/fixtures.py writes the fixtures");
+  }
+}
+
+void tearDown() {}
+
+void test_nothing_published_yet() {
+  TEST_ASSERT_NULL(frameAcquire());
+}
+
+void test_publisher_keeps_the_latest_frame() {
+  Frame* published = capture();
+  TEST_ASSERT_NOT_NULL(published);
+  Frame* frame = frameAcquire();
+  TEST_ASSERT_EQUAL_PTR(published, frame);
+  TEST_ASSERT_EQUAL_UINT32(2, frame->refs.load());
+  frameRelease(frame);
+  TEST_ASSERT_EQUAL_UINT32(1, frame->refs.load());
+}
+
+void test_replaced_frame_waits_for_its_last_reader() {
+  Frame* frame = frameAcquire();
+  Snapshot held = snapshot(frame->fb);
+
+  // Replacing it drops only the publisher's reference
+  Frame* next = capture();
+  TEST_ASSERT_NOT_EQUAL(frame, next);
+  TEST_ASSERT_EQUAL_UINT32(1, frame->refs.load());
+
+  // Capture keeps going on the other buffers without touching the held one
+  for (int i = 0; i < 4 * FB_COUNT; i++) {
+    Frame* f = capture();
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_NOT_EQUAL(frame->fb, f->fb);
+    TEST_ASSERT_TRUE_MESSAGE(unchanged(held, frame->fb), "a referenced buffer went back to the driver");
+  }
+  frameRelease(frame);
+}
+
+void test_readers_release_in_any_order() {
+  Frame* frame = frameAcquire();
+  Frame* second = frameAcquire();
+  Frame* third = frameAcquire();
+  TEST_ASSERT_EQUAL_PTR(frame, second);
+  TEST_ASSERT_EQUAL_PTR(frame, third);
+  Snapshot held = snapshot(frame->fb);
+
+  capture();
+  frameRelease(second);
+  for (int i = 0; i < 2 * FB_COUNT; i++) {
+    capture();
+    TEST_ASSERT_TRUE(unchanged(held, frame->fb));
+  }
+  frameRelease(frame);
+  for (int i = 0; i < 2 * FB_COUNT; i++) {
+    capture();
+    TEST_ASSERT_TRUE(unchanged(held, frame->fb));
+  }
+  frameRelease(third);
+  TEST_ASSERT_EQUAL_UINT32(0, frame->refs.load());
+
+  // Every buffer is back: capture cycles through all of them again
+  bool seen = false;
+  for (int i = 0; i < 2 * FB_COUNT && !seen; i++)
+    seen = capture()->fb == frame->fb;
+  TEST_ASSERT_TRUE_MESSAGE(seen, "the released buffer never came back from the driver");
+}
+
+// Readers pin frames for random lengths of time while the camera task publishes at full
+// rate; no pinned buffer may change underneath its reader, and capture must never starve
+void test_concurrent_readers_never_see_a_returned_buffer() {
+  std::atomic<bool> stop(false);
+  std::atomic<int> torn(0), reads(0);
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 3; r++) {
+    readers.emplace_back([&, r]() {
+      uint32_t seed = r + 1;
+      while (!stop.load()) {
+        Frame* frame = frameAcquire();
+        if (frame == NULL)
+          continue;
+        Snapshot held = snapshot(frame->fb);
+        seed = seed * 1103515245 + 12345;
+        delayMicroseconds((seed >> 16) % 60000);
+        if (!unchanged(held, frame->fb))
+          torn++;
+        frameRelease(frame);
+        reads++;
+      }
+    });
+  }
+  for (int i = 0; i < 60; i++)
+    capture();
+  stop = true;
+  for (std::thread& t : readers)
+    t.join();
+  TEST_ASSERT_EQUAL_INT(0, torn.load());
+  TEST_ASSERT_GREATER_THAN(20, reads.load());
+}
+
+// Stands in for the camera task: counts a capture each time it finds a consumer, and
+// sleeps as camCB does once there is none. It waits for the consumer to leave before
+// checking again, so the test's next subscribe races that check
+static std::atomic<int> wakeups(0), departures(0);
+
+static void idleCapture(void*) {
+  for (;;) {
+    while (!frameSubscribed())
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    wakeups++;
+    while (departures.load() < wakeups.load())
+      taskYIELD();
+  }
+}
+
+// A consumer arriving while capture goes idle must still wake it: no subscribe may be
+// lost between the task's check for consumers and its sleep
+void test_subscribe_always_wakes_idle_capture() {
+  TEST_ASSERT_EQUAL(pdPASS, xTaskCreatePinnedToCore(idleCapture, "cam", 4096, NULL, 1, &tCam, 0));
+  for (int i = 1; i <= 2000; i++) {
+    frameSubscribe();
+    int64_t deadline = esp_timer_get_time() + 1000000;
+    while (wakeups.load() < i && esp_timer_get_time() < deadline)
+      std::this_thread::yield();
+    TEST_ASSERT_EQUAL_INT_MESSAGE(i, wakeups.load(), "a subscribe did not wake the capture task");
+    frameUnsubscribe();
+    departures++;
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_nothing_published_yet);
+  RUN_TEST(test_publisher_keeps_the_latest_frame);
+  RUN_TEST(test_replaced_frame_waits_for_its_last_reader);
+  RUN_TEST(test_readers_release_in_any_order);
+  RUN_TEST(test_concurrent_readers_never_see_a_returned_buffer);
+  RUN_TEST(test_subscribe_always_wakes_idle_capture);
+  return UNITY_END();
+}
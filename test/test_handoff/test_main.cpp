@@ -0,0 +1,161 @@
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "globals.h"
+#include "frame.h"
+#include "metrics.h"
+
+#define STRESS_MS  3000   // How long the torn-read stress runs
+#define JITTER_MS  1500   // How long each reader count of the jitter run captures
+#define PUBLISHED  4096   // Checksums remembered per sequence number
+
+// What the producer published under each sequence number
+static std::atomic<uint32_t> publishedSum[PUBLISHED];
+static std::atomic<uint32_t> publishedSeq[PUBLISHED];
+
+static uint32_t checksum(const camera_fb_t* fb) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < fb->len; i++)
+    sum = sum * 31 + fb->buf[i];
+  return sum;
+}
+
+// Pins the latest frame in a loop, holding it up to maxHoldUs; counts every read whose
+// frame is not, or stops being, the one published under its sequence number
+struct Reader {
+  uint32_t seed;
+  int maxHoldUs;
+  std::atomic<bool>* stop;
+  int reads = 0;
+  int torn = 0;
+
+  void run() {
+    while (!stop->load()) {
+      Frame* frame = frameAcquire();
+      if (frame == NULL)
+        continue;
+      uint32_t seq = frame->seq;
+      uint32_t sum = checksum(frame->fb);
+      seed = seed * 1103515245 + 12345;
+      if (maxHoldUs)
+        delayMicroseconds((seed >> 16) % maxHoldUs);
+      bool known = publishedSeq[seq % PUBLISHED].load() == seq;
+      if (frame->seq != seq || checksum(frame->fb) != sum || (known && publishedSum[seq % PUBLISHED].load() != sum))
+        torn++;
+      frameRelease(frame);
+      reads++;
+    }
+  }
+};
+
+// Captures and publishes as fast as the camera allows, recording each frame's checksum
+// and the time framePublish() took
+static void produce(int ms, std::vector<int64_t>* publishUs) {
+  int64_t end = esp_timer_get_time() + ms * 1000LL;
+  while (esp_timer_get_time() < end) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    TEST_ASSERT_NOT_NULL_MESSAGE(fb, "capture starved: every driver buffer is pinned");
+    uint32_t sum = checksum(fb);
+    int64_t start = esp_timer_get_time();
+    Frame* frame = framePublish(fb, 0);
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (frame != NULL) {
+      // The readers may already hold it: the pool copy has the same bytes as the driver buffer
+      publishedSum[frame->seq % PUBLISHED] = sum;
+      publishedSeq[frame->seq % PUBLISHED] = frame->seq;
+    }
+    if (publishUs != NULL)
+      publishUs->push_back(elapsed);
+  }
+}
+
+static int64_t percentile(std::vector<int64_t> samples, int p) {
+  std::sort(samples.begin(), samples.end());
+  return samples[(samples.size() - 1) * p / 100];
+}
+
+void setUp() {
+  if (esp_camera_sensor_get() == NULL) {
+    // A sensor faster than any real one, so handles are recycled as often as possible
+    setenv("CAMERA_SENSOR_FPS", "2000", 1);
+    camera_config_t config = {};
+    config.frame_size = FRAME_SIZE;
+    config.jpeg_quality = JPEG_QUALITY;
+    config.fb_count = FB_COUNT;
+    config.grab_mode = CAMERA_GRAB_LATEST;
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, esp_camera_init(&config), "tools/fixtures.py writes the fixtures");
+    framePoolSetup(resolution[FRAME_SIZE].width * resolution[FRAME_SIZE].height / 5);
+  }
+}
+
+void tearDown() {}
+
+// MAX_CLIENTS readers with short holds race the producer for every handle. No reader may
+// ever get a frame whose contents or sequence number change while it holds it.
+void test_readers_never_see_a_torn_frame() {
+  std::atomic<bool> stop(false);
+  std::vector<Reader> readers;
+  for (int i = 0; i < MAX_CLIENTS; i++)
+    readers.push_back({ (uint32_t)i + 1, i % 2 ? 2000 : 0, &stop });
+  std::vector<std::thread> threads;
+  for (Reader& r : readers)
+    threads.emplace_back([&r]() { r.run(); });
+  uint32_t retries = frameRetries.value();
+  produce(STRESS_MS, NULL);
+  stop = true;
+  for (std::thread& t : threads)
+    t.join();
+
+  int reads = 0, torn = 0;
+  for (Reader& r : readers) {
+    reads += r.reads;
+    torn += r.torn;
+  }
+  FramePoolStats pool = framePoolStats();
+  char message[128];
+  snprintf(message, sizeof(message), "%d reads by %d readers, %d retried, %d pool copies, %d torn", reads, MAX_CLIENTS,
+           (int)(frameRetries.value() - retries), (int)pool.copies, torn);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL(0, torn);
+  TEST_ASSERT_GREATER_THAN(1000, reads);
+}
+
+// The producer never waits for readers: the handoff costs the same with none and with
+// MAX_CLIENTS of them pinning frames
+void test_publish_jitter_does_not_grow_with_readers() {
+  const int counts[] = { 0, 1, 4, MAX_CLIENTS };
+  int64_t idleP99 = 0;
+  for (int n : counts) {
+    std::atomic<bool> stop(false);
+    std::vector<Reader> readers;
+    for (int i = 0; i < n; i++)
+      readers.push_back({ (uint32_t)i + 1, 1000000 / FPS, &stop });
+    std::vector<std::thread> threads;
+    for (Reader& r : readers)
+      threads.emplace_back([&r]() { r.run(); });
+    std::vector<int64_t> publishUs;
+    produce(JITTER_MS, &publishUs);
+    stop = true;
+    for (std::thread& t : threads)
+      t.join();
+
+    int64_t p50 = percentile(publishUs, 50), p99 = percentile(publishUs, 99);
+    char message[128];
+    snprintf(message, sizeof(message), "%d readers: framePublish p50 %d us, p99 %d us over %d frames", n, (int)p50, (int)p99,
+             (int)publishUs.size());
+    TEST_MESSAGE(message);
+    if (n == 0)
+      idleP99 = p99;
+    else
+      TEST_ASSERT_LESS_OR_EQUAL(idleP99 * 4 + 100, p99);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_readers_never_see_a_torn_frame);
+  RUN_TEST(test_publish_jitter_does_not_grow_with_readers);
+  return UNITY_END();
+}
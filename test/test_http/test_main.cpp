@@ -0,0 +1,135 @@
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "../loopback.h"
+
+#define TTFB_REQUESTS 200
+#define POLL_MS       100  // How long the polled WebServer loop slept between passes
+
+// Opens a connection and sends raw bytes, without completing a request unless they do
+static int openWith(const std::string& bytes) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(HTTP_PORT);
+  TEST_ASSERT_EQUAL(0, connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+  if (!bytes.empty())
+    TEST_ASSERT_EQUAL((int)bytes.size(), send(fd, bytes.data(), bytes.size(), 0));
+  return fd;
+}
+
+static std::string responseTo(const std::string& request) {
+  int fd = openWith(request);
+  std::string response;
+  loopbackRead(fd, &response, 2000);
+  close(fd);
+  return response;
+}
+
+// Time from connect to the first byte of the response, microseconds
+static int64_t ttfb(const char* path) {
+  int64_t start = esp_timer_get_time();
+  int fd = loopbackGet(path);
+  TEST_ASSERT_TRUE(fd >= 0);
+  char c;
+  TEST_ASSERT_EQUAL(1, recv(fd, &c, 1, 0));
+  int64_t elapsed = esp_timer_get_time() - start;
+  close(fd);
+  return elapsed;
+}
+
+static int64_t percentile(std::vector<int64_t> samples, int p) {
+  std::sort(samples.begin(), samples.end());
+  return samples[(samples.size() - 1) * p / 100];
+}
+
+static void echo() {
+  server.send(200, "text/plain", server.arg("q") + "|" + server.header("X-Probe"));
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// Requests are answered as soon as they arrive, not on the next pass of a polling loop
+void test_time_to_first_byte() {
+  std::vector<int64_t> samples;
+  for (int i = 0; i < TTFB_REQUESTS; i++)
+    samples.push_back(ttfb("/missing"));
+  int64_t p50 = percentile(samples, 50), p99 = percentile(samples, 99);
+  char message[80];
+  snprintf(message, sizeof(message), "404 TTFB over %d requests: p50 %d us, p99 %d us", TTFB_REQUESTS, (int)p50, (int)p99);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(POLL_MS * 1000 / 10, p50);
+  TEST_ASSERT_LESS_THAN(POLL_MS * 1000, p99);
+}
+
+// A client that sends half a request does not hold up the others
+void test_stalled_request_does_not_block_others() {
+  int stalled = openWith("GET /echo HTTP/1.1\r\nHost: loc");
+  int64_t start = esp_timer_get_time();
+  std::string response = responseTo("GET /echo?q=ok HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  int64_t elapsed = esp_timer_get_time() - start;
+  TEST_ASSERT_TRUE(response.find("\r\n\r\nok|") != std::string::npos);
+  TEST_ASSERT_LESS_THAN(POLL_MS * 1000, elapsed);
+
+  // The stalled one completes later and is served as well
+  const char* rest = "alhost\r\n\r\n";
+  send(stalled, rest, strlen(rest), 0);
+  response.clear();
+  loopbackRead(stalled, &response, 2000);
+  close(stalled);
+  TEST_ASSERT_TRUE(response.compare(0, 12, "HTTP/1.1 200") == 0);
+}
+
+void test_query_and_headers_reach_the_handler() {
+  std::string response = responseTo("GET /echo?x=1&q=a%20b+c HTTP/1.1\r\nHost: localhost\r\nX-Probe: seen\r\n\r\n");
+  TEST_ASSERT_TRUE(response.compare(0, 12, "HTTP/1.1 200") == 0);
+  TEST_ASSERT_TRUE(response.find("\r\n\r\na b c|seen") != std::string::npos);
+}
+
+void test_request_split_across_segments() {
+  int fd = openWith("GE");
+  delay(20);
+  const char* rest = "T /echo?q=split HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  send(fd, rest, strlen(rest), 0);
+  std::string response;
+  loopbackRead(fd, &response, 2000);
+  close(fd);
+  TEST_ASSERT_TRUE(response.find("\r\n\r\nsplit|") != std::string::npos);
+}
+
+void test_oversized_request_gets_431() {
+  std::string request = "GET /echo HTTP/1.1\r\nX-Pad: " + std::string(HTTP_REQUEST_MAX, 'a') + "\r\n\r\n";
+  TEST_ASSERT_TRUE(responseTo(request).compare(0, 12, "HTTP/1.1 431") == 0);
+}
+
+// Connections beyond the pending table are turned away at once instead of queueing
+void test_full_pending_table_gets_503() {
+  std::vector<int> stalled;
+  for (int i = 0; i < HTTP_PENDING; i++)
+    stalled.push_back(openWith("GET /echo HTTP/1.1\r\n"));
+  delay(50);
+  std::string response = responseTo("GET /echo?q=late HTTP/1.1\r\n\r\n");
+  for (int fd : stalled)
+    close(fd);
+  TEST_ASSERT_TRUE(response.compare(0, 12, "HTTP/1.1 503") == 0);
+
+  // Closed connections leave the table, so the server takes requests again
+  delay(50);
+  TEST_ASSERT_TRUE(responseTo("GET /echo?q=again HTTP/1.1\r\n\r\n").find("\r\n\r\nagain|") != std::string::npos);
+}
+
+int main() {
+  server.on("/echo", HTTP_GET, echo);
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_time_to_first_byte);
+  RUN_TEST(test_stalled_request_does_not_block_others);
+  RUN_TEST(test_query_and_headers_reach_the_handler);
+  RUN_TEST(test_request_split_across_segments);
+  RUN_TEST(test_oversized_request_gets_431);
+  RUN_TEST(test_full_pending_table_gets_503);
+  return loopbackExit(UNITY_END());
+}
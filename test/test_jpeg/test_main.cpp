@@ -0,0 +1,138 @@
+#include <unity.h>
+#include "jpeg.h"
+#include "fixtures.h"
+
+static std::vector<uint8_t> still, restart;
+static JpegInfo info;  // Too large for the stack of some hosts' test runners
+
+// Entropy-decodes every block of the scan, leaving b where decoding stopped
+static bool decodeAll(const std::vector<uint8_t>& jpeg, JpegBits* b) {
+  if (!jpegParse(jpeg.data(), jpeg.size(), &info))
+    return false;
+  jpegBitsBegin(b, &info);
+  int16_t coef[64];
+  for (size_t m = 0; m < (size_t)info.mcusX * info.mcusY; m++) {
+    if (info.restart && m && m % info.restart == 0 && !jpegRestart(b, &info))
+      return false;
+    for (int i = 0; i < info.ncomp; i++) {
+      for (int k = 0; k < info.comp[i].h * info.comp[i].v; k++) {
+        if (!jpegDecodeBlock(b, &info, &info.comp[i], coef))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+void setUp() {
+  if (still.empty())
+    TEST_ASSERT_TRUE_MESSAGE(fixtureLoad("still.jpg", &still), "tools/fixtures.py writes the fixtures");
+  if (restart.empty())
+    TEST_ASSERT_TRUE(fixtureLoad("still-restart.jpg", &restart));
+}
+
+void tearDown() {}
+
+void test_parse_reads_the_frame_header() {
+  TEST_ASSERT_TRUE(jpegParse(still.data(), still.size(), &info));
+  TEST_ASSERT_EQUAL(320, info.width);
+  TEST_ASSERT_EQUAL(240, info.height);
+  TEST_ASSERT_EQUAL(3, info.ncomp);
+  TEST_ASSERT_EQUAL(2, info.comp[0].h);
+  TEST_ASSERT_EQUAL(1, info.comp[0].v);
+  TEST_ASSERT_EQUAL(1, info.comp[1].h);
+  TEST_ASSERT_EQUAL(20, info.mcusX);
+  TEST_ASSERT_EQUAL(30, info.mcusY);
+  TEST_ASSERT_EQUAL(0, info.restart);
+  TEST_ASSERT_TRUE(info.scan > still.data() && info.scan < still.data() + still.size());
+}
+
+void test_parse_reads_the_restart_interval() {
+  TEST_ASSERT_TRUE(jpegParse(restart.data(), restart.size(), &info));
+  TEST_ASSERT_EQUAL(7, info.restart);
+}
+
+void test_parse_rejects_what_it_cannot_decode() {
+  std::vector<uint8_t> jpeg = still;
+  TEST_ASSERT_FALSE(jpegParse(jpeg.data(), 3, &info));
+  TEST_ASSERT_FALSE(jpegParse(jpeg.data(), 200, &info));
+
+  jpeg[1] = 0xD9;
+  TEST_ASSERT_FALSE(jpegParse(jpeg.data(), jpeg.size(), &info));
+
+  // Turn the SOF0 into a progressive SOF2
+  jpeg = still;
+  for (size_t i = 2; i + 1 < jpeg.size(); i += 2 + (jpeg[i + 2] << 8 | jpeg[i + 3])) {
+    if (jpeg[i + 1] == 0xC0) {
+      jpeg[i + 1] = 0xC2;
+      break;
+    }
+  }
+  TEST_ASSERT_FALSE(jpegParse(jpeg.data(), jpeg.size(), &info));
+}
+
+void test_decode_consumes_the_whole_scan() {
+  JpegBits b;
+  TEST_ASSERT_TRUE(decodeAll(still, &b));
+  // Only the fill bits of the last byte and the EOI marker are left
+  TEST_ASSERT_TRUE(b.end - b.p <= 3);
+}
+
+void test_decode_follows_restart_markers() {
+  JpegBits b;
+  TEST_ASSERT_TRUE(decodeAll(restart, &b));
+  TEST_ASSERT_TRUE(b.end - b.p <= 3);
+}
+
+void test_decode_rejects_invalid_codes() {
+  TEST_ASSERT_TRUE(jpegParse(still.data(), still.size(), &info));
+  std::vector<uint8_t> jpeg = still;
+  size_t scan = info.scan - still.data();
+  const uint8_t ones[] = { 0xFF, 0x00, 0xFF, 0x00 };  // Stuffed: 32 one bits, longer than any code
+  memcpy(jpeg.data() + scan, ones, sizeof(ones));
+  JpegBits b;
+  TEST_ASSERT_FALSE(decodeAll(jpeg, &b));
+}
+
+void test_decode_stays_inside_truncated_data() {
+  // Past the end the reader feeds zeros, which decode, but it never reads beyond the buffer
+  std::vector<uint8_t> cut(still.begin(), still.begin() + still.size() / 2);
+  JpegBits b;
+  decodeAll(cut, &b);
+  TEST_ASSERT_TRUE(b.p <= b.end);
+  TEST_ASSERT_TRUE(b.end == cut.data() + cut.size());
+}
+
+void test_dc_map_is_the_same_with_and_without_restarts() {
+  TEST_ASSERT_TRUE(jpegParse(still.data(), still.size(), &info));
+  size_t mcus = (size_t)info.mcusX * info.mcusY;
+  std::vector<int16_t> plain(mcus), marked(mcus);
+  TEST_ASSERT_TRUE(jpegDcMap(&info, plain.data()));
+  TEST_ASSERT_TRUE(jpegParse(restart.data(), restart.size(), &info));
+  TEST_ASSERT_TRUE(jpegDcMap(&info, marked.data()));
+  TEST_ASSERT_EQUAL_INT16_ARRAY(plain.data(), marked.data(), mcus);
+}
+
+void test_dc_map_follows_the_picture() {
+  TEST_ASSERT_TRUE(jpegParse(still.data(), still.size(), &info));
+  std::vector<int16_t> dc((size_t)info.mcusX * info.mcusY);
+  TEST_ASSERT_TRUE(jpegDcMap(&info, dc.data()));
+  // The test card's colour bars run from white on the left to black on the right;
+  // DC is 8x the mean level shifted by -128
+  TEST_ASSERT_INT_WITHIN(64, 8 * (235 - 128), dc[0]);
+  TEST_ASSERT_INT_WITHIN(64, 8 * (16 - 128), dc[info.mcusX - 1]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_reads_the_frame_header);
+  RUN_TEST(test_parse_reads_the_restart_interval);
+  RUN_TEST(test_parse_rejects_what_it_cannot_decode);
+  RUN_TEST(test_decode_consumes_the_whole_scan);
+  RUN_TEST(test_decode_follows_restart_markers);
+  RUN_TEST(test_decode_rejects_invalid_codes);
+  RUN_TEST(test_decode_stays_inside_truncated_data);
+  RUN_TEST(test_dc_map_is_the_same_with_and_without_restarts);
+  RUN_TEST(test_dc_map_follows_the_picture);
+  return UNITY_END();
+}
@@ -0,0 +1,199 @@
+#include <unity.h>
+#include "logging.h"
+#include "esp_timer.h"
+#include <string>
+#include <vector>
+
+#define TIMESTAMP_CHARS 16  // "dd:hh:mm:ss.mmm " ahead of every text line
+#define COST_BATCH      40    // Records logged between drains in the cost test, well within the ring
+#define COST_BATCHES    2000
+
+// Collects what the drain writes, one entry per line
+class CapturePrint : public Print {
+public:
+  using Print::write;
+  size_t write(const uint8_t* buf, size_t len) override {
+    text.append((const char*)buf, len);
+    return len;
+  }
+  std::vector<std::string> lines() {
+    std::vector<std::string> out;
+    size_t start = 0;
+    for (size_t nl; (nl = text.find('\n', start)) != std::string::npos; start = nl + 1)
+      out.push_back(text.substr(start, nl - start));
+    text.clear();
+    return out;
+  }
+  std::string text;
+};
+
+static CapturePrint capture;
+
+// Drains the ring and returns the single line it held, without its timestamp
+static std::string drainOne() {
+  TEST_ASSERT_TRUE(Log.drain());
+  std::vector<std::string> lines = capture.lines();
+  TEST_ASSERT_EQUAL(1, lines.size());
+  TEST_ASSERT_TRUE(lines[0].size() >= TIMESTAMP_CHARS);
+  return lines[0].substr(TIMESTAMP_CHARS);
+}
+
+void setUp() {
+  Log.begin(LOG_LEVEL_VERBOSE, &capture);
+  Log.drain();
+  capture.text.clear();
+}
+
+void tearDown() {}
+
+void test_formats_every_argument_type() {
+  Log.notice("int %d uint %u big %d huge %u" CR, -5, 4000000000u, -5000000000LL, 18000000000000000000ull);
+  TEST_ASSERT_EQUAL_STRING("N: int -5 uint 4000000000 big -5000000000 huge 18000000000000000000", drainOne().c_str());
+
+  Log.trace("%x %X %b %c %t %T %F %D" CR, 255, 255, 5, 'A', 1, 0, 2.5, 0.125f);
+  TEST_ASSERT_EQUAL_STRING("T: ff 0xFF 0b101 A T false 2.50 0.12", drainOne().c_str());
+
+  Log.warning("%s and %s, 100%%, size %zu, %08lu" CR, "literal", String("copy"), (size_t)12, 7ul);
+  TEST_ASSERT_EQUAL_STRING("W: literal and copy, 100%, size 12, 7", drainOne().c_str());
+}
+
+void test_missing_arguments_are_shown_as_conversions() {
+  Log.error("%d of %d" CR, 1);
+  TEST_ASSERT_EQUAL_STRING("E: 1 of %d", drainOne().c_str());
+}
+
+// Arguments are dropped from the first one that does not fit in LOG_RECORD_MAX on
+void test_arguments_past_the_record_limit_are_dropped() {
+  std::string s(LOG_STRING_MAX, 's');
+  Log.notice("%s %s %s %s %d" CR, s.c_str(), s.c_str(), s.c_str(), s.c_str(), 7);
+  TEST_ASSERT_EQUAL_STRING(("N: " + s + " " + s + " " + s + " %s %d").c_str(), drainOne().c_str());
+}
+
+// Pointers keep every bit, whatever their width
+void test_pointers_are_not_truncated() {
+  uintptr_t address = (uintptr_t)0x89abcdef;
+  if (sizeof(address) > 4)
+    address = address << 16 | 0x1234;
+  Log.notice("%x" CR, (const void*)address);
+  char expected[32];
+  snprintf(expected, sizeof(expected), "N: %llx", (unsigned long long)address);
+  TEST_ASSERT_EQUAL_STRING(expected, drainOne().c_str());
+}
+
+void test_level_filters_records() {
+  Log.setLevel(LOG_LEVEL_WARNING);
+  Log.notice("hidden" CR);
+  TEST_ASSERT_FALSE(Log.drain());
+  Log.fatal("shown" CR);
+  TEST_ASSERT_EQUAL_STRING("F: shown", drainOne().c_str());
+}
+
+void test_strings_are_copied_when_logged() {
+  char name[64];
+  strcpy(name, "before");
+  Log.notice("%s" CR, name);
+  strcpy(name, "after");
+  TEST_ASSERT_EQUAL_STRING("N: before", drainOne().c_str());
+
+  // Long strings are cut at LOG_STRING_MAX
+  std::string longName(100, 'x');
+  Log.notice("%s" CR, longName.c_str());
+  TEST_ASSERT_EQUAL_STRING(("N: " + std::string(LOG_STRING_MAX, 'x')).c_str(), drainOne().c_str());
+}
+
+void test_full_ring_drops_and_reports() {
+  // Records without arguments are a header word, timestamp and format pointer; padding at
+  // the end of the ring can cost one more, depending on where the earlier tests left it
+  const int logged = LOG_RING_BYTES / (8 + sizeof(const char*)) + 10;
+  uint32_t before = Log.dropped();
+  for (int i = 0; i < logged; i++)
+    Log.notice("line" CR);
+  uint32_t dropped = Log.dropped() - before;
+  TEST_ASSERT_UINT_WITHIN(1, 10, dropped);
+  TEST_ASSERT_GREATER_OR_EQUAL(10, dropped);
+
+  TEST_ASSERT_TRUE(Log.drain());
+  std::vector<std::string> lines = capture.lines();
+  TEST_ASSERT_EQUAL(logged - dropped + 1, lines.size());
+  std::string report = "log: " + std::to_string(dropped) + " records dropped, ring full";
+  TEST_ASSERT_EQUAL_STRING(report.c_str(), lines.back().c_str());
+
+  // Reported once only
+  Log.notice("line" CR);
+  TEST_ASSERT_EQUAL_STRING("N: line", drainOne().c_str());
+}
+
+void test_records_wrap_in_order() {
+  // Odd-sized records leave a gap at the end of the ring that padding fills
+  std::string filler(LOG_STRING_MAX, 'y');
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 40; i++)
+      Log.notice("%d %s" CR, round * 100 + i, filler.c_str());
+    TEST_ASSERT_TRUE(Log.drain());
+    std::vector<std::string> lines = capture.lines();
+    TEST_ASSERT_EQUAL(40, lines.size());
+    for (int i = 0; i < 40; i++) {
+      std::string expected = "N: " + std::to_string(round * 100 + i) + " " + filler;
+      TEST_ASSERT_EQUAL_STRING(expected.c_str(), lines[i].substr(TIMESTAMP_CHARS).c_str());
+    }
+  }
+}
+
+void test_hex_dump() {
+  printBuffer("ABC\x01", 4);
+  TEST_ASSERT_TRUE(Log.drain());
+  std::vector<std::string> lines = capture.lines();
+  TEST_ASSERT_EQUAL(2, lines.size());
+  TEST_ASSERT_EQUAL_STRING("Buffer contents (4 bytes):", lines[0].substr(TIMESTAMP_CHARS).c_str());
+  TEST_ASSERT_EQUAL_STRING("0000 : 41 42 43 01  : ABC.", lines[1].c_str());
+}
+
+// Mean time per record of logging batches of COST_BATCH records and of draining them,
+// nanoseconds
+template <typename Call>
+static void callCost(Call call, double* logged, double* drained) {
+  int64_t logUs = 0, drainUs = 0;
+  for (int b = 0; b < COST_BATCHES; b++) {
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < COST_BATCH; i++)
+      call(i);
+    int64_t mid = esp_timer_get_time();
+    Log.drain();
+    drainUs += esp_timer_get_time() - mid;
+    logUs += mid - start;
+    capture.text.clear();
+  }
+  *logged = logUs * 1000.0 / (COST_BATCHES * COST_BATCH);
+  *drained = drainUs * 1000.0 / (COST_BATCHES * COST_BATCH);
+}
+
+// A call on a hot path only copies its arguments; the formatting it used to do in place
+// now runs on the drain task
+void test_call_cost() {
+  const char* name = "camCB";
+  uint32_t dropped = Log.dropped();
+  double bare, bareDrain, args, argsDrain;
+  callCost([](int i) { Log.verbose("camCB: frame published" CR); }, &bare, &bareDrain);
+  callCost([name](int i) { Log.verbose("%s: frame %d, %u bytes, %d us" CR, name, i, 24576u, 7); }, &args, &argsDrain);
+  char message[128];
+  snprintf(message, sizeof(message), "per call: no arguments %.0f ns (format %.0f ns), 4 arguments %.0f ns (format %.0f ns)",
+           bare, bareDrain, args, argsDrain);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(argsDrain, args);
+  TEST_ASSERT_EQUAL(dropped, Log.dropped());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_formats_every_argument_type);
+  RUN_TEST(test_missing_arguments_are_shown_as_conversions);
+  RUN_TEST(test_arguments_past_the_record_limit_are_dropped);
+  RUN_TEST(test_pointers_are_not_truncated);
+  RUN_TEST(test_level_filters_records);
+  RUN_TEST(test_strings_are_copied_when_logged);
+  RUN_TEST(test_full_ring_drops_and_reports);
+  RUN_TEST(test_records_wrap_in_order);
+  RUN_TEST(test_hex_dump);
+  RUN_TEST(test_call_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,118 @@
+#include <unity.h>
+#include <thread>
+#include "../loopback.h"
+#include "metrics.h"
+
+#define RUN_MS       6000  // How long the viewers stream
+#define STALL_PERIOD 2000  // The slow viewer stops reading for STALL_MS out of every STALL_PERIOD
+#define STALL_MS     1000
+#define SLOW_RCVBUF  8192  // Small, so the stalls push back on the server's socket
+
+// A viewer of /mjpeg counting the whole frames it gets; a stalling one stops reading
+// for STALL_MS out of every STALL_PERIOD, as tools/loadgen.py --stall does
+struct Viewer {
+  bool stalls;
+  int frames = 0;
+
+  void run() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (stalls) {
+      int rcvbuf = SLOW_RCVBUF;
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(HTTP_PORT);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+      return;
+    const char* request = "GET /mjpeg HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(fd, request, strlen(request), 0);
+
+    std::string buf;
+    int64_t start = esp_timer_get_time();
+    for (int64_t now = start; now - start < RUN_MS * 1000LL; now = esp_timer_get_time()) {
+      if (stalls && (now - start) / 1000 % STALL_PERIOD >= STALL_PERIOD - STALL_MS) {
+        delay(10);
+        continue;
+      }
+      if (!loopbackRead(fd, &buf, 10))
+        break;
+      for (;;) {
+        size_t at = buf.find("Content-Length: ");
+        size_t body = at == std::string::npos ? at : buf.find("\r\n\r\n", at);
+        if (body == std::string::npos)
+          break;
+        size_t len = strtoul(buf.c_str() + at + 16, NULL, 10);
+        if (buf.size() < body + 4 + len)
+          break;
+        frames++;
+        buf.erase(0, body + 4 + len);
+      }
+    }
+    close(fd);
+  }
+};
+
+// Value of a metric in the /metrics exposition, or -1
+static double metric(const std::string& text, const char* name) {
+  std::string key = std::string("\n") + name + " ";
+  size_t at = text.find(key);
+  return at == std::string::npos ? -1 : atof(text.c_str() + at + key.size());
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// Seconds add up past the 71 minutes of microseconds a 32-bit sum holds. Nothing else
+// renders substreams in this test, so the scale histogram holds only these observations.
+void test_histogram_sum_does_not_wrap() {
+  scaleUs.observe(3000000000u);
+  scaleUs.observe(3000000000u);
+  std::string text = loopbackFetch("/metrics");
+  TEST_ASSERT_EQUAL_INT(6000, (int)metric(text, "camera_scale_seconds_sum"));
+  TEST_ASSERT_EQUAL_INT(2, (int)metric(text, "camera_scale_seconds_count"));
+}
+
+// A viewer that stops reading has its sends stalled and its frames skipped, while capture
+// and a viewer on a good link keep the full rate; /metrics shows which frames went where
+void test_slow_client_is_skipped_not_waited_for() {
+  std::string before = loopbackFetch("/metrics");
+  Viewer fast = { false }, slow = { true };
+  std::thread fastThread([&]() { fast.run(); });
+  std::thread slowThread([&]() { slow.run(); });
+  fastThread.join();
+  slowThread.join();
+  std::string after = loopbackFetch("/metrics");
+  auto delta = [&](const char* name) { return (int)(metric(after, name) - metric(before, name)); };
+
+  int captured = delta("camera_frames_captured_total"), published = delta("camera_frames_published_total");
+  int sent = delta("mjpeg_frames_sent_total"), skipped = delta("mjpeg_frames_skipped_total");
+  int stalled = delta("mjpeg_frames_stalled_total");
+  char message[160];
+  snprintf(message, sizeof(message),
+           "%d s: captured %d, published %d, fast viewer %d frames, stalling viewer %d; sent %d, skipped %d, stalled %d",
+           RUN_MS / 1000, captured, published, fast.frames, slow.frames, sent, skipped, stalled);
+  TEST_MESSAGE(message);
+
+  int expected = FPS * RUN_MS / 1000;
+  TEST_ASSERT_GREATER_OR_EQUAL(expected * 8 / 10, captured);
+  TEST_ASSERT_GREATER_OR_EQUAL(expected * 8 / 10, fast.frames);
+  TEST_ASSERT_GREATER_THAN(0, slow.frames);
+  TEST_ASSERT_LESS_THAN(fast.frames, slow.frames);
+  // Every frame the server finished sending reached a viewer, short of the ones in flight at the end
+  TEST_ASSERT_INT_WITHIN(4, fast.frames + slow.frames, sent);
+  // Each stall holds up a send, and the frames published meanwhile are skipped. The last
+  // stall runs to the end, before a later frame could show its gap.
+  TEST_ASSERT_GREATER_OR_EQUAL(RUN_MS / STALL_PERIOD, stalled);
+  TEST_ASSERT_GREATER_OR_EQUAL((RUN_MS / STALL_PERIOD - 1) * STALL_MS * FPS / 1000 * 3 / 4, skipped);
+}
+
+int main() {
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_histogram_sum_does_not_wrap);
+  RUN_TEST(test_slow_client_is_skipped_not_waited_for);
+  return loopbackExit(UNITY_END());
+}
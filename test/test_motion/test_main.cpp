@@ -0,0 +1,142 @@
+#include <unity.h>
+#include "motion.h"
+#include "fixtures.h"
+
+#define COST_RUNS 50
+
+// The scorer keeps its reference between calls, so the tests run in order from a fresh start
+static std::vector<uint8_t> frames[2], still;
+
+// Scores a corpus sequence as camCB does: the first frame is published, later ones only
+// when they score at least MOTION_THRESHOLD. Returns the frames dropped; lowest and highest
+// receive the extreme scores.
+static int playCorpus(const char* prefix, int* lowest, int* highest) {
+  std::vector<std::string> names;
+  for (const std::string& name : fixtureList("motion")) {
+    if (name.compare(7, strlen(prefix), prefix) == 0)
+      names.push_back(name);
+  }
+  TEST_ASSERT_GREATER_THAN_MESSAGE(1, names.size(), "tools/fixtures.py writes the fixtures");
+
+  std::vector<uint8_t> jpeg;
+  int dropped = 0;
+  *lowest = MOTION_UNKNOWN;
+  *highest = 0;
+  for (size_t i = 0; i < names.size(); i++) {
+    TEST_ASSERT_TRUE(fixtureLoad(names[i].c_str(), &jpeg));
+    int score = motionScore(jpeg.data(), jpeg.size());
+    if (i == 0) {
+      motionCommit();
+      continue;
+    }
+    TEST_ASSERT_LESS_THAN(MOTION_UNKNOWN, score);
+    *lowest = score < *lowest ? score : *lowest;
+    *highest = score > *highest ? score : *highest;
+    if (score < MOTION_THRESHOLD)
+      dropped++;
+    else
+      motionCommit();
+  }
+  return dropped;
+}
+
+void setUp() {
+  if (still.empty()) {
+    TEST_ASSERT_TRUE_MESSAGE(fixtureLoad("frames/frame-0.jpg", &frames[0]), "tools/fixtures.py writes the fixtures");
+    TEST_ASSERT_TRUE(fixtureLoad("frames/frame-1.jpg", &frames[1]));
+    TEST_ASSERT_TRUE(fixtureLoad("still.jpg", &still));
+  }
+}
+
+void tearDown() {}
+
+void test_first_frame_has_no_reference() {
+  TEST_ASSERT_EQUAL(MOTION_UNKNOWN, motionScore(frames[0].data(), frames[0].size()));
+  TEST_ASSERT_EQUAL(MOTION_UNKNOWN, motionScore(frames[0].data(), frames[0].size()));
+  motionCommit();
+}
+
+void test_same_frame_is_static() {
+  TEST_ASSERT_EQUAL(0, motionScore(frames[0].data(), frames[0].size()));
+}
+
+void test_moving_ball_is_motion() {
+  uint16_t score = motionScore(frames[1].data(), frames[1].size());
+  TEST_ASSERT_GREATER_OR_EQUAL(MOTION_THRESHOLD, score);
+  TEST_ASSERT_LESS_THAN(MOTION_UNKNOWN, score);
+}
+
+void test_reference_moves_only_on_commit() {
+  // frame-1 was scored but not committed: frame-0 is still the reference
+  TEST_ASSERT_EQUAL(0, motionScore(frames[0].data(), frames[0].size()));
+  motionScore(frames[1].data(), frames[1].size());
+  motionCommit();
+  TEST_ASSERT_EQUAL(0, motionScore(frames[1].data(), frames[1].size()));
+}
+
+void test_unparsable_frames_are_unknown() {
+  TEST_ASSERT_EQUAL(MOTION_UNKNOWN, motionScore(frames[1].data(), 64));
+  std::vector<uint8_t> garbage(frames[1].size(), 0x5A);
+  TEST_ASSERT_EQUAL(MOTION_UNKNOWN, motionScore(garbage.data(), garbage.size()));
+}
+
+void test_resolution_change_is_unknown() {
+  TEST_ASSERT_EQUAL(MOTION_UNKNOWN, motionScore(still.data(), still.size()));
+  motionCommit();
+  TEST_ASSERT_EQUAL(0, motionScore(still.data(), still.size()));
+  TEST_ASSERT_EQUAL(MOTION_UNKNOWN, motionScore(frames[0].data(), frames[0].size()));
+}
+
+// Sensor noise and exposure flicker alone never reach MOTION_THRESHOLD: a static scene is
+// dropped down to the keepalive
+void test_static_corpus_is_dropped() {
+  int lowest, highest;
+  int dropped = playCorpus("static-", &lowest, &highest);
+  char message[96];
+  snprintf(message, sizeof(message), "static: %d frames dropped, scores %d-%d, threshold %d", dropped, lowest, highest,
+           MOTION_THRESHOLD);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(MOTION_THRESHOLD, highest);
+}
+
+// A small object crossing the frame scores above MOTION_THRESHOLD in every frame: the
+// false-drop rate of the moving corpus is zero
+void test_moving_corpus_is_never_dropped() {
+  int lowest, highest;
+  int dropped = playCorpus("moving-", &lowest, &highest);
+  char message[96];
+  snprintf(message, sizeof(message), "moving: %d frames dropped, scores %d-%d, threshold %d", dropped, lowest, highest,
+           MOTION_THRESHOLD);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_EQUAL_MESSAGE(0, dropped, "moving frames scored as static");
+}
+
+// The scorer runs on the camera task for every capture, so it has to fit well inside a
+// frame interval
+void test_parser_cost_per_frame() {
+  std::vector<uint8_t> jpeg;
+  TEST_ASSERT_TRUE(fixtureLoad("motion/moving-1.jpg", &jpeg));
+  motionScore(jpeg.data(), jpeg.size());
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < COST_RUNS; i++)
+    motionScore(jpeg.data(), jpeg.size());
+  int64_t perFrame = (esp_timer_get_time() - start) / COST_RUNS;
+  char message[96];
+  snprintf(message, sizeof(message), "motionScore: %d us per %d-byte HD frame", (int)perFrame, (int)jpeg.size());
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(1000000 / FPS / 4, perFrame);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_frame_has_no_reference);
+  RUN_TEST(test_same_frame_is_static);
+  RUN_TEST(test_moving_ball_is_motion);
+  RUN_TEST(test_reference_moves_only_on_commit);
+  RUN_TEST(test_unparsable_frames_are_unknown);
+  RUN_TEST(test_resolution_change_is_unknown);
+  RUN_TEST(test_static_corpus_is_dropped);
+  RUN_TEST(test_moving_corpus_is_never_dropped);
+  RUN_TEST(test_parser_cost_per_frame);
+  return UNITY_END();
+}
@@ -0,0 +1,186 @@
+#include <unity.h>
+#include <vector>
+#include "i2s.h"
+#include "../loopback.h"
+
+#define VIDEO_TRACK 1
+#define AUDIO_TRACK 2
+#define CAPTURE_MS  3000  // How much of the stream the client records
+#define ROUNDING_MS 1     // Timecodes are whole milliseconds
+
+// One SimpleBlock as a demuxer sees it: track and absolute timecode in ms
+struct Block {
+  uint8_t track;
+  int64_t ms;
+  size_t len;
+  bool jpeg;  // Payload starts with a JPEG SOI marker
+  bool lost;  // Audio: samples were lost before this block. Video: before the next audio block.
+};
+
+static std::string stream;
+static std::vector<Block> blocks;
+
+// Reads a variable-length integer; the ID keeps its length marker, a size loses it.
+// Returns 0 if the vint is not complete yet.
+static size_t readVint(const uint8_t* p, const uint8_t* end, bool keepMarker, uint64_t* value, bool* unknown) {
+  if (p >= end || *p == 0)
+    return 0;
+  size_t len = 1;
+  while (!(*p & (0x80 >> (len - 1))))
+    len++;
+  if (p + len > end)
+    return 0;
+  uint64_t v = keepMarker ? *p : *p & (0xFF >> len);
+  bool allOnes = v == (uint64_t)(0xFF >> len);
+  for (size_t i = 1; i < len; i++) {
+    v = v << 8 | p[i];
+    allOnes = allOnes && p[i] == 0xFF;
+  }
+  *value = v;
+  if (unknown)
+    *unknown = !keepMarker && allOnes;
+  return len;
+}
+
+// Walks the Matroska stream after the HTTP head: descends into the unknown-size Segment
+// and Clusters, skips Info and Tracks, and records every SimpleBlock
+static void demux(const std::string& data) {
+  const uint8_t* p = (const uint8_t*)data.data();
+  const uint8_t* end = p + data.size();
+  int64_t clusterMs = -1;
+  while (p < end) {
+    uint64_t id, size;
+    bool unknown;
+    size_t idLen = readVint(p, end, true, &id, NULL);
+    size_t sizeLen = idLen ? readVint(p + idLen, end, false, &size, &unknown) : 0;
+    if (!sizeLen)
+      break;
+    const uint8_t* body = p + idLen + sizeLen;
+    if (unknown) {
+      TEST_ASSERT_TRUE_MESSAGE(id == 0x18538067 || id == 0x1F43B675, "only the Segment and Clusters have unknown size");
+      p = body;
+      continue;
+    }
+    if (body + size > end)
+      break;  // The capture stopped inside this element
+    if (id == 0xE7) {
+      clusterMs = 0;
+      for (uint64_t i = 0; i < size; i++)
+        clusterMs = clusterMs << 8 | body[i];
+    } else if (id == 0xA3) {
+      TEST_ASSERT_TRUE_MESSAGE(clusterMs >= 0, "SimpleBlock outside a cluster");
+      int16_t rel = (int16_t)(body[1] << 8 | body[2]);
+      Block b = { (uint8_t)(body[0] & 0x7F), clusterMs + rel, (size_t)size - 4, body[4] == 0xFF && body[5] == 0xD8, false };
+      blocks.push_back(b);
+    }
+    p = body + size;
+  }
+
+  // Samples are lost when the capture task misses more than the DMA depth; on the host that
+  // takes the machine stalling it. The muxer then sends video ahead of the late audio.
+  int64_t lastAudio = -1;
+  size_t firstVideo = 0;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (blocks[i].track != AUDIO_TRACK)
+      continue;
+    blocks[i].lost = lastAudio >= 0 && blocks[i].ms - lastAudio > BLOCK_US / 1000 + ROUNDING_MS;
+    for (; firstVideo < i; firstVideo++)
+      blocks[firstVideo].lost = blocks[firstVideo].track == VIDEO_TRACK && blocks[i].lost;
+    lastAudio = blocks[i].ms;
+    firstVideo = i + 1;
+  }
+}
+
+// Records CAPTURE_MS of /av from the running server
+static void capture() {
+  int fd = loopbackGet("/av");
+  TEST_ASSERT_TRUE(fd >= 0);
+  TEST_ASSERT_TRUE_MESSAGE(loopbackRead(fd, &stream, CAPTURE_MS), "the server closed /av");
+  close(fd);
+
+  size_t head = stream.find("\r\n\r\n");
+  TEST_ASSERT_TRUE(head != std::string::npos);
+  TEST_ASSERT_TRUE(stream.compare(0, 12, "HTTP/1.1 200") == 0);
+  demux(stream.substr(head + 4));
+}
+
+void setUp() {
+  if (stream.empty())
+    capture();
+}
+
+void tearDown() {}
+
+void test_both_tracks_arrive() {
+  int video = 0, audio = 0;
+  for (const Block& b : blocks) {
+    if (b.track == VIDEO_TRACK) {
+      TEST_ASSERT_TRUE_MESSAGE(b.jpeg, "video block is not a JPEG frame");
+      video++;
+    } else {
+      TEST_ASSERT_EQUAL(AUDIO_TRACK, b.track);
+      TEST_ASSERT_EQUAL(BLOCK_SAMPLES * 2, b.len);
+      audio++;
+    }
+  }
+  // The camera replays at FPS and the microphone in real time; allow for startup
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS * CAPTURE_MS / 1000 / 2, video);
+  TEST_ASSERT_GREATER_OR_EQUAL(CAPTURE_MS * 1000 / BLOCK_US / 2, audio);
+}
+
+// Blocks go out in capture-time order across both tracks, except for audio that arrives
+// after the muxer gave up waiting for it
+void test_blocks_are_in_timecode_order() {
+  for (size_t i = 1; i < blocks.size(); i++) {
+    if (blocks[i].ms >= blocks[i - 1].ms)
+      continue;
+    char message[64];
+    snprintf(message, sizeof(message), "block %d goes back in time", (int)i);
+    TEST_ASSERT_TRUE_MESSAGE(blocks[i].lost, message);
+  }
+}
+
+// Audio timecodes advance by exactly one block, so the audio track never overlaps itself
+// and has gaps only where samples were lost
+void test_audio_timecodes_follow_the_samples() {
+  int64_t last = -1;
+  int losses = 0;
+  for (const Block& b : blocks) {
+    if (b.track != AUDIO_TRACK)
+      continue;
+    if (last >= 0 && !b.lost)
+      TEST_ASSERT_INT_WITHIN(ROUNDING_MS, BLOCK_US / 1000, b.ms - last);
+    losses += b.lost;
+    last = b.ms;
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "%d audio gaps from lost samples", losses);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL(CAPTURE_MS / 1000, losses);
+}
+
+// Every video frame follows the audio block that covers its capture time: the skew between
+// a frame and the audio sent just before it is at most one block
+void test_video_skew_to_audio_is_bounded() {
+  int64_t lastAudio = -1, maxSkew = 0;
+  for (const Block& b : blocks) {
+    if (b.track == AUDIO_TRACK)
+      lastAudio = b.ms;
+    else if (lastAudio >= 0 && !b.lost && b.ms - lastAudio > maxSkew)
+      maxSkew = b.ms - lastAudio;
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "largest video-to-audio skew %d ms", (int)maxSkew);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL(BLOCK_US / 1000 + ROUNDING_MS, maxSkew);
+}
+
+int main() {
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_both_tracks_arrive);
+  RUN_TEST(test_blocks_are_in_timecode_order);
+  RUN_TEST(test_audio_timecodes_follow_the_samples);
+  RUN_TEST(test_video_skew_to_audio_is_bounded);
+  return loopbackExit(UNITY_END());
+}
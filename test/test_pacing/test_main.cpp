@@ -0,0 +1,134 @@
+#include <unity.h>
+#include <thread>
+#include <vector>
+#include "../loopback.h"
+
+#define RUN_MS      8000   // How long the clients stream
+#define SETTLE_MS   3000   // Rates are measured after the pacing has settled
+#define SLOW_BPS    100000 // Link of the slow client, bytes/s
+#define SLOW_RCVBUF 4096   // Receive window of the slow client
+#define LINK_BURST  1460   // Most a link passes at once: one segment
+#define CAPPED_FPS  5
+
+// One simulated viewer: reads /mjpeg through a token bucket of bps bytes/s (0 for an
+// unlimited link) and counts the whole frames and bytes that arrive after SETTLE_MS
+struct Viewer {
+  const char* path;
+  uint32_t bps;
+  int rcvbuf;
+  int frames = 0;
+  int64_t bytes = 0;
+  int64_t frameBytes = 0;
+
+  void run() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf)
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(HTTP_PORT);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+      return;
+    std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    std::string buf;
+    int64_t start = esp_timer_get_time(), last = start, tokens = 0;
+    for (int64_t now = start; now - start < RUN_MS * 1000LL; now = esp_timer_get_time()) {
+      size_t want = LINK_BURST;
+      if (bps) {
+        // Token bucket: a link that was idle can only send one burst at once
+        tokens += (now - last) * bps / 1000000;
+        tokens = tokens > LINK_BURST ? LINK_BURST : tokens;
+        last = now;
+        if (tokens <= 0) {
+          delay(2);
+          continue;
+        }
+        want = tokens;
+      }
+      char chunk[LINK_BURST];
+      int r = recv(fd, chunk, want, 0);
+      if (r <= 0)
+        break;
+      tokens -= r;
+      buf.append(chunk, r);
+      bool settled = now - start >= SETTLE_MS * 1000LL;
+      if (settled)
+        bytes += r;
+
+      for (;;) {
+        size_t at = buf.find("Content-Length: ");
+        size_t body = at == std::string::npos ? at : buf.find("\r\n\r\n", at);
+        if (body == std::string::npos)
+          break;
+        size_t len = strtoul(buf.c_str() + at + 16, NULL, 10);
+        if (buf.size() < body + 4 + len)
+          break;
+        if (settled) {
+          frames++;
+          frameBytes += len;
+        }
+        buf.erase(0, body + 4 + len);
+      }
+    }
+    close(fd);
+  }
+
+  double fps() const { return frames * 1000.0 / (RUN_MS - SETTLE_MS); }
+  double linkBps() const { return bytes * 1000.0 / (RUN_MS - SETTLE_MS); }
+};
+
+static Viewer fast = { "/mjpeg", 0, 0 };
+static Viewer slow = { "/mjpeg", SLOW_BPS, SLOW_RCVBUF };
+static Viewer capped = { "/mjpeg?fps=5", 0, 0 };
+
+void setUp() {}
+
+void tearDown() {}
+
+static void report(const char* name, const Viewer& v) {
+  char message[96];
+  snprintf(message, sizeof(message), "%s: %.1f fps, %.0f bytes/s, %d bytes/frame", name, v.fps(), v.linkBps(),
+           v.frames ? (int)(v.frameBytes / v.frames) : 0);
+  TEST_MESSAGE(message);
+}
+
+// A viewer with a good link gets the full camera rate, whatever the others do
+void test_fast_client_keeps_the_camera_rate() {
+  report("fast", fast);
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS * 8 / 10, (int)fast.fps());
+}
+
+// The slow viewer is paced to whole frames its link can carry, with headroom: it receives
+// fewer frames, not frames that queue up behind a saturated link and arrive ever later
+void test_slow_client_gets_whole_frames_at_its_link_rate() {
+  report("slow", slow);
+  TEST_ASSERT_GREATER_OR_EQUAL(1, slow.frames);
+  double perFrame = (double)slow.frameBytes / slow.frames;
+  // The frames it got account for what it read: it is not stuck part-way through one
+  TEST_ASSERT_GREATER_THAN((int)(slow.linkBps() * 0.8), (int)(slow.frames * perFrame * 1000.0 / (RUN_MS - SETTLE_MS)));
+  TEST_ASSERT_LESS_THAN(SLOW_BPS * 9 / 10, (int)slow.linkBps());
+  TEST_ASSERT_LESS_OR_EQUAL((int)(SLOW_BPS / perFrame), (int)slow.fps());
+}
+
+void test_fps_argument_caps_the_rate() {
+  report("capped", capped);
+  TEST_ASSERT_INT_WITHIN(1, CAPPED_FPS, (int)(capped.fps() + 0.5));
+}
+
+int main() {
+  loopbackStart();
+  std::thread a([]() { fast.run(); });
+  std::thread b([]() { slow.run(); });
+  std::thread c([]() { capped.run(); });
+  a.join();
+  b.join();
+  c.join();
+  UNITY_BEGIN();
+  RUN_TEST(test_fast_client_keeps_the_camera_rate);
+  RUN_TEST(test_slow_client_gets_whole_frames_at_its_link_rate);
+  RUN_TEST(test_fps_argument_caps_the_rate);
+  return loopbackExit(UNITY_END());
+}
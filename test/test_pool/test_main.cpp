@@ -0,0 +1,119 @@
+#include <unity.h>
+#include <malloc.h>
+#include <vector>
+#include "globals.h"
+#include "frame.h"
+
+#define RUN_FRAMES    (FPS * 60 * 30)  // Half an hour of capture
+#define WARMUP_FRAMES 100              // Allocations of the first frames are not counted
+#define READERS       4                // Slow clients pinning frames
+#define MAX_HOLD      (3 * FPS)        // Longest a reader keeps a frame, in frames
+
+// A reader's pinned frame, the frame number to let it go at, and what it held
+struct Hold {
+  Frame* frame;
+  int until;
+  size_t len;
+  uint32_t sum;
+};
+
+static uint32_t checksum(const camera_fb_t* fb) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < fb->len; i++)
+    sum = sum * 31 + fb->buf[i];
+  return sum;
+}
+
+static void release(Hold* h) {
+  TEST_ASSERT_EQUAL_MESSAGE(h->len, h->frame->fb->len, "a pinned frame changed underneath its reader");
+  TEST_ASSERT_EQUAL_MESSAGE(h->sum, checksum(h->frame->fb), "a pinned frame changed underneath its reader");
+  frameRelease(h->frame);
+  h->frame = NULL;
+}
+
+void setUp() {
+  if (esp_camera_sensor_get() == NULL) {
+    // Replay as fast as frames are taken, so the run takes seconds rather than half an hour
+    setenv("CAMERA_SENSOR_FPS", "20000", 1);
+    camera_config_t config = {};
+    config.frame_size = FRAME_SIZE;
+    config.jpeg_quality = JPEG_QUALITY;
+    config.fb_count = FB_COUNT;
+    config.grab_mode = CAMERA_GRAB_LATEST;
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, esp_camera_init(&config), "tools/fixtures.py writes the fixtures");
+    framePoolSetup(resolution[FRAME_SIZE].width * resolution[FRAME_SIZE].height / 5);
+  }
+}
+
+void tearDown() {}
+
+// Slow readers pin frames for up to MAX_HOLD frames while capture runs at full rate.
+// Capture must never starve, pinned frames must never change, and after the first frames
+// nothing on the capture path may allocate: the heap in use stays where it was. More
+// readers than slabs can pin every slab at once; then frames are dropped, not capture.
+void test_long_run_never_allocates_or_starves() {
+  Hold holds[READERS] = {};
+  uint32_t seed = 1;
+  size_t heapStart = 0;
+  int dropped = 0;
+
+  for (int n = 0; n < RUN_FRAMES; n++) {
+    if (n == WARMUP_FRAMES)
+      heapStart = mallinfo2().uordblks;
+
+    camera_fb_t* fb = esp_camera_fb_get();
+    TEST_ASSERT_NOT_NULL_MESSAGE(fb, "capture starved: every driver buffer is pinned");
+    dropped += framePublish(fb, 0) == NULL;
+
+    for (Hold& h : holds) {
+      if (h.frame != NULL && n >= h.until)
+        release(&h);
+      if (h.frame == NULL) {
+        seed = seed * 1103515245 + 12345;
+        h.frame = frameAcquire();
+        h.until = n + 1 + (seed >> 16) % MAX_HOLD;
+        h.len = h.frame->fb->len;
+        h.sum = checksum(h.frame->fb);
+      }
+    }
+
+    FramePoolStats s = framePoolStats();
+    TEST_ASSERT_LESS_OR_EQUAL(s.slabs, s.inUse);
+  }
+  size_t heapEnd = mallinfo2().uordblks;
+
+  FramePoolStats s = framePoolStats();
+  char message[160];
+  snprintf(message, sizeof(message),
+           "%d frames: %d copied to the pool, %d with the pool exhausted, %d oversize, high water %d/%d, heap %+d bytes",
+           RUN_FRAMES, (int)s.copies, (int)s.exhausted, (int)s.oversize, (int)s.highWater, (int)s.slabs,
+           (int)(heapEnd - heapStart));
+  TEST_MESSAGE(message);
+  // Frames only go missing while the pool is exhausted; the last published one stays up
+  TEST_ASSERT_EQUAL(s.exhausted, dropped);
+  TEST_ASSERT_EQUAL(0, s.oversize);
+  TEST_ASSERT_GREATER_THAN(0, s.copies);
+  TEST_ASSERT_EQUAL_MESSAGE(heapStart, heapEnd, "the capture path allocated");
+
+  for (Hold& h : holds)
+    release(&h);
+}
+
+// Once every reader lets go, every slab is free again and capture goes back to publishing
+// driver buffers without copies
+void test_pool_drains_when_readers_leave() {
+  FramePoolStats before = framePoolStats();
+  // Only the publisher's reference is left; the next captures replace it
+  for (int i = 0; i < 2 * FB_COUNT; i++)
+    framePublish(esp_camera_fb_get(), 0);
+  FramePoolStats after = framePoolStats();
+  TEST_ASSERT_EQUAL(0, after.inUse);
+  TEST_ASSERT_EQUAL(before.copies, after.copies);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_long_run_never_allocates_or_starves);
+  RUN_TEST(test_pool_drains_when_readers_leave);
+  return UNITY_END();
+}
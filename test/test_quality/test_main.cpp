@@ -0,0 +1,174 @@
+#include <unity.h>
+#include <vector>
+#include "globals.h"
+#include "quality.h"
+#include "esp_camera.h"
+
+#define BUDGET_BPS (TARGET_KBPS * 1000 / 8)
+
+// A scene whose JPEG size falls as the quality value rises: bytes = scene / quality.
+// The trace plays one client at FPS through whole controller windows.
+static uint32_t now;
+static uint32_t sent;
+
+// The one client asks for FPS, but only receives the frames that were published
+static uint32_t oneClient(uint32_t frameBytes, uint32_t publishedFps, uint32_t* wantFps) {
+  *wantFps = publishedFps < FPS ? publishedFps : FPS;
+  return frameBytes * *wantFps;
+}
+
+struct Trace {
+  std::vector<int> quality;  // Quality in force at the end of each window
+  std::vector<int> changes;  // Window index of every change
+};
+
+// Plays windows of FPS frames, of which the camera task publishes one in every publishEvery;
+// delivered is the share (percent) of the published frames' bytes that the links carry
+static Trace play(int windows, uint32_t scene, int delivered = 100, int publishEvery = 1) {
+  Trace t;
+  for (int w = 0; w < windows; w++) {
+    int before = qualityState().quality;
+    for (int f = 0; f < FPS; f++) {
+      now += QUALITY_WINDOW_MS / FPS;
+      uint32_t len = scene / qualityState().quality;
+      bool published = f % publishEvery == 0;
+      if (published)
+        sent += len * delivered / 100;
+      qualityUpdate(len, published, sent, now);
+    }
+    // Round the window up to the controller's interval
+    now += QUALITY_WINDOW_MS % FPS;
+    t.quality.push_back(qualityState().quality);
+    if (qualityState().quality != before)
+      t.changes.push_back(w);
+  }
+  return t;
+}
+
+// The scene that makes the demand exactly ratio percent of the budget at quality q
+static uint32_t sceneFor(int ratio, int q) {
+  return (uint64_t)BUDGET_BPS * ratio / 100 * q / FPS;
+}
+
+static void assertSteps(const Trace& t, int step, int hold) {
+  int q = t.quality.empty() ? 0 : t.quality[0];
+  for (size_t i = 0; i < t.changes.size(); i++) {
+    int w = t.changes[i];
+    int prev = w == 0 ? q - step : t.quality[w - 1];
+    TEST_ASSERT_EQUAL_INT_MESSAGE(step, t.quality[w] - prev, "quality moved by the wrong step");
+    if (i > 0)
+      TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(hold, t.changes[i] - t.changes[i - 1], "quality moved before the hold time");
+  }
+}
+
+static void report(const char* what, const Trace& t) {
+  char message[96];
+  snprintf(message, sizeof(message), "%s: %d changes, settled at %d after %d windows", what, (int)t.changes.size(),
+           t.quality.back(), t.changes.empty() ? 0 : t.changes.back() + 1);
+  TEST_MESSAGE(message);
+}
+
+void setUp() {
+  if (esp_camera_sensor_get() == NULL) {
+    camera_config_t config = {};
+    config.frame_size = FRAME_SIZE;
+    config.jpeg_quality = JPEG_QUALITY;
+    config.fb_count = FB_COUNT;
+    TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, esp_camera_init(&config), "tools/fixtures.py writes the fixtures");
+    qualitySetDemand(oneClient);
+  }
+}
+
+void tearDown() {}
+
+// Twice the budget at the best quality: coarsen by 2 every 2 windows until the demand
+// falls into the dead band, then stay there
+void test_overload_coarsens_by_two_and_settles() {
+  uint32_t scene = sceneFor(200, JPEG_QUALITY);
+  play(1, scene);  // The first window only starts the measurement
+  Trace t = play(40, scene);
+  report("2x overload", t);
+  TEST_ASSERT_GREATER_THAN(0, t.changes.size());
+  TEST_ASSERT_EQUAL(1, t.changes[0]);
+  assertSteps(t, 2, 2);
+  int settled = t.quality.back();
+  uint32_t demand = scene / settled * FPS;
+  TEST_ASSERT_LESS_OR_EQUAL(BUDGET_BPS * 110 / 100, demand);
+  TEST_ASSERT_GREATER_OR_EQUAL(BUDGET_BPS * 75 / 100, demand);
+  // From 2x, seven steps of 2 take 14 windows
+  TEST_ASSERT_LESS_OR_EQUAL(16, t.changes.back() + 1);
+}
+
+// Demand anywhere in the dead band leaves the quality alone
+void test_dead_band_holds() {
+  int q = qualityState().quality;
+  for (int ratio = 76; ratio <= 109; ratio += 11) {
+    Trace t = play(20, sceneFor(ratio, q));
+    TEST_ASSERT_EQUAL_MESSAGE(0, t.changes.size(), "quality moved inside the dead band");
+  }
+}
+
+// A simpler scene halves the demand: refine by 1 every 4 windows, without overshooting
+// back over the budget
+void test_underload_refines_by_one_and_settles() {
+  int start = qualityState().quality;
+  uint32_t scene = sceneFor(50, start);
+  Trace t = play(60, scene);
+  report("0.5x underload", t);
+  TEST_ASSERT_GREATER_THAN(0, t.changes.size());
+  // Four windows under budget, one more while the frame size average catches up
+  TEST_ASSERT_INT_WITHIN(1, 4, t.changes[0]);
+  assertSteps(t, -1, 4);
+  int settled = t.quality.back();
+  TEST_ASSERT_LESS_THAN(start, settled);
+  TEST_ASSERT_LESS_OR_EQUAL(BUDGET_BPS * 110 / 100, scene / settled * FPS);
+  TEST_ASSERT_TRUE(settled == JPEG_QUALITY || scene / settled * FPS >= BUDGET_BPS * 75 / 100);
+}
+
+// Links that carry less than 90% of the demand count as over budget, whatever the budget says
+void test_congestion_coarsens_under_budget() {
+  int start = qualityState().quality;
+  Trace t = play(6, sceneFor(90, start), 50);
+  report("congested", t);
+  TEST_ASSERT_GREATER_THAN(0, t.changes.size());
+  // Two congested windows, one more while the delivered rate catches up
+  TEST_ASSERT_INT_WITHIN(1, 2, t.changes[0]);
+  TEST_ASSERT_EQUAL(start + 2, t.quality[t.changes[0]]);
+  assertSteps(t, 2, 2);
+}
+
+// A static scene publishes a frame a second, and the client gets all of them: the frames the
+// camera task dropped are not mistaken for congestion
+void test_static_scene_is_not_congestion() {
+  play(2, sceneFor(90, qualityState().quality));  // Inside the dead band: ends the congestion before
+  int start = qualityState().quality;
+  Trace t = play(10, sceneFor(90, start), 100, FPS);
+  TEST_ASSERT_EQUAL(1, qualityState().publishedFps);
+  TEST_ASSERT_EQUAL(1, qualityState().wantFps);
+  for (int q : t.quality)
+    TEST_ASSERT_LESS_OR_EQUAL(start, q);
+}
+
+void test_quality_stays_within_its_bounds() {
+  Trace t = play(60, sceneFor(1000, JPEG_QUALITY));
+  TEST_ASSERT_EQUAL(QUALITY_WORST, t.quality.back());
+  for (int q : t.quality)
+    TEST_ASSERT_LESS_OR_EQUAL(QUALITY_WORST, q);
+
+  t = play(200, sceneFor(10, QUALITY_WORST));
+  TEST_ASSERT_EQUAL(JPEG_QUALITY, t.quality.back());
+  for (int q : t.quality)
+    TEST_ASSERT_GREATER_OR_EQUAL(JPEG_QUALITY, q);
+  TEST_ASSERT_EQUAL(JPEG_QUALITY, esp_camera_sensor_get()->status.quality);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_overload_coarsens_by_two_and_settles);
+  RUN_TEST(test_dead_band_holds);
+  RUN_TEST(test_underload_refines_by_one_and_settles);
+  RUN_TEST(test_congestion_coarsens_under_budget);
+  RUN_TEST(test_static_scene_is_not_congestion);
+  RUN_TEST(test_quality_stays_within_its_bounds);
+  return UNITY_END();
+}
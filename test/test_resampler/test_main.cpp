@@ -0,0 +1,103 @@
+#include <unity.h>
+#include <math.h>
+#include <vector>
+#include "codec.h"
+#include "i2s.h"
+
+#define OUT_RATE 16000
+#define BLOCKS   20
+
+static Resampler r;
+static std::vector<int16_t> out;
+
+// Feeds BLOCKS blocks of a sine (or DC for hz == 0) through a fresh resampler
+static void run(double hz, double amplitude) {
+  free(r.coefs);
+  free(r.history);
+  TEST_ASSERT_TRUE(resamplerInit(&r, SAMPLE_RATE_HZ, OUT_RATE, BLOCK_SAMPLES));
+  out.clear();
+  int16_t in[BLOCK_SAMPLES];
+  std::vector<int16_t> block(RESAMPLE_MAX_OUT(&r, BLOCK_SAMPLES));
+  for (int b = 0; b < BLOCKS; b++) {
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+      double t = (double)(b * BLOCK_SAMPLES + i) / SAMPLE_RATE_HZ;
+      in[i] = lround(hz == 0 ? amplitude : amplitude * sin(2 * M_PI * hz * t));
+    }
+    size_t n = resample(&r, in, BLOCK_SAMPLES, block.data());
+    TEST_ASSERT_LESS_OR_EQUAL(RESAMPLE_MAX_OUT(&r, BLOCK_SAMPLES), n);
+    out.insert(out.end(), block.begin(), block.begin() + n);
+  }
+}
+
+// RMS of the output once the filter has filled, scaled to a sine's peak
+static double peak() {
+  double sum = 0;
+  size_t from = out.size() / 4;
+  for (size_t i = from; i < out.size(); i++)
+    sum += (double)out[i] * out[i];
+  return sqrt(2 * sum / (out.size() - from));
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_factors_are_reduced() {
+  run(0, 0);
+  TEST_ASSERT_EQUAL(160, r.up);
+  TEST_ASSERT_EQUAL(441, r.down);
+}
+
+void test_phases_have_unit_gain() {
+  run(0, 0);
+  for (int p = 0; p < r.up; p++) {
+    int32_t sum = 0;
+    for (int k = 0; k < r.taps; k++)
+      sum += r.coefs[p * r.taps + k];
+    TEST_ASSERT_EQUAL(32768, sum);
+  }
+}
+
+void test_output_count_follows_the_ratio() {
+  run(0, 0);
+  double expected = (double)BLOCKS * BLOCK_SAMPLES * OUT_RATE / SAMPLE_RATE_HZ;
+  TEST_ASSERT_INT_WITHIN(1, lround(expected), out.size());
+}
+
+void test_dc_passes_unchanged() {
+  run(0, 12345);
+  for (size_t i = r.taps; i < out.size(); i++)
+    TEST_ASSERT_INT_WITHIN(1, 12345, out[i]);
+}
+
+void test_passband_tone_keeps_its_level() {
+  run(1000, 16000);
+  TEST_ASSERT_FLOAT_WITHIN(16000 * 0.02, 16000, peak());
+}
+
+void test_tone_above_output_nyquist_is_removed() {
+  // 12 kHz would alias to 4 kHz at 16 kHz without the filter
+  run(12000, 16000);
+  TEST_ASSERT_LESS_THAN(16000 / 500, peak());
+}
+
+void test_full_scale_does_not_wrap() {
+  run(0, -32768);
+  for (size_t i = r.taps; i < out.size(); i++)
+    TEST_ASSERT_EQUAL_INT16(-32768, out[i]);
+  run(0, 32767);
+  for (size_t i = r.taps; i < out.size(); i++)
+    TEST_ASSERT_EQUAL_INT16(32767, out[i]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_factors_are_reduced);
+  RUN_TEST(test_phases_have_unit_gain);
+  RUN_TEST(test_output_count_follows_the_ratio);
+  RUN_TEST(test_dc_passes_unchanged);
+  RUN_TEST(test_passband_tone_keeps_its_level);
+  RUN_TEST(test_tone_above_output_nyquist_is_removed);
+  RUN_TEST(test_full_scale_does_not_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,465 @@
+#include <unity.h>
+#include <math.h>
+#include "jpeg.h"
+#include "scale.h"
+#include "esp_timer.h"
+#include "quality.h"
+#include "mjpeg.h"
+#include "fixtures.h"
+#include "../loopback.h"
+
+#define COST_RUNS 20  // Downscales timed per factor
+
+static std::vector<uint8_t> still, restart, hd;
+static std::vector<uint8_t> out(256 * 1024);
+static JpegInfo info;
+
+// Mean luma DC of a JPEG's MCUs, 8x the mean level shifted by -128
+static long meanDc(const uint8_t* jpeg, size_t len) {
+  TEST_ASSERT_TRUE(jpegParse(jpeg, len, &info));
+  std::vector<int16_t> dc((size_t)info.mcusX * info.mcusY);
+  TEST_ASSERT_TRUE(jpegDcMap(&info, dc.data()));
+  long sum = 0;
+  for (int16_t v : dc)
+    sum += v;
+  return sum / (long)dc.size();
+}
+
+//  === Reference decoder  ========================================================================
+// A plain baseline decoder written from the specification, sharing no code with the firmware:
+// bit-serial Huffman decoding and a floating-point IDCT. It yields the Y, Cb and Cr planes at
+// each component's own resolution, so no colour conversion or upsampling enters the comparison.
+
+struct RefPlane {
+  int width, height;
+  std::vector<float> px;
+  float at(int x, int y) const { return px[(size_t)y * width + x]; }
+};
+
+struct RefHuffman {
+  int maxcode[18], valptr[17], mincode[17];
+  std::vector<uint8_t> vals;
+};
+
+struct RefDecoder {
+  const uint8_t* p;
+  const uint8_t* end;
+  uint32_t bits = 0;
+  int nbits = 0;
+  uint16_t qt[4][64];
+  RefHuffman huff[2][2];  // [DC, AC][table]
+  int width = 0, height = 0, ncomp = 0, restart = 0, hmax = 1, vmax = 1;
+  int id[3], h[3], v[3], tq[3], td[3], ta[3], pred[3];
+  RefPlane planes[3];
+
+  int readBit() {
+    if (nbits == 0) {
+      uint8_t byte = 0;
+      if (p < end && *p == 0xFF && p + 1 < end && p[1] == 0x00) {
+        byte = 0xFF;
+        p += 2;
+      } else if (p < end && *p != 0xFF) {
+        byte = *p++;
+      }
+      bits = byte;
+      nbits = 8;
+    }
+    return bits >> --nbits & 1;
+  }
+
+  int receive(int n) {
+    int v = 0;
+    for (int i = 0; i < n; i++)
+      v = v << 1 | readBit();
+    return v;
+  }
+
+  static int extend(int v, int n) {
+    return n && v < 1 << (n - 1) ? v - (1 << n) + 1 : v;
+  }
+
+  int decode(const RefHuffman& t) {
+    int code = 0;
+    for (int len = 1; len <= 16; len++) {
+      code = code << 1 | readBit();
+      if (t.maxcode[len] >= 0 && code <= t.maxcode[len])
+        return t.vals[t.valptr[len] + code - t.mincode[len]];
+    }
+    return -1;
+  }
+
+  bool headers(const uint8_t* buf, size_t len) {
+    p = buf + 2;
+    end = buf + len;
+    while (p + 4 <= end) {
+      if (p[0] != 0xFF)
+        return false;
+      uint8_t marker = p[1];
+      int seg = p[2] << 8 | p[3];
+      const uint8_t* s = p + 4;
+      const uint8_t* segEnd = p + 2 + seg;
+      if (marker == 0xDB) {
+        for (; s < segEnd; s += 65)
+          for (int i = 0; i < 64; i++)
+            qt[s[0] & 3][i] = s[1 + i];
+      } else if (marker == 0xC4) {
+        while (s < segEnd) {
+          RefHuffman& t = huff[s[0] >> 4][s[0] & 1];
+          int count = 0, code = 0;
+          t.vals.clear();
+          for (int l = 1; l <= 16; l++) {
+            int n = s[l];
+            t.valptr[l] = count;
+            t.mincode[l] = code;
+            t.maxcode[l] = n ? code + n - 1 : -1;
+            code = (code + n) << 1;
+            count += n;
+          }
+          t.vals.assign(s + 17, s + 17 + count);
+          s += 17 + count;
+        }
+      } else if (marker == 0xC0) {
+        height = s[1] << 8 | s[2];
+        width = s[3] << 8 | s[4];
+        ncomp = s[5];
+        for (int c = 0; c < ncomp; c++) {
+          id[c] = s[6 + c * 3];
+          h[c] = s[7 + c * 3] >> 4;
+          v[c] = s[7 + c * 3] & 15;
+          tq[c] = s[8 + c * 3];
+          hmax = h[c] > hmax ? h[c] : hmax;
+          vmax = v[c] > vmax ? v[c] : vmax;
+        }
+      } else if (marker == 0xDD) {
+        restart = s[0] << 8 | s[1];
+      } else if (marker == 0xDA) {
+        for (int i = 0; i < s[0]; i++)
+          for (int c = 0; c < ncomp; c++)
+            if (id[c] == s[1 + i * 2]) {
+              td[c] = s[2 + i * 2] >> 4;
+              ta[c] = s[2 + i * 2] & 15;
+            }
+        p = segEnd;
+        return ncomp > 0;
+      } else if (marker == 0xC1 || marker == 0xC2) {
+        return false;
+      }
+      p = segEnd;
+    }
+    return false;
+  }
+
+  // Decodes, dequantizes and inverse-transforms one block into its plane
+  bool block(int c, int bx, int by) {
+    static const int zigzag[64] = {
+      0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+      41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+      30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+    };
+    float coef[64] = {};
+    int s = decode(huff[0][td[c]]);
+    if (s < 0)
+      return false;
+    pred[c] += extend(receive(s), s);
+    coef[0] = pred[c] * qt[tq[c]][0];
+    for (int k = 1; k < 64;) {
+      int rs = decode(huff[1][ta[c]]);
+      if (rs < 0)
+        return false;
+      if (rs == 0)
+        break;
+      k += rs >> 4;
+      if (k > 63)
+        return false;
+      int size = rs & 15;
+      coef[zigzag[k]] = extend(receive(size), size) * qt[tq[c]][k];
+      k++;
+    }
+
+    RefPlane& plane = planes[c];
+    for (int y = 0; y < 8; y++) {
+      for (int x = 0; x < 8; x++) {
+        float sum = 0;
+        for (int v = 0; v < 8; v++)
+          for (int u = 0; u < 8; u++)
+            sum += (u ? 1 : M_SQRT1_2) * (v ? 1 : M_SQRT1_2) * coef[v * 8 + u] * cosf((2 * x + 1) * u * M_PI / 16) *
+                   cosf((2 * y + 1) * v * M_PI / 16);
+        int px = bx * 8 + x, py = by * 8 + y;
+        if (px < plane.width && py < plane.height)
+          plane.px[(size_t)py * plane.width + px] = sum / 4 + 128;
+      }
+    }
+    return true;
+  }
+
+  bool run(const uint8_t* buf, size_t len) {
+    if (!headers(buf, len))
+      return false;
+    int mcusX = (width + 8 * hmax - 1) / (8 * hmax), mcusY = (height + 8 * vmax - 1) / (8 * vmax);
+    for (int c = 0; c < ncomp; c++) {
+      planes[c].width = (width * h[c] + hmax - 1) / hmax;
+      planes[c].height = (height * v[c] + vmax - 1) / vmax;
+      planes[c].px.assign((size_t)planes[c].width * planes[c].height, 0);
+      pred[c] = 0;
+    }
+    for (int m = 0; m < mcusX * mcusY; m++) {
+      if (restart && m && m % restart == 0) {
+        // Byte-align and step over the RSTn marker
+        nbits = 0;
+        if (p + 1 < end && p[0] == 0xFF && (p[1] & 0xF8) == 0xD0)
+          p += 2;
+        for (int c = 0; c < ncomp; c++)
+          pred[c] = 0;
+      }
+      int mx = m % mcusX, my = m / mcusX;
+      for (int c = 0; c < ncomp; c++)
+        for (int y = 0; y < v[c]; y++)
+          for (int x = 0; x < h[c]; x++)
+            if (!block(c, mx * h[c] + x, my * v[c] + y))
+              return false;
+    }
+    return true;
+  }
+};
+
+// PSNR of a plane against the reference plane averaged over factor x factor boxes, over the
+// output pixels that cover whole boxes
+static double psnrAgainstBoxAverage(const RefPlane& full, const RefPlane& scaled, int factor) {
+  int w = full.width / factor, h = full.height / factor;
+  double err = 0;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      double sum = 0;
+      for (int j = 0; j < factor; j++)
+        for (int i = 0; i < factor; i++)
+          sum += full.at(x * factor + i, y * factor + j);
+      double d = sum / (factor * factor) - scaled.at(x, y);
+      err += d * d;
+    }
+  }
+  return 10 * log10(255.0 * 255.0 / (err / ((double)w * h)));
+}
+
+void setUp() {
+  if (still.empty())
+    TEST_ASSERT_TRUE_MESSAGE(fixtureLoad("still.jpg", &still), "tools/fixtures.py writes the fixtures");
+  if (restart.empty())
+    TEST_ASSERT_TRUE(fixtureLoad("still-restart.jpg", &restart));
+  if (hd.empty())
+    TEST_ASSERT_TRUE(fixtureLoad("motion/moving-0.jpg", &hd));
+}
+
+void tearDown() {}
+
+void test_factors_map_to_substreams() {
+  for (int i = 0; i < SCALE_COUNT; i++)
+    TEST_ASSERT_EQUAL(i, scaleIndex(scaleFactor(i)));
+  TEST_ASSERT_EQUAL(-1, scaleIndex(1));
+  TEST_ASSERT_EQUAL(-1, scaleIndex(3));
+  TEST_ASSERT_EQUAL(-1, scaleIndex(16));
+}
+
+void test_downscale_produces_a_decodable_jpeg_of_the_reduced_size() {
+  for (int factor = 2; factor <= 8; factor *= 2) {
+    size_t len = jpegDownscale(still.data(), still.size(), factor, out.data(), out.size());
+    TEST_ASSERT_GREATER_THAN(0, len);
+    TEST_ASSERT_LESS_THAN(still.size(), len);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, out[len - 2]);
+    TEST_ASSERT_EQUAL_HEX8(0xD9, out[len - 1]);
+    TEST_ASSERT_TRUE(jpegParse(out.data(), len, &info));
+    TEST_ASSERT_EQUAL((320 + factor - 1) / factor, info.width);
+    TEST_ASSERT_EQUAL((240 + factor - 1) / factor, info.height);
+    TEST_ASSERT_EQUAL(3, info.ncomp);
+    TEST_ASSERT_EQUAL(2, info.comp[0].h);
+    TEST_ASSERT_EQUAL(0, info.restart);
+  }
+}
+
+// Every output decodes cleanly with the reference decoder, and each of its planes matches
+// the reference decode of the source averaged down by the same factor
+void test_downscale_matches_the_reference_decode() {
+  const char* names[] = { "still.jpg", "still-restart.jpg", "frames/frame-0.jpg", "motion/moving-0.jpg" };
+  const double minPsnr[] = { 0, 36, 32, 30 };  // By log2(factor); quantization noise grows with the block reach
+  for (const char* name : names) {
+    std::vector<uint8_t> src;
+    TEST_ASSERT_TRUE(fixtureLoad(name, &src));
+    RefDecoder full;
+    TEST_ASSERT_TRUE_MESSAGE(full.run(src.data(), src.size()), name);
+    for (int factor = 2, k = 1; factor <= 8; factor *= 2, k++) {
+      size_t len = jpegDownscale(src.data(), src.size(), factor, out.data(), out.size());
+      TEST_ASSERT_GREATER_THAN(0, len);
+      RefDecoder scaled;
+      TEST_ASSERT_TRUE_MESSAGE(scaled.run(out.data(), len), name);
+      TEST_ASSERT_EQUAL((full.width + factor - 1) / factor, scaled.width);
+      TEST_ASSERT_EQUAL((full.height + factor - 1) / factor, scaled.height);
+      TEST_ASSERT_EQUAL(full.ncomp, scaled.ncomp);
+
+      double worst = 1e9;
+      for (int c = 0; c < full.ncomp; c++) {
+        double psnr = psnrAgainstBoxAverage(full.planes[c], scaled.planes[c], factor);
+        worst = psnr < worst ? psnr : worst;
+      }
+      char message[96];
+      snprintf(message, sizeof(message), "%s 1/%d: %dx%d, %d bytes, worst plane %.1f dB", name, factor, scaled.width,
+               scaled.height, (int)len, worst);
+      TEST_MESSAGE(message);
+      TEST_ASSERT_GREATER_THAN_MESSAGE((int)minPsnr[k], (int)worst, message);
+    }
+  }
+}
+
+void test_downscale_keeps_the_brightness() {
+  long source = meanDc(still.data(), still.size());
+  for (int factor = 2; factor <= 8; factor *= 2) {
+    size_t len = jpegDownscale(still.data(), still.size(), factor, out.data(), out.size());
+    TEST_ASSERT_GREATER_THAN(0, len);
+    // Partial MCUs at the right and bottom edges repeat the last pixels, so allow a little drift
+    TEST_ASSERT_INT_WITHIN(24, source, meanDc(out.data(), len));
+  }
+}
+
+void test_downscale_reads_restart_intervals() {
+  size_t plain = jpegDownscale(still.data(), still.size(), 4, out.data(), out.size());
+  std::vector<uint8_t> expected(out.begin(), out.begin() + plain);
+  size_t marked = jpegDownscale(restart.data(), restart.size(), 4, out.data(), out.size());
+  TEST_ASSERT_EQUAL(plain, marked);
+  TEST_ASSERT_EQUAL_MEMORY(expected.data(), out.data(), plain);
+}
+
+void test_downscale_refuses_what_it_cannot_do() {
+  TEST_ASSERT_EQUAL(0, jpegDownscale(still.data(), still.size(), 3, out.data(), out.size()));
+  TEST_ASSERT_EQUAL(0, jpegDownscale(still.data(), still.size(), 1, out.data(), out.size()));
+  TEST_ASSERT_EQUAL(0, jpegDownscale(still.data(), 100, 2, out.data(), out.size()));
+  // The output must fit in cap, or nothing is produced
+  TEST_ASSERT_EQUAL(0, jpegDownscale(still.data(), still.size(), 2, out.data(), 700));
+}
+
+// Each subscribed scale is rendered once per published frame: report what an HD frame
+// costs at each factor
+void test_transcode_cost() {
+  double ms[SCALE_COUNT];
+  for (int i = 0; i < SCALE_COUNT; i++) {
+    int64_t start = esp_timer_get_time();
+    for (int run = 0; run < COST_RUNS; run++)
+      TEST_ASSERT_GREATER_THAN(0, jpegDownscale(hd.data(), hd.size(), scaleFactor(i), out.data(), out.size()));
+    ms[i] = (esp_timer_get_time() - start) / 1000.0 / COST_RUNS;
+  }
+  char message[96];
+  snprintf(message, sizeof(message), "1280x720, %d bytes: 1/2 %.1f ms, 1/4 %.1f ms, 1/8 %.1f ms", (int)hd.size(), ms[0],
+           ms[1], ms[2]);
+  TEST_MESSAGE(message);
+  // Entropy decoding the source is common to all factors; the rest shrinks with the output
+  TEST_ASSERT_TRUE(ms[2] < ms[0]);
+  TEST_ASSERT_TRUE(ms[0] < 1000.0 / FPS);
+}
+
+// Integer field of a flat JSON object, or -1
+static long field(const std::string& json, const char* name) {
+  std::string key = std::string("\"") + name + "\":";
+  size_t at = json.find(key);
+  return at == std::string::npos ? -1 : atol(json.c_str() + at + key.size());
+}
+
+// Value of a metric in the /metrics exposition, or -1
+static double metric(const std::string& text, const char* name) {
+  std::string key = std::string("\n") + name + " ";
+  size_t at = text.find(key);
+  return at == std::string::npos ? -1 : atof(text.c_str() + at + key.size());
+}
+
+// A 1/2 viewer gets only whole copies of the reduced size, rendered off the capture path:
+// publishing a frame costs far less than rendering its copy
+void test_substream_is_rendered_off_the_capture_path() {
+  int fd = loopbackGet("/mjpeg?scale=2");
+  std::string stream;
+  TEST_ASSERT_TRUE(loopbackRead(fd, &stream, 2000));
+  close(fd);
+  int frames = 0;
+  for (size_t at = stream.find("\r\n\r\n", stream.find("Content-Length: ")); at != std::string::npos;) {
+    size_t len = strtoul(stream.c_str() + stream.rfind("Content-Length: ", at) + 16, NULL, 10);
+    if (at + 4 + len > stream.size())
+      break;
+    TEST_ASSERT_TRUE(jpegParse((const uint8_t*)stream.data() + at + 4, len, &info));
+    TEST_ASSERT_EQUAL(320, info.width);
+    TEST_ASSERT_EQUAL(240, info.height);
+    frames++;
+    size_t next = stream.find("Content-Length: ", at + 4 + len);
+    at = next == std::string::npos ? next : stream.find("\r\n\r\n", next);
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS * 2 * 7 / 10, frames);
+
+  std::string text = loopbackFetch("/metrics");
+  double publish = metric(text, "camera_publish_seconds_sum") / metric(text, "camera_publish_seconds_count");
+  double render = metric(text, "camera_scale_seconds_sum") / metric(text, "camera_scale_seconds_count");
+  char message[96];
+  snprintf(message, sizeof(message), "1/2 viewer: %d frames in 2 s, publish %.0f us, render %.0f us", frames,
+           publish * 1e6, render * 1e6);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(publish < render / 4);
+}
+
+// A 1/8 viewer asks the quality controller for its substream's bitrate, not the full one
+void test_substream_demand_is_weighted_by_its_size() {
+  int fd = loopbackGet("/mjpeg?scale=8");
+  std::string stream;
+  TEST_ASSERT_TRUE(loopbackRead(fd, &stream, 3 * QUALITY_WINDOW_MS));
+  std::string json = loopbackFetch("/quality");
+  close(fd);
+  long frameBytes = field(json, "frameBytes"), wantFps = field(json, "wantFps"), demand = field(json, "demandBps");
+  char message[96];
+  snprintf(message, sizeof(message), "1/8 viewer at %ld fps: demand %ld B/s, full frames %ld B/s", wantFps, demand,
+           frameBytes * wantFps);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(0, wantFps);
+  TEST_ASSERT_GREATER_THAN(0, demand);
+  TEST_ASSERT_LESS_THAN(frameBytes * wantFps / 8, demand);
+}
+
+// Waits up to 2 s for the server to drop the clients closed so far; returns the demand left
+static uint32_t demandOnceDropped(uint32_t frameBytes, uint32_t* wantFps) {
+  int64_t deadline = esp_timer_get_time() + 2000000;
+  uint32_t demand;
+  while ((demand = mjpegDemand(frameBytes, FPS, wantFps)) != 0 && esp_timer_get_time() < deadline)
+    delay(10);
+  return demand;
+}
+
+// The demand counts follow clients in and out, and any task may read them
+void test_demand_counts_follow_clients() {
+  const uint32_t frameBytes = 10000;
+  uint32_t wantFps;
+  TEST_ASSERT_EQUAL(0, demandOnceDropped(frameBytes, &wantFps));
+  TEST_ASSERT_EQUAL(0, wantFps);
+
+  int full = loopbackGet("/mjpeg?fps=5");
+  int quarter = loopbackGet("/mjpeg?scale=4&fps=3");
+  std::string stream;
+  loopbackRead(full, &stream, 500);
+  uint32_t demand = mjpegDemand(frameBytes, FPS, &wantFps);
+  TEST_ASSERT_EQUAL(5 + 3, wantFps);
+  TEST_ASSERT_EQUAL(frameBytes * 5 + scaleFrameBytes(scaleIndex(4), frameBytes) * 3, demand);
+  // No client gets more frames than were published
+  mjpegDemand(frameBytes, 4, &wantFps);
+  TEST_ASSERT_EQUAL(4 + 3, wantFps);
+
+  close(full);
+  close(quarter);
+  TEST_ASSERT_EQUAL(0, demandOnceDropped(frameBytes, &wantFps));
+  TEST_ASSERT_EQUAL(0, wantFps);
+}
+
+int main() {
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_factors_map_to_substreams);
+  RUN_TEST(test_downscale_produces_a_decodable_jpeg_of_the_reduced_size);
+  RUN_TEST(test_downscale_matches_the_reference_decode);
+  RUN_TEST(test_downscale_keeps_the_brightness);
+  RUN_TEST(test_downscale_reads_restart_intervals);
+  RUN_TEST(test_downscale_refuses_what_it_cannot_do);
+  RUN_TEST(test_transcode_cost);
+  RUN_TEST(test_substream_is_rendered_off_the_capture_path);
+  RUN_TEST(test_substream_demand_is_weighted_by_its_size);
+  RUN_TEST(test_demand_counts_follow_clients);
+  return loopbackExit(UNITY_END());
+}
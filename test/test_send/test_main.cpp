@@ -0,0 +1,163 @@
+#include <unity.h>
+#include <thread>
+#include <vector>
+#include "../loopback.h"
+
+#define VIEWERS    4      // Clients reading as fast as the loopback allows
+#define RUN_MS     5000   // How long the clients stream
+#define SETTLE_MS  2000   // Counts start after the pacing has settled
+#define MSS        1448   // Segment size the clients advertise, as over WiFi with timestamps
+#define SLOW_BPS   200000 // Link of the congested client, bytes/s
+#define SLOW_CHUNK 1448   // It reads one segment at a time
+
+// glibc's struct tcp_info ends before the counters Linux 4.2 added to it
+struct TcpInfo {
+  struct tcp_info info;
+  uint64_t pacingRate, maxPacingRate, bytesAcked, bytesReceived;
+  uint32_t segsOut, segsIn;
+};
+
+// A viewer of /mjpeg that counts, from SETTLE_MS on, the whole frames it gets, the bytes,
+// and the TCP segments its socket received (tcpi_segs_in)
+struct Viewer {
+  uint32_t bps;  // 0 for an unlimited link
+  int frames = 0;
+  int64_t bytes = 0;
+  uint32_t segments = 0;
+
+  static uint32_t segmentsIn(int fd) {
+    TcpInfo info = {};
+    socklen_t len = sizeof(info);
+    TEST_ASSERT_EQUAL(0, getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len));
+    TEST_ASSERT_EQUAL(sizeof(info), len);
+    return info.segsIn;
+  }
+
+  void run() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int mss = MSS;
+    setsockopt(fd, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+    if (bps) {
+      int rcvbuf = 4 * SLOW_CHUNK;
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(HTTP_PORT);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+      return;
+    const char* request = "GET /mjpeg HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(fd, request, strlen(request), 0);
+
+    std::string buf;
+    uint32_t segmentsAtSettle = 0;
+    bool settled = false;
+    int64_t start = esp_timer_get_time();
+    for (int64_t now = start; now - start < RUN_MS * 1000LL; now = esp_timer_get_time()) {
+      if (!settled && now - start >= SETTLE_MS * 1000LL) {
+        settled = true;
+        segmentsAtSettle = segmentsIn(fd);
+      }
+      char chunk[16384];
+      int r = recv(fd, chunk, bps ? SLOW_CHUNK : sizeof(chunk), 0);
+      if (r <= 0)
+        break;
+      if (bps)
+        delayMicroseconds((uint64_t)r * 1000000 / bps);
+      buf.append(chunk, r);
+      if (settled)
+        bytes += r;
+
+      for (;;) {
+        size_t at = buf.find("Content-Length: ");
+        size_t body = at == std::string::npos ? at : buf.find("\r\n\r\n", at);
+        if (body == std::string::npos)
+          break;
+        size_t len = strtoul(buf.c_str() + at + 16, NULL, 10);
+        if (buf.size() < body + 4 + len)
+          break;
+        frames += settled;
+        buf.erase(0, body + 4 + len);
+      }
+    }
+    segments = segmentsIn(fd) - segmentsAtSettle;
+    close(fd);
+  }
+
+  // Fewest segments the bytes received could have taken, one part after another
+  double idealSegmentsPerFrame() const { return ceil((double)bytes / frames / MSS); }
+};
+
+// Value of a metric in the /metrics exposition, or -1
+static double metric(const char* name) {
+  std::string text = loopbackFetch("/metrics");
+  std::string key = std::string("\n") + name + " ";
+  size_t at = text.find(key);
+  return at == std::string::npos ? -1 : atof(text.c_str() + at + key.size());
+}
+
+// Streams the viewers at once; returns the server's send calls while they were settled
+static double stream(std::vector<Viewer>& viewers) {
+  std::vector<std::thread> threads;
+  for (Viewer& v : viewers)
+    threads.emplace_back([&v]() { v.run(); });
+  delay(SETTLE_MS);
+  double before = metric("mjpeg_send_calls_total");
+  delay(RUN_MS - SETTLE_MS);
+  double after = metric("mjpeg_send_calls_total");
+  for (std::thread& t : threads)
+    t.join();
+  TEST_ASSERT_TRUE(before >= 0);
+  return after - before;
+}
+
+static void report(const char* what, const Viewer& v, double callsPerFrame) {
+  char message[160];
+  snprintf(message, sizeof(message),
+           "%s: %.1f fps, %.0f kB/s, %.2f send calls/frame, %.2f segments/frame (%.0f at least)", what,
+           v.frames * 1000.0 / (RUN_MS - SETTLE_MS), (double)v.bytes / (RUN_MS - SETTLE_MS), callsPerFrame,
+           (double)v.segments / v.frames, v.idealSegmentsPerFrame());
+  TEST_MESSAGE(message);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// A part goes out in one send call, in as few segments as its size allows: no short
+// segment for the header or the boundary
+void test_each_part_is_one_send_in_full_segments() {
+  std::vector<Viewer> viewers(VIEWERS, Viewer{ 0 });
+  double calls = stream(viewers);
+  int frames = 0;
+  for (const Viewer& v : viewers)
+    frames += v.frames;
+  for (const Viewer& v : viewers) {
+    report("uncongested", v, calls / frames);
+    TEST_ASSERT_GREATER_OR_EQUAL(FPS * (RUN_MS - SETTLE_MS) / 1000 * 8 / 10, v.frames);
+    TEST_ASSERT_LESS_OR_EQUAL(v.idealSegmentsPerFrame() + 1, (double)v.segments / v.frames);
+  }
+  // The window's first and last parts may be split across its edges
+  TEST_ASSERT_LESS_OR_EQUAL(1.1, calls / frames);
+}
+
+// A congested client takes a part in several calls, each resuming where the socket
+// filled up, and still gets whole frames
+void test_congested_client_resumes_mid_part() {
+  std::vector<Viewer> viewers(1, Viewer{ SLOW_BPS });
+  double calls = stream(viewers);
+  const Viewer& v = viewers[0];
+  report("congested", v, calls / v.frames);
+  TEST_ASSERT_GREATER_THAN(0, v.frames);
+  TEST_ASSERT_TRUE(calls / v.frames > 1);
+  TEST_ASSERT_LESS_OR_EQUAL(v.idealSegmentsPerFrame() + 1, (double)v.segments / v.frames);
+}
+
+int main() {
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_each_part_is_one_send_in_full_segments);
+  RUN_TEST(test_congested_client_resumes_mid_part);
+  return loopbackExit(UNITY_END());
+}
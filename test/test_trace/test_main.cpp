@@ -0,0 +1,135 @@
+#include <unity.h>
+#include <thread>
+#include <vector>
+#include "trace.h"
+#include "../loopback.h"
+
+#define COST_CALLS   2000000  // traceSpan() calls timed per state
+#define WRITERS      4        // Threads recording at once in the concurrency test
+#define WRITER_SPANS 20000    // Spans each of them records
+#define WRITER_TRACK 200      // First track of the writer threads, clear of the client tracks
+
+// One "X" event from the /trace dump
+struct Event {
+  std::string name;
+  unsigned track, start, dur, seq;
+};
+
+static std::string body(const std::string& response) {
+  size_t head = response.find("\r\n\r\n");
+  return head == std::string::npos ? "" : response.substr(head + 4);
+}
+
+static std::vector<Event> dump() {
+  std::string json = body(loopbackFetch("/trace"));
+  const char* start = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  TEST_ASSERT_TRUE(json.compare(0, strlen(start), start) == 0);
+  TEST_ASSERT_TRUE(json.size() >= 3 && json.compare(json.size() - 3, 3, "]}\n") == 0);
+  std::vector<Event> events;
+  for (size_t at = json.find("{\"name\":\""); at != std::string::npos; at = json.find("{\"name\":\"", at + 1)) {
+    char name[32];
+    Event e;
+    if (sscanf(json.c_str() + at, "{\"name\":\"%31[^\"]\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%u,\"dur\":%u,\"args\":{\"seq\":%u}}",
+               name, &e.track, &e.start, &e.dur, &e.seq) == 5) {
+      e.name = name;
+      events.push_back(e);
+    }
+  }
+  return events;
+}
+
+// Mean cost of one traceSpan() call in the current state, nanoseconds
+static double spanCost() {
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < COST_CALLS; i++)
+    traceSpan(TRACE_SEND, WRITER_TRACK - 1, i, i, i + 1);
+  return (esp_timer_get_time() - start) * 1000.0 / COST_CALLS;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_dump_needs_tracing_enabled_once() {
+  TEST_ASSERT_TRUE(loopbackFetch("/trace").compare(0, 12, "HTTP/1.1 404") == 0);
+  TEST_ASSERT_TRUE(body(loopbackFetch("/trace?enable=1")) == "{\"tracing\":true}");
+}
+
+// The firmware's own spans reach the ring while a viewer streams
+void test_pipeline_spans_are_recorded() {
+  int fd = loopbackGet("/mjpeg");
+  std::string stream;
+  loopbackRead(fd, &stream, 1000);
+  close(fd);
+  int capture = 0, publish = 0, send = 0, read = 0;
+  for (const Event& e : dump()) {
+    capture += e.name == "capture" && e.track == TRACK_CAMERA;
+    publish += e.name == "publish" && e.track == TRACK_CAMERA;
+    send += e.name == "send" && e.track >= TRACE_TRACK_CLIENT;
+    read += e.name == "i2s_read" && e.track == TRACK_MIC;
+  }
+  char message[96];
+  snprintf(message, sizeof(message), "1 s of /mjpeg: %d capture, %d publish, %d send, %d i2s_read spans", capture, publish,
+           send, read);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS / 2, capture);
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS / 2, publish);
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS / 2, send);
+  TEST_ASSERT_GREATER_THAN(0, read);
+}
+
+// Writers racing each other and a dump never produce a mixed-up event: every one the dump
+// returns is whole, and each writer's spans appear in the order it recorded them
+void test_concurrent_writers_leave_whole_events() {
+  std::vector<std::thread> writers;
+  for (int w = 0; w < WRITERS; w++)
+    writers.emplace_back([w]() {
+      for (uint32_t i = 0; i < WRITER_SPANS; i++)
+        traceSpan(TRACE_PUBLISH, WRITER_TRACK + w, i, i * 7, i * 7 + i % 1000);
+    });
+  std::vector<Event> during = dump();
+  for (std::thread& t : writers)
+    t.join();
+  std::vector<Event> after = dump();
+
+  for (const std::vector<Event>* events : { &during, &after }) {
+    int64_t last[WRITERS];
+    for (int w = 0; w < WRITERS; w++)
+      last[w] = -1;
+    int ours = 0;
+    for (const Event& e : *events) {
+      if (e.track < WRITER_TRACK || e.track >= WRITER_TRACK + WRITERS)
+        continue;
+      TEST_ASSERT_EQUAL_STRING("publish", e.name.c_str());
+      TEST_ASSERT_EQUAL(e.seq * 7, e.start);
+      TEST_ASSERT_EQUAL(e.seq % 1000, e.dur);
+      TEST_ASSERT_GREATER_THAN(last[e.track - WRITER_TRACK], (int64_t)e.seq);
+      last[e.track - WRITER_TRACK] = e.seq;
+      ours++;
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(TRACE_EVENTS, ours);
+  }
+}
+
+// traceSpan() stays in the hot paths: report what one call costs off and on
+void test_span_cost() {
+  TEST_ASSERT_TRUE(body(loopbackFetch("/trace?enable=0")) == "{\"tracing\":false}");
+  double off = spanCost();
+  loopbackFetch("/trace?enable=1");
+  double on = spanCost();
+  char message[64];
+  snprintf(message, sizeof(message), "traceSpan(): %.1f ns off, %.1f ns on", off, on);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(10, off);
+  TEST_ASSERT_LESS_THAN(200, on);
+}
+
+int main() {
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_dump_needs_tracing_enabled_once);
+  RUN_TEST(test_pipeline_spans_are_recorded);
+  RUN_TEST(test_concurrent_writers_leave_whole_events);
+  RUN_TEST(test_span_cost);
+  return loopbackExit(UNITY_END());
+}
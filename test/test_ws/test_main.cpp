@@ -0,0 +1,257 @@
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "ws.h"
+#include "i2s.h"
+#include "../loopback.h"
+
+#define RUN_MS      4000  // How long each streaming client runs
+#define SETTLE_MS   1000  // Latencies are measured after the stream has settled
+#define SLOW_ACK_MS 400   // How long the slow client takes to acknowledge a frame
+
+static uint8_t hdr[10 + WS_HEADER_BYTES];
+
+static uint64_t littleEndian(const uint8_t* p, int bytes) {
+  uint64_t v = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+    v = v << 8 | p[i];
+  return v;
+}
+
+static uint64_t bigEndian(const uint8_t* p, int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; i++)
+    v = v << 8 | p[i];
+  return v;
+}
+
+// Checks the message header at p against what was passed to wsMessageHeader()
+static void checkMessageHeader(const uint8_t* p, uint8_t type, uint32_t seq, int64_t time) {
+  TEST_ASSERT_EQUAL(type, p[0]);
+  TEST_ASSERT_EQUAL(0, p[1]);
+  TEST_ASSERT_EQUAL(0, p[2]);
+  TEST_ASSERT_EQUAL(0, p[3]);
+  TEST_ASSERT_EQUAL_HEX32(seq, littleEndian(p + 4, 4));
+  TEST_ASSERT_TRUE((int64_t)littleEndian(p + 8, 8) == time);
+}
+
+// A video message as the client saw it: its sequence number and capture time, and when
+// the client acknowledged it (esp_timer, us; the firmware runs in the same process)
+struct Received {
+  uint32_t seq;
+  int64_t time;
+  int64_t ackedAt;
+};
+
+// One WebSocket viewer of /ws: acknowledges every video message ackMs after it arrives
+// (-1 never), and records the video messages it got
+struct Viewer {
+  std::string query;
+  int ackMs;
+  std::string head;
+  std::vector<Received> video;
+  int audio = 0;
+  int64_t start;
+
+  void run() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(HTTP_PORT);
+    TEST_ASSERT_EQUAL(0, connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+    // The key and accept value from the example in RFC 6455
+    std::string request = "GET " WS_URL + query + " HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+                          "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                          "Sec-WebSocket-Version: 13\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+
+    std::string buf;
+    std::vector<uint32_t> pending;  // Acks not sent yet, with when they are due
+    std::vector<int64_t> due;
+    start = esp_timer_get_time();
+    for (int64_t now = start; now - start < RUN_MS * 1000LL; now = esp_timer_get_time()) {
+      while (!due.empty() && due.front() <= now) {
+        sendAck(fd, pending.front());
+        for (Received& r : video)
+          if (r.seq == pending.front())
+            r.ackedAt = esp_timer_get_time();
+        pending.erase(pending.begin());
+        due.erase(due.begin());
+      }
+
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      if (poll(&pfd, 1, 1) <= 0)
+        continue;
+      char chunk[16384];
+      int r = recv(fd, chunk, sizeof(chunk), 0);
+      if (r <= 0)
+        break;
+      buf.append(chunk, r);
+
+      if (head.empty()) {
+        size_t end = buf.find("\r\n\r\n");
+        if (end == std::string::npos)
+          continue;
+        head = buf.substr(0, end + 4);
+        buf.erase(0, end + 4);
+      }
+      for (;;) {
+        const uint8_t* p = (const uint8_t*)buf.data();
+        if (buf.size() < 2)
+          break;
+        size_t at = 2;
+        uint64_t len = p[1] & 0x7F;
+        if (len == 126) {
+          at = 4;
+          len = buf.size() >= at ? bigEndian(p + 2, 2) : 0;
+        } else if (len == 127) {
+          at = 10;
+          len = buf.size() >= at ? bigEndian(p + 2, 8) : 0;
+        }
+        if (buf.size() < at + len)
+          break;
+        TEST_ASSERT_EQUAL_HEX8(0x82, p[0]);
+        const uint8_t* m = p + at;
+        if (m[0] == WS_VIDEO) {
+          Received got = { (uint32_t)littleEndian(m + 4, 4), (int64_t)littleEndian(m + 8, 8), -1 };
+          TEST_ASSERT_EQUAL_HEX8(0xFF, m[WS_HEADER_BYTES]);
+          TEST_ASSERT_EQUAL_HEX8(0xD8, m[WS_HEADER_BYTES + 1]);
+          video.push_back(got);
+          if (ackMs >= 0) {
+            pending.push_back(got.seq);
+            due.push_back(esp_timer_get_time() + ackMs * 1000LL);
+          }
+        } else {
+          TEST_ASSERT_EQUAL(WS_AUDIO, m[0]);
+          audio++;
+        }
+        buf.erase(0, at + len);
+      }
+    }
+    close(fd);
+  }
+
+  // Acknowledges seq with a masked 4-byte binary message
+  static void sendAck(int fd, uint32_t seq) {
+    uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    uint8_t msg[10] = { 0x82, 0x80 | 4, mask[0], mask[1], mask[2], mask[3] };
+    for (int i = 0; i < 4; i++)
+      msg[6 + i] = (uint8_t)(seq >> (8 * i)) ^ mask[i];
+    send(fd, msg, sizeof(msg), 0);
+  }
+
+  // Capture-to-ack latencies (us) of the acknowledged frames received after SETTLE_MS
+  std::vector<int64_t> latencies() const {
+    std::vector<int64_t> samples;
+    for (const Received& r : video)
+      if (r.ackedAt >= 0 && r.time - start >= SETTLE_MS * 1000LL)
+        samples.push_back(r.ackedAt - r.time);
+    std::sort(samples.begin(), samples.end());
+    return samples;
+  }
+};
+
+static int64_t percentile(const std::vector<int64_t>& sorted, int p) {
+  return sorted[(sorted.size() - 1) * p / 100];
+}
+
+static void report(const char* name, const Viewer& v) {
+  std::vector<int64_t> samples = v.latencies();
+  char message[128];
+  snprintf(message, sizeof(message), "%s: %d frames, capture-to-ack p50 %d us, p99 %d us", name, (int)v.video.size(),
+           samples.empty() ? 0 : (int)percentile(samples, 50), samples.empty() ? 0 : (int)percentile(samples, 99));
+  TEST_MESSAGE(message);
+}
+
+void setUp() {
+  memset(hdr, 0xEE, sizeof(hdr));
+}
+
+void tearDown() {}
+
+void test_small_message_uses_the_7_bit_length() {
+  size_t n = wsMessageHeader(hdr, WS_AUDIO, 7, 123456, 109);
+  TEST_ASSERT_EQUAL(2 + WS_HEADER_BYTES, n);
+  TEST_ASSERT_EQUAL_HEX8(0x82, hdr[0]);  // FIN, binary, unmasked
+  TEST_ASSERT_EQUAL(125, hdr[1]);
+  checkMessageHeader(hdr + 2, WS_AUDIO, 7, 123456);
+}
+
+void test_medium_message_uses_the_16_bit_length() {
+  size_t n = wsMessageHeader(hdr, WS_AUDIO, 0x01020304, 1, 110);
+  TEST_ASSERT_EQUAL(4 + WS_HEADER_BYTES, n);
+  TEST_ASSERT_EQUAL(126, hdr[1]);
+  TEST_ASSERT_EQUAL(126, bigEndian(hdr + 2, 2));
+  checkMessageHeader(hdr + 4, WS_AUDIO, 0x01020304, 1);
+
+  n = wsMessageHeader(hdr, WS_VIDEO, 1, 1, 65535 - WS_HEADER_BYTES);
+  TEST_ASSERT_EQUAL(4 + WS_HEADER_BYTES, n);
+  TEST_ASSERT_EQUAL(65535, bigEndian(hdr + 2, 2));
+}
+
+void test_large_message_uses_the_64_bit_length() {
+  int64_t time = 0x0123456789ABCDEFLL;
+  size_t n = wsMessageHeader(hdr, WS_VIDEO, 0xFFFFFFFF, time, 65536 - WS_HEADER_BYTES);
+  TEST_ASSERT_EQUAL(10 + WS_HEADER_BYTES, n);
+  TEST_ASSERT_EQUAL(127, hdr[1]);
+  TEST_ASSERT_TRUE(bigEndian(hdr + 2, 8) == 65536);
+  checkMessageHeader(hdr + 10, WS_VIDEO, 0xFFFFFFFF, time);
+
+  n = wsMessageHeader(hdr, WS_VIDEO, 2, time, 300000);
+  TEST_ASSERT_TRUE(bigEndian(hdr + 2, 8) == 300000 + WS_HEADER_BYTES);
+}
+
+// A client that acknowledges at once gets every frame, a frame period or less after capture
+void test_prompt_client_acks_within_a_frame() {
+  Viewer v = { "", 0 };
+  v.run();
+  TEST_ASSERT_TRUE(v.head.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+  report("prompt", v);
+  std::vector<int64_t> samples = v.latencies();
+  TEST_ASSERT_GREATER_OR_EQUAL(FPS * (RUN_MS - SETTLE_MS) / 1000 * 8 / 10, (int)samples.size());
+  TEST_ASSERT_LESS_THAN(1000000 / FPS, percentile(samples, 50));
+  TEST_ASSERT_LESS_THAN(2 * 1000000 / FPS, percentile(samples, 99));
+  for (size_t i = 1; i < v.video.size(); i++)
+    TEST_ASSERT_GREATER_THAN(v.video[i - 1].seq, v.video[i].seq);
+}
+
+// A client slower than the camera skips frames instead of falling behind: its latency is
+// bounded by the window and its own ack delay, and does not grow over the run
+void test_slow_client_latency_is_bounded_by_the_window() {
+  Viewer v = { "?window=2", SLOW_ACK_MS };
+  v.run();
+  report("slow, window 2", v);
+  std::vector<int64_t> samples = v.latencies();
+  TEST_ASSERT_GREATER_OR_EQUAL(2, (int)samples.size());
+  // The frame it gets is the newest one: at most a frame old when it is sent
+  TEST_ASSERT_LESS_THAN((SLOW_ACK_MS + 2000 / FPS) * 1000, percentile(samples, 99));
+  // At most window frames per ack delay
+  TEST_ASSERT_LESS_OR_EQUAL(2 * RUN_MS / SLOW_ACK_MS + 2, (int)v.video.size());
+  TEST_ASSERT_LESS_THAN(FPS * RUN_MS / 1000 / 2, (int)v.video.size());
+}
+
+// A client that never acknowledges gets window frames, then one more each time the oldest
+// in flight expires
+void test_silent_client_is_held_to_its_window() {
+  Viewer v = { "?window=3&audio=1", -1 };
+  v.run();
+  report("silent, window 3", v);
+  int expiries = RUN_MS / WS_ACK_TIMEOUT_MS;
+  TEST_ASSERT_GREATER_OR_EQUAL(3, (int)v.video.size());
+  TEST_ASSERT_LESS_OR_EQUAL(3 * (expiries + 1), (int)v.video.size());
+  // Audio is not gated by the window
+  TEST_ASSERT_GREATER_OR_EQUAL(RUN_MS * 1000 / BLOCK_US / 2, v.audio);
+}
+
+int main() {
+  loopbackStart();
+  UNITY_BEGIN();
+  RUN_TEST(test_small_message_uses_the_7_bit_length);
+  RUN_TEST(test_medium_message_uses_the_16_bit_length);
+  RUN_TEST(test_large_message_uses_the_64_bit_length);
+  RUN_TEST(test_prompt_client_acks_within_a_frame);
+  RUN_TEST(test_slow_client_latency_is_bounded_by_the_window);
+  RUN_TEST(test_silent_client_is_held_to_its_window);
+  return loopbackExit(UNITY_END());
+}
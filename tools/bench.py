@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""Benchmark runner for the camera server: capture, fan-out and per-client send cost.
+
+Runs 1, 2, ... N MJPEG clients in turn against one server and, for each step,
+reports the cost of a capture, of publishing a frame to the streaming tasks, of one
+service pass over a sender's clients and of sending one frame to one client, next to
+the number of sender tasks, the busiest one's load, and the frame rate and bytes the
+clients received. The costs are the BENCHMARK reports the firmware logs (moving
+averages, in microseconds), averaged over the step.
+
+With --program the runner starts the host build itself, reads its log and stops it
+afterwards:
+
+    pio run -e native
+    tools/bench.py --program .pio/build/native/program --clients 8
+
+--program can be given more than once to compare builds, e.g. throughput against the
+number of sender tasks:
+
+    for n in 1 2 4; do
+        PLATFORMIO_BUILD_FLAGS="-D STREAM_WORKERS=$n" pio run -e native
+        cp .pio/build/native/program /tmp/program-$n
+    done
+    tools/bench.py --program /tmp/program-1 --program /tmp/program-2 --program /tmp/program-4
+
+Otherwise it measures a running server, e.g. a board built with the
+ai-thinker-cam-benchmark env, reading the reports from its serial log:
+
+    pio device monitor -e ai-thinker-cam-benchmark | \\
+        tools/bench.py --host 192.168.1.50 --port 80 --log - --clients 4 --json > bench.json
+
+The reports come every 5 s, so a step should run for at least 10 s. Only the Python
+standard library is used.
+"""
+
+import argparse
+import json
+import os
+import re
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+STARTUP_S = 10    # How long a started program gets to begin serving
+SETTLE_S = 1      # Pause between steps, so the previous clients are gone
+WARMUP_S = 2      # Reports this early in a step still average over the previous step
+RECV_CHUNK = 16 * 1024
+REPORTS = [
+    (re.compile(r"camCB: capture avg=(\d+) us, (?:motion avg=\d+ us, )?publish avg=(\d+) us"), ("capture_us", "publish_us")),
+    (re.compile(r"streamCB: sender (\d+) on core \d+: clients=(\d+), busy=(\d+)/1000, pass avg=(\d+) us, send avg=(\d+) us"),
+     ("sender", "report_clients", "busy", "pass_us", "send_us")),
+]
+COSTS = ["capture_us", "publish_us", "pass_us", "send_us"]
+
+
+class LogReader:
+    """Collects the BENCHMARK reports of a log stream, with the time each arrived."""
+
+    def __init__(self, stream, echo):
+        self.reports = []
+        self.lock = threading.Lock()
+        self.thread = threading.Thread(target=self._run, args=(stream, echo), daemon=True)
+        self.thread.start()
+
+    def _run(self, stream, echo):
+        for line in stream:
+            if isinstance(line, bytes):
+                line = line.decode(errors="replace")
+            if echo:
+                sys.stderr.write(line)
+            for pattern, keys in REPORTS:
+                m = pattern.search(line)
+                if m:
+                    with self.lock:
+                        self.reports.append((time.monotonic(), dict(zip(keys, map(int, m.groups())))))
+
+    def since(self, start):
+        with self.lock:
+            return [values for t, values in self.reports if t >= start]
+
+
+def mjpeg_client(args, stop, result):
+    """Reads the MJPEG stream until stop is set, counting whole frames and bytes."""
+    start = time.monotonic()
+    result.update(frames=0, bytes=0, error=None)
+    try:
+        sock = socket.create_connection((args.host, args.port), timeout=args.timeout)
+        sock.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (args.mjpeg_path, args.host)).encode())
+        buf = b""
+        while not stop.is_set():
+            m = re.search(rb"Content-Length: (\d+)\r\n(?:[^\r\n]+\r\n)*\r\n", buf)
+            if m and len(buf) >= m.end() + int(m.group(1)):
+                length = int(m.group(1))
+                buf = buf[m.end() + length:]
+                result["frames"] += 1
+                result["bytes"] += length
+                continue
+            data = sock.recv(RECV_CHUNK)
+            if not data:
+                raise EOFError("server closed the stream")
+            buf += data
+        sock.close()
+    except (OSError, EOFError) as e:
+        if not stop.is_set():
+            result["error"] = str(e) or type(e).__name__
+    finally:
+        elapsed = time.monotonic() - start
+        result["fps"] = round(result["frames"] / elapsed, 2) if elapsed else 0
+
+
+def serving(args):
+    try:
+        socket.create_connection((args.host, args.port), timeout=1).close()
+        return True
+    except OSError:
+        return False
+
+
+def start_program(args, program, log=subprocess.DEVNULL):
+    """Starts a host build and waits until it accepts connections.
+
+    The program's output goes to log; pass subprocess.PIPE to read it from proc.stdout.
+    """
+    if serving(args):
+        raise SystemExit("port %d is already in use; stop the server on it first" % args.port)
+    env = dict(os.environ)
+    if args.fixtures:
+        env["FIXTURE_DIR"] = os.path.abspath(args.fixtures)
+    proc = subprocess.Popen([program], env=env, stdout=log, stderr=subprocess.STDOUT)
+    deadline = time.monotonic() + STARTUP_S
+    while time.monotonic() < deadline:
+        if proc.poll() is not None:
+            raise SystemExit("%s exited with %d" % (program, proc.returncode))
+        if serving(args):
+            return proc
+        time.sleep(0.2)
+    stop_program(proc)
+    raise SystemExit("%s is not serving on port %d" % (program, args.port))
+
+
+def stop_program(proc):
+    proc.terminate()
+    try:
+        proc.wait(5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        proc.wait()
+
+
+def run_step(args, program, log, clients):
+    """Runs `clients` MJPEG clients for args.duration; returns the step's row."""
+    stop = threading.Event()
+    results = [{} for _ in range(clients)]
+    threads = [threading.Thread(target=mjpeg_client, args=(args, stop, results[i]), daemon=True)
+               for i in range(clients)]
+    start = time.monotonic()
+    for t in threads:
+        t.start()
+    time.sleep(args.duration)
+    stop.set()
+    for t in threads:
+        t.join(args.timeout + 1)
+    elapsed = time.monotonic() - start
+
+    row = {"program": os.path.basename(program) if program else args.host, "clients": clients}
+    reports = log.since(start + WARMUP_S) if log else []
+    for key in COSTS:
+        values = [r[key] for r in reports if key in r]
+        row[key] = round(sum(values) / len(values)) if values else None
+    senders = set(r["sender"] for r in reports if "sender" in r)
+    row["senders"] = len(senders) if senders else None
+    busy = [r["busy"] for r in reports if "busy" in r]
+    row["max_busy"] = round(max(busy) / 10) if busy else None
+    fps = [r.get("fps", 0) for r in results]
+    row["fps"] = round(sum(fps) / clients, 2)
+    row["min_fps"] = min(fps)
+    row["kbytes_per_s"] = round(sum(r.get("bytes", 0) for r in results) / elapsed / 1000, 1)
+    row["errors"] = sum(1 for r in results if r.get("error"))
+    return row
+
+
+def print_table(rows):
+    columns = ["program", "clients"] + COSTS + ["senders", "max_busy", "fps", "min_fps", "kbytes_per_s", "errors"]
+    print("  ".join("%12s" % c for c in columns))
+    for row in rows:
+        print("  ".join("%12s" % ("-" if row[c] is None else row[c]) for c in columns))
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    p.add_argument("--program", action="append",
+                   help="host build to start, e.g. .pio/build/native/program; repeat to compare builds")
+    p.add_argument("--fixtures", help="fixture directory for the started program (default: built in)")
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, help="server port (default: 8080 with --program, else 80)")
+    p.add_argument("--log", help="file with the server's log, - for stdin (default: the started program's output)")
+    p.add_argument("--clients", type=int, default=4, help="largest number of MJPEG clients")
+    p.add_argument("--mjpeg-path", default="/mjpeg", help="path and query of the clients")
+    p.add_argument("--duration", type=float, default=12, help="seconds per step")
+    p.add_argument("--timeout", type=float, default=10, help="socket timeout, seconds")
+    p.add_argument("--json", action="store_true", help="print JSON instead of a table")
+    p.add_argument("--verbose", action="store_true", help="echo the server's log to stderr")
+    args = p.parse_args()
+    if args.port is None:
+        args.port = 8080 if args.program else 80
+
+    rows = []
+    for program in args.program or [None]:
+        proc = start_program(args, program, subprocess.PIPE) if program else None
+        if proc is not None:
+            log = LogReader(proc.stdout, args.verbose)
+        elif args.log:
+            log = LogReader(sys.stdin if args.log == "-" else open(args.log, errors="replace"), args.verbose)
+        else:
+            log = None
+            print("no --log: only the client side is measured", file=sys.stderr)
+
+        try:
+            for clients in range(1, args.clients + 1):
+                rows.append(run_step(args, program, log, clients))
+                if not args.json:
+                    print("%s: %d client%s done" % (rows[-1]["program"], clients, "" if clients == 1 else "s"),
+                          file=sys.stderr)
+                time.sleep(SETTLE_S)
+        finally:
+            if proc is not None:
+                stop_program(proc)
+
+    if args.json:
+        json.dump({"config": {"host": args.host, "port": args.port, "mjpeg_path": args.mjpeg_path,
+                              "duration": args.duration, "programs": args.program},
+                   "steps": rows}, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+    else:
+        print_table(rows)
+    return 1 if any(row["errors"] for row in rows) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
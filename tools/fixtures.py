@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+"""Generates the JPEG and PCM fixtures the native build replays and the unit tests read.
+
+    tools/fixtures.py [--out test/fixtures]
+
+frames/frame-N.jpg  VGA 4:2:2 baseline JPEGs like the OV2640's: a test card with a
+                    ball moving across it, so every frame scores as motion
+still.jpg           QVGA test card without restart markers
+still-restart.jpg   The same image with a restart marker every RESTART_MCUS MCUs
+motion/static-N.jpg HD test card with fresh sensor noise and exposure flicker in every
+                    frame: nothing moves, so every frame should be dropped
+motion/moving-N.jpg The same, with a small dark object crossing it MOVING_STEP pixels a
+                    frame: every frame should be published
+audio.pcm           Half a second of 16-bit little-endian mono PCM at 44.1 kHz; every
+                    tone completes whole cycles, so it loops without a click
+
+The encoder is a plain baseline encoder with the Annex K tables; only the Python
+standard library is used, and the output is the same on every run.
+"""
+
+import argparse
+import math
+import os
+import random
+import struct
+
+FRAMES = 6
+FRAME_SIZE = (640, 480)
+STILL_SIZE = (320, 240)
+CORPUS_SIZE = (1280, 720)  # The resolution the firmware streams at
+QUALITY = 80
+RESTART_MCUS = 7           # Does not divide the MCU count of a row, so intervals straddle rows
+CORPUS_FRAMES = 6
+CORPUS_NOISE = 6           # Peak sensor noise of the motion corpus, levels
+CORPUS_FLICKER = 3         # Peak frame-to-frame exposure change of the motion corpus, levels
+MOVING_RADIUS = 40         # About a person at the far side of a room
+MOVING_STEP = 24           # Walking pace across the frame at FPS
+SAMPLE_RATE = 44100
+AUDIO_MS = 500
+BALL_RADIUS = 48
+
+ZIGZAG = [
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+]
+
+LUMA_QT = [
+    16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+]
+
+CHROMA_QT = [
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+] + [99] * 32
+
+DC_LUMA = ([0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0], list(range(12)))
+DC_CHROMA = ([0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0], list(range(12)))
+AC_LUMA = ([0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D], [
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+])
+AC_CHROMA = ([0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77], [
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+    0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+    0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+])
+
+# DCT basis: COS[u][x] = C(u) / 2 * cos((2x + 1) u pi / 16)
+COS = [[(math.sqrt(0.5) if u == 0 else 1.0) / 2 * math.cos((2 * x + 1) * u * math.pi / 16) for x in range(8)]
+       for u in range(8)]
+
+
+def scaled_table(table, quality):
+    scale = 5000 // quality if quality < 50 else 200 - 2 * quality
+    return [min(255, max(1, (q * scale + 50) // 100)) for q in table]
+
+
+def huffman_codes(table):
+    counts, symbols = table
+    codes = {}
+    code = 0
+    k = 0
+    for length in range(1, 17):
+        for _ in range(counts[length - 1]):
+            codes[symbols[k]] = (code, length)
+            code += 1
+            k += 1
+        code <<= 1
+    return codes
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.n = 0
+
+    def put(self, bits, size):
+        self.acc = (self.acc << size) | (bits & ((1 << size) - 1))
+        self.n += size
+        while self.n >= 8:
+            self.n -= 8
+            byte = (self.acc >> self.n) & 0xFF
+            self.out.append(byte)
+            if byte == 0xFF:
+                self.out.append(0)
+        self.acc &= (1 << self.n) - 1
+
+    def flush(self):
+        if self.n:
+            self.put(0x7F, 8 - self.n)
+
+
+def category(v):
+    v = abs(v)
+    n = 0
+    while v:
+        n += 1
+        v >>= 1
+    return n
+
+
+def fdct(block):
+    """Forward DCT of a level-shifted 8x8 block given as 8 rows."""
+    rows = [[sum(COS[u][x] * row[x] for x in range(8)) for u in range(8)] for row in block]
+    return [[sum(COS[v][y] * rows[y][u] for y in range(8)) for u in range(8)] for v in range(8)]
+
+
+def encode_block(w, block, qt, dc_codes, ac_codes, pred):
+    coef = fdct(block)
+    flat = [coef[i // 8][i % 8] for i in range(64)]
+    q = [int(round(flat[ZIGZAG[i]] / qt[i])) for i in range(64)]
+
+    diff = q[0] - pred
+    size = category(diff)
+    w.put(*dc_codes[size])
+    if size:
+        w.put(diff if diff > 0 else diff - 1, size)
+
+    run = 0
+    for k in range(1, 64):
+        v = q[k]
+        if v == 0:
+            run += 1
+            continue
+        while run > 15:
+            w.put(*ac_codes[0xF0])
+            run -= 16
+        size = category(v)
+        w.put(*ac_codes[(run << 4) | size])
+        w.put(v if v > 0 else v - 1, size)
+        run = 0
+    if run:
+        w.put(*ac_codes[0x00])
+    return q[0]
+
+
+def segment(marker, body):
+    return struct.pack(">BBH", 0xFF, marker, len(body) + 2) + bytes(body)
+
+
+def encode_jpeg(width, height, pixel, quality=QUALITY, restart=0):
+    """Encodes a 4:2:2 baseline JPEG; pixel(x, y) returns (r, g, b). Width must be a
+    multiple of 16 and height a multiple of 8."""
+    lqt = scaled_table(LUMA_QT, quality)
+    cqt = scaled_table(CHROMA_QT, quality)
+
+    ys, cbs, crs = [], [], []
+    for y in range(height):
+        yr, cbr, crr = [], [], []
+        for x in range(0, width, 2):
+            r0, g0, b0 = pixel(x, y)
+            r1, g1, b1 = pixel(x + 1, y)
+            yr.append(0.299 * r0 + 0.587 * g0 + 0.114 * b0 - 128)
+            yr.append(0.299 * r1 + 0.587 * g1 + 0.114 * b1 - 128)
+            r, g, b = (r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2
+            cbr.append(-0.168736 * r - 0.331264 * g + 0.5 * b)
+            crr.append(0.5 * r - 0.418688 * g - 0.081312 * b)
+        ys.append(yr)
+        cbs.append(cbr)
+        crs.append(crr)
+
+    dc = [huffman_codes(DC_LUMA), huffman_codes(DC_CHROMA)]
+    ac = [huffman_codes(AC_LUMA), huffman_codes(AC_CHROMA)]
+    w = BitWriter()
+    pred = [0, 0, 0]
+    mcus_x, mcus_y = width // 16, height // 8
+    for my in range(mcus_y):
+        rows = range(my * 8, my * 8 + 8)
+        for mx in range(mcus_x):
+            m = my * mcus_x + mx
+            if restart and m and m % restart == 0:
+                w.flush()
+                w.out += bytes([0xFF, 0xD0 + (m // restart - 1) % 8])
+                pred = [0, 0, 0]
+            for bx in (0, 1):
+                x0 = mx * 16 + bx * 8
+                pred[0] = encode_block(w, [ys[y][x0:x0 + 8] for y in rows], lqt, dc[0], ac[0], pred[0])
+            x0 = mx * 8
+            pred[1] = encode_block(w, [cbs[y][x0:x0 + 8] for y in rows], cqt, dc[1], ac[1], pred[1])
+            pred[2] = encode_block(w, [crs[y][x0:x0 + 8] for y in rows], cqt, dc[1], ac[1], pred[2])
+    w.flush()
+
+    out = bytearray(b"\xFF\xD8")
+    out += segment(0xE0, b"JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00")
+    out += segment(0xDB, bytes([0]) + bytes(lqt) + bytes([1]) + bytes(cqt))
+    out += segment(0xC0, struct.pack(">BHHB", 8, height, width, 3) + bytes([1, 0x21, 0, 2, 0x11, 1, 3, 0x11, 1]))
+    for tc_th, table in ((0x00, DC_LUMA), (0x10, AC_LUMA), (0x01, DC_CHROMA), (0x11, AC_CHROMA)):
+        out += segment(0xC4, bytes([tc_th] + table[0] + table[1]))
+    if restart:
+        out += segment(0xDD, struct.pack(">H", restart))
+    out += segment(0xDA, bytes([3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0]))
+    out += w.out
+    out += b"\xFF\xD9"
+    return bytes(out)
+
+
+def test_card(width, height, seed, noise_peak=3, offset=0):
+    """Colour bars over a gradient with a little sensor-like noise; offset shifts the
+    exposure of the whole frame."""
+    bars = [(235, 235, 235), (235, 235, 16), (16, 235, 235), (16, 235, 16),
+            (235, 16, 235), (235, 16, 16), (16, 16, 235), (16, 16, 16)]
+    rng = random.Random(seed)
+    noise = [rng.randint(-noise_peak, noise_peak) + offset for _ in range(width * height)]
+
+    def base(x, y):
+        n = noise[y * width + x]
+        if y < height // 2:
+            r, g, b = bars[x * len(bars) // width]
+        else:
+            level = 255 * x // (width - 1)
+            r, g, b = level, (level + 255 * (y - height // 2) // height) // 2, 255 - level
+        return tuple(min(255, max(0, c + n)) for c in (r, g, b))
+
+    return base
+
+
+def with_ball(base, cx, cy, radius=BALL_RADIUS, colour=(250, 120, 20)):
+    def pixel(x, y):
+        if (x - cx) ** 2 + (y - cy) ** 2 < radius ** 2:
+            return colour
+        return base(x, y)
+    return pixel
+
+
+def motion_corpus(out, width, height):
+    """Static and moving sequences with the noise a sensor adds to every capture."""
+    rng = random.Random(3)
+    for i in range(CORPUS_FRAMES):
+        card = test_card(width, height, 100 + i, CORPUS_NOISE, rng.randint(-CORPUS_FLICKER, CORPUS_FLICKER))
+        write(os.path.join(out, "motion", "static-%d.jpg" % i), encode_jpeg(width, height, card))
+        # Across the lower half, where the dark object stands out from the gradient
+        cx = width // 4 + i * MOVING_STEP
+        ball = with_ball(card, cx, height * 3 // 4, MOVING_RADIUS, (40, 40, 40))
+        write(os.path.join(out, "motion", "moving-%d.jpg" % i), encode_jpeg(width, height, ball))
+
+
+def tone_pcm():
+    samples = SAMPLE_RATE * AUDIO_MS // 1000
+    out = bytearray()
+    for i in range(samples):
+        t = i / SAMPLE_RATE
+        v = 6000 * math.sin(2 * math.pi * 440 * t) + 3000 * math.sin(2 * math.pi * 1000 * t) \
+            + 1500 * math.sin(2 * math.pi * 3000 * t)
+        out += struct.pack("<h", int(round(v)))
+    return bytes(out)
+
+
+def write(path, data):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "wb") as f:
+        f.write(data)
+    print("%s: %d bytes" % (path, len(data)))
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    p.add_argument("--out", default=os.path.join(os.path.dirname(__file__), "..", "test", "fixtures"))
+    args = p.parse_args()
+
+    width, height = FRAME_SIZE
+    card = test_card(width, height, 1)
+    for i in range(FRAMES):
+        # The ball travels one lap, so the last frame also differs from the first
+        cx = width // 2 + int(width / 3 * math.cos(2 * math.pi * i / FRAMES))
+        cy = height // 2 + int(height / 3 * math.sin(2 * math.pi * i / FRAMES))
+        write(os.path.join(args.out, "frames", "frame-%d.jpg" % i), encode_jpeg(width, height, with_ball(card, cx, cy)))
+    motion_corpus(args.out, *CORPUS_SIZE)
+
+    width, height = STILL_SIZE
+    card = test_card(width, height, 2)
+    write(os.path.join(args.out, "still.jpg"), encode_jpeg(width, height, card))
+    write(os.path.join(args.out, "still-restart.jpg"), encode_jpeg(width, height, card, restart=RESTART_MCUS))
+
+    write(os.path.join(args.out, "audio.pcm"), tone_pcm())
+
+
+if __name__ == "__main__":
+    main()
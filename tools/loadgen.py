@@ -0,0 +1,362 @@
+#!/usr/bin/env python3
+"""Multi-client load generator for the camera server.
+
+Drives N MJPEG and M /i2s clients against one server, each optionally behind a
+bandwidth cap, a per-read delay and a periodic stall, and prints a JSON summary:
+per-client frame rate, frame completeness, audio continuity and time to first
+frame/block, plus the change in the server's drop and send counters scraped from
+/metrics.
+
+    tools/loadgen.py --host 192.168.1.50 --mjpeg 10 --i2s 3 --rate-kbps 2000 \
+        --stall 10:2 --duration 30 > summary.json
+
+With --program it starts the host build itself on the loopback interface and stops it
+afterwards, as tools/bench.py does:
+
+    pio run -e native
+    tools/loadgen.py --program .pio/build/native/program --mjpeg 10 --i2s 3 --rate-kbps 2000
+
+Caps apply per client. Reads are throttled in user space and the receive buffer is
+kept small, so a capped or stalled client pushes back on the server's socket the way
+a congested link does. Only the Python standard library is used.
+"""
+
+import argparse
+import json
+import re
+import socket
+import sys
+import threading
+import time
+
+from bench import start_program, stop_program
+
+RECV_CHUNK = 4096
+RCVBUF = 16 * 1024         # Receive buffer per client, small so throttling reaches the server
+AUDIO_GAP_FACTOR = 3       # An audio chunk arriving later than this many block times is a gap
+SERVER_COUNTERS = [
+    "camera_frames_dropped_total",
+    "camera_frames_static_total",
+    "mjpeg_frames_sent_total",
+    "mjpeg_frames_skipped_total",
+    "mjpeg_frames_stalled_total",
+    "mjpeg_send_calls_total",
+    "mjpeg_scale_failures_total",
+    "frame_acquire_retries_total",
+    "audio_overruns_total",
+    "audio_underruns_total",
+    "http_connects_total",
+    "http_disconnects_total",
+]
+
+
+class Link:
+    """Receiving end of one emulated link: bandwidth cap, read delay and stalls."""
+
+    def __init__(self, sock, rate_kbps, delay_ms, stall, start):
+        self.sock = sock
+        self.rate = rate_kbps * 1000 / 8 if rate_kbps else 0
+        self.delay = delay_ms / 1000
+        self.stall = stall
+        self.start = start
+        self.tokens = 0.0
+        self.refilled = time.monotonic()
+        self.buf = b""
+
+    def _throttle(self, want):
+        now = time.monotonic()
+        if self.stall:
+            period, duration = self.stall
+            phase = (now - self.start) % period
+            if phase >= period - duration:
+                time.sleep(period - phase)
+                now = time.monotonic()
+        if self.delay:
+            time.sleep(self.delay)
+        if not self.rate:
+            return want
+        while True:
+            now = time.monotonic()
+            self.tokens = min(self.tokens + (now - self.refilled) * self.rate, max(self.rate / 10, RECV_CHUNK))
+            self.refilled = now
+            if self.tokens >= 1:
+                return min(want, int(self.tokens))
+            time.sleep((1 - self.tokens) / self.rate)
+
+    def _fill(self):
+        n = self._throttle(RECV_CHUNK)
+        data = self.sock.recv(n)
+        if not data:
+            raise EOFError
+        if self.rate:
+            self.tokens -= len(data)
+        self.buf += data
+
+    def read(self, n):
+        while len(self.buf) < n:
+            self._fill()
+        data, self.buf = self.buf[:n], self.buf[n:]
+        return data
+
+    def readline(self):
+        while b"\r\n" not in self.buf:
+            self._fill()
+        line, self.buf = self.buf.split(b"\r\n", 1)
+        return line
+
+    def read_until(self, marker):
+        while marker not in self.buf:
+            if len(self.buf) > 1 << 20:
+                raise ValueError("marker not found")
+            self._fill()
+        head, self.buf = self.buf.split(marker, 1)
+        return head
+
+
+def connect(args, path):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, RCVBUF)
+    sock.settimeout(args.timeout)
+    sock.connect((args.host, args.port))
+    sock.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % (path, args.host)).encode())
+    return sock
+
+
+def read_headers(link):
+    status = link.readline().decode(errors="replace")
+    headers = {}
+    while True:
+        line = link.readline()
+        if not line:
+            break
+        name, _, value = line.decode(errors="replace").partition(":")
+        headers[name.strip().lower()] = value.strip()
+    code = int(status.split()[1]) if len(status.split()) > 1 else 0
+    return code, headers
+
+
+def mjpeg_client(args, index, stop, result):
+    start = time.monotonic()
+    result.update(kind="mjpeg", index=index, frames=0, complete=0, incomplete=0, bytes=0, error=None,
+                  first_frame_ms=None)
+    try:
+        sock = connect(args, args.mjpeg_path)
+        link = Link(sock, args.rate_kbps, args.delay_ms, args.stall, start)
+        code, headers = read_headers(link)
+        result["status"] = code
+        if code != 200:
+            result["error"] = "HTTP %d" % code
+            return
+        boundary = re.search(r"boundary=(\S+)", headers.get("content-type", ""))
+        if not boundary:
+            result["error"] = "no multipart boundary"
+            return
+        delimiter = b"--" + boundary.group(1).encode()
+        link.read_until(delimiter + b"\r\n")
+        first = None
+        while not stop.is_set():
+            part = {}
+            while True:
+                line = link.readline()
+                if not line:
+                    break
+                name, _, value = line.decode(errors="replace").partition(":")
+                part[name.strip().lower()] = value.strip()
+            length = int(part.get("content-length", "0"))
+            body = link.read(length)
+            link.read_until(delimiter + b"\r\n")
+            now = time.monotonic()
+            if first is None:
+                first = now
+                result["first_frame_ms"] = round((now - start) * 1000, 1)
+            result["frames"] += 1
+            result["bytes"] += length
+            if body[:2] == b"\xff\xd8" and body[-2:] == b"\xff\xd9":
+                result["complete"] += 1
+            else:
+                result["incomplete"] += 1
+    except (OSError, EOFError, ValueError) as e:
+        if not stop.is_set():
+            result["error"] = str(e) or type(e).__name__
+    finally:
+        elapsed = time.monotonic() - start
+        result["seconds"] = round(elapsed, 2)
+        result["fps"] = round(result["frames"] / elapsed, 2) if elapsed else 0
+        result["completeness"] = round(result["complete"] / result["frames"], 4) if result["frames"] else 0
+
+
+def i2s_client(args, index, stop, result):
+    start = time.monotonic()
+    result.update(kind="i2s", index=index, blocks=0, bytes=0, gaps=0, longest_gap_ms=0, error=None,
+                  first_block_ms=None)
+    byte_rate = 0
+    first = None
+    last = None
+    try:
+        sock = connect(args, args.i2s_path)
+        link = Link(sock, args.rate_kbps, args.delay_ms, args.stall, start)
+        code, headers = read_headers(link)
+        result["status"] = code
+        if code != 200:
+            result["error"] = "HTTP %d" % code
+            return
+        wav = None
+        while not stop.is_set():
+            size = int(link.readline().split(b";")[0], 16)
+            data = link.read(size)
+            link.read(2)
+            if size == 0:
+                break
+            if wav is None:
+                # The first chunk is the WAV header; byte_rate is at offset 28
+                wav = data
+                byte_rate = int.from_bytes(data[28:32], "little") if len(data) >= 32 else 0
+                continue
+            now = time.monotonic()
+            if first is None:
+                first = now
+                result["first_block_ms"] = round((now - start) * 1000, 1)
+            elif byte_rate:
+                gap = now - last
+                expected = size / byte_rate
+                if gap > AUDIO_GAP_FACTOR * expected:
+                    result["gaps"] += 1
+                result["longest_gap_ms"] = max(result["longest_gap_ms"], round(gap * 1000, 1))
+            last = now
+            result["blocks"] += 1
+            result["bytes"] += size
+    except (OSError, EOFError, ValueError) as e:
+        if not stop.is_set():
+            result["error"] = str(e) or type(e).__name__
+    finally:
+        result["seconds"] = round(time.monotonic() - start, 2)
+        # Audio received against wall time since the first block: 1.0 is gapless
+        if byte_rate and first is not None and last > first:
+            result["continuity"] = round(result["bytes"] / byte_rate / (last - first), 4)
+        else:
+            result["continuity"] = 0
+
+
+def scrape(args):
+    """Returns {metric{labels}: value} from /metrics, or None if it cannot be read."""
+    try:
+        sock = socket.create_connection((args.host, args.port), timeout=args.timeout)
+        sock.sendall(("GET /metrics HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % args.host).encode())
+        data = b""
+        while True:
+            chunk = sock.recv(RECV_CHUNK)
+            if not chunk:
+                break
+            data += chunk
+        sock.close()
+    except OSError:
+        return None
+    values = {}
+    for line in data.split(b"\r\n\r\n", 1)[-1].decode(errors="replace").splitlines():
+        if line.startswith("#") or " " not in line:
+            continue
+        name, _, value = line.rpartition(" ")
+        try:
+            values[name] = float(value)
+        except ValueError:
+            pass
+    return values
+
+
+def counter_deltas(before, after):
+    if before is None or after is None:
+        return None
+    deltas = {}
+    for key, value in after.items():
+        if key.split("{")[0] in SERVER_COUNTERS:
+            deltas[key] = value - before.get(key, 0)
+    return deltas
+
+
+def parse_stall(text):
+    if not text:
+        return None
+    period, duration = (float(v) for v in text.split(":"))
+    if not 0 < duration < period:
+        raise argparse.ArgumentTypeError("stall must be PERIOD:DURATION with 0 < DURATION < PERIOD")
+    return period, duration
+
+
+def run(args):
+    """Runs the clients for args.duration against a serving server; returns the summary."""
+    before = scrape(args)
+    stop = threading.Event()
+    results = []
+    threads = []
+    for kind, count, target in (("mjpeg", args.mjpeg, mjpeg_client), ("i2s", args.i2s, i2s_client)):
+        for i in range(count):
+            result = {}
+            results.append(result)
+            t = threading.Thread(target=target, args=(args, i, stop, result), daemon=True)
+            t.start()
+            threads.append(t)
+            time.sleep(args.stagger_ms / 1000)
+
+    time.sleep(args.duration)
+    stop.set()
+    for t in threads:
+        t.join(args.timeout + 1)
+    after = scrape(args)
+
+    video = [r for r in results if r.get("kind") == "mjpeg"]
+    audio = [r for r in results if r.get("kind") == "i2s"]
+    summary = {
+        "config": {
+            "program": args.program, "host": args.host, "port": args.port, "mjpeg": args.mjpeg, "i2s": args.i2s,
+            "mjpeg_path": args.mjpeg_path, "i2s_path": args.i2s_path, "duration": args.duration,
+            "rate_kbps": args.rate_kbps, "delay_ms": args.delay_ms,
+            "stall": list(args.stall) if args.stall else None,
+        },
+        "totals": {
+            "mjpeg_bytes_per_s": round(sum(r.get("bytes", 0) / r["seconds"] for r in video if r.get("seconds")), 1),
+            "mjpeg_fps": round(sum(r.get("fps", 0) for r in video), 2),
+            "mjpeg_min_fps": min((r.get("fps", 0) for r in video), default=0),
+            "mjpeg_incomplete": sum(r.get("incomplete", 0) for r in video),
+            "audio_min_continuity": min((r.get("continuity", 0) for r in audio), default=0),
+            "audio_gaps": sum(r.get("gaps", 0) for r in audio),
+            "errors": sum(1 for r in results if r.get("error")),
+        },
+        "server": counter_deltas(before, after),
+        "clients": results,
+    }
+    return summary
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    p.add_argument("--program", help="host build to start, e.g. .pio/build/native/program")
+    p.add_argument("--fixtures", help="fixture directory for the started program (default: built in)")
+    p.add_argument("--host", default="127.0.0.1")
+    p.add_argument("--port", type=int, help="server port (default: 8080 with --program, else 80)")
+    p.add_argument("--mjpeg", type=int, default=1, help="MJPEG clients")
+    p.add_argument("--i2s", type=int, default=0, help="/i2s clients")
+    p.add_argument("--mjpeg-path", default="/mjpeg", help="path and query of the MJPEG clients, e.g. /mjpeg?scale=4")
+    p.add_argument("--i2s-path", default="/i2s", help="path and query of the audio clients, e.g. /i2s?codec=ulaw")
+    p.add_argument("--duration", type=float, default=20, help="seconds to run")
+    p.add_argument("--rate-kbps", type=float, default=0, help="bandwidth cap per client, 0 for none")
+    p.add_argument("--delay-ms", type=float, default=0, help="delay before every read, models a slow consumer")
+    p.add_argument("--stall", type=parse_stall, help="PERIOD:DURATION, stop reading for DURATION s every PERIOD s")
+    p.add_argument("--stagger-ms", type=float, default=50, help="delay between client connects")
+    p.add_argument("--timeout", type=float, default=10, help="socket timeout, seconds")
+    args = p.parse_args()
+    if args.port is None:
+        args.port = 8080 if args.program else 80
+
+    proc = start_program(args, args.program) if args.program else None
+    try:
+        summary = run(args)
+    finally:
+        if proc is not None:
+            stop_program(proc)
+    json.dump(summary, sys.stdout, indent=2)
+    sys.stdout.write("\n")
+    return 1 if summary["totals"]["errors"] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())